@@ -34,6 +34,7 @@
 #include "tracer.h"
 #include "qspn.h"
 #include "radar.h"
+#include "mapowner.h"
 #include "netsukuku.h"
 #include "daemon.h"
 #include "crypto.h"
@@ -104,6 +105,7 @@ andna_save_caches(void)
 	debug(DBG_NORMAL, "Saving the andna local cache");
 	save_lcl_cache(andna_lcl, server_opt.lcl_file);
 
+	pthread_mutex_lock(&andna_cache_mutex);
 	debug(DBG_NORMAL, "Saving the andna cache");
 	save_andna_cache(andna_c, server_opt.andna_cache_file);
 
@@ -112,6 +114,7 @@ andna_save_caches(void)
 
 	debug(DBG_NORMAL, "Saving the resolved hnames cache");
 	save_rh_cache(andna_rhc, server_opt.rhc_file);
+	pthread_mutex_unlock(&andna_cache_mutex);
 
 	return 0;
 }
@@ -161,6 +164,9 @@ andna_resolvconf_restore(void)
 void
 andna_init(void)
 {
+	setzero(hgnode_memo, sizeof(hgnode_memo));
+	pthread_mutex_init(&hgnode_memo_mutex, 0);
+
 	/* register the andna's ops in the pkt_op_table */
 	add_pkt_op(ANDNA_REGISTER_HNAME, SKT_TCP, andna_tcp_port,
 			   andna_recv_reg_rq);
@@ -183,6 +189,16 @@ andna_init(void)
 	add_pkt_op(ANDNA_SPREAD_SACACHE, SKT_UDP, andna_udp_port,
 			   recv_spread_single_acache);
 
+	/* Their flooded copies are dropped by pkt_recv(). A flood is
+	 * identified by the registrant ip and the hash, or by the hash of the
+	 * spread andna_cache */
+	pkt_op_tbl[ANDNA_REGISTER_HNAME].flags |= PKT_OP_FLOOD;
+	pkt_op_tbl[ANDNA_REGISTER_HNAME].flood_key_sz = MAX_IP_SZ * 2;
+	pkt_op_tbl[ANDNA_CHECK_COUNTER].flags |= PKT_OP_FLOOD;
+	pkt_op_tbl[ANDNA_CHECK_COUNTER].flood_key_sz = MAX_IP_SZ * 2;
+	pkt_op_tbl[ANDNA_SPREAD_SACACHE].flags |= PKT_OP_FLOOD;
+	pkt_op_tbl[ANDNA_SPREAD_SACACHE].flood_key_sz = MAX_IP_SZ;
+
 
 	if (!server_opt.disable_resolvconf)
 		/* Restore resolv.conf if our backup is still there */
@@ -215,10 +231,6 @@ andna_init(void)
 			loginfo("Internet hostname resolution is disabled");
 		}
 
-	setzero(last_reg_pkt_id, sizeof(int) * ANDNA_MAX_FLOODS);
-	setzero(last_counter_pkt_id, sizeof(int) * ANDNA_MAX_FLOODS);
-	setzero(last_spread_acache_pkt_id, sizeof(int) * ANDNA_MAX_FLOODS);
-
 	/* Modify /etc/resolv.conf if requested */
 	andna_resolvconf_modify();
 }
@@ -232,9 +244,11 @@ andna_close(void)
 	andns_close();
 	lcl_destroy_keyring(&lcl_keyring);
 	lcl_cache_destroy(andna_lcl, &lcl_counter);
+	pthread_mutex_lock(&andna_cache_mutex);
 	andna_cache_destroy();
 	counter_c_destroy();
 	rh_cache_flush();
+	pthread_mutex_unlock(&andna_cache_mutex);
 	pkt_queue_close();
 }
 
@@ -345,46 +359,39 @@ is_hgnodeip_excluded(inet_prefix * hgnodeip, u_int ** excluded_hgnode,
  * If the gid found is also a MAP_ME node, 2 is returned.
  */
 int
-random_gid_level_0(quadro_group * qg, inet_prefix * to, int exclude_me)
+random_gid_level_0(struct map_snapshot *snap, quadro_group * qg,
+				   inet_prefix * to, int exclude_me)
 {
-	int x, e, i;
+	u_int live[GNODE_LIVE_WORDS];
+	int gid, start;
 
 	/*
-	 * Set `e' and `i' to a rand value from 0 to MAXGROUPNODE-1.
-	 * In the first for go from `e' to MAXGROUPNODE-1, if nothing is found
-	 * continue in the second for and go from `i' to 0. If nothing is
-	 * found return -1.
+	 * Start from a rand gid, from 0 to MAXGROUPNODE-1, and take the first
+	 * node up going towards MAXGROUPNODE-1. If nothing is found go from
+	 * the same gid to 0. If nothing is found return -1.
+	 * There's only one MAP_ME node, so it has to be skipped at most once.
 	 */
-
-	for (x = 0, e = i = rand_range(0, MAXGROUPNODE - 1); e < MAXGROUPNODE;
-		 e++) {
-		if (!(me.int_map[e].flags & MAP_VOID)) {
-			if (exclude_me && (me.int_map[e].flags & MAP_ME))
-				continue;
-			qg->gid[0] = e;
-			x = 1;
-			break;
-		}
-	}
-	if (!x)
-		for (x = 0; i >= 0; i--) {
-			if (!(me.int_map[i].flags & MAP_VOID)) {
-				if (exclude_me && (me.int_map[i].flags & MAP_ME))
-					continue;
-				qg->gid[0] = i;
-				x = 1;
-				break;
-			}
-		}
-	if (x) {
-		gidtoipstart(qg->gid, me.cur_quadg.levels, me.cur_quadg.levels,
-					 my_family, to);
-		debug(DBG_NOISE, "find_hashgnode: Internal found: gid0 %d, to "
-			  "%s!", qg->gid[0], inet_to_str(*to));
-		return me.int_map[qg->gid[0]].flags & MAP_ME ? 2 : 0;
+	gnode_live_get(0, snap->int_map, snap->ext_map,
+				   map_snapshot_gen(snap, 0), live);
+	start = rand_range(0, MAXGROUPNODE - 1);
+
+	gid = bits_next_set(live, MAXGROUPNODE, start);
+	if (exclude_me && gid >= 0 && (snap->int_map[gid].flags & MAP_ME))
+		gid = bits_next_set(live, MAXGROUPNODE, gid + 1);
+	if (gid < 0) {
+		gid = bits_prev_set(live, MAXGROUPNODE, start);
+		if (exclude_me && gid >= 0 && (snap->int_map[gid].flags & MAP_ME))
+			gid = bits_prev_set(live, MAXGROUPNODE, gid - 1);
 	}
-
-	return -1;
+	if (gid < 0)
+		return -1;
+
+	qg->gid[0] = gid;
+	gidtoipstart(qg->gid, snap->cur_quadg.levels, snap->cur_quadg.levels,
+				 my_family, to);
+	debug(DBG_NOISE, "find_hashgnode: Internal found: gid0 %d, to "
+		  "%s!", qg->gid[0], inet_to_str(*to));
+	return snap->int_map[qg->gid[0]].flags & MAP_ME ? 2 : 0;
 }
 
 /*
@@ -392,15 +399,17 @@ random_gid_level_0(quadro_group * qg, inet_prefix * to, int exclude_me)
  * tree is started by find_hash_gnode()
  */
 int
-find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
+find_hash_gnode_recurse(struct map_snapshot *snap, quadro_group qg,
+						int level, inet_prefix * to,
 						u_int ** excluded_hgnode, int tot_excluded_hgnodes,
 						int exclude_me)
 {
-	int gid, i, e, steps, err, ret;
+	u_int live[GNODE_LIVE_WORDS];
+	int gid, start, up, down, err, ret;
 	map_gnode *gnode;
 
 	if (!level)
-		return random_gid_level_0(&qg, to, exclude_me);
+		return random_gid_level_0(snap, &qg, to, exclude_me);
 
 	/*
 	 * This is how the ip nearer to `hash' is found:
@@ -412,9 +421,11 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
 	 *   convert `qg' in the inet_prefix format, store it in `to' and
 	 *   return.
 	 * loop1:
-	 *  - If the gnode `gq'.gid[level] is down increment or decrement
-	 *    (alternatively) `gq'.gid[level] and continue the loop1.
-	 *    If (it is up) {
+	 *  - Take the next gnode which is up, nearest to the starting
+	 *    `gq'.gid[level]: gid, gid+1, gid-1, gid+2, gid-2, ...
+	 *    The gnodes which are down are skipped a word at a time in the
+	 *    gnode_live bitmap.
+	 *    {
 	 *      if (`gq'.gid[level] is a gnode where we belong) {
 	 *          call recursively find_hash_gnode_recurse,
 	 *          giving the new modified `qg' and `level'-1 as
@@ -438,24 +449,27 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
 		  qg.gid[level]);
 #endif
 
-	/* the maximum steps required to complete the for. */
-	steps =
-		qg.gid[level] >=
-		MAXGROUPNODE / 2 ? qg.gid[level] : MAXGROUPNODE - qg.gid[level];
-
-	for (i = 0, e = 1, gid = qg.gid[level]; i < steps;
-		 e & 1 ? i++ : i, e = (~(e & 1)) & 1) {
-		/* `i' is incremented only when `e' is odd, while `e'
-		 * is always alternated between 0 and 1. */
+	gnode_live_get(level, snap->int_map, snap->ext_map,
+				   map_snapshot_gen(snap, level), live);
+	start = qg.gid[level];
+
+	/* `up' and `down' are the nearest live gids on the two sides of
+	 * `start' not yet visited, -1 when a side is exhausted. At the same
+	 * distance the upper one comes first. */
+	for (up = start, down = start - 1;;) {
+		if (up >= 0)
+			up = bits_next_set(live, MAXGROUPNODE, up);
+		if (down >= 0)
+			down = bits_prev_set(live, MAXGROUPNODE, down);
+		if (up < 0 && down < 0)
+			break;
 
-		if (!(e & 1) && (qg.gid[level] + i < MAXGROUPNODE))
-			gid = qg.gid[level] + i;
-		else if (qg.gid[level] - i >= 0)
-			gid = qg.gid[level] - i;
+		if (up >= 0 && (down < 0 || up - start <= start - down))
+			gid = up++;
 		else
-			continue;
+			gid = down--;
 
-		gnode = gnode_from_pos(gid, me.ext_map[_EL(level)]);
+		gnode = gnode_from_pos(gid, snap->ext_map[_EL(level)]);
 		if (!(gnode->g.flags & MAP_VOID) && !(gnode->flags & GMAP_VOID)) {
 			qg.gid[level] = gid;
 
@@ -464,7 +478,7 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
 				  qg.gid[level]);
 #endif
 
-			if (!quadg_gids_cmp(qg, me.cur_quadg, level)) {
+			if (!quadg_gids_cmp(qg, snap->cur_quadg, level)) {
 				/* Is this hash_gnode not wanted ? */
 				if (excluded_hgnode && level == 1 &&
 					is_hgnode_excluded(&qg, excluded_hgnode,
@@ -472,7 +486,7 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
 					continue;	/* yea, exclude it */
 
 				ret =
-					find_hash_gnode_recurse(qg, level - 1, to,
+					find_hash_gnode_recurse(snap, qg, level - 1, to,
 											excluded_hgnode,
 											tot_excluded_hgnodes,
 											exclude_me);
@@ -486,8 +500,9 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
 									   tot_excluded_hgnodes, level))
 					continue;	/* Yes, it is */
 
-				err = get_gw_ips(me.int_map, me.ext_map, me.bnode_map,
-								 me.bmap_nodes, &me.cur_quadg,
+				err = get_gw_ips(snap->int_map, snap->ext_map,
+								 snap->bnode_map, snap->bmap_nodes,
+								 snap->cur_erc, &snap->cur_quadg,
 								 gnode, level, 0, to, 0, 1);
 				debug(DBG_NOISE,
 					  "find_hashgnode: ext_found, err %d, to %s!", err,
@@ -503,7 +518,7 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
 			}
 		}
 
-	}							/* for(...) */
+	}							/* for(up, down) */
 
 
 #if 0							/* TOO NOISY */
@@ -524,26 +539,106 @@ find_hash_gnode_recurse(quadro_group qg, int level, inet_prefix * to,
  * All the hash_gnodes included in `excluded_hgnode' will be excluded by the
  * algorithm.
  * If `exclude_me' is set to 1, it will not return ourself as the hash_gnode.
+ * The search is done in the map_snapshot published by the map owner.
  */
 int
 find_hash_gnode(u_int hash[MAX_IP_INT], inet_prefix * to,
 				u_int ** excluded_hgnode, int tot_excluded_hgnodes,
 				int exclude_me)
 {
-	int total_levels;
+	struct map_snapshot live, *snap;
+	int total_levels, ret, memoize;
 	quadro_group qg;
+	u_int gen = 0, epoch;
 
 	total_levels = FAMILY_LVLS;
+	snap = map_snapshot_read(&live, &epoch);
+
+	/* Only the plain searches are remembered */
+	memoize = !excluded_hgnode || !tot_excluded_hgnodes;
+	if (memoize) {
+		gen = map_snapshot_gen(snap, total_levels - 1);
+		if (hgnode_memo_find(snap, hash, exclude_me, gen, to, &ret))
+			goto finish;
+	}
 
 	/* Hash to ip and quadro_group conversion */
 	inet_setip(to, hash, my_family);
 	inet_htonl(to->data, to->family);
-	iptoquadg(*to, me.ext_map, &qg, QUADG_GID | QUADG_GNODE);
+	iptoquadg(*to, snap->ext_map, &qg, QUADG_GID | QUADG_GNODE);
+
 
+	ret = find_hash_gnode_recurse(snap, qg, total_levels - 1, to,
+								  excluded_hgnode, tot_excluded_hgnodes,
+								  exclude_me);
+	if (memoize)
+		hgnode_memo_store(hash, exclude_me, gen, ret, to);
 
-	return find_hash_gnode_recurse(qg, total_levels - 1, to,
-								   excluded_hgnode, tot_excluded_hgnodes,
-								   exclude_me);
+  finish:
+	map_snapshot_put(epoch);
+	return ret;
+}
+
+/*
+ * hgnode_memo_find
+ *
+ * If the result of find_hash_gnode(`hash', `exclude_me'), computed when the
+ * maps had the `gen' generation, is in the hgnode_memo, it is stored in `to'
+ * and `ret' and 1 is returned, otherwise 0.
+ * If the hash_gnode is our gnode, a new node of level 0 is chosen.
+ */
+int
+hgnode_memo_find(struct map_snapshot *snap, u_int hash[MAX_IP_INT],
+				 int exclude_me, u_int gen, inet_prefix * to, int *ret)
+{
+	struct hgnode_memo *m;
+	quadro_group qg;
+	int hit;
+
+	m = &hgnode_memo[hash[0] % HGNODE_MEMO_SZ];
+
+	pthread_mutex_lock(&hgnode_memo_mutex);
+	hit = (m->flags & HGNODE_MEMO_VALID) && m->gen == gen &&
+		!(m->flags & HGNODE_MEMO_EXCLUDE_ME) == !exclude_me &&
+		!memcmp(m->hash, hash, MAX_IP_SZ);
+	if (hit) {
+		inet_copy(to, &m->to);
+		*ret = m->ret;
+	}
+	pthread_mutex_unlock(&hgnode_memo_mutex);
+
+	if (hit && (*ret == 0 || *ret == 2)) {
+		setzero(&qg, sizeof(qg));
+		iptogids(to, qg.gid, snap->cur_quadg.levels);
+		*ret = random_gid_level_0(snap, &qg, to, exclude_me);
+	}
+
+	return hit;
+}
+
+/*
+ * hgnode_memo_store
+ *
+ * remembers that find_hash_gnode(`hash', `exclude_me') returned `ret' and
+ * `to' while the maps had the `gen' generation.
+ */
+void
+hgnode_memo_store(u_int hash[MAX_IP_INT], int exclude_me, u_int gen,
+				  int ret, inet_prefix * to)
+{
+	struct hgnode_memo *m;
+
+	m = &hgnode_memo[hash[0] % HGNODE_MEMO_SZ];
+
+	pthread_mutex_lock(&hgnode_memo_mutex);
+	memcpy(m->hash, hash, MAX_IP_SZ);
+	m->flags = HGNODE_MEMO_VALID;
+	if (exclude_me)
+		m->flags |= HGNODE_MEMO_EXCLUDE_ME;
+	m->gen = gen;
+	m->ret = ret;
+	inet_copy(&m->to, to);
+	pthread_mutex_unlock(&hgnode_memo_mutex);
 }
 
 
@@ -556,14 +651,18 @@ find_hash_gnode(u_int hash[MAX_IP_INT], inet_prefix * to,
 /*
  * andna_flood_pkt: Sends the `rpkt' pkt to all the rnodes of our same gnode
  * and exclude the the rpkt->from node if `exclude_rfrom' is non zero.
- * The return value of flood_pkt_send() is returned.
+ * Our rnodes are read from the map_snapshot.
+ * The number of pkts sent is returned.
  */
 int
 andna_flood_pkt(PACKET * rpkt, int exclude_rfrom)
 {
+	struct map_snapshot live, *snap;
 	PACKET flood_pkt;
-	int real_from_rpos = -1, ret;
-	int (*exclude_function) (TRACER_PKT_EXCLUDE_VARS);
+	quadro_group qg;
+	map_node *from = 0, *node, *rnode;
+	u_int epoch;
+	int i, e = 0;
 
 	pkt_copy(&flood_pkt, rpkt);
 	flood_pkt.sk = 0;
@@ -571,64 +670,44 @@ andna_flood_pkt(PACKET * rpkt, int exclude_rfrom)
 	flood_pkt.hdr.flags &= ~ASYNC_REPLY;
 	flood_pkt.hdr.flags |= BCAST_PKT;
 
-	/* If the pkt was sent from an our rnode, ignore it while flooding */
-	if (exclude_rfrom)
-		real_from_rpos = ip_to_rfrom(flood_pkt.from, 0, 0, 0);
-	if (real_from_rpos < 0 || !exclude_rfrom) {
-		exclude_function = exclude_glevel;
-		real_from_rpos = -1;
-	} else
-		exclude_function = exclude_from_and_glevel;
-	ret =
-		flood_pkt_send(exclude_function, 1, -1, real_from_rpos, flood_pkt);
-
-	return ret;
-}
-
-/*
- * andna_find_flood_pkt_id: Search in the `ids_array' a member which is equal
- * to `pkt_id', if it is found its array position is returned otherwise -1
- * will be the return value
- */
-int
-andna_find_flood_pkt_id(int *ids_array, int pkt_id)
-{
-	int i;
+	snap = map_snapshot_read(&live, &epoch);
+	if (!snap->cur_node)
+		goto finish;
 
-	for (i = 0; i < ANDNA_MAX_FLOODS; i++)
-		if (ids_array[i] == pkt_id)
-			return i;
-	return -1;
-}
+	/* If the pkt was sent from an our rnode, ignore it while flooding */
+	if (exclude_rfrom) {
+		iptoquadg(flood_pkt.from, snap->ext_map, &qg, QUADG_GID);
+		if (!quadg_gids_cmp(qg, snap->cur_quadg, 1))
+			from = &snap->int_map[qg.gid[0]];
+	}
 
-/*
- * andna_add_flood_pkt_id: If the `pkt_id' is already present in the
- * `ids_array', 1 is returned, otherwise `pkt_id' is added at the 0 position
- * of the array. All the array elements, except the last one, will be
- * preserved and shifted of one position like a FIFO.
- */
-int
-andna_add_flood_pkt_id(int *ids_array, int pkt_id)
-{
-	int i;
+	for (i = 0; i < snap->cur_node->links; i++) {
+		node = (map_node *) snap->cur_node->r_node[i].r_node;
 
-	if ((i = andna_find_flood_pkt_id(ids_array, pkt_id)) < 0) {
-		int tmp_array[ANDNA_MAX_FLOODS - 1];
+		/* The external rnodes aren't in our gnode */
+		if (node->flags & MAP_ERNODE || node == from)
+			continue;
 
-		/* Shift the array of one position to free the position 0
-		 * where the new id will be added */
-		memcpy(tmp_array, ids_array, sizeof(int) * (ANDNA_MAX_FLOODS - 1));
-		memcpy(&ids_array[1], tmp_array,
-			   sizeof(int) * (ANDNA_MAX_FLOODS - 1));
-		ids_array[0] = pkt_id;
+		/* The rnode_list knows the live rnode */
+		rnode = map_snapshot_live(snap, node);
+		if (!rnode || rnl_fill_rq(rnode, &flood_pkt) < 0)
+			continue;
 
-		return 0;
+		if (rnl_send_rq(rnode, &flood_pkt, 0, flood_pkt.hdr.op,
+						flood_pkt.hdr.id, 0, 0, 0) == -1)
+			error(ERROR_MSG "Cannot send the %s request with id: %d to %s",
+				  ERROR_FUNC, rq_to_str(flood_pkt.hdr.op),
+				  flood_pkt.hdr.id, inet_to_str(flood_pkt.to));
+		else
+			e++;
 	}
 
-	return 1;
+  finish:
+	map_snapshot_put(epoch);
+	pkt_free(&flood_pkt, 0);
+	return e;
 }
 
-
 /*
  *
  *  *  *  *  Hostname registration  *  *  *
@@ -786,7 +865,7 @@ andna_recv_reg_rq(PACKET rpkt)
 	int ret = 0, err;
 	size_t unpacked_sz, packed_sz;
 	char *ntop = 0, *rfrom_ntop = 0, *snsd_pack;
-	u_char forwarded_pkt = 0;
+	u_char forwarded_pkt = 0, new_hgnode;
 	const u_char *pk;
 
 	pkt_copy(&rpkt_local_copy, &rpkt);
@@ -803,14 +882,6 @@ andna_recv_reg_rq(PACKET rpkt)
 		/* The pkt we received has been only forwarded to us */
 		forwarded_pkt = 1;
 
-	/* Check if we already received this pkt during the flood */
-	if (forwarded_pkt &&
-		andna_add_flood_pkt_id(last_reg_pkt_id, rpkt.hdr.id)) {
-		debug(DBG_INSANE, "Dropped 0x%0x andna pkt, we already "
-			  "received it", rpkt.hdr.id);
-		ERROR_FINISH(ret, 0, finish);
-	}
-
 	/* Save the real sender of the request */
 	inet_setip(&rfrom, req->rip, my_family);
 
@@ -879,8 +950,11 @@ andna_recv_reg_rq(PACKET rpkt)
 	}
 
 	/* Are we a new hash_gnode ? */
-	if (time(0) - me.uptime < (ANDNA_EXPIRATION_TIME / 3) &&
-		!(ac = andna_cache_findhash((int *) req->hash))) {
+	pthread_mutex_lock(&andna_cache_mutex);
+	new_hgnode = time(0) - me.uptime < (ANDNA_EXPIRATION_TIME / 3) &&
+		!andna_cache_findhash((int *) req->hash);
+	pthread_mutex_unlock(&andna_cache_mutex);
+	if (new_hgnode) {
 		/*
 		 * We are a new hash_gnode and we haven't this hostname in our
 		 * andna_cache, so we have to check if there is an
@@ -891,7 +965,9 @@ andna_recv_reg_rq(PACKET rpkt)
 			 * The hostname was already registered, so we save it
 			 * in our andna_cache.
 			 */
+			pthread_mutex_lock(&andna_cache_mutex);
 			clist_add(&andna_c, &andna_c_counter, ac);
+			pthread_mutex_unlock(&andna_cache_mutex);
 
 			/* Spread it in our gnode */
 			spread_single_acache(req->hash);
@@ -913,9 +989,11 @@ andna_recv_reg_rq(PACKET rpkt)
 	 * Finally, let's register/update the hname
 	 */
 	cur_t = time(0);
+	pthread_mutex_lock(&andna_cache_mutex);
 	ac = andna_cache_addhash((int *) req->hash);
 	acq = ac_queue_add(ac, req->pubkey);
 	if (!acq) {
+		pthread_mutex_unlock(&andna_cache_mutex);
 		debug(DBG_SOFT, "Registration rq 0x%x rejected: %s",
 			  rpkt.hdr.id, rq_strerror(E_ANDNA_QUEUE_FULL));
 		if (!forwarded_pkt)
@@ -930,6 +1008,7 @@ andna_recv_reg_rq(PACKET rpkt)
 		debug(DBG_SOFT, "Registration rq 0x%x rejected: hname_updates"
 			  " mismatch %d > %d", rpkt.hdr.id,
 			  acq->hname_updates, req->hname_updates);
+		pthread_mutex_unlock(&andna_cache_mutex);
 		if (!forwarded_pkt)
 			pkt_err(pkt, E_ANDNA_HUPDATE_MISMATCH, 0);
 		ERROR_FINISH(ret, -1, finish);
@@ -939,6 +1018,7 @@ andna_recv_reg_rq(PACKET rpkt)
 	 * Has the registration request been sent too early ? */
 		if (cur_t > acq->timestamp &&
 			(cur_t - acq->timestamp) < ANDNA_MIN_UPDATE_TIME) {
+		pthread_mutex_unlock(&andna_cache_mutex);
 		debug(DBG_SOFT, "Registration rq 0x%x rejected: %s",
 			  rpkt.hdr.id, rq_strerror(E_ANDNA_UPDATE_TOO_EARLY));
 		if (!forwarded_pkt)
@@ -968,6 +1048,7 @@ andna_recv_reg_rq(PACKET rpkt)
 
 		if ((!snsd_unpacked && req->flags & ANDNA_PKT_SNSD_DEL) ||
 			(snsd_counter > SNSD_MAX_RECORDS - 1)) {
+			pthread_mutex_unlock(&andna_cache_mutex);
 
 			debug(DBG_SOFT,
 				  "Registration rq 0x%x rejected: couldn't unpack"
@@ -1009,12 +1090,14 @@ andna_recv_reg_rq(PACKET rpkt)
 	snsd_service_llist_del(&acq->service);
 	acq->service = snsd_unpacked;
 	acq->snsd_counter = snsd_counter;
+	snsd_flat_cache_del(&acq->flat);
 
 	/*
 	 * Final registration step: touch the hname timestamp
 	 */
 	acq->hname_updates = req->hname_updates + 1;
 	acq->timestamp = cur_t;
+	pthread_mutex_unlock(&andna_cache_mutex);
 
 	/* Reply to the requester: <<Yes, don't worry, it worked.>> */
 	if (!forwarded_pkt) {
@@ -1030,7 +1113,7 @@ andna_recv_reg_rq(PACKET rpkt)
 	 * other nodes register the hname.
 	 */
 	if (!forwarded_pkt)
-		andna_add_flood_pkt_id(last_reg_pkt_id, rpkt.hdr.id);
+		pkt_flood_key_seen(&rpkt);
 	andna_flood_pkt(&rpkt, 1);
    /**/ finish:
 	if (ntop)
@@ -1155,14 +1238,6 @@ andna_recv_check_counter(PACKET rpkt)
 	if (req->flags & ANDNA_PKT_JUST_CHECK)
 		just_check = 1;
 
-	/* Check if we already received this pkt during the flood */
-	if (forwarded_pkt &&
-		andna_add_flood_pkt_id(last_counter_pkt_id, rpkt.hdr.id)) {
-		debug(DBG_INSANE, "Dropped 0x%0x andna pkt, we already "
-			  "received it", rpkt.hdr.id);
-		ERROR_FINISH(ret, 0, finish);
-	}
-
 	/* Save the real sender of the request */
 	buf = rpkt.msg + ANDNA_REG_PKT_SZ;
 	inet_setip(&rfrom, (u_int *) buf, my_family);
@@ -1232,12 +1307,14 @@ andna_recv_check_counter(PACKET rpkt)
 	}
 
 	/* Finally, let's register/update the hname */
+	pthread_mutex_lock(&andna_cache_mutex);
 	cc = counter_c_add(&rfrom, req->pubkey);
 	if (!just_check)
 		cch = cc_hashes_add(cc, (int *) req->hash);
 	else
 		cch = cc_findhash(cc, (int *) req->hash);
 	if (!cch) {
+		pthread_mutex_unlock(&andna_cache_mutex);
 		debug(DBG_SOFT, "Request %s (0x%x) rejected: %s",
 			  rq_to_str(rpkt.hdr.op), rpkt.hdr.id,
 			  rq_strerror(E_ANDNA_TOO_MANY_HNAME));
@@ -1249,6 +1326,7 @@ andna_recv_check_counter(PACKET rpkt)
 	old_updates = cch->hname_updates;
 	old_updates -= ! !just_check;
 	if (old_updates > req->hname_updates) {
+		pthread_mutex_unlock(&andna_cache_mutex);
 		debug(DBG_SOFT, "Request %s (0x%x) rejected: hname_updates"
 			  " mismatch %d > %d", rq_to_str(rpkt.hdr.op), rpkt.hdr.id,
 			  old_updates, req->hname_updates);
@@ -1260,6 +1338,7 @@ andna_recv_check_counter(PACKET rpkt)
 		cch->hname_updates = req->hname_updates + 1;
 		cch->timestamp = time(0);
 	}
+	pthread_mutex_unlock(&andna_cache_mutex);
 
 	/* Report the successful result to rfrom */
 	if (!forwarded_pkt || just_check) {
@@ -1276,7 +1355,7 @@ andna_recv_check_counter(PACKET rpkt)
 	 */
 	if (!just_check) {
 		if (!forwarded_pkt)
-			andna_add_flood_pkt_id(last_counter_pkt_id, rpkt.hdr.id);
+			pkt_flood_key_seen(&rpkt);
 		andna_flood_pkt(&rpkt, forwarded_pkt);
 	}
 
@@ -1306,7 +1385,7 @@ andna_recv_check_counter(PACKET rpkt)
  * local andna caches.
  * It uses the same arguments of `andna_resolve_hash' see below).
  */
-snsd_service *
+snsd_flat *
 andna_resolve_hash_locally(u_int hname_hash[MAX_IP_INT], int service,
 						   u_char proto, int *records)
 {
@@ -1314,7 +1393,8 @@ andna_resolve_hash_locally(u_int hname_hash[MAX_IP_INT], int service,
 	lcl_cache *lcl;
 	rh_cache *rhc;
 	andna_cache *ac;
-	snsd_service *ret;
+	snsd_service *sns;
+	snsd_flat *ret;
 	u_int hash;
 
 	setzero(&req, sizeof(req));
@@ -1331,62 +1411,55 @@ andna_resolve_hash_locally(u_int hname_hash[MAX_IP_INT], int service,
 		u_short fake_counter = 0;
 
 		*records = lcl->snsd_counter;
-		ret = snsd_service_llist_copy(lcl->service, service, proto);
+		sns = snsd_service_llist_copy(lcl->service, service, proto);
 
 		/* Add our current main ip */
 		if (service == SNSD_ALL_SERVICE ||
-			service == SNSD_DEFAULT_SERVICE || !ret)
-			snsd_add_mainip(&ret, &fake_counter,
+			service == SNSD_DEFAULT_SERVICE || !sns)
+			snsd_add_mainip(&sns, &fake_counter,
 							SNSD_MAX_RECORDS, me.cur_ip.data);
+
+		ret = snsd_flat_build(sns, SNSD_ALL_SERVICE, 0);
+		snsd_service_llist_del(&sns);
 		return ret;
 	}
+#endif
+
+	ret = 0;
+	pthread_mutex_lock(&andna_cache_mutex);
 
+#ifndef ANDNA_DEBUG
 	/*
 	 * Last try before asking to ANDNA: let's see if we have it in
 	 * the resolved_hnames cache
 	 */
 	if ((rhc = rh_cache_find_hash(hash))) {
 		*records = rhc->snsd_counter;
-		ret = snsd_service_llist_copy(rhc->service, service, proto);
-
-		if (!ret && (service != SNSD_ALL_SERVICE) &&
-			(service != SNSD_DEFAULT_SERVICE))
-			/* The specific service hasn't been found, fallback to
-			 * SNSD_DEFAULT_SERVICE */
-			ret = snsd_service_llist_copy(rhc->service,
-										  SNSD_DEFAULT_SERVICE, 0);
-		if (ret)
-			return ret;
+		ret = snsd_flat_cache_select(&rhc->flat, rhc->service,
+									 service, proto);
 	}
 #endif
 
 	/*
 	 * If we manage an andna_cache, it's better to peek at it.
 	 */
-	if ((ac = andna_cache_gethash((int *) hname_hash))) {
+	if (!ret && (ac = andna_cache_gethash((int *) hname_hash))) {
 		*records = ac->acq->snsd_counter;
-
-		ret = snsd_service_llist_copy(ac->acq->service, service, proto);
-
-		if (!ret && (service != SNSD_ALL_SERVICE) &&
-			(service != SNSD_DEFAULT_SERVICE))
-			/* The specific service hasn't been found, fallback to
-			 * SNSD_DEFAULT_SERVICE */
-			ret = snsd_service_llist_copy(ac->acq->service,
-										  SNSD_DEFAULT_SERVICE, 0);
-		if (ret)
-			return ret;
+		ret = snsd_flat_cache_select(&ac->acq->flat, ac->acq->service,
+									 service, proto);
 	}
 
-	return 0;
+	pthread_mutex_unlock(&andna_cache_mutex);
+	return ret;
 }
 
 /*
  * andna_resolve_hash
  *
- * It returns a snsd_service llist (see snsd.h) which contains the snsd
+ * It returns a snsd_flat arena (see snsd_cache.h) which contains the snsd
  * records of the resolved hostname. Among them there's at least the mainip
- * record which can be found using snsd_find_mainip().
+ * record which can be found using snsd_flat_find_mainip().
+ * The arena has to be freed with snsd_flat_del().
  *
  * `hname_hash' is the full MD5 hash of the hostname we want to resolve.
  *
@@ -1396,12 +1469,12 @@ andna_resolve_hash_locally(u_int hname_hash[MAX_IP_INT], int service,
  * `proto' is the protocol of the `service', it must be specified in the
  * proto_to_8bit() format.
  *
- * In `*records' the number of records stored in the returned snsd_service
- * llist is written.
+ * In `*records' the number of records stored in the returned arena is
+ * written.
  *
  * It returns 0 on error
  */
-snsd_service *
+snsd_flat *
 andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
 				   u_char proto, int *records)
 {
@@ -1409,11 +1482,11 @@ andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
 	struct andna_resolve_rq_pkt req;
 	struct andna_resolve_reply_pkt *reply;
 	rh_cache *rhc;
-	snsd_service *sns_dup;
 	u_int hash_gnode[MAX_IP_INT], hash32;
 	inet_prefix to;
 
-	snsd_service *sns, *snsd_unpacked, *ret = 0;
+	snsd_service *snsd_unpacked;
+	snsd_flat *ret = 0;
 
 	const char *ntop;
 	char *snsd_packed;
@@ -1430,9 +1503,9 @@ andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
 		fnv_32_buf((u_char *) hname_hash, ANDNA_HASH_SZ, FNV1_32_INIT);
 
 	/* Try to resolve the hostname locally */
-	sns = andna_resolve_hash_locally(hname_hash, service, proto, records);
-	if (sns)
-		return sns;
+	ret = andna_resolve_hash_locally(hname_hash, service, proto, records);
+	if (ret)
+		return ret;
 
 	/*
 	 * Fill the request structure.
@@ -1497,33 +1570,40 @@ andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
 	/* Unpack the received snsd records */
 	snsd_packed = rpkt.msg + sizeof(struct andna_resolve_reply_pkt);
 	packed_sz = rpkt.hdr.sz - sizeof(struct andna_resolve_reply_pkt);
-	if (service == -1)
-		snsd_unpacked = snsd_unpack_all_service(snsd_packed, packed_sz,
-												&unpacked_sz,
-												&snsd_counter);
-	else
-		snsd_unpacked = snsd_unpack_service(snsd_packed, packed_sz,
-											&unpacked_sz, &snsd_counter);
+	ret = snsd_flat_unpack(snsd_packed, packed_sz,
+						   service == SNSD_ALL_SERVICE, &snsd_counter);
 
-	if (!snsd_unpacked ||
+	if (!ret ||
 		((service == SNSD_ALL_SERVICE ||
 		  service == SNSD_DEFAULT_SERVICE) &&
-		 !snsd_find_mainip(snsd_unpacked))) {
+		 !snsd_flat_find_mainip(ret))) {
 		debug(DBG_SOFT, ERROR_MSG "Malformed resolution reply (0x%x)",
 			  ERROR_FUNC, rpkt.hdr.id);
-		ERROR_FINISH(ret, 0, finish);
+		snsd_flat_del(&ret);
+		goto finish;
 	}
 	*records = snsd_counter;
-	ret = snsd_unpacked;
 
 	/*
 	 * Add the hostname in the resolved_hnames cache since it was
 	 * successful resolved ;)
 	 */
+	unpacked_sz = 0;
+	if (service == SNSD_ALL_SERVICE)
+		snsd_unpacked = snsd_unpack_all_service(snsd_packed, packed_sz,
+												&unpacked_sz,
+												&snsd_counter);
+	else
+		snsd_unpacked = snsd_unpack_service(snsd_packed, packed_sz,
+											&unpacked_sz, &snsd_counter);
+
 	reply->timestamp = time(0) - reply->timestamp;
+	pthread_mutex_lock(&andna_cache_mutex);
 	rhc = rh_cache_add_hash(hash32, reply->timestamp);
-	sns_dup = snsd_service_llist_copy(snsd_unpacked, SNSD_ALL_SERVICE, 0);
-	snsd_service_llist_merge(&rhc->service, &rhc->snsd_counter, sns_dup);
+	snsd_service_llist_merge(&rhc->service, &rhc->snsd_counter,
+							 snsd_unpacked);
+	snsd_flat_cache_del(&rhc->flat);
+	pthread_mutex_unlock(&andna_cache_mutex);
 
   finish:
 	pkt_free(&pkt, 1);
@@ -1539,7 +1619,7 @@ andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
  *
  * It returns 0 on error
  */
-snsd_service *
+snsd_flat *
 andna_resolve_hname(char *hname, int service, u_char proto, int *records)
 {
 	u_int hname_hash[MAX_IP_INT];
@@ -1563,13 +1643,13 @@ andna_recv_resolve_rq(PACKET rpkt)
 	struct andna_resolve_reply_pkt reply;
 
 	andna_cache *ac;
-	snsd_service *sns;
+	snsd_flat *flat;
 
 	u_int hash_gnode[MAX_IP_INT];
 	inet_prefix rfrom, to;
 	u_short service;
 	size_t pack_sz;
-	int ret = 0, err;
+	int ret = 0, err, s = -1;
 	char *ntop = 0, *rfrom_ntop = 0, *buf;
 	u_char spread_the_acache = 0;
 
@@ -1621,9 +1701,12 @@ andna_recv_resolve_rq(PACKET rpkt)
 	}
 
 	/*
-	 * Search the hostname to resolve in the andna_cache
+	 * Search the hostname to resolve in the andna_cache. The cache stays
+	 * locked until the reply is packed.
 	 */
+	pthread_mutex_lock(&andna_cache_mutex);
 	if (!(ac = andna_cache_gethash((int *) req->hash))) {
+		pthread_mutex_unlock(&andna_cache_mutex);
 
 		/* We don't have that hname in our andna_cache */
 
@@ -1638,6 +1721,7 @@ andna_recv_resolve_rq(PACKET rpkt)
 				 * hash_gnode. Save it in our andna_cache, then
 				 * reply to `rfrom' and diffuse it in our gnode
 				 */
+				pthread_mutex_lock(&andna_cache_mutex);
 				clist_add(&andna_c, &andna_c_counter, ac);
 
 				spread_the_acache = 1;
@@ -1667,41 +1751,55 @@ andna_recv_resolve_rq(PACKET rpkt)
 	/* host -> network order */
 	ints_host_to_network((void *) &reply, andna_resolve_reply_pkt_iinfo);
 
-	pack_sz = sizeof(reply);
-	pack_sz += req->service == SNSD_ALL_SERVICE ?
-		SNSD_SERVICE_LLIST_PACK_SZ(ac->acq->service) :
-		SNSD_SERVICE_SINGLE_PACK_SZ(ac->acq->service);
-	pkt_fill_hdr(&pkt.hdr, ASYNC_REPLIED, rpkt.hdr.id, ANDNA_RESOLVE_REPLY,
-				 pack_sz);
-
-	pkt.msg = buf = xmalloc(pkt.hdr.sz);
-	memcpy(pkt.msg, &reply, sizeof(reply));
-	buf += sizeof(reply);
-	pack_sz -= sizeof(reply);
+	/*
+	 * The records are packed directly from the arena of the acq, see
+	 * snsd_cache.h
+	 */
+	pthread_mutex_lock(&snsd_flat_mutex);
+	flat = snsd_flat_cache(&ac->acq->flat, ac->acq->service);
 
-	if (req->service == SNSD_ALL_SERVICE)
-		/* Pack all the registered snsd records */
-		ret = snsd_pack_all_services(buf, pack_sz, ac->acq->service);
-	else {
+	if (req->service != SNSD_ALL_SERVICE) {
 		/* Pack the snsd records of the specified service number */
 		service = (u_short) req->service;
-		sns = snsd_find_service(ac->acq->service, service, req->proto);
+		s = snsd_flat_find_service(flat, service, req->proto);
 
-		if (!sns && service != SNSD_DEFAULT_SERVICE) {
+		if (s < 0 && service != SNSD_DEFAULT_SERVICE)
 			/*
 			 * The specified service and proto record hasn't been
 			 * found, fallback to SNSD_DEFAULT_SERVICE
 			 */
-			sns = snsd_find_service(ac->acq->service,
-									SNSD_DEFAULT_SERVICE, 0);
-		}
+			s = snsd_flat_find_service(flat, SNSD_DEFAULT_SERVICE, 0);
 
-		/* pack what we found */
-		ret = snsd_pack_service(buf, pack_sz, sns);
+		if (s < 0) {
+			pthread_mutex_unlock(&snsd_flat_mutex);
+			pthread_mutex_unlock(&andna_cache_mutex);
+			debug(DBG_NORMAL, "Cannot pack the services for the 0x%x "
+				  "resolve request", rpkt.hdr.id);
+			ERROR_FINISH(ret, -1, finish);
+		}
 	}
+
+	pack_sz = sizeof(reply) + snsd_flat_pack_sz(flat, s);
+	pkt_fill_hdr(&pkt.hdr, ASYNC_REPLIED, rpkt.hdr.id, ANDNA_RESOLVE_REPLY,
+				 pack_sz);
+
+	pkt.msg = buf = xmalloc(pkt.hdr.sz);
+	memcpy(pkt.msg, &reply, sizeof(reply));
+	buf += sizeof(reply);
+	pack_sz -= sizeof(reply);
+
+	if (s < 0)
+		/* Pack all the registered snsd records */
+		ret = snsd_flat_pack_all_services(buf, pack_sz, flat);
+	else
+		ret = snsd_flat_pack_service(buf, pack_sz, flat, s);
+	pthread_mutex_unlock(&snsd_flat_mutex);
+	pthread_mutex_unlock(&andna_cache_mutex);
+
 	if (ret < 0) {
 		debug(DBG_NORMAL, "Cannot pack the services for the 0x%x "
 			  "resolve request", rpkt.hdr.id);
+		pkt_free(&pkt, 0);
 		goto finish;
 	}
 
@@ -2002,7 +2100,9 @@ put_single_acache(PACKET rpkt)
 	/*
 	 * Search in our andna_cache if we have what `rfrom' wants.
 	 */
+	pthread_mutex_lock(&andna_cache_mutex);
 	if (!(ac = andna_cache_gethash((int *) req_hdr->hash))) {
+		pthread_mutex_unlock(&andna_cache_mutex);
 
 		/*
 		 * Nothing found! Maybe it's because we have an uptime less than
@@ -2066,6 +2166,7 @@ put_single_acache(PACKET rpkt)
 	/* Exctract the `ac' cache from the llist, so we can pack it alone */
 	ac_tmp = list_dup(ac);
 	pkt.msg = pack_andna_cache(ac_tmp, &pkt_sz, ACACHE_PACK_PKT);
+	pthread_mutex_unlock(&andna_cache_mutex);
 	pkt.hdr.sz = pkt_sz;
 
 	debug(DBG_INSANE, "Reply put_single_acache to %s", ntop);
@@ -2113,7 +2214,7 @@ spread_single_acache(u_int hash[MAX_IP_INT])
 	memcpy(pkt.msg, &req, pkt.hdr.sz);
 
 	debug(DBG_NOISE, "Spreading the single andna_cache 0x%x", pkt.hdr.id);
-	andna_add_flood_pkt_id(last_spread_acache_pkt_id, pkt.hdr.id);
+	pkt_flood_key_seen(&pkt);
 	return andna_flood_pkt(&pkt, 0);
 }
 
@@ -2129,7 +2230,7 @@ recv_spread_single_acache(PACKET rpkt)
 	struct spread_acache_pkt *req;
 	andna_cache *ac;
 	u_int hash_gnode[MAX_IP_INT];
-	int ret = 0;
+	int ret = 0, old_hgnode;
 
 	pkt_copy(&rpkt_local_copy, &rpkt);
 	req = (struct spread_acache_pkt *) rpkt_local_copy.msg;
@@ -2140,15 +2241,11 @@ recv_spread_single_acache(PACKET rpkt)
 	/* network -> host order */
 	ints_network_to_host(req, spread_acache_pkt_info);
 
-	/* Check if we already received this pkt during the flood */
-	if (andna_add_flood_pkt_id(last_spread_acache_pkt_id, rpkt.hdr.id)) {
-		debug(DBG_INSANE, "Dropped 0x%0x andna pkt, we already "
-			  "received it", rpkt.hdr.id);
-		ERROR_FINISH(ret, 0, finish);
-	}
-
-	if (time(0) - me.uptime > (ANDNA_EXPIRATION_TIME / 2) ||
-		(ac = andna_cache_findhash((int *) req->hash))) {
+	pthread_mutex_lock(&andna_cache_mutex);
+	old_hgnode = time(0) - me.uptime > (ANDNA_EXPIRATION_TIME / 2) ||
+		andna_cache_findhash((int *) req->hash);
+	pthread_mutex_unlock(&andna_cache_mutex);
+	if (old_hgnode) {
 		/* We don't need to get the andna_cache from an old
 		 * hash_gnode, since we currently are one of them! */
 		debug(DBG_NOISE, "recv_spread_single_acache: We are an old "
@@ -2166,7 +2263,9 @@ recv_spread_single_acache(PACKET rpkt)
 	andna_hash_by_family(my_family, (u_char *) req->hash, hash_gnode);
 	if ((ac = get_single_andna_c(req->hash, hash_gnode))) {
 		/* Save it in our andna_cache. */
+		pthread_mutex_lock(&andna_cache_mutex);
 		clist_add(&andna_c, &andna_c_counter, ac);
+		pthread_mutex_unlock(&andna_cache_mutex);
 	} else {
 		debug(DBG_NOISE, "recv_spread_single_acache: (0x%x) "
 			  "get_single_andna_c request failed", rpkt.hdr.id);
@@ -2251,7 +2350,9 @@ put_andna_cache(PACKET rq_pkt)
 	pkt_addsk(&pkt, my_family, rq_pkt.sk, rq_pkt.sk_type);
 	pkt_addcompress(&pkt);
 
+	pthread_mutex_lock(&andna_cache_mutex);
 	pkt.msg = pack_andna_cache(andna_c, &pkt_sz, ACACHE_PACK_PKT);
+	pthread_mutex_unlock(&andna_cache_mutex);
 	pkt.hdr.sz = pkt_sz;
 	debug(DBG_INSANE, "Reply %s to %s", re_to_str(ANDNA_PUT_ANDNA_CACHE),
 		  ntop);
@@ -2338,7 +2439,9 @@ put_counter_cache(PACKET rq_pkt)
 	pkt_addsk(&pkt, my_family, rq_pkt.sk, rq_pkt.sk_type);
 	pkt_addcompress(&pkt);
 
+	pthread_mutex_lock(&andna_cache_mutex);
 	pkt.msg = pack_counter_cache(andna_counter_c, &pkt_sz);
+	pthread_mutex_unlock(&andna_cache_mutex);
 	pkt.hdr.sz = pkt_sz;
 	debug(DBG_INSANE, "Reply %s to %s", re_to_str(ANDNA_PUT_COUNT_CACHE),
 		  ntop);
@@ -2361,6 +2464,37 @@ put_counter_cache(PACKET rq_pkt)
  *
  */
 
+/*
+ * andna_hook_rnodes
+ *
+ * stores in the `rnodes' array, which must have MAXGROUPNODE+1 members, our
+ * rnodes which belong to our same gnode, followed by a null pointer. Their
+ * number is returned. They are read from the map_snapshot, but they are the
+ * pointers of the live rnodes, which are used by the rnode_list.
+ */
+int
+andna_hook_rnodes(map_node ** rnodes)
+{
+	struct map_snapshot live, *snap;
+	map_node *node;
+	u_int epoch;
+	int i, n = 0;
+
+	snap = map_snapshot_read(&live, &epoch);
+	for (i = 0; snap->cur_node && i < snap->cur_node->links &&
+		 n < MAXGROUPNODE; i++) {
+		node = (map_node *) snap->cur_node->r_node[i].r_node;
+		if (!node || node->flags & MAP_ERNODE)
+			continue;
+		if ((node = map_snapshot_live(snap, node)))
+			rnodes[n++] = node;
+	}
+	rnodes[n] = 0;
+	map_snapshot_put(epoch);
+
+	return n;
+}
+
 /*
  * andna_hook
  *
@@ -2371,8 +2505,10 @@ void *
 andna_hook(void *null)
 {
 	inet_prefix to;
-	map_node *node;
-	int e = 0, i;
+	map_node *node, **rnodes;
+	andna_cache *ac;
+	counter_c *cc;
+	int e = 0, i, counter;
 
 	setzero(&to, sizeof(inet_prefix));
 
@@ -2381,7 +2517,8 @@ andna_hook(void *null)
 
 	loginfo("Starting the ANDNA hook.");
 
-	if (!me.cur_node->links) {
+	rnodes = xmalloc(sizeof(map_node *) * (MAXGROUPNODE + 1));
+	if (!andna_hook_rnodes(rnodes)) {
 		/* nothing to do */
 		debug(DBG_NORMAL, "There are no nodes, skipping the ANDNA hook.");
 		goto finish;
@@ -2391,13 +2528,13 @@ andna_hook(void *null)
 	 * Send the GET_ANDNA_CACHE request to the nearest rnode we have, if it
 	 * fails send it to the second rnode and so on...
 	 */
-	for (i = 0, e = 0; i < me.cur_node->links; i++) {
-		node = (map_node *) me.cur_node->r_node[i].r_node;
-		if (!node || node->flags & MAP_ERNODE)
-			continue;
-
-		andna_c = get_andna_cache(node, &andna_c_counter);
-		if (andna_c) {
+	for (i = 0, e = 0; (node = rnodes[i]); i++) {
+		if ((ac = get_andna_cache(node, &counter))) {
+			pthread_mutex_lock(&andna_cache_mutex);
+			andna_cache_destroy();
+			andna_c = ac;
+			andna_c_counter = counter;
+			pthread_mutex_unlock(&andna_cache_mutex);
 			e = 1;
 			break;
 		}
@@ -2410,13 +2547,13 @@ andna_hook(void *null)
 	 * Send the GET_COUNT_CACHE request to the nearest rnode we have, if it
 	 * fails send it to the second rnode and so on...
 	 */
-	for (i = 0, e = 0; i < me.cur_node->links; i++) {
-		node = (map_node *) me.cur_node->r_node[i].r_node;
-		if (!node || node->flags & MAP_ERNODE)
-			continue;
-
-		andna_counter_c = get_counter_cache(node, &cc_counter);
-		if (andna_counter_c) {
+	for (i = 0, e = 0; (node = rnodes[i]); i++) {
+		if ((cc = get_counter_cache(node, &counter))) {
+			pthread_mutex_lock(&andna_cache_mutex);
+			counter_c_destroy();
+			andna_counter_c = cc;
+			cc_counter = counter;
+			pthread_mutex_unlock(&andna_cache_mutex);
 			e = 1;
 			break;
 		}
@@ -2426,6 +2563,8 @@ andna_hook(void *null)
 			("None of the rnodes in this area gave me the counter_cache.");
 
   finish:
+	xfree(rnodes);
+
 	/* Un-block these requests */
 	op_filter_clr(ANDNA_SPREAD_SACACHE);
 
@@ -2492,45 +2631,41 @@ andna_update_hnames(int only_new_hname)
 }
 
 /*
- * andna_maintain_hnames_active
+ * andna_maintain_hnames_job
  *
- * periodically registers and keep up to date the hostnames of the local cache.
+ * The andna_hnames_job: it registers and keeps up to date the hostnames of
+ * the local cache. It returns the msecs after which it has to be run again.
  */
-void *
-andna_maintain_hnames_active(void *null)
+u_int
+andna_maintain_hnames_job(void *null)
 {
 	lcl_cache *alcl;
 	int ret, updates;
 
 	/* Wait a bit before trying to register the hname. The first QSPN must
 	 * be already sent */
-	while (time(0) - me.uptime < QSPN_WAIT_ROUND / 2)
-		sleep(1);
-
-	for (;;) {
-		updates = 0;
-		alcl = andna_lcl;
-
-		/** If we don't have rnodes, it's useless to try
-		 * anything */
-		while (!me.cur_node->links)
-			sleep(2);
-		 /**/ list_for(alcl) {
-			ret = andna_register_hname(alcl, 0);
-			if (!ret) {
-				loginfo("Hostname \"%s\" registered/updated "
-						"successfully", alcl->hostname);
-				updates++;
-			}
+	if (time(0) - me.uptime < QSPN_WAIT_ROUND / 2)
+		return 1000;
+
+	/** If we don't have rnodes, it's useless to try
+	 * anything */
+	if (!me.cur_node->links)
+		return 2000;
+	 /**/ updates = 0;
+	alcl = andna_lcl;
+	list_for(alcl) {
+		ret = andna_register_hname(alcl, 0);
+		if (!ret) {
+			loginfo("Hostname \"%s\" registered/updated "
+					"successfully", alcl->hostname);
+			updates++;
 		}
-
-		if (updates)
-			save_lcl_cache(andna_lcl, server_opt.lcl_file);
-
-		sleep((ANDNA_EXPIRATION_TIME / 2) + rand_range(1, 10));
 	}
 
-	return 0;
+	if (updates)
+		save_lcl_cache(andna_lcl, server_opt.lcl_file);
+
+	return ((ANDNA_EXPIRATION_TIME / 2) + rand_range(1, 10)) * 1000;
 }
 
 void *
@@ -2579,7 +2714,7 @@ andna_main(void *null)
 	/*
 	 * Start the hostnames updater and register
 	 */
-	andna_maintain_hnames_active(0);
+	timer_job_start(&andna_hnames_job, 0, andna_maintain_hnames_job, 0);
 
 	xfree(port);
 	return 0;
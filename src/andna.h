@@ -19,30 +19,19 @@
 #ifndef ANDNA_H
 #define ANDNA_H
 
+#include "gmap.h"
 #include "andna_cache.h"
 #include "pkts.h"
+#include "mapowner.h"
 
 #define MY_NAMESERV		"nameserver 127.0.0.1"
 #define MY_NAMESERV_IPV6	"nameserver ::1"
 #define ETC_RESOLV_CONF		"/etc/resolv.conf"
 #define ETC_RESOLV_CONF_BAK	"/etc/resolv.conf.bak"
 
-/* How many different andna pkt can be flooded simultaneusly */
-#define ANDNA_MAX_FLOODS	(ANDNA_MAX_QUEUE*3+1)
-
 /* How many new hash_gnodes are supported in the andna hash_gnode mutation */
 #define ANDNA_MAX_NEW_GNODES	1024
 
-/* 
- * These arrays keeps the latest reg_pkt and counter_check IDs to drop pkts
- * alreay received during the floods. These arrays are a FIFO, so the
- * last pkt_id will be always at the 0 position, while the first one will be
- * at the last position 
- */
-int last_reg_pkt_id[ANDNA_MAX_FLOODS];
-int last_counter_pkt_id[ANDNA_MAX_FLOODS];
-int last_spread_acache_pkt_id[ANDNA_MAX_FLOODS];
-
 /*\
  *			   *** ANDNA hash notes ***
  * 
@@ -224,6 +213,29 @@ struct spread_acache_pkt {
 INT_INFO spread_acache_pkt_info = { 0, {0}, {0}, {0} };
 
 
+/*
+ * The hgnode_memo keeps the last results of find_hash_gnode() searched
+ * without excluded hash_gnodes. An entry is valid until the maps change
+ * (see map_gen_sum()). When the hash_gnode is our gnode, the node of level
+ * 0 is chosen again at random each time, as find_hash_gnode() does.
+ */
+#define HGNODE_MEMO_SZ		64
+
+#define HGNODE_MEMO_VALID	1
+#define HGNODE_MEMO_EXCLUDE_ME	(1<<1)
+
+struct hgnode_memo {
+	u_int hash[MAX_IP_INT];
+	u_char flags;
+	u_int gen;					/* map_gen_sum() of all the levels */
+	int ret;					/* find_hash_gnode() return value */
+	inet_prefix to;
+};
+struct hgnode_memo hgnode_memo[HGNODE_MEMO_SZ];
+pthread_mutex_t hgnode_memo_mutex;
+
+struct timer_job andna_hnames_job;	/* see andna_maintain_hnames_job() */
+
 
 /*\
  *
@@ -239,16 +251,35 @@ void andna_close(void);
 void andna_resolvconf_modify(void);
 void andna_resolvconf_restore(void);
 
+int random_gid_level_0(struct map_snapshot *snap, quadro_group * qg,
+					   inet_prefix * to, int exclude_me);
+int find_hash_gnode_recurse(struct map_snapshot *snap, quadro_group qg,
+							int level, inet_prefix * to,
+							u_int ** excluded_hgnode,
+							int tot_excluded_hgnodes, int exclude_me);
+int find_hash_gnode(u_int hash[MAX_IP_INT], inet_prefix * to,
+					u_int ** excluded_hgnode, int tot_excluded_hgnodes,
+					int exclude_me);
+int hgnode_memo_find(struct map_snapshot *snap, u_int hash[MAX_IP_INT],
+					 int exclude_me, u_int gen, inet_prefix * to, int *ret);
+void hgnode_memo_store(u_int hash[MAX_IP_INT], int exclude_me, u_int gen,
+					   int ret, inet_prefix * to);
+
+int andna_flood_pkt(PACKET * rpkt, int exclude_rfrom);
+
 int andna_register_hname(lcl_cache * alcl, snsd_service * snsd_delete);
 int andna_recv_reg_rq(PACKET rpkt);
 
 int andna_check_counter(PACKET pkt);
 int andna_recv_check_counter(PACKET rpkt);
 
-snsd_service *andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
-								 u_char proto, int *records);
-snsd_service *andna_resolve_hname(char *hname, int service, u_char proto,
-								  int *records);
+snsd_flat *andna_resolve_hash_locally(u_int hname_hash[MAX_IP_INT],
+									 int service, u_char proto,
+									 int *records);
+snsd_flat *andna_resolve_hash(u_int hname_hash[MAX_IP_INT], int service,
+							  u_char proto, int *records);
+snsd_flat *andna_resolve_hname(char *hname, int service, u_char proto,
+							   int *records);
 int andna_recv_resolve_rq(PACKET rpkt);
 
 lcl_cache *andna_reverse_resolve(inet_prefix ip);
@@ -262,9 +293,10 @@ int put_single_acache(PACKET rpkt);
 int put_andna_cache(PACKET rq_pkt);
 int put_counter_cache(PACKET rq_pkt);
 
+int andna_hook_rnodes(map_node ** rnodes);
 void *andna_hook(void *);
 void andna_update_hnames(int only_new_hname);
-void *andna_maintain_hnames_active(void *null);
+u_int andna_maintain_hnames_job(void *null);
 void *andna_main(void *);
 
 #endif							/*ANDNA_H */
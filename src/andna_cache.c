@@ -37,6 +37,7 @@ andna_caches_init(int family)
 	net_family = family;
 
 	setzero(&lcl_keyring, sizeof(lcl_keyring));
+	pthread_mutex_init(&andna_cache_mutex, 0);
 
 	andna_lcl = (lcl_cache *) clist_init(&lcl_counter);
 	andna_c = (andna_cache *) clist_init(&andna_c_counter);
@@ -264,6 +265,7 @@ ac_queue_del(andna_cache * ac, andna_cache_queue * acq)
 	acq->snsd_counter = 0;
 	if (acq->service)
 		snsd_service_llist_del(&acq->service);
+	snsd_flat_cache_del(&acq->flat);
 	clist_del(&ac->acq, &ac->queue_counter, acq);
 	ac->flags &= ~ANDNA_FULL;
 }
@@ -604,8 +606,7 @@ rh_cache_add_hash(u_int hash, time_t timestamp)
 
 			if (rhc_counter >= ANDNA_MAX_HOSTNAMES) {
 				/* Delete the oldest struct in cache */
-				rhc = list_last(andna_rhc);
-				clist_del(&andna_rhc, &rhc_counter, rhc);
+				rh_cache_del(list_last(andna_rhc));
 			}
 		}
 
@@ -675,6 +676,7 @@ rh_cache_del(rh_cache * rhc)
 	rhc->snsd_counter = 0;
 	if (rhc->service)
 		snsd_service_llist_del(&rhc->service);
+	snsd_flat_cache_del(&rhc->flat);
 
 	clist_del(&andna_rhc, &rhc_counter, rhc);
 }
@@ -83,6 +83,8 @@ struct andna_cache_queue {
 
 	u_short snsd_counter;		/* # of `snsd' nodes */
 	snsd_service *service;
+	snsd_flat *flat;			/* the arena of `service', see
+								   snsd_cache.h */
 };
 typedef struct andna_cache_queue andna_cache_queue;
 
@@ -214,6 +216,7 @@ struct resolved_hnames_cache {
 
 	u_short snsd_counter;
 	snsd_service *service;
+	snsd_flat *flat;			/* the arena of `service' */
 };
 typedef struct resolved_hnames_cache rh_cache;
 
@@ -234,6 +237,14 @@ int lcl_counter;
 rh_cache *andna_rhc;
 int rhc_counter;
 
+/*
+ * andna_cache_mutex protects the andna_c, andna_counter_c and andna_rhc
+ * llists, used at the same time by the request threads, the snapshot_job
+ * and the map owner. It is taken before the snsd_flat_mutex and it is
+ * never held while waiting for a reply.
+ */
+pthread_mutex_t andna_cache_mutex;
+
 
 /*
  * 
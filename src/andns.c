@@ -734,8 +734,7 @@ inet_rslv(dns_pkt * dp, char *msg, int msglen, char *answer)
 	inet_prefix addr;
 	int res, qt, rcode;
 	u_short service;
-	snsd_service *ss;
-	snsd_prio *sp;
+	snsd_flat *f;
 	int records;
 	u_char proto;
 	char temp[DNS_MAX_HNAME_LEN];
@@ -747,14 +746,16 @@ inet_rslv(dns_pkt * dp, char *msg, int msglen, char *answer)
 		service = (qt == T_A) ? 0 : 25;
 		proto = (qt != T_A);
 		//ss=andna_resolve_hname(temp,service,proto,&records);
-		ss = andna_resolve_hname(temp, service, proto, &records);
-		if (!ss) {
+		f = andna_resolve_hname(temp, service, proto, &records);
+		if (!f) {
 			rcode = RCODE_ENSDMN;
 			goto safe_return_rcode;
 		}
-		sp = ss->prio;
-		snsd_prio_to_dansws(dp, sp, _ip_len_);
-		snsd_service_llist_del(&ss);
+		/* The nodes with the highest priority are contacted first */
+		snsd_prio_to_dansws(dp, f,
+							snsd_flat_highest_prio(f, SNSD_FLAT_SERVICES(f)),
+							_ip_len_);
+		snsd_flat_del(&f);
 	} else if (qt == T_PTR) {
 		char tomp[DNS_MAX_HNAME_LEN];
 		lcl_cache *lc;
@@ -806,22 +807,26 @@ nk_rslv(andns_pkt * ap, char *msg, int msglen, char *answer)
 
 	qt = ap->qtype;
 	if (qt == AT_A) {
-		snsd_service *ss;
-		ss = andna_resolve_hash((u_int *) ap->qstdata,
-								ap->service, ap->p + 1, &records);
+		snsd_flat *f;
+		struct snsd_flat_service *ss;
+
+		f = andna_resolve_hash((u_int *) ap->qstdata,
+							   ap->service, ap->p + 1, &records);
 		//ss=andna_resolve_hname(ap->qstdata, //USE HASH!
 		//      ap->service,ap->p,&records);
-		if (!ss) {
+		if (!f) {
 			rcode = RCODE_ENSDMN;
 			goto safe_return_rcode;
 		}
-		res = snsd_prio_to_aansws(answer + msglen,
-								  ss->prio, _ip_len_, ap->r, &records);
+		ss = SNSD_FLAT_SERVICES(f);
+		res = snsd_prio_to_aansws(answer + msglen, f,
+								  ss->prios ? SNSD_FLAT_PRIOS(f) +
+								  ss->prio : 0, _ip_len_, ap->r, &records);
+		snsd_flat_del(&f);
 		if (!records) {
 			rcode = RCODE_ENSDMN;
 			goto safe_return_rcode;
 		}
-		snsd_service_llist_del(&ss);
 	} else if (qt == AT_PTR) {
 		lcl_cache *lc;
 		int family;
@@ -841,14 +846,15 @@ nk_rslv(andns_pkt * ap, char *msg, int msglen, char *answer)
 		}
 		res = lcl_cache_to_aansws(answer + msglen, lc, &records);	/* destroys lc */
 	} else if (qt == AT_G) {
-		snsd_service *ss;
-		ss = andna_resolve_hash((u_int *) ap->qstdata, -1, 0, &records);
-		if (!ss) {
+		snsd_flat *f;
+		f = andna_resolve_hash((u_int *) ap->qstdata, -1, 0, &records);
+		if (!f) {
 			rcode = RCODE_ENSDMN;
 			goto safe_return_rcode;
 		}
-		res = snsd_service_to_aansws(answer + msglen + 2, ss,
+		res = snsd_service_to_aansws(answer + msglen + 2, f,
 									 _ip_len_, &records, ap->r);
+		snsd_flat_del(&f);
 		if (!res) {
 			rcode = RCODE_ENSDMN;
 			goto safe_return_rcode;
@@ -857,7 +863,6 @@ nk_rslv(andns_pkt * ap, char *msg, int msglen, char *answer)
 			rcode = RCODE_ESRVFAIL;
 			goto safe_return_rcode;
 		}
-		snsd_service_llist_del(&ss);
 	} else {
 		rcode = RCODE_EINTRPRT;
 		goto safe_return_rcode;
@@ -0,0 +1,697 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * andns_client.c
+ *
+ * The asynchronous andns resolver of libandns. See andns_client.h.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "andns_client.h"
+#include "hash.h"
+#include "xmalloc.h"
+#include "log.h"
+
+/*
+ * andns_client_connect
+ *
+ * returns a UDP socket connected to `host':`port', or -1 on error.
+ * Unlike the andns_net.c functions, it never exits the application which
+ * embeds libandns.
+ */
+int
+andns_client_connect(const char *host, uint16_t port)
+{
+	struct addrinfo filter, *ai, *res;
+	char portstr[6];
+	int sk = -1;
+
+	if (!host)
+		return -1;
+
+	memset(&filter, 0, sizeof(struct addrinfo));
+	filter.ai_socktype = SOCK_DGRAM;
+	snprintf(portstr, sizeof(portstr), "%u", port);
+	if (getaddrinfo(host, portstr, &filter, &res))
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((sk = socket(ai->ai_family, ai->ai_socktype,
+						 ai->ai_protocol)) < 0)
+			continue;
+		if (!connect(sk, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(sk);
+		sk = -1;
+	}
+	freeaddrinfo(res);
+
+	return sk;
+}
+
+/*
+ * andns_client_open
+ *
+ * returns a new client which sends its queries to `host':`port', or 0 if
+ * the socket can't be opened.
+ */
+andns_client *
+andns_client_open(const char *host, uint16_t port)
+{
+	andns_client *c;
+	int sk;
+
+	if ((sk = andns_client_connect(host, port)) < 0)
+		return 0;
+	if (fcntl(sk, F_SETFL, O_NONBLOCK) < 0) {
+		close(sk);
+		return 0;
+	}
+
+	c = xzalloc(sizeof(andns_client));
+	c->sk = sk;
+	c->cache_ttl = ANDNS_CLIENT_CACHE_TTL;
+
+	return c;
+}
+
+/*
+ * andns_client_close
+ *
+ * closes the socket of `c' and frees it, with all its queries. The
+ * callbacks of the pending queries aren't called.
+ */
+void
+andns_client_close(andns_client * c)
+{
+	struct andns_client_query *q, *next;
+	int i;
+
+	for (i = 0; i < ANDNS_CLIENT_MAX_PENDING; i++)
+		if (c->pending[i])
+			andns_client_query_free(c->pending[i]);
+	for (q = c->done; q; q = next) {
+		next = q->next;
+		andns_client_query_free(q);
+	}
+	andns_client_cache_flush(c);
+
+	close(c->sk);
+	xfree(c);
+}
+
+/*
+ * andns_client_fd
+ *
+ * returns the fd to poll: when it is readable, andns_client_process() has
+ * to be called.
+ */
+int
+andns_client_fd(andns_client * c)
+{
+	return c->sk;
+}
+
+/*
+ * andns_client_set_cache_ttl
+ *
+ * the answers will be cached for `ttl' seconds. 0 disables and flushes the
+ * cache.
+ */
+void
+andns_client_set_cache_ttl(andns_client * c, int ttl)
+{
+	c->cache_ttl = ttl > 0 ? ttl : 0;
+	if (!c->cache_ttl)
+		andns_client_cache_flush(c);
+}
+
+/*
+ * andns_client_cache_key
+ *
+ * copies in `key' the `pkt' query without its id, so that two queries with
+ * the same question have the same key, and stores its hash in `hash'.
+ */
+void
+andns_client_cache_key(char *key, char *pkt, int len, u_int * hash)
+{
+	memcpy(key, pkt, len);
+	/* The id is in the first 15 bits, the 16th is the recursion flag */
+	key[0] = 0;
+	key[1] &= 0x01;
+	*hash = fnv_32_buf(key, len, FNV1_32_INIT);
+}
+
+/*
+ * andns_client_cache_find
+ *
+ * returns the cached answer of the `key' query, or 0 if it isn't cached or
+ * it has expired.
+ */
+struct andns_client_cache *
+andns_client_cache_find(andns_client * c, char *key, int len, u_int hash)
+{
+	struct andns_client_cache *set;
+	time_t cur_t;
+	int i;
+
+	if (!c->cache_ttl)
+		return 0;
+
+	cur_t = time(0);
+	set = c->cache[hash % ANDNS_CLIENT_CACHE_SETS];
+	for (i = 0; i < ANDNS_CLIENT_CACHE_WAYS; i++)
+		if (set[i].key && set[i].hash == hash && set[i].key_len == len &&
+			set[i].expire > cur_t && !memcmp(set[i].key, key, len))
+			return &set[i];
+
+	return 0;
+}
+
+/*
+ * andns_client_cache_store
+ *
+ * caches the `answ' reply of the `key' query. It replaces the same query,
+ * or an expired entry, or the one which expires first.
+ */
+void
+andns_client_cache_store(andns_client * c, char *key, int len, char *answ,
+						 int answ_len)
+{
+	struct andns_client_cache *set, *e;
+	u_int hash;
+	int i;
+
+	if (!c->cache_ttl)
+		return;
+
+	hash = fnv_32_buf(key, len, FNV1_32_INIT);
+	set = c->cache[hash % ANDNS_CLIENT_CACHE_SETS];
+	for (e = &set[0], i = 0; i < ANDNS_CLIENT_CACHE_WAYS; i++) {
+		if (!set[i].key || (set[i].hash == hash && set[i].key_len == len &&
+							!memcmp(set[i].key, key, len))) {
+			e = &set[i];
+			break;
+		}
+		if (set[i].expire < e->expire)
+			e = &set[i];
+	}
+
+	if (e->key) {
+		xfree(e->key);
+		xfree(e->answ);
+	}
+	e->hash = hash;
+	e->expire = time(0) + c->cache_ttl;
+	e->key = xmalloc(len);
+	memcpy(e->key, key, len);
+	e->key_len = len;
+	e->answ = xmalloc(answ_len);
+	memcpy(e->answ, answ, answ_len);
+	e->answ_len = answ_len;
+}
+
+void
+andns_client_cache_flush(andns_client * c)
+{
+	struct andns_client_cache *e;
+	int i, j;
+
+	for (i = 0; i < ANDNS_CLIENT_CACHE_SETS; i++)
+		for (j = 0; j < ANDNS_CLIENT_CACHE_WAYS; j++) {
+			e = &c->cache[i][j];
+			if (!e->key)
+				continue;
+			xfree(e->key);
+			xfree(e->answ);
+			memset(e, 0, sizeof(struct andns_client_cache));
+		}
+}
+
+/*
+ * andns_client_query_new
+ *
+ * reserves a slot in `c->pending' and packs `ap' in a new query. `ap' is
+ * always destroyed, as a_p() does.
+ * It returns 0 if there are too many pending queries or `ap' is malformed.
+ */
+struct andns_client_query *
+andns_client_query_new(andns_client * c, andns_pkt * ap, andns_client_cb cb,
+					   void *arg)
+{
+	struct andns_client_query *q;
+	int i, slot;
+
+	if (c->pending_n >= ANDNS_CLIENT_MAX_PENDING) {
+		destroy_andns_pkt(ap);
+		return 0;
+	}
+
+	slot = rand() % ANDNS_CLIENT_MAX_PENDING;
+	for (i = 0; i < ANDNS_CLIENT_MAX_PENDING; i++, slot++)
+		if (!c->pending[ANDNS_CLIENT_ID_SLOT(slot)])
+			break;
+	slot = ANDNS_CLIENT_ID_SLOT(slot);
+
+	q = xzalloc(sizeof(struct andns_client_query));
+	q->id = ((rand() << 8) | slot) & ANDNS_CLIENT_MAX_ID;
+	q->cb = cb;
+	q->arg = arg;
+
+	ap->id = q->id;
+	q->pkt = xmalloc(ANDNS_MAX_SZ);
+	if ((q->pkt_len = a_p(ap, q->pkt)) <= 0) {
+		andns_client_query_free(q);
+		return 0;
+	}
+
+	c->pending[slot] = q;
+	c->pending_n++;
+
+	return q;
+}
+
+void
+andns_client_query_free(struct andns_client_query *q)
+{
+	if (q->pkt)
+		xfree(q->pkt);
+	if (q->answ)
+		xfree(q->answ);
+	xfree(q);
+}
+
+/*
+ * andns_client_complete
+ *
+ * removes `q' from the pending queries and queues it in `c->done' with its
+ * `status' and its `answ' reply. It will be delivered by
+ * andns_client_process() or andns_client_get().
+ */
+void
+andns_client_complete(andns_client * c, struct andns_client_query *q,
+					  int status, char *answ, int answ_len)
+{
+	int slot;
+
+	slot = ANDNS_CLIENT_ID_SLOT(q->id);
+	if (c->pending[slot] == q) {
+		c->pending[slot] = 0;
+		c->pending_n--;
+	}
+
+	q->status = status;
+	if (answ) {
+		q->answ = xmalloc(answ_len);
+		memcpy(q->answ, answ, answ_len);
+		q->answ_len = answ_len;
+	}
+	xfree(q->pkt);
+	q->pkt = 0;
+
+	q->next = 0;
+	if (c->done_tail)
+		c->done_tail->next = q;
+	else
+		c->done = q;
+	c->done_tail = q;
+	if (q->cb)
+		c->done_cb++;
+}
+
+/*
+ * andns_client_send
+ *
+ * sends the `n' `qs' queries with as few syscalls as possible. The queries
+ * which can't be sent now will be retransmitted by andns_client_expire().
+ * It returns the number of queries sent.
+ */
+int
+andns_client_send(andns_client * c, struct andns_client_query **qs, int n)
+{
+	struct mmsghdr msgs[ANDNS_CLIENT_BATCH];
+	struct iovec iov[ANDNS_CLIENT_BATCH];
+	struct timeval cur_t;
+	int i, b, ret, sent = 0;
+
+	gettimeofday(&cur_t, 0);
+	for (i = 0; i < n; i += b) {
+		b = n - i < ANDNS_CLIENT_BATCH ? n - i : ANDNS_CLIENT_BATCH;
+		memset(msgs, 0, sizeof(struct mmsghdr) * b);
+		for (ret = 0; ret < b; ret++) {
+			qs[i + ret]->sent = cur_t;
+			qs[i + ret]->tries++;
+			iov[ret].iov_base = qs[i + ret]->pkt;
+			iov[ret].iov_len = qs[i + ret]->pkt_len;
+			msgs[ret].msg_hdr.msg_iov = &iov[ret];
+			msgs[ret].msg_hdr.msg_iovlen = 1;
+		}
+
+		if ((ret = sendmmsg(c->sk, msgs, b, 0)) < 0) {
+			if (errno != EAGAIN && errno != ECONNREFUSED)
+				debug(DBG_NOISE, "andns_client_send: %s",
+					  strerror(errno));
+			break;
+		}
+		sent += ret;
+		if (ret < b)
+			break;
+	}
+	c->sent += sent;
+
+	return sent;
+}
+
+/*
+ * andns_client_submit_batch
+ *
+ * submits the `n' `aps' queries. When the i-th is completed,
+ * `cb'(c, handles[i], status, answer, args[i]) is called by
+ * andns_client_process(). If `cb' is 0, it has to be fetched with
+ * andns_client_get(). `args' can be 0.
+ * All the `aps' are destroyed.
+ * handles[i] is set to the handle of the i-th query, or to -1 if it
+ * couldn't be submitted. It returns the number of queries submitted.
+ */
+int
+andns_client_submit_batch(andns_client * c, andns_pkt ** aps, int n,
+						  andns_client_cb cb, void **args, int *handles)
+{
+	struct andns_client_query *q, *batch[ANDNS_CLIENT_BATCH];
+	struct andns_client_cache *e;
+	char key[ANDNS_MAX_SZ];
+	u_int hash;
+	int i, b, ret = 0;
+
+	for (i = b = 0; i < n; i++) {
+		handles[i] = -1;
+		if (!(q = andns_client_query_new(c, aps[i], cb,
+										 args ? args[i] : 0)))
+			continue;
+		handles[i] = q->id;
+		ret++;
+
+		andns_client_cache_key(key, q->pkt, q->pkt_len, &hash);
+		if ((e = andns_client_cache_find(c, key, q->pkt_len, hash))) {
+			/* The cached reply carries the id of its own query */
+			memcpy(e->answ, q->pkt, 2);
+			andns_client_complete(c, q, ANDNS_CLIENT_OK, e->answ,
+								  e->answ_len);
+			c->cache_hits++;
+			continue;
+		}
+
+		batch[b++] = q;
+		if (b == ANDNS_CLIENT_BATCH) {
+			andns_client_send(c, batch, b);
+			b = 0;
+		}
+	}
+	if (b)
+		andns_client_send(c, batch, b);
+
+	return ret;
+}
+
+/*
+ * andns_client_submit
+ *
+ * submits the `ap' query, see andns_client_submit_batch().
+ * It returns the handle of the query, or -1 on error.
+ */
+int
+andns_client_submit(andns_client * c, andns_pkt * ap, andns_client_cb cb,
+					void *arg)
+{
+	int handle;
+
+	andns_client_submit_batch(c, &ap, 1, cb, &arg, &handle);
+	return handle;
+}
+
+/*
+ * andns_client_recv
+ *
+ * receives all the replies waiting in the socket and completes their
+ * queries.
+ */
+void
+andns_client_recv(andns_client * c)
+{
+	struct mmsghdr msgs[ANDNS_CLIENT_BATCH];
+	struct iovec iov[ANDNS_CLIENT_BATCH];
+	struct andns_client_query *q;
+	andns_pkt hdr;
+	char key[ANDNS_MAX_SZ];
+	u_int hash;
+	int i, n, len;
+
+	do {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < ANDNS_CLIENT_BATCH; i++) {
+			iov[i].iov_base = c->rbuf[i];
+			iov[i].iov_len = ANDNS_MAX_SZ;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = recvmmsg(c->sk, msgs, ANDNS_CLIENT_BATCH, MSG_DONTWAIT, 0);
+		for (i = 0; i < n; i++) {
+			len = msgs[i].msg_len;
+			if (len < ANDNS_HDR_SZ)
+				continue;
+
+			a_hdr_u(c->rbuf[i], &hdr);
+			q = c->pending[ANDNS_CLIENT_ID_SLOT(hdr.id)];
+			if (!hdr.qr || !q || q->id != hdr.id)
+				/* Not a reply, or too late */
+				continue;
+
+			if (hdr.rcode == ANDNS_RCODE_NOERR) {
+				andns_client_cache_key(key, q->pkt, q->pkt_len, &hash);
+				andns_client_cache_store(c, key, q->pkt_len, c->rbuf[i],
+										 len);
+			}
+			andns_client_complete(c, q, ANDNS_CLIENT_OK, c->rbuf[i], len);
+		}
+	} while (n == ANDNS_CLIENT_BATCH);
+}
+
+/*
+ * andns_client_expire
+ *
+ * retransmits the queries which haven't been answered in
+ * ANDNS_CLIENT_RETRY_MS ms. After ANDNS_CLIENT_TRIES tries they are
+ * completed with ANDNS_CLIENT_TIMEOUT.
+ */
+void
+andns_client_expire(andns_client * c)
+{
+	struct andns_client_query *q, *batch[ANDNS_CLIENT_MAX_PENDING];
+	struct timeval cur_t, diff;
+	int i, b;
+
+	if (!c->pending_n)
+		return;
+
+	gettimeofday(&cur_t, 0);
+	for (i = b = 0; i < ANDNS_CLIENT_MAX_PENDING; i++) {
+		if (!(q = c->pending[i]))
+			continue;
+		timersub(&cur_t, &q->sent, &diff);
+		if (diff.tv_sec * 1000 + diff.tv_usec / 1000 < ANDNS_CLIENT_RETRY_MS)
+			continue;
+
+		if (q->tries >= ANDNS_CLIENT_TRIES) {
+			c->timeouts++;
+			andns_client_complete(c, q, ANDNS_CLIENT_TIMEOUT, 0, 0);
+		} else
+			batch[b++] = q;
+	}
+
+	if (b) {
+		c->retransmits += b;
+		andns_client_send(c, batch, b);
+	}
+}
+
+/*
+ * andns_client_process
+ *
+ * receives the replies, handles the late queries and calls the callbacks
+ * of the completed queries. It returns the number of callbacks called.
+ */
+int
+andns_client_process(andns_client * c)
+{
+	struct andns_client_query *q, *next, *keep = 0, *keep_tail = 0;
+	andns_pkt *ap;
+	int status, ret = 0;
+
+	andns_client_recv(c);
+	andns_client_expire(c);
+
+	if (!c->done_cb)
+		return 0;
+
+	/* The callbacks can submit new queries: detach the queue first */
+	q = c->done;
+	c->done = c->done_tail = 0;
+	c->done_cb = 0;
+	for (; q; q = next) {
+		next = q->next;
+		if (!q->cb) {
+			q->next = 0;
+			if (keep_tail)
+				keep_tail->next = q;
+			else
+				keep = q;
+			keep_tail = q;
+			continue;
+		}
+
+		ap = 0;
+		status = q->status;
+		if (status == ANDNS_CLIENT_OK &&
+			a_u(q->answ, q->answ_len, &ap) <= 0) {
+			ap = 0;
+			status = ANDNS_CLIENT_EINVAL;
+		}
+		q->cb(c, q->id, status, ap, q->arg);
+		if (ap)
+			destroy_andns_pkt(ap);
+		andns_client_query_free(q);
+		ret++;
+	}
+
+	if (keep) {
+		keep_tail->next = c->done;
+		c->done = keep;
+		if (!c->done_tail)
+			c->done_tail = keep_tail;
+	}
+
+	return ret;
+}
+
+/*
+ * andns_client_timeout
+ *
+ * returns the ms after which andns_client_process() has to be called even
+ * if the socket isn't readable, or -1 if there is nothing to wait.
+ */
+int
+andns_client_timeout(andns_client * c)
+{
+	struct timeval cur_t, diff;
+	int i, ms, ret = -1;
+
+	if (c->done_cb)
+		return 0;
+
+	gettimeofday(&cur_t, 0);
+	for (i = 0; i < ANDNS_CLIENT_MAX_PENDING; i++) {
+		if (!c->pending[i])
+			continue;
+		timersub(&cur_t, &c->pending[i]->sent, &diff);
+		ms = ANDNS_CLIENT_RETRY_MS -
+			(diff.tv_sec * 1000 + diff.tv_usec / 1000);
+		if (ms < 0)
+			ms = 0;
+		if (ret < 0 || ms < ret)
+			ret = ms;
+	}
+
+	return ret;
+}
+
+/*
+ * andns_client_get
+ *
+ * fetches the first completed query which had no callback. Its handle is
+ * stored in `handle' and its answer in `ap', which has to be destroyed by
+ * the caller.
+ * It returns the status of the query, or ANDNS_CLIENT_NONE if there's
+ * none.
+ */
+int
+andns_client_get(andns_client * c, int *handle, andns_pkt ** ap)
+{
+	struct andns_client_query *q, *prev = 0;
+	int status;
+
+	for (q = c->done; q; prev = q, q = q->next)
+		if (!q->cb)
+			break;
+	if (!q)
+		return ANDNS_CLIENT_NONE;
+
+	if (prev)
+		prev->next = q->next;
+	else
+		c->done = q->next;
+	if (c->done_tail == q)
+		c->done_tail = prev;
+
+	*handle = q->id;
+	*ap = 0;
+	status = q->status;
+	if (status == ANDNS_CLIENT_OK && a_u(q->answ, q->answ_len, ap) <= 0) {
+		*ap = 0;
+		status = ANDNS_CLIENT_EINVAL;
+	}
+	andns_client_query_free(q);
+
+	return status;
+}
+
+/*
+ * andns_client_wait
+ *
+ * waits at most `timeout_ms' ms (-1 is forever) for something to do, then
+ * calls andns_client_process(). For the applications without an event
+ * loop.
+ */
+int
+andns_client_wait(andns_client * c, int timeout_ms)
+{
+	struct pollfd pfd;
+	int ms;
+
+	ms = andns_client_timeout(c);
+	if (ms < 0 || (timeout_ms >= 0 && timeout_ms < ms))
+		ms = timeout_ms;
+
+	pfd.fd = c->sk;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, ms) < 0 && errno != EINTR)
+		return -1;
+
+	return andns_client_process(c);
+}
@@ -0,0 +1,163 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef ANDNS_CLIENT_H
+#define ANDNS_CLIENT_H
+
+#include <time.h>
+#include <sys/time.h>
+
+#include "andns_lib.h"
+
+/*
+ * The andns client is the asynchronous resolver of libandns, which the
+ * applications can embed to resolve the ANDNA hostnames without blocking.
+ *
+ * A client keeps a single connected UDP socket to ntkd, opened by
+ * andns_client_open() and used for all its queries. andns_client_submit()
+ * packs and sends a query and returns immediately. When the socket is
+ * readable (see andns_client_fd()) or andns_client_timeout() milliseconds
+ * have passed, andns_client_process() has to be called: it receives all
+ * the replies, retransmits or expires the late queries and completes them.
+ * A completed query is passed to its callback or, if it had none, it is
+ * queued and can be fetched with andns_client_get().
+ * andns_client_wait() does all of this for the applications which don't
+ * have an event loop.
+ *
+ * The replies are matched to the queries with the andns id: its low 8 bits
+ * are the index of the query in `pending', the others are random.
+ *
+ * The answers with ANDNS_RCODE_NOERR are kept in a small cache for
+ * `cache_ttl' seconds. A query found in the cache doesn't leave the
+ * process, it is completed at the next andns_client_process().
+ *
+ * A client isn't thread safe: use one client per thread.
+ */
+
+#define ANDNS_CLIENT_MAX_PENDING	256	/* the low 8 bits of the id */
+#define ANDNS_CLIENT_ID_SLOT(id)	((id) & (ANDNS_CLIENT_MAX_PENDING - 1))
+#define ANDNS_CLIENT_MAX_ID		0x7fff	/* andns ids are 15 bits long */
+
+#define ANDNS_CLIENT_RETRY_MS		1000	/* retransmission timeout */
+#define ANDNS_CLIENT_TRIES		3
+#define ANDNS_CLIENT_BATCH		32	/* pkts per sendmmsg/recvmmsg */
+
+#define ANDNS_CLIENT_CACHE_SETS		128
+#define ANDNS_CLIENT_CACHE_WAYS		4
+#define ANDNS_CLIENT_CACHE_TTL		60	/* seconds */
+
+/* Status of a completed query */
+#define ANDNS_CLIENT_OK			0
+#define ANDNS_CLIENT_TIMEOUT		-1
+#define ANDNS_CLIENT_EINVAL		-2	/* malformed reply */
+#define ANDNS_CLIENT_NONE		-3	/* nothing to andns_client_get() */
+
+struct andns_client;
+
+/*
+ * The callback of a query. `ap' is the unpacked reply, or 0 if `status'
+ * isn't ANDNS_CLIENT_OK. It is destroyed after the callback returns.
+ */
+typedef void (*andns_client_cb) (struct andns_client * c, int handle,
+								 int status, andns_pkt * ap, void *arg);
+
+struct andns_client_query {
+	struct andns_client_query *next;	/* in the `done' queue */
+
+	uint16_t id;
+	int tries;
+	struct timeval sent;
+
+	andns_client_cb cb;
+	void *arg;
+
+	char *pkt;					/* the packed query */
+	int pkt_len;
+	int status;
+	char *answ;					/* the raw reply, when completed */
+	int answ_len;
+};
+
+struct andns_client_cache {
+	u_int hash;
+	time_t expire;
+	char *key;					/* the packed query, with id 0 */
+	int key_len;
+	char *answ;
+	int answ_len;
+};
+
+typedef struct andns_client {
+	int sk;
+
+	struct andns_client_query *pending[ANDNS_CLIENT_MAX_PENDING];
+	int pending_n;
+	struct andns_client_query *done, *done_tail;
+	int done_cb;				/* queries in `done' with a callback */
+
+	char rbuf[ANDNS_CLIENT_BATCH][ANDNS_MAX_SZ];
+
+	struct andns_client_cache
+	 cache[ANDNS_CLIENT_CACHE_SETS][ANDNS_CLIENT_CACHE_WAYS];
+	int cache_ttl;				/* 0 disables the cache */
+
+	/* Stupid statistics */
+	u_int sent;
+	u_int cache_hits;
+	u_int retransmits;
+	u_int timeouts;
+} andns_client;
+
+
+/* * * Functions declaration * * */
+int andns_client_connect(const char *host, uint16_t port);
+andns_client *andns_client_open(const char *host, uint16_t port);
+void andns_client_close(andns_client * c);
+int andns_client_fd(andns_client * c);
+void andns_client_set_cache_ttl(andns_client * c, int ttl);
+
+void andns_client_cache_key(char *key, char *pkt, int len, u_int * hash);
+struct andns_client_cache *andns_client_cache_find(andns_client * c,
+												   char *key, int len,
+												   u_int hash);
+void andns_client_cache_store(andns_client * c, char *key, int len,
+							  char *answ, int answ_len);
+void andns_client_cache_flush(andns_client * c);
+
+struct andns_client_query *andns_client_query_new(andns_client * c,
+												  andns_pkt * ap,
+												  andns_client_cb cb,
+												  void *arg);
+void andns_client_query_free(struct andns_client_query *q);
+void andns_client_complete(andns_client * c, struct andns_client_query *q,
+						   int status, char *answ, int answ_len);
+int andns_client_send(andns_client * c, struct andns_client_query **qs,
+					  int n);
+int andns_client_submit_batch(andns_client * c, andns_pkt ** aps, int n,
+							  andns_client_cb cb, void **args,
+							  int *handles);
+int andns_client_submit(andns_client * c, andns_pkt * ap,
+						andns_client_cb cb, void *arg);
+void andns_client_recv(andns_client * c);
+void andns_client_expire(andns_client * c);
+int andns_client_process(andns_client * c);
+int andns_client_timeout(andns_client * c);
+int andns_client_get(andns_client * c, int *handle, andns_pkt ** ap);
+int andns_client_wait(andns_client * c, int timeout_ms);
+
+#endif							/*ANDNS_CLIENT_H */
@@ -33,38 +33,28 @@
 /*
  * Given a a hostname hash, makes a resolution 
  * call (service=0) and search the main ip entry,
- * storing it to snsd_node dst.
+ * storing it to the snsd_flat_node dst.
  *
  * Returns:
  * 	0
  * 	-1
  */
 int
-snsd_main_ip(u_int * hname_hash, snsd_node * dst)
+snsd_main_ip(u_int * hname_hash, struct snsd_flat_node *dst)
 {
-	snsd_service *ss;
-	snsd_prio *sp;
-	snsd_node *sn;
+	snsd_flat *f;
+	struct snsd_flat_node *sn;
 	int records;
 
-	ss = andna_resolve_hash(hname_hash, 0, 0, &records);
-	if (!ss)
+	f = andna_resolve_hash(hname_hash, 0, 0, &records);
+	if (!f)
 		err_ret(ERR_SNDMRF, -1);
-	if (!(sp = ss->prio)) {
-		goto destroy_return;
-	}
-	list_for(sp) {
-		sn = sp->node;
-		list_for(sn)
-			if (sn->flags & SNSD_NODE_MAIN_IP) {
-			memcpy(dst, sn, sizeof(snsd_node));
-			snsd_service_llist_del(&ss);
-			return 0;
-		}
+	if ((sn = snsd_flat_find_mainip(f))) {
+		memcpy(dst, sn, sizeof(struct snsd_flat_node));
+		snsd_flat_del(&f);
+		return 0;
 	}
-	goto destroy_return;
-  destroy_return:
-	snsd_service_llist_del(&ss);
+	snsd_flat_del(&f);
 	err_ret(ERR_SNDMRF, -1);
 }
 
@@ -78,8 +68,8 @@ snsd_main_ip(u_int * hname_hash, snsd_node * dst)
  * 	
  */
 int
-snsd_node_to_data(char *buf, snsd_node * sn, u_char prio, int iplen,
-				  int recursion)
+snsd_node_to_data(char *buf, struct snsd_flat_node *sn, u_char prio,
+				  int iplen, int recursion)
 {
 	int res;
 	int family;
@@ -98,7 +88,7 @@ snsd_node_to_data(char *buf, snsd_node * sn, u_char prio, int iplen,
 		inet_htonl((u_int *) (buf + 2), family);
 		return iplen + 2;
 	} else if (recursion) {
-		snsd_node snt;
+		struct snsd_flat_node snt;
 		res = snsd_main_ip(sn->record, &snt);
 		if (!res) {				/* I love recursion */
 			res = snsd_node_to_data(buf, &snt, prio, iplen, -1);
@@ -149,50 +139,51 @@ size_t snsd_node_to_aansw(char *buf,snsd_node *sn,u_char prio,int iplen)
  *
  */
 int
-snsd_prio_to_aansws(char *buf, snsd_prio * sp, int iplen, int recursion,
-					int *count)
+snsd_prio_to_aansws(char *buf, snsd_flat * f, struct snsd_flat_prio *sp,
+					int iplen, int recursion, int *count)
 {
 	int res = 0;
-	snsd_node *sn;
-	int c = 0;
+	struct snsd_flat_node *sn;
+	int i;
 
+	*count = 0;
 	if (!sp || !buf)
 		return 0;
 
-	sn = sp->node;
-	list_for(sn) {
+	sn = SNSD_FLAT_NODES(f) + sp->node;
+	for (i = 0; i < sp->nodes; i++, sn++)
 		res += snsd_node_to_data(buf + res, sn, sp->prio,
 								 iplen, recursion);
-		c++;
-	}
-	*count = c;
+	*count = sp->nodes;
 	return res;
 }
 
 int
-snsd_service_to_aansws(char *buf, snsd_service * ss, int iplen, int *count,
+snsd_service_to_aansws(char *buf, snsd_flat * f, int iplen, int *count,
 					   int recursion)
 {
-	int family, c = 0;
+	int family, c = 0, i, j, k;
 	uint16_t service;
 	uint8_t prio, proto;
-	snsd_prio *sp;
-	snsd_node *sn;
+	struct snsd_flat_service *ss;
+	struct snsd_flat_prio *sp;
+	struct snsd_flat_node *sn;
 	char *rem;
-	snsd_node snt;
+	struct snsd_flat_node snt;
 
-	if (!ss || !buf)
+	if (!f || !buf)
 		return 0;
 	rem = buf;
 
-	list_for(ss) {
+	ss = SNSD_FLAT_SERVICES(f);
+	for (i = 0; i < f->services; i++, ss++) {
 		service = htons(ss->service);
 		proto = ss->proto;
-		sp = ss->prio;
-		list_for(sp) {
+		sp = SNSD_FLAT_PRIOS(f) + ss->prio;
+		for (j = 0; j < ss->prios; j++, sp++) {
 			prio = sp->prio;
-			sn = sp->node;
-			list_for(sn) {
+			sn = SNSD_FLAT_NODES(f) + sp->node;
+			for (k = 0; k < sp->nodes; k++, sn++) {
 				if (sn->flags & SNSD_NODE_MAIN_IP)
 					(*buf) |= 0xc0;
 				else if (sn->flags & SNSD_NODE_IP)
@@ -251,21 +242,21 @@ snsd_service_to_aansws(char *buf, snsd_service * ss, int iplen, int *count,
  * Otherwise returns -1.
  */
 int
-snsd_node_to_dansw(dns_pkt * dp, snsd_node * sn, int iplen)
+snsd_node_to_dansw(dns_pkt * dp, struct snsd_flat_node *sn, int iplen)
 {
 	char temp[18];
 	dns_pkt_a *dpa;
-	snsd_node snt, *s;
-	int res;
+	struct snsd_flat_node snt, *s;
 
-	if (!(sn->flags & SNSD_NODE_HNAME)) {
-		if (!(res = snsd_main_ip(sn->record, &snt)))
+	if (sn->flags & SNSD_NODE_HNAME) {
+		/* The record is the hash of a hname: take its main ip */
+		if (snsd_main_ip(sn->record, &snt))
 			return -1;
 		s = &snt;
 	} else
 		s = sn;
 
-	memcpy(temp, sn->record, iplen);
+	memcpy(temp, s->record, iplen);
 	inet_htonl((u_int *) (temp), (iplen == 4) ? AF_INET : AF_INET6);
 
 	dpa = DP_ADD_ANSWER(dp);
@@ -278,18 +269,26 @@ snsd_node_to_dansw(dns_pkt * dp, snsd_node * sn, int iplen)
 /*
  * Converts a snsd_prio struct, adding a set of answers to
  * the dns_packet dp.
+ * The dns clients use the first answer, so the first one is the
+ * node chosen by snsd_flat_choose_wrand(), the others follow.
  * Returns the number of answers added to dp.
  */
 int
-snsd_prio_to_dansws(dns_pkt * dp, snsd_prio * sp, int iplen)
+snsd_prio_to_dansws(dns_pkt * dp, snsd_flat * f, struct snsd_flat_prio *sp,
+					int iplen)
 {
-	int res = 0;
-	snsd_node *sn;
+	int res = 0, i;
+	struct snsd_flat_node *sn, *first;
 
-	sn = sp->node;
-	list_for(sn)
-		if (!snsd_node_to_dansw(dp, sn, iplen))
+	if (!(first = snsd_flat_choose_wrand(f, sp)))
+		return 0;
+	if (!snsd_node_to_dansw(dp, first, iplen))
 		res++;
+
+	sn = SNSD_FLAT_NODES(f) + sp->node;
+	for (i = 0; i < sp->nodes; i++, sn++)
+		if (sn != first && !snsd_node_to_dansw(dp, sn, iplen))
+			res++;
 	return res;
 }
 
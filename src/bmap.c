@@ -91,7 +91,7 @@ map_add_bnode(map_bnode ** bmap, u_int * bmap_nodes, u_int bnode,
 		*bmap = xrealloc(*bmap, sizeof(map_bnode) * *bmap_nodes);
 
 	bnode_map = *bmap;
-	setzero(bnode_map, sizeof(map_bnode));
+	setzero(&bnode_map[bm], sizeof(map_bnode));
 	bnode_map[bm].bnode_ptr = bnode;
 	bnode_map[bm].links = links;
 	return bm;
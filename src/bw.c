@@ -0,0 +1,376 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * bw.c
+ *
+ * The monitor of the bandwidth available on the links of each interface.
+ */
+
+#include "includes.h"
+#include <linux/if_link.h>
+
+#include "common.h"
+#include "inet.h"
+#include "request.h"
+#include "pkts.h"
+#include "bmap.h"
+#include "radar.h"
+#include "tracer.h"
+#include "netsukuku.h"
+#include "timer.h"
+#include "bw.h"
+
+int
+bw_init(void)
+{
+	setzero(bw_ifs, sizeof(bw_ifs));
+	bw_ifs_n = 0;
+	bw_passive_samples = 0;
+	pthread_mutex_init(&bw_mutex, 0);
+
+	if (rtnl_open(&bw_rth, 0) < 0) {
+		error("bw_init(): cannot open the netlink socket, the bandwidth "
+			  "monitor is disabled");
+		bw_rth.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * bw_if_find
+ *
+ * returns the bw_if of the `dev_idx' interface, or 0 if it isn't monitored.
+ * bw_mutex must be locked.
+ */
+struct bw_if *
+bw_if_find(int dev_idx)
+{
+	int i;
+
+	for (i = 0; i < bw_ifs_n; i++)
+		if (bw_ifs[i].dev_idx == dev_idx)
+			return &bw_ifs[i];
+	return 0;
+}
+
+/*
+ * bw_if_speed
+ *
+ * reads from sysfs the speed and the duplex mode of the link of `b'.
+ * The speed of the `server_opt.inet_gw_dev' is the one of the Internet
+ * connection, if it has been set in the config file.
+ */
+void
+bw_if_speed(struct bw_if *b)
+{
+	char path[64], duplex[8];
+	FILE *fd;
+	int speed = 0;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/speed", b->dev_name);
+	if ((fd = fopen(path, "r"))) {
+		if (fscanf(fd, "%d", &speed) != 1)
+			speed = 0;
+		fclose(fd);
+	}
+	/* In Mb/s, -1 if the driver doesn't know it */
+	b->speed = speed > 0 ? speed * 1000 : 0;
+
+	if ((b->flags & BW_IF_INET) && server_opt.my_upload_bw &&
+		server_opt.my_dnload_bw)
+		b->speed = (server_opt.my_upload_bw + server_opt.my_dnload_bw) / 2;
+
+	b->flags &= ~BW_IF_FULL_DUPLEX;
+	snprintf(path, sizeof(path), "/sys/class/net/%s/duplex", b->dev_name);
+	if ((fd = fopen(path, "r"))) {
+		if (fscanf(fd, "%7s", duplex) == 1 && !strcmp(duplex, "full"))
+			b->flags |= BW_IF_FULL_DUPLEX;
+		fclose(fd);
+	}
+}
+
+/*
+ * bw_ifs_sync
+ *
+ * updates `bw_ifs' with the current interfaces, keeping the statistics of
+ * the ones which were already monitored. bw_mutex must be locked.
+ */
+void
+bw_ifs_sync(void)
+{
+	struct bw_if new[MAX_INTERFACES + 1], *b;
+	int i, n, idx;
+
+	for (i = n = 0; i < me.cur_ifs_n && i < MAX_INTERFACES; i++, n++) {
+		if ((b = bw_if_find(me.cur_ifs[i].dev_idx)))
+			memcpy(&new[n], b, sizeof(struct bw_if));
+		else {
+			setzero(&new[n], sizeof(struct bw_if));
+			strncpy(new[n].dev_name, me.cur_ifs[i].dev_name, IFNAMSIZ - 1);
+			new[n].dev_idx = me.cur_ifs[i].dev_idx;
+		}
+		new[n].flags &= ~BW_IF_INET;
+	}
+
+	if (server_opt.share_internet && server_opt.inet_gw_dev &&
+		(idx = if_nametoindex(server_opt.inet_gw_dev))) {
+		for (i = 0; i < n; i++)
+			if (new[i].dev_idx == idx)
+				break;
+		if (i == n) {
+			if ((b = bw_if_find(idx)))
+				memcpy(&new[n], b, sizeof(struct bw_if));
+			else {
+				setzero(&new[n], sizeof(struct bw_if));
+				strncpy(new[n].dev_name, server_opt.inet_gw_dev,
+						IFNAMSIZ - 1);
+				new[n].dev_idx = idx;
+			}
+			n++;
+		}
+		new[i].flags |= BW_IF_INET;
+	}
+
+	memcpy(bw_ifs, new, sizeof(struct bw_if) * n);
+	bw_ifs_n = n;
+}
+
+/*
+ * bw_if_update
+ *
+ * updates the estimates of `b' with the `rx_bytes' and `tx_bytes' counters
+ * read at the `now' time. bw_mutex must be locked.
+ */
+void
+bw_if_update(struct bw_if *b, u_int rx_bytes, u_int tx_bytes,
+			 struct timeval *now)
+{
+	struct timeval diff;
+	u_int ms, rx, tx, thr;
+
+	if (!b->stamp.tv_sec)
+		goto store;
+
+	timersub(now, &b->stamp, &diff);
+	if (!(ms = MILLISEC(diff)))
+		return;
+
+	/* The counters are 32bit, the difference survives their wrap.
+	 * bytes*8/ms == Kb/s */
+	rx = (uint64_t) (rx_bytes - b->rx_bytes) * 8 / ms;
+	tx = (uint64_t) (tx_bytes - b->tx_bytes) * 8 / ms;
+	if (b->flags & BW_IF_FULL_DUPLEX)
+		thr = rx > tx ? rx : tx;
+	else
+		thr = rx + tx;
+
+	b->used = b->samples ? (b->used * 3 + thr) / 4 : thr;
+	b->peak -= b->peak / BW_PEAK_DECAY;
+	if (thr > b->peak)
+		b->peak = thr;
+	b->samples++;
+
+	if (b->speed)
+		b->capacity = b->speed;
+	else
+		b->capacity = b->peak > BW_MIN_CAPACITY ? b->peak : BW_MIN_CAPACITY;
+
+	b->avail = b->capacity > b->used ? b->capacity - b->used : 0;
+	if (b->avail < b->capacity / BW_AVAIL_MIN_DIV)
+		b->avail = b->capacity / BW_AVAIL_MIN_DIV;
+	if (!b->avail)
+		b->avail = 1;
+
+  store:
+	b->rx_bytes = rx_bytes;
+	b->tx_bytes = tx_bytes;
+	b->stamp = *now;
+}
+
+/*
+ * bw_store_link
+ *
+ * The rtnl_dump_filter() of bw_update(): it passes the statistics of each
+ * link to bw_if_update(). `arg' points to the time of the dump.
+ */
+int
+bw_store_link(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct rtnl_link_stats *st;
+	struct bw_if *b;
+
+	if (n->nlmsg_type != RTM_NEWLINK)
+		return 0;
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return -1;
+
+	if (!(b = bw_if_find(ifi->ifi_index)))
+		return 0;
+
+	setzero(tb, sizeof(tb));
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
+	if (!tb[IFLA_STATS])
+		return 0;
+
+	st = RTA_DATA(tb[IFLA_STATS]);
+	bw_if_update(b, st->rx_bytes, st->tx_bytes, (struct timeval *) arg);
+
+	return 0;
+}
+
+/*
+ * bw_update
+ *
+ * dumps the statistics of all the links and updates the bandwidth
+ * estimates of the monitored interfaces.
+ */
+int
+bw_update(void)
+{
+	struct timeval now;
+	int i, ret = 0;
+
+	if (bw_rth.fd < 0)
+		return -1;
+
+	pthread_mutex_lock(&bw_mutex);
+	bw_ifs_sync();
+	for (i = 0; i < bw_ifs_n; i++)
+		bw_if_speed(&bw_ifs[i]);
+
+	gettimeofday(&now, 0);
+	if (rtnl_wilddump_request(&bw_rth, AF_UNSPEC, RTM_GETLINK) < 0) {
+		error(ERROR_MSG "Cannot send dump request", ERROR_POS);
+		ERROR_FINISH(ret, -1, finish);
+	}
+	if (rtnl_dump_filter(&bw_rth, bw_store_link, &now, NULL, NULL) < 0) {
+		debug(DBG_NORMAL, ERROR_MSG "Dump terminated", ERROR_POS);
+		ERROR_FINISH(ret, -1, finish);
+	}
+
+  finish:
+	pthread_mutex_unlock(&bw_mutex);
+	return ret;
+}
+
+/*
+ * bw_devs_avail
+ *
+ * returns the available bandwidth of the best interface of the `dev_n'
+ * `devs'. An rnode reached through `devs' is reached with this bandwidth.
+ * If it isn't known 0 is returned.
+ */
+u_int
+bw_devs_avail(interface ** devs, int dev_n)
+{
+	struct bw_if *b;
+	u_int bw = 0;
+	int i;
+
+	pthread_mutex_lock(&bw_mutex);
+	for (i = 0; i < dev_n; i++)
+		if (devs[i] && (b = bw_if_find(devs[i]->dev_idx)) &&
+			b->avail > bw)
+			bw = b->avail;
+	pthread_mutex_unlock(&bw_mutex);
+
+	return bw;
+}
+
+/*
+ * bw_inet_avail
+ *
+ * returns the available bandwidth of our Internet connection, or 0 if it
+ * isn't known.
+ */
+u_int
+bw_inet_avail(void)
+{
+	u_int bw = 0;
+	int i;
+
+	pthread_mutex_lock(&bw_mutex);
+	for (i = 0; i < bw_ifs_n; i++)
+		if (bw_ifs[i].flags & BW_IF_INET && bw_ifs[i].speed) {
+			bw = bw_ifs[i].avail;
+			break;
+		}
+	pthread_mutex_unlock(&bw_mutex);
+
+	return bw;
+}
+
+/*
+ * bw_passive_sample
+ *
+ * `bytes' bytes have been received in `usecs' usecs from the `sk' TCP
+ * socket. If the peer is one of our rnodes, the throughput is a lower bound
+ * of the capacity of the link it is reached from, so the peak throughput of
+ * that interface is raised.
+ */
+void
+bw_passive_sample(int sk, size_t bytes, u_int usecs)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	inet_prefix ip;
+	interface **devs;
+	struct bw_if *b;
+	map_node *node;
+	u_int kb;
+	int pos;
+
+	if (!usecs || bytes < BW_PASSIVE_MIN_SZ)
+		return;
+
+	if (getpeername(sk, (struct sockaddr *) &ss, &len) < 0 ||
+		sockaddr_to_inet((struct sockaddr *) &ss, &ip, 0) < 0)
+		return;
+
+	if ((pos = ip_to_rfrom(ip, 0, 0, 0)) < 0 || pos >= me.cur_node->links)
+		return;
+	node = (map_node *) me.cur_node->r_node[pos].r_node;
+	if (!(devs = rnl_get_dev(rlist, node)) || !devs[0])
+		return;
+
+	/* bytes*8*1000/usecs == Kb/s */
+	kb = (uint64_t) bytes * 8 * 1000 / usecs;
+
+	pthread_mutex_lock(&bw_mutex);
+	if ((b = bw_if_find(devs[0]->dev_idx)) && kb > b->peak)
+		b->peak = kb;
+	bw_passive_samples++;
+	pthread_mutex_unlock(&bw_mutex);
+}
+
+/*
+ * bw_update_job
+ *
+ * The bw_job: it updates the bandwidth estimates every BW_UPDATE_INTERVAL
+ * seconds.
+ */
+u_int
+bw_update_job(void *null)
+{
+	bw_update();
+	return BW_UPDATE_INTERVAL * 1000;
+}
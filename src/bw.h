@@ -0,0 +1,111 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef BW_H
+#define BW_H
+
+#include "if.h"
+#include "libnetlink.h"
+#include "timer.h"
+
+/*
+ * The bandwidth monitor keeps, for each interface used by ntkd, an estimate
+ * of the bandwidth still available on its link.
+ *
+ * Every BW_UPDATE_INTERVAL seconds the bw_update_job() dumps the link statistics
+ * with netlink and calculates the throughput of each interface since the
+ * last dump. The available bandwidth is the capacity of the link minus its
+ * smoothed throughput.
+ * The capacity is the speed reported by the kernel or, when it isn't known
+ * (i.e. wireless cards), the highest throughput ever seen on the link. The
+ * big TCP pkts received from the rnodes (maps, qspn replies, ...) are timed
+ * with bw_passive_sample() and they too raise the capacity of the interface
+ * they came from.
+ *
+ * The available bandwidth of an rnode is the one of its best interface. The
+ * radar stores it in map_rnode.bw, the tracer pkts carry it and the qspn
+ * keeps in map_rnode.bw the bottleneck of each route (see rnode_cost()).
+ * All the bandwidths are in Kb/s, 0 means unknown.
+ */
+
+#define BW_UPDATE_INTERVAL	2	/* seconds */
+#define BW_MIN_CAPACITY		64	/* Kb/s. The capacity of a link we know
+								   nothing about */
+#define BW_AVAIL_MIN_DIV	10	/* A saturated link has still 1/10 of its
+								   capacity available */
+#define BW_PEAK_DECAY		64	/* The peak throughput loses 1/64 of its
+								   value at each update */
+#define BW_PASSIVE_MIN_SZ	8192	/* Smaller pkts aren't timed */
+#define BW_DELTA_PERC		25	/* A bandwidth change smaller than
+								   BW_DELTA_PERC% isn't propagated */
+#define BW_QSPN_MIN_INTERVAL	30	/* seconds. A bandwidth change starts a
+								   qspn round at most once in this time
+								   for each level */
+
+/* The smallest of two known bandwidths */
+#define BW_MIN(a, b)		(!(a) || ((b) && (b) < (a)) ? (b) : (a))
+#define BW_SIMILAR(old, new)						\
+	(llabs((long long)(new) - (long long)(old)) * 100 <=		\
+	 BW_DELTA_PERC * (long long)(old))
+
+/* bw_if flags */
+#define BW_IF_INET		1	/* It is the `server_opt.inet_gw_dev' */
+#define BW_IF_FULL_DUPLEX	(1<<1)
+
+struct bw_if {
+	char dev_name[IFNAMSIZ];
+	int dev_idx;
+	u_char flags;
+
+	u_int rx_bytes;				/* The counters of the last dump */
+	u_int tx_bytes;
+	struct timeval stamp;		/* When the last dump was done */
+
+	u_int speed;				/* The speed reported by the kernel */
+	u_int peak;					/* The highest throughput seen */
+	u_int used;					/* Smoothed throughput */
+	u_int capacity;
+	u_int avail;				/* capacity - used */
+	u_int samples;
+};
+
+struct bw_if bw_ifs[MAX_INTERFACES + 1];	/* +1 for the inet_gw_dev */
+int bw_ifs_n;
+pthread_mutex_t bw_mutex;
+struct rtnl_handle bw_rth;
+struct timer_job bw_job;
+
+u_int bw_passive_samples;		/* Stupid statistics */
+
+
+/* * * Functions declaration * * */
+int bw_init(void);
+struct bw_if *bw_if_find(int dev_idx);
+void bw_if_speed(struct bw_if *b);
+void bw_ifs_sync(void);
+void bw_if_update(struct bw_if *b, u_int rx_bytes, u_int tx_bytes,
+				  struct timeval *now);
+int bw_store_link(const struct sockaddr_nl *who, struct nlmsghdr *n,
+				  void *arg);
+int bw_update(void);
+u_int bw_devs_avail(interface ** devs, int dev_n);
+u_int bw_inet_avail(void);
+void bw_passive_sample(int sk, size_t bytes, u_int usecs);
+u_int bw_update_job(void *null);
+
+#endif							/*BW_H */
@@ -0,0 +1,386 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * codec.c
+ *
+ * The codecs used to compress the packets and the adaptive selection of the
+ * codec used for each op.
+ */
+
+#include "includes.h"
+#include <zlib.h>
+
+#include "codec.h"
+#include "hash.h"
+#include "common.h"
+
+struct codec_peer codec_peers[CODEC_PEERS];
+pthread_mutex_t codec_peers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+size_t
+zlib_bound(size_t sz)
+{
+	return compressBound(sz);
+}
+
+int
+zlib_compress_level(u_char * dst, size_t * dst_sz, const u_char * src,
+					size_t src_sz, int level)
+{
+	uLongf len = *dst_sz;
+
+	if (compress2(dst, &len, src, src_sz, level) != Z_OK)
+		return -1;
+	*dst_sz = len;
+	return 0;
+}
+
+int
+zlib_compress(u_char * dst, size_t * dst_sz, const u_char * src,
+			  size_t src_sz)
+{
+	return zlib_compress_level(dst, dst_sz, src, src_sz,
+							   Z_DEFAULT_COMPRESSION);
+}
+
+int
+zlib_fast_compress(u_char * dst, size_t * dst_sz, const u_char * src,
+				   size_t src_sz)
+{
+	return zlib_compress_level(dst, dst_sz, src, src_sz, Z_BEST_SPEED);
+}
+
+int
+zlib_uncompress(u_char * dst, size_t * dst_sz, const u_char * src,
+				size_t src_sz)
+{
+	uLongf len = *dst_sz;
+
+	if (uncompress(dst, &len, src, src_sz) != Z_OK)
+		return -1;
+	*dst_sz = len;
+	return 0;
+}
+
+size_t
+lzf_bound(size_t sz)
+{
+	/* In the worst case, there is one header each LZF_MAX_LIT bytes */
+	return sz + sz / LZF_MAX_LIT + 1;
+}
+
+/*
+ * lzf_compress
+ *
+ * compresses `src' with the LZF codec. If the compressed data doesn't fit
+ * in `*dst_sz' bytes, -1 is returned.
+ */
+int
+lzf_compress(u_char * dst, size_t * dst_sz, const u_char * src,
+			 size_t src_sz)
+{
+	u_int htab[LZF_HSIZE], h, off;
+	const u_char *ip = src, *src_end = src + src_sz, *ref;
+	u_char *op = dst, *dst_end = dst + *dst_sz;
+	size_t len, maxlen;
+	int lit = 0;
+
+	if (!src_sz || !*dst_sz)
+		return -1;
+
+	/* htab[h] is the position+1 of the last sequence with hash `h' */
+	setzero(htab, sizeof(htab));
+
+	/* The header of the first literal run */
+	op++;
+
+	while (ip < src_end) {
+		ref = 0;
+		if (ip + 2 < src_end) {
+			h = LZF_HASH(ip);
+			if (htab[h])
+				ref = src + htab[h] - 1;
+			htab[h] = ip - src + 1;
+		}
+
+		if (ref && (off = ip - ref - 1) < LZF_MAX_OFF &&
+			ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+
+			maxlen = src_end - ip;
+			if (maxlen > LZF_MAX_REF)
+				maxlen = LZF_MAX_REF;
+			for (len = 3; len < maxlen && ref[len] == ip[len]; len++);
+
+			/* Close the literal run, or drop its empty header */
+			if (lit)
+				op[-lit - 1] = lit - 1;
+			else
+				op--;
+
+			/* The reference takes 2 or 3 bytes, the header of the next
+			 * literal run is checked when a literal is written */
+			if (op + (len - 2 < 7 ? 2 : 3) > dst_end)
+				return -1;
+			if (len - 2 < 7)
+				*op++ = ((len - 2) << 5) | (off >> 8);
+			else {
+				*op++ = (7 << 5) | (off >> 8);
+				*op++ = len - 2 - 7;
+			}
+			*op++ = off & 0xff;
+
+			lit = 0;
+			op++;
+			ip += len;
+
+			/* Keep the table fresh with the end of the match */
+			if (ip + 2 < src_end) {
+				htab[LZF_HASH(ip - 2)] = ip - 2 - src + 1;
+				htab[LZF_HASH(ip - 1)] = ip - 1 - src + 1;
+			}
+			continue;
+		}
+
+		if (op >= dst_end)
+			return -1;
+		*op++ = *ip++;
+
+		if (++lit == LZF_MAX_LIT) {
+			op[-lit - 1] = lit - 1;
+			lit = 0;
+			op++;
+		}
+	}
+
+	if (lit)
+		op[-lit - 1] = lit - 1;
+	else
+		op--;
+
+	*dst_sz = op - dst;
+	return 0;
+}
+
+/*
+ * lzf_uncompress
+ *
+ * On error, or if the uncompressed data doesn't fit in `*dst_sz' bytes, -1
+ * is returned.
+ */
+int
+lzf_uncompress(u_char * dst, size_t * dst_sz, const u_char * src,
+			   size_t src_sz)
+{
+	const u_char *ip = src, *src_end = src + src_sz;
+	u_char *op = dst, *dst_end = dst + *dst_sz, *ref;
+	u_int ctrl, len, off;
+
+	while (ip < src_end) {
+		ctrl = *ip++;
+
+		if (ctrl < LZF_MAX_LIT) {
+			/* Literal run */
+			len = ctrl + 1;
+			if (op + len > dst_end || ip + len > src_end)
+				return -1;
+			memcpy(op, ip, len);
+			op += len;
+			ip += len;
+			continue;
+		}
+
+		/* Back reference */
+		len = ctrl >> 5;
+		if (len == 7) {
+			if (ip >= src_end)
+				return -1;
+			len += *ip++;
+		}
+		len += 2;
+
+		if (ip >= src_end)
+			return -1;
+		off = ((ctrl & 0x1f) << 8) + *ip++;
+
+		ref = op - off - 1;
+		if (ref < dst || op + len > dst_end)
+			return -1;
+
+		/* It may overlap `op', copy it byte by byte */
+		while (len--)
+			*op++ = *ref++;
+	}
+
+	*dst_sz = op - dst;
+	return 0;
+}
+
+struct pkt_codec pkt_codecs[PKT_CODECS] = {
+	{"zlib", zlib_bound, zlib_compress, zlib_uncompress},
+	{"zlib-fast", zlib_bound, zlib_fast_compress, zlib_uncompress},
+	{"lzf", lzf_bound, lzf_compress, lzf_uncompress},
+};
+
+/*
+ * codec_cost
+ *
+ * The estimated usecs needed to compress and send 1 KB of data with the
+ * `c' codec.
+ */
+u_int
+codec_cost(struct codec_stat *c)
+{
+	return c->us_kb + c->ratio * PKT_CODEC_LINK_US_KB / 1000;
+}
+
+/*
+ * codec_select
+ *
+ * returns the codec to use to compress the next packet of the `op' op. Only
+ * the codecs of the `codecs' PKT_CODEC_BIT() bitmask, which the receiver can
+ * uncompress, and PKT_CODEC_ZLIB are considered.
+ */
+int
+codec_select(u_char op, u_int codecs)
+{
+	struct codec_op_stat *st = &codec_op_stats[op];
+	u_int pkts = st->pkts, cur = st->cur;
+	int i, c;
+
+	codecs |= PKT_CODEC_BIT(PKT_CODEC_ZLIB);
+
+	/* Try each codec at least once */
+	for (i = 0; i < PKT_CODECS; i++)
+		if (codecs & PKT_CODEC_BIT(i) && !st->codec[i].samples)
+			return i;
+
+	if (!(codecs & PKT_CODEC_BIT(cur))) {
+		/* The receiver doesn't know the best codec, take the best of
+		 * the ones it knows */
+		cur = PKT_CODEC_ZLIB;
+		for (i = 0; i < PKT_CODECS; i++)
+			if (codecs & PKT_CODEC_BIT(i) &&
+				codec_cost(&st->codec[i]) < codec_cost(&st->codec[cur]))
+				cur = i;
+	}
+
+	if (pkts % PKT_CODEC_PROBE == PKT_CODEC_PROBE - 1)
+		/* Probe one of the other codecs */
+		for (i = 0; i < PKT_CODECS - 1; i++) {
+			c = (cur + 1 + (pkts / PKT_CODEC_PROBE + i) %
+				 (PKT_CODECS - 1)) % PKT_CODECS;
+			if (codecs & PKT_CODEC_BIT(c))
+				return c;
+		}
+
+	return cur;
+}
+
+/*
+ * codec_avg
+ *
+ * adds `val' to the `*avg' moving average, or sets it if `first' is
+ * non zero. Other threads may update it at the same time.
+ */
+void
+codec_avg(u_int * avg, u_int val, int first)
+{
+	u_int old, new;
+
+	do {
+		old = *avg;
+		new = first ? val : (old * 7 + val) / 8;
+	} while (!__sync_bool_compare_and_swap(avg, old, new));
+}
+
+/*
+ * codec_update
+ *
+ * updates the statistics of the `codec' codec for the `op' op, after it
+ * compressed `in_sz' bytes in `out_sz' bytes in `us' usecs. If the
+ * compression wasn't useful, `out_sz' is equal to `in_sz'.
+ */
+void
+codec_update(u_char op, int codec, size_t in_sz, size_t out_sz, u_int us)
+{
+	struct codec_op_stat *st = &codec_op_stats[op];
+	struct codec_stat *c = &st->codec[codec];
+	u_int ratio, us_kb, cur;
+	int i, first;
+
+	if (!in_sz)
+		return;
+
+	ratio = out_sz * 1000 / in_sz;
+	us_kb = (u_long) us *1024 / in_sz;
+
+	first = !c->samples;
+	codec_avg(&c->ratio, ratio, first);
+	codec_avg(&c->us_kb, us_kb, first);
+	__sync_fetch_and_add(&c->samples, 1);
+
+	__sync_fetch_and_add(&st->pkts, 1);
+	__sync_fetch_and_add(&st->in_bytes, in_sz);
+	__sync_fetch_and_add(&st->out_bytes, out_sz);
+
+	cur = st->cur;
+	for (i = 0; i < PKT_CODECS; i++)
+		if (st->codec[i].samples &&
+			codec_cost(&st->codec[i]) < codec_cost(&st->codec[cur]))
+			cur = i;
+	__sync_lock_test_and_set(&st->cur, cur);
+}
+
+/*
+ * codec_peer_set
+ *
+ * saves the `codecs' bitmask advertised by `ip'.
+ */
+void
+codec_peer_set(inet_prefix * ip, u_char codecs)
+{
+	struct codec_peer *p = &codec_peers[CODEC_PEER_HASH(ip)];
+
+	pthread_mutex_lock(&codec_peers_mutex);
+	inet_copy(&p->ip, ip);
+	p->codecs = codecs & PKT_CODECS_ALL;
+	p->seen = time(0);
+	pthread_mutex_unlock(&codec_peers_mutex);
+}
+
+/*
+ * codec_peer_get
+ *
+ * returns the bitmask of the codecs advertised by `ip'. It is 0 if `ip' is
+ * unknown or is an older ntkd, which can uncompress only PKT_CODEC_ZLIB.
+ */
+u_char
+codec_peer_get(inet_prefix * ip)
+{
+	struct codec_peer *p = &codec_peers[CODEC_PEER_HASH(ip)];
+	u_char codecs = 0;
+
+	pthread_mutex_lock(&codec_peers_mutex);
+	if (p->seen && !memcmp(p->ip.data, ip->data, MAX_IP_SZ) &&
+		p->ip.family == ip->family &&
+		time(0) - p->seen < CODEC_PEER_TIMEOUT)
+		codecs |= p->codecs;
+	pthread_mutex_unlock(&codec_peers_mutex);
+
+	return codecs;
+}
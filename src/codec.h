@@ -0,0 +1,140 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "request.h"
+#include "inet.h"
+
+/*
+ * The codecs used to compress the body of the packets. The id of the codec
+ * used is written in the high byte of pkt_hdr.uncompress_sz (see
+ * PKT_HDR_CODEC). An older ntkd knows only zlib and drops the packets of the
+ * other codecs as invalid, because their uncompress_sz is bigger than
+ * PKT_MAX_MSG_SZ, thus a node uses them only with the peers which
+ * advertised them in their ECHO_REPLY (see codec_peer_set()).
+ */
+#define PKT_CODEC_ZLIB		0	/* zlib, default level */
+#define PKT_CODEC_ZLIB_FAST	1	/* zlib, level 1 */
+#define PKT_CODEC_LZF		2	/* Fast LZ77, see lzf_compress() */
+#define PKT_CODECS		3
+
+#define PKT_CODEC_BIT(codec)	(1<<(codec))
+#define PKT_CODECS_ALL		(PKT_CODEC_BIT(PKT_CODECS)-1)
+
+struct pkt_codec {
+	char *name;
+
+	/* The maximum size of the compressed `sz' bytes */
+	size_t(*bound) (size_t sz);
+
+	/* They both return 0 on success, and store in `dst_sz' the size of
+	 * the data written in `dst', which is `*dst_sz' bytes big */
+	int (*compress) (u_char * dst, size_t * dst_sz, const u_char * src,
+					 size_t src_sz);
+	int (*uncompress) (u_char * dst, size_t * dst_sz, const u_char * src,
+					   size_t src_sz);
+};
+extern struct pkt_codec pkt_codecs[PKT_CODECS];
+
+/*
+ * lzf
+ *
+ * The LZF codec: a literal run is a byte `ctrl'<32 followed by ctrl+1
+ * bytes, a back reference is a byte `ctrl'>=32 where ctrl>>5 is the
+ * length-2 (if it is 7, the next byte is added to it) and ctrl&0x1f the
+ * high bits of the offset-1, the next byte is its low byte.
+ */
+#define LZF_HLOG		13
+#define LZF_HSIZE		(1<<LZF_HLOG)
+#define LZF_MAX_LIT		(1<<5)
+#define LZF_MAX_OFF		(1<<13)
+#define LZF_MAX_REF		((1<<8) + (1<<3))
+#define LZF_HASH(p)							\
+	(((((u_int)(p)[0] << 16) | ((p)[1] << 8) | (p)[2]) * 2654435761U)	\
+	 >> (32 - LZF_HLOG))
+
+/*
+ * The codec used for each op is chosen by looking at how the codecs
+ * performed with the last packets of the same op: the codec which minimizes
+ * the cpu time plus the time needed to send the compressed data is used.
+ * Every PKT_CODEC_PROBE packets a different codec is tried, to keep its
+ * statistics fresh.
+ */
+#define PKT_CODEC_PROBE		16
+#define PKT_CODEC_LINK_US_KB	1000	/* usec to send 1 KB */
+
+/*
+ * The statistics are updated by all the threads sending packets, so their
+ * fields are changed only with the __sync builtins.
+ */
+struct codec_stat {
+	u_int samples;
+	u_int ratio;				/* compressed/original size, in
+								   per mille */
+	u_int us_kb;				/* usec spent to compress 1 KB */
+};
+
+struct codec_op_stat {
+	u_int pkts;					/* Compressed packets */
+	u_int cur;					/* Current codec */
+	u_long in_bytes;
+	u_long out_bytes;
+
+	struct codec_stat codec[PKT_CODECS];
+} codec_op_stats[TOTAL_OPS];
+
+
+/*
+ * codec_peers
+ *
+ * The bitmask of the codecs each peer can uncompress, as advertised by its
+ * last ECHO_REPLY. The table is indexed by the hash of the peer ip: a peer
+ * which isn't in it, because its slot was taken by another one or because
+ * it didn't reply for CODEC_PEER_TIMEOUT seconds, gets only PKT_CODEC_ZLIB.
+ */
+#define CODEC_PEERS		256	/* It must be a power of 2 */
+#define CODEC_PEER_TIMEOUT	600
+#define CODEC_PEER_HASH(ip)	(fnv_32_buf((ip)->data, MAX_IP_SZ,		\
+					    FNV1_32_INIT) & (CODEC_PEERS-1))
+
+struct codec_peer {
+	inet_prefix ip;
+	u_char codecs;
+	time_t seen;
+};
+
+
+/* * * Functions declaration * * */
+size_t lzf_bound(size_t sz);
+int lzf_compress(u_char * dst, size_t * dst_sz, const u_char * src,
+				 size_t src_sz);
+int lzf_uncompress(u_char * dst, size_t * dst_sz, const u_char * src,
+				   size_t src_sz);
+
+void codec_avg(u_int * avg, u_int val, int first);
+int codec_select(u_char op, u_int codecs);
+void codec_update(u_char op, int codec, size_t in_sz, size_t out_sz,
+				  u_int us);
+
+
+void codec_peer_set(inet_prefix * ip, u_char codecs);
+u_char codec_peer_get(inet_prefix * ip);
+
+#endif							/*CODEC_H */
@@ -45,6 +45,7 @@ enum config_options {
 	CONF_NTK_INT_MAP_FILE,
 	CONF_NTK_BNODE_MAP_FILE,
 	CONF_NTK_EXT_MAP_FILE,
+	CONF_NTK_SNAPSHOT_FILE,
 
 	CONF_ANDNA_HNAMES_FILE,
 	CONF_SNSD_NODES_FILE,
@@ -61,6 +62,7 @@ enum config_options {
 
 	CONF_DISABLE_ANDNA,
 	CONF_DISABLE_RESOLVCONF,
+	CONF_NTK_WARM_RESTART,
 
 	CONF_NTK_RESTRICTED_MODE,
 	CONF_NTK_RESTRICTED_CLASS,
@@ -80,6 +82,7 @@ const static char config_str[][30] = {
 	{"ntk_int_map_file"},
 	{"ntk_bnode_map_file"},
 	{"ntk_ext_map_file"},
+	{"ntk_snapshot_file"},
 
 	{"andna_hnames_file"},
 	{"snsd_nodes_file"},
@@ -96,6 +99,7 @@ const static char config_str[][30] = {
 
 	{"disable_andna"},
 	{"disable_resolvconf"},
+	{"ntk_warm_restart"},
 	{"ntk_restricted_mode"},
 	{"ntk_restricted_class"},
 	{"internet_connection"},
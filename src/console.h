@@ -46,6 +46,21 @@ typedef enum {
 	COMMAND_IFSCT,
 	COMMAND_QUIT,
 	COMMAND_CONSUPTIME,
+	COMMAND_HOOKSTATS,
+	COMMAND_RNODERTT,
+	COMMAND_RADARSTATS,
+	COMMAND_ROUTESYNC,
+	COMMAND_CODECSTATS,
+	COMMAND_ADMISSION,
+	COMMAND_FLOODSTATS,
+	COMMAND_TIMERSTATS,
+	COMMAND_BWSTATS,
+	COMMAND_QSPNSTATS,
+	COMMAND_GWCACHESTATS,
+	COMMAND_LANESTATS,
+	COMMAND_KRNLSTATS,
+	COMMAND_MARKSTATS,
+	COMMAND_SNAPSTATS,
 } command_t;
 
 
@@ -227,6 +227,12 @@ udp_daemon(void *passed_argv)
 		fatal("Creation of the %s daemon aborted. "
 			  "Is there another ntkd running?", "udp");
 
+	/* Let the kernel timestamp the received pkts, the radar uses them to
+	 * measure the rtts */
+	for (i = 0; i < me.cur_ifs_n; i++)
+		if (dev_sk[i])
+			set_timestamp_sk(dev_sk[i]);
+
 	debug(DBG_NORMAL, "Udp daemon on port %d up & running", udp_port);
 	pthread_mutex_unlock(&udp_daemon_lock);
 
@@ -272,6 +278,7 @@ udp_daemon(void *passed_argv)
 			pkt_addsk(&rpkt, my_family, dev_sk[i], SKT_UDP);
 			pkt_add_dev(&rpkt, ifs, 0);
 			rpkt.flags = MSG_WAITALL;
+			rpkt.pkt_flags |= PKT_ADMIT;
 			pkt_addport(&rpkt, udp_port);
 
 			if (pkt_recv(&rpkt) < 0) {
@@ -430,6 +437,7 @@ tcp_daemon(void *door)
 			pkt_addsk(&rpkt, my_family, fd, SKT_TCP);
 			pkt_add_dev(&rpkt, ifs, 0);
 			rpkt.flags = MSG_WAITALL;
+			rpkt.pkt_flags |= PKT_ADMIT;
 			pkt_addport(&rpkt, tcp_port);
 
 			ntop = 0;
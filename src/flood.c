@@ -0,0 +1,86 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * flood.c
+ *
+ * The duplicate suppression of the flooded pkts.
+ */
+
+#include "includes.h"
+
+#include "hash.h"
+#include "flood.h"
+#include "common.h"
+
+void
+flood_dedup_init(void)
+{
+	setzero(flood_dedup, sizeof(flood_dedup));
+	setzero(flood_dedup_checks, sizeof(flood_dedup_checks));
+	setzero(flood_dedup_dups, sizeof(flood_dedup_dups));
+	pthread_mutex_init(&flood_dedup_mutex, 0);
+}
+
+/*
+ * flood_seen
+ *
+ * If the flood identified by `op', `id' and the `origin_sz' bytes of
+ * `origin' has already been seen in the last FLOOD_DEDUP_TTL seconds, 1 is
+ * returned. Otherwise it is remembered and 0 is returned.
+ * `origin' can be 0 if `id' alone identifies the flood.
+ */
+int
+flood_seen(u_char op, int id, void *origin, size_t origin_sz)
+{
+	struct flood_dedup_slot *bucket, *slot = 0;
+	u_int key;
+	time_t cur_t;
+	int i, ret = 0;
+
+	key = fnv_32_buf(&op, sizeof(u_char), FNV1_32_INIT);
+	key = fnv_32_buf(&id, sizeof(int), key);
+	if (origin)
+		key = fnv_32_buf(origin, origin_sz, key);
+	key |= 1;
+
+	bucket = flood_dedup[inthash(key) & (FLOOD_DEDUP_BUCKETS - 1)];
+	cur_t = time(0);
+
+	pthread_mutex_lock(&flood_dedup_mutex);
+	flood_dedup_checks[op]++;
+
+	for (i = 0; i < FLOOD_DEDUP_WAYS; i++) {
+		if (bucket[i].key == key &&
+			cur_t - bucket[i].stamp < FLOOD_DEDUP_TTL) {
+			flood_dedup_dups[op]++;
+			ret = 1;
+			goto finish;
+		}
+
+		/* Overwrite the oldest slot, the free ones have a zero stamp */
+		if (!slot || bucket[i].stamp < slot->stamp)
+			slot = &bucket[i];
+	}
+
+	slot->key = key;
+	slot->stamp = cur_t;
+
+  finish:
+	pthread_mutex_unlock(&flood_dedup_mutex);
+	return ret;
+}
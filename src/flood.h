@@ -0,0 +1,55 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef FLOOD_H
+#define FLOOD_H
+
+#include "request.h"
+
+/*
+ * Flood duplicate suppression
+ *
+ * A flooded pkt reaches us through all the paths of the mesh, but only its
+ * first copy has to be processed. Each flood is identified by its
+ * (origin, op, id), which is hashed in a 32bit key and remembered for
+ * FLOOD_DEDUP_TTL seconds in the flood_dedup table.
+ * The table has a fixed size: each key can stay in one of the
+ * FLOOD_DEDUP_WAYS slots of its bucket, and when they are all taken the
+ * oldest one is overwritten.
+ */
+#define FLOOD_DEDUP_BUCKETS	256
+#define FLOOD_DEDUP_WAYS	4
+#define FLOOD_DEDUP_TTL		60	/* seconds */
+
+struct flood_dedup_slot {
+	u_int key;					/* 0 if the slot is free */
+	time_t stamp;				/* When the key was added */
+};
+struct flood_dedup_slot flood_dedup[FLOOD_DEDUP_BUCKETS][FLOOD_DEDUP_WAYS];
+pthread_mutex_t flood_dedup_mutex;
+
+/* Per op statistics */
+u_int flood_dedup_checks[TOTAL_OPS];
+u_int flood_dedup_dups[TOTAL_OPS];
+
+
+/* * * Functions declaration * * */
+void flood_dedup_init(void);
+int flood_seen(u_char op, int id, void *origin, size_t origin_sz);
+
+#endif							/*FLOOD_H */
@@ -311,6 +311,7 @@ gnode_inc_seeds(quadro_group * qg, int level)
 		qg->gnode[_EL(level + 1)]->flags |= GMAP_FULL;
 	else
 		qg->gnode[_EL(level + 1)]->seeds++;
+	map_gen_bump(level + 1);
 }
 
 /*
@@ -327,6 +328,7 @@ gnode_dec_seeds(quadro_group * qg, int level)
 	if (qg->gnode[_EL(level + 1)]->seeds - 1 >= 0)
 		qg->gnode[_EL(level + 1)]->seeds--;
 	qg->gnode[_EL(level + 1)]->flags &= ~GMAP_FULL;
+	map_gen_bump(level + 1);
 }
 
 /*
@@ -950,6 +952,92 @@ erc_find_gnode(ext_rnode_cache * erc, map_gnode * gnode, u_char level)
 	return 0;
 }
 
+/*
+ * map_gen_bump
+ *
+ * records that the maps of `level' have been modified. A `level' of 0
+ * invalidates what has been read from the maps of all the levels.
+ */
+void
+map_gen_bump(int level)
+{
+	if (level < 0 || level >= MAX_LEVELS)
+		level = 0;
+	__sync_fetch_and_add(&map_gen[level], 1);
+}
+
+/*
+ * map_gen_sum
+ *
+ * returns the sum of the generations of the levels from 0 to `level'.
+ */
+u_int
+map_gen_sum(int level)
+{
+	u_int sum = 0;
+	int i;
+
+	for (i = 0; i <= level && i < MAX_LEVELS; i++)
+		sum += *(volatile u_int *) &map_gen[i];
+	return sum;
+}
+
+void
+gnode_live_init(void)
+{
+	setzero(gnode_live, sizeof(gnode_live));
+	setzero(gnode_live_built, sizeof(gnode_live_built));
+	pthread_mutex_init(&gnode_live_mutex, 0);
+}
+
+/*
+ * gnode_live_build
+ *
+ * fills gnode_live[`level'] with the (g)nodes which are up in the map of
+ * `level'. gnode_live_mutex must be locked.
+ */
+void
+gnode_live_build(int level, map_node * int_map, map_gnode ** ext_map)
+{
+	map_gnode *gmap;
+	int i;
+
+	setzero(gnode_live[level], sizeof(gnode_live[level]));
+	if (!level) {
+		for (i = 0; i < MAXGROUPNODE; i++)
+			if (!(int_map[i].flags & MAP_VOID))
+				SET_BITW(gnode_live[level], i);
+	} else {
+		gmap = ext_map[_EL(level)];
+		for (i = 0; i < MAXGROUPNODE; i++)
+			if (!(gmap[i].g.flags & MAP_VOID) &&
+				!(gmap[i].flags & GMAP_VOID))
+				SET_BITW(gnode_live[level], i);
+	}
+}
+
+/*
+ * gnode_live_get
+ *
+ * copies in `live', which has GNODE_LIVE_WORDS members, the gnode_live
+ * bitmap of `level', rebuilding it if the maps changed since the last time.
+ * `gen' is the map_gen_sum(`level') of `int_map' and `ext_map', which can
+ * be the maps of a map_snapshot.
+ */
+void
+gnode_live_get(int level, map_node * int_map, map_gnode ** ext_map,
+			   u_int gen, u_int * live)
+{
+	pthread_mutex_lock(&gnode_live_mutex);
+	if (!gnode_live_built[level] || gnode_live_gen[level] != gen) {
+		gnode_live_build(level, int_map, ext_map);
+		gnode_live_gen[level] = gen;
+		gnode_live_built[level] = 1;
+	}
+	memcpy(live, gnode_live[level], sizeof(gnode_live[level]));
+	pthread_mutex_unlock(&gnode_live_mutex);
+}
+
 /*
  * * * External map functions * * *
  */
@@ -1099,7 +1187,7 @@ merge_lvl_ext_maps(map_gnode * base, map_gnode * new,
 {
 	map_gnode *gnode_gw, *new_root_in_base;
 	int base_root_pos, ngpos;
-	u_int base_trtt, new_trtt;
+	u_int base_cost, new_cost;
 	int i, e, x;
 
 	new_root_in_base = &base[new_root.gid[level]];
@@ -1133,15 +1221,15 @@ merge_lvl_ext_maps(map_gnode * base, map_gnode * new,
 				continue;
 			}
 
-			base_trtt = get_route_trtt(&base[i].g, base[i].g.links - 1);
-			new_trtt = get_route_trtt(&new[i].g, e);
-			if (base_trtt < new_trtt)
+			base_cost = get_route_cost(&base[i].g, base[i].g.links - 1);
+			new_cost = get_route_cost(&new[i].g, e);
+			if (base_cost < new_cost)
 				continue;
 
 			for (x = 0; x < base[i].g.links; x++) {
-				base_trtt = get_route_trtt(&base[i].g, x);
-				new_trtt = get_route_trtt(&new[i].g, e);
-				if (base_trtt > new_trtt) {
+				base_cost = get_route_cost(&base[i].g, x);
+				new_cost = get_route_cost(&new[i].g, e);
+				if (base_cost > new_cost) {
 					map_rnode_insert(&base[i].g, x, &new[i].g.r_node[e]);
 					base[i].g.flags |= MAP_UPDATE;
 					break;
@@ -1220,15 +1308,24 @@ gmap_get_rblock(map_gnode * map, int maxgroupnode, int *count)
 }
 
 /* gmap_store_rblock: Given a correct ext_map with `maxgroupnode' elements it
- * restores all the r_node structs in the map from the rnode_block using
- * store_rnode_block.*/
+ * restores all the r_node structs in the map from the `rblock_sz' bytes
+ * rnode_block using store_rnode_block. If the size of the block doesn't
+ * match the rnodes of the map, -1 is returned. */
 int
-gmap_store_rblock(map_gnode * gmap, int maxgroupnode, map_rnode * rblock)
+gmap_store_rblock(map_gnode * gmap, int maxgroupnode, map_rnode * rblock,
+				  size_t rblock_sz)
 {
-	int i, c = 0;
+	int i, c = 0, links = 0;
+	size_t rnode_sz;
 
 	for (i = 0; i < maxgroupnode; i++)
-		c += store_rnode_block((int *) gmap, &gmap[i].g, rblock, c);
+		links += gmap[i].g.links;
+	if (!(rnode_sz = rnode_pack_sz(links, rblock_sz)))
+		return -1;
+
+	for (i = 0; i < maxgroupnode; i++)
+		c += store_rnode_block((int *) gmap, &gmap[i].g, rblock, c,
+							   rnode_sz);
 	return c;
 }
 
@@ -1270,6 +1367,7 @@ extmap_get_rblock(map_gnode ** ext_map, u_char levels, int maxgroupnodes,
  * The maps have `maxgroupnode' nodes, while the `ext_map' has `levels' levels.
  * The rnodes are taken from the `rblock'.
  * The number of map restored is returned and it shall be equal to the number of `levels'.
+ * If a rblock can't be restored, -1 is returned.
  */
 int
 extmap_store_rblock(map_gnode ** ext_map, u_char levels, int maxgroupnode,
@@ -1277,8 +1375,10 @@ extmap_store_rblock(map_gnode ** ext_map, u_char levels, int maxgroupnode,
 {
 	int i;
 	for (i = 0; i < levels; i++) {
-		if (rblock_sz[i])
-			gmap_store_rblock(ext_map[i], maxgroupnode, rblock);
+		if (rblock_sz[i] &&
+			gmap_store_rblock(ext_map[i], maxgroupnode, rblock,
+							  rblock_sz[i]) < 0)
+			return -1;
 		rblock = (map_rnode *) ((char *) rblock + rblock_sz[i]);
 	}
 	return i;
@@ -21,6 +21,7 @@
 
 #include "includes.h"
 #include "llist.c"
+#include "misc.h"
 #include "map.h"
 
 /* * * Groupnode stuff * * */
@@ -207,6 +208,28 @@ struct ext_rnode_cache {
 };
 typedef struct ext_rnode_cache ext_rnode_cache;
 
+/*
+ * map_gen[level] is incremented each time the map of `level', or the
+ * bnode_map of `level', is modified. A change of the level 0 includes the
+ * ones of the root_node, of its ext_rnodes and of the whole maps (hooks).
+ * Since what is read from the maps at `level' depends only on the maps of
+ * the levels <= `level', map_gen_sum(level) changes whenever the
+ * information of `level' can have changed.
+ */
+u_int map_gen[MAX_LEVELS];
+
+/*
+ * gnode_live[level] has the bit `gid' set if the (g)node `gid' of the map of
+ * `level' is up (not MAP_VOID nor GMAP_VOID). The level 0 is the int_map.
+ * It describes me.int_map and me.ext_map, or the copies of a map_snapshot,
+ * and a level is rebuilt by gnode_live_get() when its map_gen_sum() changes.
+ */
+#define GNODE_LIVE_WORDS	BITS_WORDS(MAXGROUPNODE)
+u_int gnode_live[MAX_LEVELS][GNODE_LIVE_WORDS];
+u_int gnode_live_gen[MAX_LEVELS];
+u_char gnode_live_built[MAX_LEVELS];
+pthread_mutex_t gnode_live_mutex;
+
 /* * * Functions' declaration * * */
 int get_groups(int family, int lvl);
 int is_group_invalid(int *gids, int gid, int lvl, int family);
@@ -258,6 +281,12 @@ void erc_update_rnodepos(ext_rnode_cache * erc, map_node * root_node,
 						 int old_rnode_pos);
 void erc_reorder_rnodepos(ext_rnode_cache ** erc, u_int * erc_counter,
 						  map_node * root_node);
+void map_gen_bump(int level);
+u_int map_gen_sum(int level);
+void gnode_live_init(void);
+void gnode_live_build(int level, map_node * int_map, map_gnode ** ext_map);
+void gnode_live_get(int level, map_node * int_map, map_gnode ** ext_map,
+					u_int gen, u_int * live);
 ext_rnode_cache *erc_find_gnode(ext_rnode_cache * erc, map_gnode * gnode,
 								u_char level);
 
@@ -41,13 +41,15 @@
 #include "hook.h"
 #include "rehook.h"
 #include "radar.h"
+#include "mapowner.h"
+#include "snapshot.h"
 #include "netsukuku.h"
 #include "common.h"
 
-int free_the_tmp_cur_node;
 int we_are_rehooking;			/* 1 if it is true */
 
-void hook_reset(void);
+struct timeval hook_start_t;	/* When the current hook started */
+struct timeval hook_phase_t;	/* When the last hook phase ended */
 
 /*
  * hook_fill_rq
@@ -475,8 +477,10 @@ put_ext_map(PACKET rq_pkt)
 	pkt_addsk(&pkt, my_family, rq_pkt.sk, rq_pkt.sk_type);
 	pkt_addcompress(&pkt);
 
-	pkt.msg =
-		pack_extmap(me.ext_map, MAXGROUPNODE, &me.cur_quadg, &pkt_sz);
+	pkt.msg = map_snapshot_pack(MAP_SNAP_EXT_MAP, &pkt_sz);
+	if (!pkt.msg)
+		pkt.msg =
+			pack_extmap(me.ext_map, MAXGROUPNODE, &me.cur_quadg, &pkt_sz);
 	pkt.hdr.sz = pkt_sz;
 	debug(DBG_INSANE, "Reply %s to %s", re_to_str(PUT_EXT_MAP), ntop);
 	err = send_rq(&pkt, 0, PUT_EXT_MAP, rq_pkt.hdr.id, 0, 0, 0);
@@ -549,7 +553,9 @@ put_int_map(PACKET rq_pkt)
 	pkt_add_dev(&pkt, rq_pkt.dev, 1);
 	pkt_addcompress(&pkt);
 
-	pkt.msg = pack_map(map, 0, MAXGROUPNODE, me.cur_node, &pkt_sz);
+	pkt.msg = map_snapshot_pack(MAP_SNAP_INT_MAP, &pkt_sz);
+	if (!pkt.msg)
+		pkt.msg = pack_map(map, 0, MAXGROUPNODE, me.cur_node, &pkt_sz);
 	pkt.hdr.sz = pkt_sz;
 	debug(DBG_INSANE, "Reply %s to %s", re_to_str(PUT_INT_MAP), ntop);
 	err = send_rq(&pkt, 0, PUT_INT_MAP, rq_pkt.hdr.id, 0, 0, 0);
@@ -623,9 +629,11 @@ put_bnode_map(PACKET rq_pkt)
 	pkt_add_dev(&pkt, rq_pkt.dev, 1);
 	pkt_addcompress(&pkt);
 
-	pkt.msg =
-		pack_all_bmaps(bmaps, me.bmap_nodes, me.ext_map, me.cur_quadg,
-					   &pack_sz);
+	pkt.msg = map_snapshot_pack(MAP_SNAP_BNODE_MAP, &pack_sz);
+	if (!pkt.msg)
+		pkt.msg =
+			pack_all_bmaps(bmaps, me.bmap_nodes, me.ext_map, me.cur_quadg,
+						   &pack_sz);
 	pkt.hdr.sz = pack_sz;
 
 	debug(DBG_INSANE, "Reply %s to %s", re_to_str(PUT_BNODE_MAP), ntop);
@@ -865,6 +873,22 @@ create_gnodes(inet_prefix * ip, int final_level)
 	return 0;
 }
 
+/*
+ * create_new_qgroup_run
+ *
+ * the create_gnodes() of create_new_qgroup(), called by the map owner.
+ * `level' points to the hook_level.
+ */
+int
+create_new_qgroup_run(void *level)
+{
+	int hook_level = *(int *) level;
+
+	if (we_are_rehooking)
+		return create_gnodes(&rk_gnode_ip, hook_level + 1);
+	return create_gnodes(0, FAMILY_LVLS);
+}
+
 /*
  * create_new_qgroup
  * 
@@ -876,10 +900,7 @@ create_new_qgroup(int hook_level)
 {
 	const char *ntop;
 
-	if (we_are_rehooking)
-		create_gnodes(&rk_gnode_ip, hook_level + 1);
-	else
-		create_gnodes(0, FAMILY_LVLS);
+	map_owner_run(create_new_qgroup_run, &hook_level);
 	ntop = inet_to_str(me.cur_ip);
 
 	hook_set_all_ips(me.cur_ip, me.cur_ifs, me.cur_ifs_n);
@@ -1003,7 +1024,11 @@ hook_init(void)
 	we_are_rehooking = 0;
 	free_the_tmp_cur_node = 0;
 
-	hook_reset();
+	/* A warm restart keeps the ips we already have */
+	if (snap_warm)
+		hook_reset_state();
+	else
+		hook_reset();
 
 	debug(DBG_NORMAL, "Activating ip_forward and disabling rp_filter");
 	route_ip_forward(my_family, 1);
@@ -1017,14 +1042,14 @@ hook_init(void)
 }
 
 /*
- * hook_reset: resets all the variables needed to hook. This function is
- * called at the beginning of netsukuku_hook().
+ * hook_reset_state
+ *
+ * resets the variables needed to hook, without touching the ips of the
+ * interfaces.
  */
 void
-hook_reset(void)
+hook_reset_state(void)
 {
-	u_int idata[MAX_IP_INT];
-
 	/* We use a fake root_node for a while */
 	if (free_the_tmp_cur_node)
 		xfree(me.cur_node);
@@ -1042,6 +1067,20 @@ hook_reset(void)
 	op_filter_reset_re(OP_FILTER_ALLOW);
 	op_filter_clr(ECHO_ME);
 	op_filter_clr(ECHO_REPLY);
+}
+
+/*
+ * hook_reset_ip
+ *
+ * the part of hook_reset() which changes our ip and the maps, called by the
+ * map owner.
+ */
+void
+hook_reset_ip(void)
+{
+	u_int idata[MAX_IP_INT];
+
+	hook_reset_state();
 
 	/*
 	 * We set the dev ip to HOOKING_IP+random_number to begin our 
@@ -1063,11 +1102,36 @@ hook_reset(void)
 	inet_setip_raw(&me.cur_ip, idata, my_family);
 	iptoquadg(me.cur_ip, me.ext_map, &me.cur_quadg,
 			  QUADG_GID | QUADG_GNODE | QUADG_IPSTART);
+}
 
+/*
+ * hook_reset: resets all the variables needed to hook. This function is
+ * called at the beginning of netsukuku_hook().
+ */
+void
+hook_reset(void)
+{
+	map_owner_call(hook_reset_ip);
 	hook_set_all_ips(me.cur_ip, me.cur_ifs, me.cur_ifs_n);
 }
 
 
+/*
+ * hook_rescan_reset
+ *
+ * forgets the rnodes found by the last radar scan of the hook, before
+ * retrying it. It is called by the map owner.
+ */
+void
+hook_rescan_reset(void)
+{
+	reset_radar();
+	rnode_destroy(me.cur_node);
+	setzero(me.cur_node, sizeof(map_node));
+	me.cur_node->flags |= MAP_HNODE;
+	qspn_b_del_all_dead_rnodes();
+}
+
 /*
  * hook_first_radar_scan: launches the first scan to know what rnodes we have
  * around us.
@@ -1119,8 +1183,6 @@ hook_first_radar_scan(map_gnode * hook_gnode, int hook_level,
 	 */
 
 	for (i = 0; i < MAX_FIRST_RADAR_SCANS; i++) {
-		me.cur_node->flags |= MAP_HNODE;
-
 		loginfo("Launching radar_scan %d of %d", i + 1,
 				MAX_FIRST_RADAR_SCANS);
 
@@ -1173,11 +1235,7 @@ hook_first_radar_scan(map_gnode * hook_gnode, int hook_level,
 			break;
 
 	  hook_retry_scan:
-		reset_radar();
-		rnode_destroy(me.cur_node);
-		setzero(me.cur_node, sizeof(map_node));
-		me.cur_node->flags |= MAP_HNODE;
-		qspn_b_del_all_dead_rnodes();
+		map_owner_call(hook_rescan_reset);
 	}
 	if (me.cur_node->links < 1) {
 		loginfo("We have %d nodes around us. (%d are hooking)",
@@ -1190,18 +1248,35 @@ hook_first_radar_scan(map_gnode * hook_gnode, int hook_level,
 }
 
 
+/*
+ * hook_qspn_round_run
+ *
+ * replaces our qspn round info with the one received in the hook_state
+ * `argv'. It is called by the map owner.
+ */
+int
+hook_qspn_round_run(void *argv)
+{
+	struct hook_state *hs = (struct hook_state *) argv;
+	int levels = me.cur_quadg.levels;
+
+	qspn_backup_gcount(qspn_old_gcount, (int *) qspn_gnode_count);
+	memcpy(me.cur_qspn_time, hs->qtime, sizeof(struct timeval) * levels);
+	memcpy(me.cur_qspn_id, hs->qspn_id, sizeof(int) * levels);
+	memcpy(qspn_gnode_count, hs->gcount, sizeof(qspn_gnode_count));
+
+	return 0;
+}
+
 /*
  * hook_get_free_nodes
  * 
  * gets the free_nodes list and the qson_round info from our nearest rnode.
- * In `fn_hdr', `fnodes', `gnode_ipstart' and `new_gcount' there will be stored the relative
- * value.
+ * They are stored in the `hs' hook_state.
  * If a new gnode has to be created 1 is returned.
  */
 int
-hook_get_free_nodes(int hook_level, struct free_nodes_hdr *fn_hdr,
-					u_char * fnodes, inet_prefix * gnode_ipstart,
-					u_int * new_gcount, struct rnode_list **ret_rnl)
+hook_get_free_nodes(struct hook_state *hs, struct rnode_list **ret_rnl)
 {
 	struct radar_queue *rq = 0;
 	struct rnode_list *rnl = rlist;
@@ -1215,19 +1290,20 @@ hook_get_free_nodes(int hook_level, struct free_nodes_hdr *fn_hdr,
 		if (rnl->node->flags & MAP_HNODE)
 			continue;
 
-		err = get_free_nodes(rnl->node, fn_hdr, fnodes);
+		err = get_free_nodes(rnl->node, &hs->fn_hdr, hs->fnodes);
 		if (err == -2)
 			fatal("Netsukuku is full! Bring down some nodes and retry");
 		else if (err == -1)
 			continue;
 
 		/* Extract the ipstart of the gnode */
-		inet_setip(gnode_ipstart, (u_int *) fn_hdr->ipstart, my_family);
+		inet_setip(&hs->gnode_ipstart, (u_int *) hs->fn_hdr.ipstart,
+				   my_family);
 
 		/* Get the qspn round info */
 		rq = find_node_radar_q(rnl->node);
-		if (!get_qspn_round(rnl->node, rq->final_rtt, me.cur_qspn_time,
-							me.cur_qspn_id, (int *) new_gcount)) {
+		if (!get_qspn_round(rnl->node, rq->final_rtt, hs->qtime,
+							hs->qspn_id, (int *) hs->gcount)) {
 			e = 1;
 			break;
 		}
@@ -1240,32 +1316,34 @@ hook_get_free_nodes(int hook_level, struct free_nodes_hdr *fn_hdr,
 				"or are not cooperating.\n  "
 				"We are going to create a new gnode");
 
-		create_new_qgroup(hook_level);
+		create_new_qgroup(hs->hook_level);
 		return 1;
 	}
 
+	map_owner_run(hook_qspn_round_run, hs);
 	return 0;
 }
 
 /*
- * hook_choose_new_ip
+ * hook_choose_new_ip_run
  * 
- * after reading the received `fn_hdr', it decides our new IP and if we have to
- * create a new gnode it returns 1.
+ * after reading the received free_nodes_hdr of the hook_state `argv', it
+ * decides our new IP and if we have to create a new gnode it returns 1.
+ * It is called by the map owner.
  */
 int
-hook_choose_new_ip(map_gnode * hook_gnode, int hook_level,
-				   struct free_nodes_hdr *fn_hdr, u_char * fnodes,
-				   inet_prefix * gnode_ipstart)
+hook_choose_new_ip_run(void *argv)
 {
+	struct hook_state *hs = (struct hook_state *) argv;
+	struct free_nodes_hdr *fn_hdr = &hs->fn_hdr;
 	int new_gnode, e;
 
 	/*
 	 * Let's see if we can re-hook at `hook_gnode' or if we have
 	 * to create a new gnode, in other words: update the join_rate.
 	 */
-	new_gnode = update_join_rate(hook_gnode, hook_level, qspn_old_gcount,
-								 qspn_gnode_count, fn_hdr);
+	new_gnode = update_join_rate(hs->hook_gnode, hs->hook_level,
+								 qspn_old_gcount, qspn_gnode_count, fn_hdr);
 	if (new_gnode > 0) {
 		/* 
 		 * The `hook_gnode' gnode cannot take all the nodes of our 
@@ -1284,11 +1362,11 @@ hook_choose_new_ip(map_gnode * hook_gnode, int hook_level,
 		e = rand_range(0, fn_hdr->nodes - 1);
 		if (fn_hdr->level == 1) {
 			new_gnode = 0;
-			postoip(fnodes[e], *gnode_ipstart, &me.cur_ip);
+			postoip(hs->fnodes[e], hs->gnode_ipstart, &me.cur_ip);
 		} else {
 			new_gnode = 1;
 			for (;;) {
-				random_ip(gnode_ipstart, fn_hdr->level, fn_hdr->gid,
+				random_ip(&hs->gnode_ipstart, fn_hdr->level, fn_hdr->gid,
 						  FAMILY_LVLS, me.ext_map, 0,
 						  &me.cur_ip, my_family);
 				if (!inet_validate_ip(me.cur_ip))
@@ -1299,6 +1377,22 @@ hook_choose_new_ip(map_gnode * hook_gnode, int hook_level,
 
 	if (restricted_mode)
 		inet_setip_localaddr(&me.cur_ip, my_family, restricted_class);
+
+	return new_gnode;
+}
+
+/*
+ * hook_choose_new_ip
+ * 
+ * makes the map owner choose our new IP, see hook_choose_new_ip_run(), and
+ * sets it to our interfaces. If we have to create a new gnode it returns 1.
+ */
+int
+hook_choose_new_ip(struct hook_state *hs)
+{
+	int new_gnode;
+
+	new_gnode = map_owner_run(hook_choose_new_ip_run, hs);
 	hook_set_all_ips(me.cur_ip, me.cur_ifs, me.cur_ifs_n);
 
 	/*
@@ -1312,28 +1406,23 @@ hook_choose_new_ip(map_gnode * hook_gnode, int hook_level,
 
 
 /*
- * hook_get_ext_map
+ * hook_get_ext_map_run
  *
- * gets the external map from the rnodes who sent us the free_nodes list. 
- * `rq' points to that rnode.
- * `old_ext_map' is the currently used ext_map; it will be merged with the
- * new received map. 
- *
- * If a new gnode has been created, 1 is returned.
+ * replaces our ext_map with the one received in the hook_state `argv'. The
+ * current ext_map is merged with it if a new gnode has to be created.
+ * It is called by the map owner. If a new gnode has been created, 1 is
+ * returned.
  */
 int
-hook_get_ext_map(int hook_level, int new_gnode,
-				 struct rnode_list *rnl, struct free_nodes_hdr *fn_hdr,
-				 map_gnode ** old_ext_map, quadro_group * old_quadg)
+hook_get_ext_map_run(void *argv)
 {
-	map_gnode **new_ext_map;
+	struct hook_state *hs = (struct hook_state *) argv;
+	map_gnode **new_ext_map = hs->new_ext_map, **old_ext_map = me.ext_map;
+	quadro_group *old_quadg = &hs->old_quadg;
+	int hook_level = hs->hook_level;
 
-	/* 
-	 * Fetch the ext_map from the node who gave us the free nodes list. 
-	 */
-	if (!(new_ext_map = get_ext_map(rnl->node, &me.cur_quadg)))
-		fatal("None of the rnodes in this area gave me the extern map");
 	me.ext_map = new_ext_map;
+	memcpy(&me.cur_quadg, &hs->new_quadg, sizeof(quadro_group));
 
 	if (we_are_rehooking && hook_level) {
 		int gcount, old_gid;
@@ -1361,15 +1450,15 @@ hook_get_ext_map(int hook_level, int new_gnode,
 	}
 
 	/* If we have to create new gnodes, let's do it. */
-	if (new_gnode) {
+	if (hs->new_gnode) {
 		me.ext_map = old_ext_map;
 		old_ext_map = new_ext_map;
 		memcpy(old_quadg, &me.cur_quadg, sizeof(quadro_group));
 
 		/* Create a new gnode. After this we have a new ip,
 		 * ext_map and quadro_group */
-		create_gnodes(&me.cur_ip,
-					  we_are_rehooking ? hook_level : fn_hdr->level);
+		create_gnodes(&me.cur_ip, we_are_rehooking ? hook_level :
+					  hs->fn_hdr.level);
 
 		/* Merge the received ext_map with our new empty ext_map */
 		merge_ext_maps(me.ext_map, new_ext_map, me.cur_quadg, *old_quadg);
@@ -1382,19 +1471,183 @@ hook_get_ext_map(int hook_level, int new_gnode,
 	return 0;
 }
 
-/* 
- * hook_get_int_map
- * 
- * fetch the internal map from a rnode which belongs to our same gnode.
+/*
+ * hook_get_ext_map
+ *
+ * gets the external map from the rnodes who sent us the free_nodes list. 
+ * `rnl' points to that rnode.
+ * The map owner replaces the currently used ext_map with the new received
+ * one, see hook_get_ext_map_run().
+ *
+ * If a new gnode has been created, 1 is returned.
+ */
+int
+hook_get_ext_map(struct hook_state *hs, struct rnode_list *rnl)
+{
+	/* 
+	 * Fetch the ext_map from the node who gave us the free nodes list. 
+	 */
+	memcpy(&hs->new_quadg, &me.cur_quadg, sizeof(quadro_group));
+	if (!(hs->new_ext_map = get_ext_map(rnl->node, &hs->new_quadg)))
+		fatal("None of the rnodes in this area gave me the extern map");
+
+	return map_owner_run(hook_get_ext_map_run, hs);
+}
+
+/*
+ * hook_fetch
+ *
+ * Each rnode of our gnode is queried by its own detached hook_fetch_t()
+ * thread. Since all the requests sent to the same rnode share its
+ * rnl->tcp_sk socket, the fetches directed to a single rnode are done in
+ * sequence, while the different rnodes are queried concurrently.
+ *
+ * hook_get_maps() waits only until the first int_map, bnode_map and Internet
+ * Gateways list have been received, then it `closes' the hook_fetch_ctx: the
+ * slower fetchers are left behind and what they receive later is discarded.
+ * The ctx is shared by hook_get_maps() and its fetchers and it is freed by the
+ * last of them which leaves it.
+ */
+struct hook_fetch {
+	map_node *rnode;
+	struct hook_fetch_ctx *ctx;
+
+	map_node *int_map;			/* The int_map received from `rnode' */
+	map_node *new_root;
+};
+
+struct hook_fetch_ctx {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;		/* signaled at each fetch */
+	int refs;					/* hook_get_maps() + the fetchers */
+	int running;				/* fetchers which haven't finished */
+	int closed;					/* hook_get_maps() isn't waiting */
+	int want_igw;
+
+	struct hook_fetch *hf;
+	int fetchers;
+	int int_maps;				/* how many hf[] have an int_map */
+
+	/* The first valid bnode_map and Internet Gateways list received */
+	map_bnode **bmap;
+	u_int *bmap_nodes;
+	inet_gw **igws;
+	int *igws_counter;
+};
+
+/*
+ * hook_fetch_ctx_put
+ *
+ * drops a reference to `ctx', freeing it with what it still holds when it
+ * was the last one.
  */
 void
-hook_get_int_map(void)
+hook_fetch_ctx_put(struct hook_fetch_ctx *ctx)
+{
+	int refs;
+
+	pthread_mutex_lock(&ctx->mutex);
+	refs = --ctx->refs;
+	pthread_mutex_unlock(&ctx->mutex);
+	if (refs)
+		return;
+
+	if (ctx->bmap)
+		bmap_levels_free(ctx->bmap, ctx->bmap_nodes);
+	if (ctx->igws)
+		free_igws(ctx->igws, ctx->igws_counter, FAMILY_LVLS);
+	pthread_mutex_destroy(&ctx->mutex);
+	pthread_cond_destroy(&ctx->cond);
+	xfree(ctx->hf);
+	xfree(ctx);
+}
+
+/*
+ * hook_fetch_t
+ *
+ * It retrieves the int_map of `hf'->rnode, then it races with the other
+ * hook_fetch_t() threads to get the bnode_map and, if `ctx'->want_igw
+ * is set, the Internet Gateways list. It stops as soon as the ctx is closed.
+ */
+void *
+hook_fetch_t(void *arg)
 {
-	struct radar_queue *rq = radar_q;
+	struct hook_fetch *hf = (struct hook_fetch *) arg;
+	struct hook_fetch_ctx *ctx = hf->ctx;
+	map_node *int_map, *new_root;
+	map_bnode **bmap = 0;
+	u_int *bmap_nodes;
+	inet_gw **igws = 0;
+	int *igws_counter, get_bmap, get_igw;
+
+	int_map = get_int_map(hf->rnode, &new_root);
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (int_map && !ctx->closed) {
+		hf->int_map = int_map;
+		hf->new_root = new_root;
+		ctx->int_maps++;
+		int_map = 0;
+		pthread_cond_signal(&ctx->cond);
+	}
+	get_bmap = !ctx->closed && !ctx->bmap;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	/* Too late */
+	if (int_map)
+		free_map(int_map, 0);
+
+	if (get_bmap && (bmap = get_bnode_map(hf->rnode, &bmap_nodes))) {
+		pthread_mutex_lock(&ctx->mutex);
+		if (!ctx->closed && !ctx->bmap) {
+			ctx->bmap = bmap;
+			ctx->bmap_nodes = bmap_nodes;
+			bmap = 0;
+			pthread_cond_signal(&ctx->cond);
+		}
+		pthread_mutex_unlock(&ctx->mutex);
+
+		/* Someone else came first */
+		if (bmap)
+			bmap_levels_free(bmap, bmap_nodes);
+	}
 
-	map_node **merg_map, *new_root;
-	int imaps = 0, i;
+	pthread_mutex_lock(&ctx->mutex);
+	get_igw = !ctx->closed && ctx->want_igw && !ctx->igws;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (get_igw && (igws = get_internet_gws(hf->rnode, &igws_counter))) {
+		pthread_mutex_lock(&ctx->mutex);
+		if (!ctx->closed && !ctx->igws) {
+			ctx->igws = igws;
+			ctx->igws_counter = igws_counter;
+			igws = 0;
+			pthread_cond_signal(&ctx->cond);
+		}
+		pthread_mutex_unlock(&ctx->mutex);
+
+		if (igws)
+			free_igws(igws, igws_counter, FAMILY_LVLS);
+	}
 
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->running--;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	hook_fetch_ctx_put(ctx);
+	return 0;
+}
+
+/*
+ * hook_get_maps_reset
+ *
+ * prepares a new empty int_map for hook_get_maps(). It is called by the map
+ * owner.
+ */
+void
+hook_get_maps_reset(void)
+{
 	/* 
 	 * We want a new shiny traslucent internal map 
 	 */
@@ -1406,123 +1659,199 @@ hook_get_int_map(void)
 	/* Increment the gnode seeds counter of level one, since
 	 * we are new in that gnode */
 	gnode_inc_seeds(&me.cur_quadg, 0);
+}
+
+/*
+ * hook_get_maps_run
+ *
+ * merges the int_maps fetched by the hook_fetch_t() threads of the
+ * hook_state `argv' and replaces our bnode map and Internet Gateways list
+ * with the received ones. It is called by the map owner, after the fetch ctx
+ * has been closed, and it returns the number of merged int_maps.
+ */
+int
+hook_get_maps_run(void *argv)
+{
+	struct hook_state *hs = (struct hook_state *) argv;
+	struct hook_fetch_ctx *ctx = hs->fetch;
+	struct hook_fetch *hf = ctx->hf;
+	int imaps, i;
 
 	/* 
-	 * Fetch the int_map from each rnode and merge them into a
-	 * single, big, shiny map.
+	 * Merge the received int_maps
 	 */
-	imaps = 0;
-	rq = radar_q;
-	merg_map = xzalloc(me.cur_node->links * sizeof(map_node *));
-
-	for (i = 0; i < me.cur_node->links; i++) {
-		rq = find_node_radar_q((map_node *) me.cur_node->r_node[i].r_node);
-
-		if (rq->node->flags & MAP_HNODE)
-			continue;
-		if (quadg_gids_cmp(rq->quadg, me.cur_quadg, 1))
-			/* This node isn't part of our gnode, let's skip it */
+	for (i = 0, imaps = 0; i < ctx->fetchers; i++) {
+		if (!hf[i].int_map)
 			continue;
+		merge_maps(me.int_map, hf[i].int_map, me.cur_node,
+				   hf[i].new_root);
+		free_map(hf[i].int_map, 0);
+		hf[i].int_map = 0;
+		imaps++;
+	}
 
-		if ((merg_map[imaps] = get_int_map(rq->node, &new_root))) {
-			merge_maps(me.int_map, merg_map[imaps], me.cur_node, new_root);
-			imaps++;
-		}
+	/*
+	 * The bnode map
+	 */
+	if (ctx->bmap) {
+		bmap_levels_free(me.bnode_map, me.bmap_nodes);
+		me.bnode_map = ctx->bmap;
+		me.bmap_nodes = ctx->bmap_nodes;
+		ctx->bmap = 0;
+	} else
+		loginfo("None of the rnodes in this area gave me the bnode map.");
+
+	/*
+	 * The Internet Gateway list
+	 */
+	if (!hs->get_igw)
+		return imaps;
+
+	if (ctx->igws) {
+		free_igws(me.igws, me.igws_counter, FAMILY_LVLS);
+		me.igws = ctx->igws;
+		me.igws_counter = ctx->igws_counter;
+		ctx->igws = 0;
+	} else {
+		loginfo("None gave me the Internet Gateway list");
+		reset_igws(me.igws, me.igws_counter, FAMILY_LVLS);
 	}
-	if (!imaps)
-		fatal("None of the rnodes in this area gave me the int_map");
 
-	for (i = 0; i < imaps; i++)
-		free_map(merg_map[i], 0);
-	xfree(merg_map);
+	return imaps;
 }
 
+/* 
+ * hook_get_maps
+ * 
+ * It fetches the internal map, the bnode map and, if `hs'->get_igw is non
+ * zero, the Internet Gateways list from the rnodes which belong to our same
+ * gnode.
+ * All the rnodes are queried at the same time and we wait only for the
+ * first answer of each map: the int_maps received until then are merged
+ * into a single, big, shiny map, the fetchers still running are left behind.
+ * Only the merge is done by the map owner, see hook_get_maps_run().
+ */
 void
-hook_get_bnode_map(void)
+hook_get_maps(struct hook_state *hs)
 {
-	struct radar_queue *rq = radar_q;
+	struct radar_queue *rq;
+	struct hook_fetch_ctx *ctx;
+	struct hook_fetch *hf;
+	pthread_attr_t t_attr;
+	pthread_t thread;
+	int i;
 
-	map_bnode **old_bnode_map;
-	u_int *old_bnodes;
+	map_owner_call(hook_get_maps_reset);
 
-	int e, i;
+	ctx = xzalloc(sizeof(struct hook_fetch_ctx));
+	pthread_mutex_init(&ctx->mutex, 0);
+	pthread_cond_init(&ctx->cond, 0);
+	ctx->refs = 1;
+	ctx->want_igw = hs->get_igw;
+	ctx->hf = hf = xzalloc(me.cur_node->links * sizeof(struct hook_fetch));
 
-	/* 
-	 * Let's get the bnode map. Fast, fast, quick quick! 
+	pthread_attr_init(&t_attr);
+	pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
+
+	/*
+	 * Launch a fetcher for each rnode of our gnode
 	 */
-	e = 0;
 	for (i = 0; i < me.cur_node->links; i++) {
 		rq = find_node_radar_q((map_node *) me.cur_node->r_node[i].r_node);
+
 		if (rq->node->flags & MAP_HNODE)
 			continue;
 		if (quadg_gids_cmp(rq->quadg, me.cur_quadg, 1))
 			/* This node isn't part of our gnode, let's skip it */
 			continue;
-		old_bnode_map = me.bnode_map;
-		old_bnodes = me.bmap_nodes;
-		me.bnode_map = get_bnode_map(rq->node, &me.bmap_nodes);
-		if (me.bnode_map) {
-			bmap_levels_free(old_bnode_map, old_bnodes);
-			e = 1;
-			break;
-		} else {
-			me.bnode_map = old_bnode_map;
-			me.bmap_nodes = old_bnodes;
-		}
+
+		hf[ctx->fetchers].rnode = rq->node;
+		hf[ctx->fetchers].ctx = ctx;
+
+		pthread_mutex_lock(&ctx->mutex);
+		ctx->refs++;
+		ctx->running++;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		if (pthread_create(&thread, &t_attr, hook_fetch_t,
+						   &hf[ctx->fetchers]))
+			/* Do it by ourself */
+			hook_fetch_t(&hf[ctx->fetchers]);
+		ctx->fetchers++;
 	}
-	if (!e)
-		loginfo("None of the rnodes in this area gave me the bnode map.");
+	pthread_attr_destroy(&t_attr);
 
+	/*
+	 * Wait the first int_map, bnode map and igw list, or the end of all
+	 * the fetchers
+	 */
+	pthread_mutex_lock(&ctx->mutex);
+	while (ctx->running && !(ctx->int_maps && ctx->bmap &&
+							 (!ctx->want_igw || ctx->igws)))
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	ctx->closed = 1;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	hs->fetch = ctx;
+	if (!map_owner_run(hook_get_maps_run, hs))
+		fatal("None of the rnodes in this area gave me the int_map");
+	hs->fetch = 0;
+	hook_fetch_ctx_put(ctx);
 }
 
+/*
+ * hook_phase_done
+ *
+ * Stores in hook_phase_ms[`phase'] the milliseconds elapsed since the end of
+ * the previous hook phase.
+ */
 void
-hook_get_igw(void)
+hook_phase_done(int phase)
 {
-	struct radar_queue *rq = radar_q;
-
-	inet_gw **old_igws;
-	int *old_igws_counter;
+	struct timeval cur_t, diff;
 
-	int e, i;
+	gettimeofday(&cur_t, 0);
+	timersub(&cur_t, &hook_phase_t, &diff);
+	hook_phase_ms[phase] = MILLISEC(diff);
+	hook_phase_t = cur_t;
+}
 
-	/* 
-	 * Let's get the Internet Gateway list
-	 */
-	e = 0;
-	for (i = 0; i < me.cur_node->links; i++) {
-		rq = find_node_radar_q((map_node *) me.cur_node->r_node[i].r_node);
-		if (rq->node->flags & MAP_HNODE)
-			continue;
-		if (quadg_gids_cmp(rq->quadg, me.cur_quadg, 1))
-			/* This node isn't part of our gnode, let's skip it */
-			continue;
 
-		old_igws = me.igws;
-		old_igws_counter = me.igws_counter;
-		me.igws = get_internet_gws(rq->node, &me.igws_counter);
-		if (me.igws) {
-			free_igws(old_igws, old_igws_counter, FAMILY_LVLS);
-			e = 1;
-			break;
-		} else {
-			me.igws = old_igws;
-			me.igws_counter = old_igws_counter;
-		}
-	}
-	if (!e) {
-		loginfo("None gave me the Internet Gateway list");
-		reset_igws(me.igws, me.igws_counter, FAMILY_LVLS);
+/*
+ * hook_set_root_node
+ *
+ * replaces the fake me.cur_node, used while hooking, with our node of the
+ * new int_map. It is called by the map owner.
+ */
+void
+hook_set_root_node(void)
+{
+	if (free_the_tmp_cur_node) {
+		xfree(me.cur_node);
+		free_the_tmp_cur_node = 0;
 	}
-}
+	me.cur_node = &me.int_map[me.cur_quadg.gid[0]];
+	map_node_del(me.cur_node);
+	me.cur_node->flags &= ~MAP_VOID;
+	me.cur_node->flags |= MAP_ME;
 
+	/* We need a fresh me.cur_node */
+	refresh_hook_root_node();
+}
 
 /*
- * hook_finish: final part of the netsukuku_hook process
+ * hook_finish_run
+ *
+ * ends the hook state: after it, the maps are changed by the other threads
+ * too. It is called by the map owner.
  */
-void
-hook_finish(int new_gnode, struct free_nodes_hdr *fn_hdr)
+int
+hook_finish_run(void *argv)
 {
-	int tracer_levels, i;
+	struct hook_state *hs = (struct hook_state *) argv;
+
+	/* All the maps have been replaced */
+	map_gen_bump(0);
 
 	/* 
 	 * We must reset the radar_queue because the first radar_scan, used while hooking,
@@ -1540,25 +1869,25 @@ hook_finish(int new_gnode, struct free_nodes_hdr *fn_hdr)
 	/* Disable the filter */
 	op_filter_reset(OP_FILTER_ALLOW);
 
-	if (new_gnode) {
+	if (hs->new_gnode) {
 		if (!me.cur_node->links)
 			/* 
 			 * We are a node lost in the desert, so we don't send
 			 * anything because nobody is listening
 			 */
-			tracer_levels = 0;
+			hs->tracer_levels = 0;
 		else
 			/* 
 			 * We are a new gnode, so we send the tracer in all higher
 			 * levels
 			 */
-			tracer_levels = fn_hdr->level;
+			hs->tracer_levels = hs->fn_hdr.level;
 	} else {
 		/* 
 		 * We are just a normal node inside a gnode, let's notice only
 		 * the other nodes in this gnode.
 		 */
-		tracer_levels = 2;
+		hs->tracer_levels = 2;
 	}
 
 	/*
@@ -1570,11 +1899,20 @@ hook_finish(int new_gnode, struct free_nodes_hdr *fn_hdr)
 					 me.my_bandwidth, me.cur_node, &me.cur_quadg);
 	}
 
-	loginfo("Starting the second radar scan before sending our"
-			" first tracer_pkt");
-	if (radar_scan(0))
-		fatal("%s:%d: Scan of the area failed. Cannot continue.",
-			  ERROR_POS);
+	return 0;
+}
+
+/*
+ * hook_finish_routes
+ *
+ * sends our first tracer_pkts and fills the kernel routing table. It is
+ * called by the map owner.
+ */
+int
+hook_finish_routes(void *argv)
+{
+	struct hook_state *hs = (struct hook_state *) argv;
+	int i;
 
 	/* 
 	 * Now we send a simple tracer_pkt in all the level we have to. This pkt
@@ -1583,9 +1921,8 @@ hook_finish(int new_gnode, struct free_nodes_hdr *fn_hdr)
 	 * Note that this is done only at the first time we hook.
 	 */
 	if (!we_are_rehooking) {
-		usleep(rand_range(0, 999999));
 		tracer_pkt_start_mutex = 0;
-		for (i = 1; i < tracer_levels; i++)
+		for (i = 1; i < hs->tracer_levels; i++)
 			tracer_pkt_start(i - 1);
 	}
 
@@ -1598,8 +1935,44 @@ hook_finish(int new_gnode, struct free_nodes_hdr *fn_hdr)
 		igw_replace_def_igws(me.igws, me.igws_counter,
 							 me.my_igws, me.cur_quadg.levels, my_family);
 
+	return 0;
+}
+
+/*
+ * hook_finish: final part of the netsukuku_hook process
+ */
+void
+hook_finish(struct hook_state *hs)
+{
+	struct timeval hook_t;
+
+	map_owner_run(hook_finish_run, hs);
+
+	loginfo("Starting the second radar scan before sending our"
+			" first tracer_pkt");
+	if (radar_scan(0))
+		fatal("%s:%d: Scan of the area failed. Cannot continue.",
+			  ERROR_POS);
+
+	if (!we_are_rehooking)
+		usleep(rand_range(0, 999999));
+	map_owner_run(hook_finish_routes, hs);
+
+	/* Publish the snapshot of the new maps */
+	map_owner_sync();
+
+	hook_phase_done(HOOK_PHASE_ROUTES);
+	timersub(&hook_phase_t, &hook_start_t, &hook_t);
+	hook_total_ms = MILLISEC(hook_t);
+
 	/* (Re)Hook completed */
-	loginfo("%sook completed", we_are_rehooking ? "Reh" : "H");
+	loginfo("%sook completed in %u ms (scan %u, free_nodes %u, ext_map %u,"
+			" maps %u, routes %u)", we_are_rehooking ? "Reh" : "H",
+			hook_total_ms, hook_phase_ms[HOOK_PHASE_SCAN],
+			hook_phase_ms[HOOK_PHASE_FREE_NODES],
+			hook_phase_ms[HOOK_PHASE_EXT_MAP],
+			hook_phase_ms[HOOK_PHASE_MAPS],
+			hook_phase_ms[HOOK_PHASE_ROUTES]);
 
 	we_are_rehooking = 0;
 }
@@ -1609,98 +1982,88 @@ hook_finish(int new_gnode, struct free_nodes_hdr *fn_hdr)
  * `hook_level' specifies at what level we are hooking, generally it is 0.
  * If `hook_gnode' is not null, netsukuku_hook will try to hook only to the
  * rnodes which belongs to the `hook_gnode' at `hook_level' level.
+ *
+ * The scans and the requests of the hook are done by the caller, while the
+ * maps are changed only by the map owner, with the hook_*_run() steps.
+ * While me.cur_node is a MAP_HNODE, the only requests accepted are the radar
+ * ones, so the maps are changed only by these steps and the hook can read
+ * them directly. No snapshot is published until the hook_finish().
  */
 int
 netsukuku_hook(map_gnode * hook_gnode, int hook_level)
 {
 	struct rnode_list *rnl = rlist;
-	struct free_nodes_hdr fn_hdr;
-
-	inet_prefix gnode_ipstart, old_ip;
-	quadro_group old_quadg;
+	struct hook_state hs;
+	inet_prefix old_ip;
+	int ret = 0;
 
-	int ret = 0, new_gnode = 0;
-	u_char fnodes[MAXGROUPNODE];
+	setzero(&hs, sizeof(struct hook_state));
+	hs.hook_gnode = hook_gnode;
+	hs.hook_level = hook_level;
 
 	/* Save our current IP before resetting */
 	inet_copy(&old_ip, &me.cur_ip);
-	memcpy(&old_quadg, &me.cur_quadg, sizeof(quadro_group));
+	memcpy(&hs.old_quadg, &me.cur_quadg, sizeof(quadro_group));
 
 	/* Reset the hook */
 	if (total_hooks) {
-		hook_reset();
 		we_are_rehooking = 1;
+		hook_reset();
 	}
 	total_hooks++;
 
+	setzero(hook_phase_ms, sizeof(hook_phase_ms));
+	gettimeofday(&hook_start_t, 0);
+	hook_phase_t = hook_start_t;
+
 	/*  
 	 * *       The beginning          * *       
 	 */
 	loginfo("The %s begins. Starting to scan the area",
 			we_are_rehooking ? "rehook" : "hook");
-	new_gnode = hook_first_radar_scan(hook_gnode, hook_level, &old_quadg);
-	if (new_gnode)
+	hs.new_gnode = hook_first_radar_scan(hook_gnode, hook_level,
+										 &hs.old_quadg);
+	hook_phase_done(HOOK_PHASE_SCAN);
+	if (hs.new_gnode)
 		goto finish;
 
 	/* 
 	 * Get the free nodes list
 	 */
-	qspn_backup_gcount(qspn_old_gcount, (int *) qspn_gnode_count);
-	new_gnode = hook_get_free_nodes(hook_level, &fn_hdr, fnodes,
-									&gnode_ipstart, qspn_gnode_count,
-									&rnl);
-	if (new_gnode)
+	hs.new_gnode = hook_get_free_nodes(&hs, &rnl);
+	hook_phase_done(HOOK_PHASE_FREE_NODES);
+	if (hs.new_gnode)
 		goto finish;
 
 	/* 
 	 * Choose a new IP 
 	 */
-	new_gnode = hook_choose_new_ip(hook_gnode, hook_level, &fn_hdr, fnodes,
-								   &gnode_ipstart);
+	hs.new_gnode = hook_choose_new_ip(&hs);
 
 	/*
 	 * Get the external map 
 	 */
-	new_gnode = hook_get_ext_map(hook_level, new_gnode, rnl, &fn_hdr,
-								 me.ext_map, &old_quadg);
-	if (new_gnode)
+	hs.new_gnode = hook_get_ext_map(&hs, rnl);
+	hook_phase_done(HOOK_PHASE_EXT_MAP);
+	if (hs.new_gnode)
 		goto finish;
 
 	/* 
-	 * Get the internal map 
-	 */
-	hook_get_int_map();
-
-	/*
-	 * Fetch the bnode map
+	 * Get the internal map and the bnode map. If we are in restricted
+	 * mode, get the Internet Gateways too.
 	 */
-	hook_get_bnode_map();
-
-	/*
-	 * If we are in restricted mode, get the Internet Gateways
-	 */
-	if (restricted_mode && (server_opt.use_shared_inet ||
-							server_opt.share_internet))
-		hook_get_igw();
+	hs.get_igw = restricted_mode && (server_opt.use_shared_inet ||
+									 server_opt.share_internet);
+	hook_get_maps(&hs);
+	hook_phase_done(HOOK_PHASE_MAPS);
 
 	/*
 	 * And that's all, clean the mess
 	 */
-
-	if (free_the_tmp_cur_node) {
-		xfree(me.cur_node);
-		free_the_tmp_cur_node = 0;
-	}
-	me.cur_node = &me.int_map[me.cur_quadg.gid[0]];
-	map_node_del(me.cur_node);
-	me.cur_node->flags &= ~MAP_VOID;
-	me.cur_node->flags |= MAP_ME;
-
-	/* We need a fresh me.cur_node */
-	refresh_hook_root_node();
+	map_owner_call(hook_set_root_node);
 
   finish:
-	hook_finish(new_gnode, &fn_hdr);
+	hook_finish(&hs);
 	return ret;
 }
 
@@ -42,6 +42,24 @@
 
 /* How many times netsukuku_hook() was launched */
 int total_hooks;
+int free_the_tmp_cur_node;		/* me.cur_node is the fake one used
+								   while hooking */
+
+/*
+ * Hook phases. hook_phase_ms[HOOK_PHASE_x] keeps how many milliseconds the
+ * phase x of the last (re)hook took, while `hook_total_ms' is the time passed
+ * from the start of the last hook to the moment our routes were written in
+ * the kernel.
+ */
+#define HOOK_PHASE_SCAN		0	/* first radar scan */
+#define HOOK_PHASE_FREE_NODES	1	/* free_nodes and qspn_round */
+#define HOOK_PHASE_EXT_MAP	2
+#define HOOK_PHASE_MAPS		3	/* int_map, bnode_map and igws */
+#define HOOK_PHASE_ROUTES	4	/* second scan and kernel routes */
+#define HOOK_PHASES		5
+
+u_int hook_phase_ms[HOOK_PHASES];
+u_int hook_total_ms;
 
 /* Current join_rate */
 u_int hook_join_rate;
@@ -119,6 +137,38 @@ INT_INFO qspn_round_pkt_iinfo = { 3,
 						 (GCOUNT_LEVELS * sizeof(u_int)))
 
 
+/*
+ * The state of a netsukuku_hook(). It is passed to the hook_*_run() steps,
+ * which change the maps and are called by the map owner.
+ */
+struct hook_state {
+	map_gnode *hook_gnode;
+	int hook_level;
+	int new_gnode;
+	quadro_group old_quadg;		/* Our quadro_group before the hook */
+
+	/* The free_nodes list */
+	struct free_nodes_hdr fn_hdr;
+	u_char fnodes[MAXGROUPNODE];
+	inet_prefix gnode_ipstart;
+
+	/* The qspn_round info */
+	struct timeval qtime[MAX_LEVELS];
+	int qspn_id[MAX_LEVELS];
+	u_int gcount[GCOUNT_LEVELS];
+
+	/* The received ext_map */
+	map_gnode **new_ext_map;
+	quadro_group new_quadg;
+
+	/* The hook_fetch_t()s of the rnodes, see hook.c */
+	struct hook_fetch_ctx *fetch;
+	int get_igw;
+
+	int tracer_levels;
+};
+
+
 /* 
  * * * Functions declaration * * *
  */
@@ -132,7 +182,21 @@ int put_bnode_map(PACKET rq_pkt);
 int create_gnodes(inet_prefix * ip, int final_level);
 void set_ip_and_def_gw(char *dev, inet_prefix ip);
 
+void hook_set_all_ips(inet_prefix ip, interface * ifs, int ifs_n);
 int hook_init(void);
+void hook_reset_state(void);
+void hook_reset_ip(void);
+void hook_reset(void);
+int create_new_qgroup_run(void *level);
+void hook_rescan_reset(void);
+int hook_qspn_round_run(void *argv);
+int hook_choose_new_ip_run(void *argv);
+int hook_get_ext_map_run(void *argv);
+void hook_get_maps_reset(void);
+int hook_get_maps_run(void *argv);
+void hook_set_root_node(void);
+int hook_finish_run(void *argv);
+int hook_finish_routes(void *argv);
 int netsukuku_hook(map_gnode * hook_gnode, int hook_level);
 
 #endif							/*HOOK_H */
@@ -25,6 +25,7 @@
 #include "if.h"
 #include "libnetlink.h"
 #include "ll_map.h"
+#include "krnl_state.h"
 
 extern int errno;
 
@@ -180,20 +181,15 @@ get_dev(int *dev_idx)
 int
 get_all_up_ifs(interface * ifs, int ifs_n)
 {
-	int i, idx, n;
+	int idx, n;
 
-	for (i = 0, n = 0; i < ifs_n; i++) {
-		idx = ll_nth_up_if(n + 1);
-		if (idx <= 0)
-			continue;
+	for (n = 0; n < ifs_n; n++) {
+		if ((idx = ll_nth_up_if(n + 1)) <= 0)
+			break;
 
 		ifs[n].dev_idx = idx;
 		strncpy(ifs[n].dev_name, ll_index_to_name(idx), IFNAMSIZ);
 		loginfo("Network interface \"%s\" detected", ifs[n].dev_name);
-		n++;
-
-		if ((idx - 1) > i)
-			i = idx - 1;
 	}
 
 	return n;
@@ -409,7 +405,8 @@ set_all_dev_ip(inet_prefix ip, interface * ifs, int ifs_n)
 
 /*
  * get_dev_ip: fetches the ip currently assigned to the interface named `dev'
- * and stores it to `ip'.
+ * and stores it to `ip'. If the kernel state mirror is live it is just read
+ * from there.
  * On success 0 is returned, -1 otherwise.
  */
 int
@@ -420,6 +417,10 @@ get_dev_ip(inet_prefix * ip, int family, char *dev)
 
 	setzero(ip, sizeof(inet_prefix));
 
+	if ((ret = krnl_addr_get(ll_name_to_index(dev), family, ip)) >= 0)
+		return ret ? 0 : -1;
+	ret = 0;
+
 	if ((s = new_socket(family)) < 0) {
 		error("Error while setting \"%s\" ip: Cannot open socket", dev);
 		return -1;
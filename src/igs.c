@@ -32,6 +32,7 @@
 #include "bmap.h"
 #include "qspn.h"
 #include "radar.h"
+#include "mapowner.h"
 #include "andns.h"
 #include "netsukuku.h"
 #include "route.h"
@@ -41,6 +42,8 @@
 #include "libiptc/libiptc.h"
 #include "mark.h"
 #include "igs.h"
+#include "prober.h"
+#include "bw.h"
 #include "err_errno.h"
 
 int igw_multi_gw_disabled;
@@ -292,7 +295,7 @@ init_internet_gateway_search(void)
 	inet_prefix new_gw;
 	char new_gw_dev[IFNAMSIZ];
 
-	pthread_t ping_thread;
+	pthread_t prober_thread;
 	pthread_attr_t t_attr;
 	int i, ret, res, e;
 
@@ -470,6 +473,12 @@ init_internet_gateway_search(void)
 					 "  Internet connection");
 		}
 
+	debug(DBG_SOFT, "Evoking the prober daemon.");
+	pthread_attr_init(&t_attr);
+	pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
+	if (!prober_init())
+		pthread_create(&prober_thread, &t_attr, prober_daemon, 0);
+
 	loginfo("Launching the first ping to the Internet hosts");
 	if (!server_opt.disable_andna)
 		internet_hosts_to_ip();
@@ -482,10 +491,9 @@ init_internet_gateway_search(void)
 		fatal("We are not connected to the Internet, but you want to "
 			  "share your connection. Please check your options");
 
-	debug(DBG_SOFT, "Evoking the Internet ping daemon.");
-	pthread_attr_init(&t_attr);
-	pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
-	pthread_create(&ping_thread, &t_attr, igw_check_inet_conn_t, 0);
+	debug(DBG_SOFT, "Starting the Internet ping job.");
+	timer_job_start(&igw_inet_conn_job, INET_NEXT_PING_WAIT * 1000,
+					igw_check_inet_conn_job, 0);
 }
 
 void
@@ -649,8 +657,39 @@ igw_update_gnode_bw(int *igws_counter, inet_gw ** my_igws, inet_gw * igw,
 
 
 /*
- * igw_cmp: compares two inet_gw structs calculating their connection quality:
- * bandwith - rtt/1000;
+ * igw_quality
+ *
+ * returns the connection quality of `igw': its bandwith, in Kb/s, minus its
+ * rtt, in millisec.
+ * The bandwidth can't be greater than the one of the route to the igw node.
+ * If the prober is monitoring `igw', its live rtt (plus the jitter) is used
+ * and the bandwidth is reduced by its loss rate, otherwise the rtt of the
+ * route to the igw node is used.
+ */
+int
+igw_quality(inet_gw * igw)
+{
+	struct in_addr addr;
+	u_int bw, rtt_us, rtt_ms, loss;
+
+	bw = bandwidth_to_32bit(igw->bandwidth);
+	if (igw->node->links && !(igw->node->flags & MAP_ME))
+		bw = BW_MIN(bw, igw->node->r_node[0].bw);
+
+	addr.s_addr = htonl(igw->ip[0]);
+	if (my_family == AF_INET && !probe_quality(addr, &rtt_us, &loss)) {
+		bw -= (u_long) bw *loss / 1000;
+		rtt_ms = rtt_us / 1000;
+	} else
+		/* The trtt of the routes is already in millisec */
+		rtt_ms = igw->node->links ? igw->node->r_node[0].trtt : 0;
+
+	return (int) bw - (int) rtt_ms;
+}
+
+/*
+ * igw_cmp: compares two inet_gw structs calculating their connection
+ * quality with igw_quality()
  */
 int
 igw_cmp(const void *a, const void *b)
@@ -658,13 +697,11 @@ igw_cmp(const void *a, const void *b)
 	inet_gw *gw_a = *(inet_gw **) a;
 	inet_gw *gw_b = *(inet_gw **) b;
 
-	u_int cq_a, cq_b, trtt;
+	int cq_a, cq_b;
 
 	/* let's calculate the connection quality of both A and B */
-	trtt = gw_a->node->links ? gw_a->node->r_node[0].trtt / 1000 : 0;
-	cq_a = bandwidth_to_32bit(gw_a->bandwidth) - trtt;
-	trtt = gw_b->node->links ? gw_b->node->r_node[0].trtt / 1000 : 0;
-	cq_b = bandwidth_to_32bit(gw_b->bandwidth) - trtt;
+	cq_a = igw_quality(gw_a);
+	cq_b = igw_quality(gw_b);
 
 	if (cq_a > cq_b)
 		return 1;
@@ -694,6 +731,7 @@ igw_order(inet_gw ** igws, int *igws_counter, inet_gw ** my_igws,
 	clist_qsort(new_head, igws[level], igws_counter[level], igw_cmp);
 
 	igw = new_head;
+	i = 0;
 	list_for(igw) {
 		if (i >= MAXIGWS) {
 			if (igw->node->flags & MAP_ME) {
@@ -719,12 +757,28 @@ igw_order(inet_gw ** igws, int *igws_counter, inet_gw ** my_igws,
 
 /*
  * igw_check_inet_conn: returns 1 if we are still connected to the Internet.
- * The check is done by pinging the `server_opt.inet_hosts'.
+ * The check is done by pinging the `server_opt.inet_hosts', all at the same
+ * time with the prober, or one after the other if it isn't available.
  */
 int
 igw_check_inet_conn(void)
 {
-	int i, ret;
+	struct in_addr *addrs;
+	int i, n, ret;
+
+	if (prober_sk >= 0 && server_opt.inet_hosts) {
+		addrs = xmalloc(sizeof(struct in_addr) *
+						(server_opt.inet_hosts_counter + 1));
+		for (i = n = 0; server_opt.inet_hosts[i] &&
+			 i < server_opt.inet_hosts_counter; i++)
+			if (!probe_resolve(server_opt.inet_hosts[i], &addrs[n]))
+				n++;
+
+		ret = n ? probe_round(addrs, n, INET_HOST_PING_TIMEOUT * 1000, 1,
+							  0) : 0;
+		xfree(addrs);
+		return ret > 0;
+	}
 
 	for (i = 0; server_opt.inet_hosts && server_opt.inet_hosts[i] &&
 		 i < server_opt.inet_hosts_counter; i++) {
@@ -737,73 +791,125 @@ igw_check_inet_conn(void)
 }
 
 /*
- * igw_check_inet_conn_t
+ * igw_inet_conn_lost
+ *
+ * disables me.my_igws[0] after the Internet connection has been lost. It is
+ * called by the map owner.
+ */
+void
+igw_inet_conn_lost(void)
+{
+	me.my_igws[0]->bandwidth = 0;
+	igw_update_gnode_bw(me.igws_counter, me.my_igws,
+						me.my_igws[0], 0, 0, me.cur_quadg.levels);
+	clist_join(&me.igws[0], &me.igws_counter[0], me.my_igws[0]);
+}
+
+/*
+ * igw_inet_conn_back
+ *
+ * enables again me.my_igws[0]. It is called by the map owner.
+ */
+void
+igw_inet_conn_back(void)
+{
+	me.my_igws[0]->bandwidth = me.my_bandwidth;
+	clist_ins(&me.igws[0], &me.igws_counter[0], me.my_igws[0]);
+	igw_update_gnode_bw(me.igws_counter, me.my_igws,
+						me.my_igws[0], 1, 0, me.cur_quadg.levels);
+}
+
+/*
+ * igw_check_inet_conn_job
  *
- * checks if we are connected to the internet, then waits, then checks
- * if we are connected, then ...
+ * The igw_inet_conn_job: it checks if we are connected to the internet and
+ * it is run again after INET_NEXT_PING_WAIT seconds.
  */
-void *
-igw_check_inet_conn_t(void *null)
+u_int
+igw_check_inet_conn_job(void *null)
 {
 	inet_prefix new_gw;
 	char new_gw_dev[IFNAMSIZ];
 	int old_status, ret;
 
-	for (;;) {
-		old_status = me.inet_connected;
-		me.inet_connected = igw_check_inet_conn();
-
-		if (old_status && !me.inet_connected) {
-			/* Connection lost, disable me.my_igws[0] */
-			loginfo
-				("Internet connection lost. Inet connection sharing disabled");
-
-			me.my_igws[0]->bandwidth = 0;
-			igw_update_gnode_bw(me.igws_counter, me.my_igws,
-								me.my_igws[0], 0, 0, me.cur_quadg.levels);
-			clist_join(&me.igws[0], &me.igws_counter[0], me.my_igws[0]);
-
-		} else if (!old_status && me.inet_connected) {
-			if (server_opt.share_internet) {
-				/* Maybe the Internet gateway is changed, it's
-				 * better to check it */
-
-				ret = rt_get_default_gw(&new_gw, new_gw_dev);
-				if (ret < 0) {
-					/*
-					 * Something's wrong, we can reach Inet
-					 * hosts, but we cannot take the default
-					 * gw, thus consider ourself not connected.
-					 */
-					me.inet_connected = 0;
-					goto skip_it;
-				}
-				if (strncmp(new_gw_dev, server_opt.inet_gw_dev, IFNAMSIZ)
-					|| memcmp(new_gw.data, server_opt.inet_gw.data,
-							  MAX_IP_SZ)) {
-
-					/* New Internet gw (dialup connection ?) */
-					strncpy(server_opt.inet_gw_dev, new_gw_dev, IFNAMSIZ);
-					memcpy(&server_opt.inet_gw, &new_gw,
-						   sizeof(inet_prefix));
-					loginfo
-						("Our Internet gateway changed, now it is: %s dev %s",
-						 inet_to_str(new_gw), new_gw_dev);
-				} else
-					loginfo("Internet connection is alive again. "
-							"Inet connection sharing enabled");
-			}
+	old_status = me.inet_connected;
+	me.inet_connected = igw_check_inet_conn();
+
+	if (old_status && !me.inet_connected) {
+		/* Connection lost, disable me.my_igws[0] */
+		loginfo
+			("Internet connection lost. Inet connection sharing disabled");
+
+		map_owner_call(igw_inet_conn_lost);
 
-			/* Yay! We're connected, enable me.my_igws[0] */
-			me.my_igws[0]->bandwidth = me.my_bandwidth;
-			clist_ins(&me.igws[0], &me.igws_counter[0], me.my_igws[0]);
-			igw_update_gnode_bw(me.igws_counter, me.my_igws,
-								me.my_igws[0], 1, 0, me.cur_quadg.levels);
+	} else if (!old_status && me.inet_connected) {
+		if (server_opt.share_internet) {
+			/* Maybe the Internet gateway is changed, it's
+			 * better to check it */
 
+			ret = rt_get_default_gw(&new_gw, new_gw_dev);
+			if (ret < 0) {
+				/*
+				 * Something's wrong, we can reach Inet
+				 * hosts, but we cannot take the default
+				 * gw, thus consider ourself not connected.
+				 */
+				me.inet_connected = 0;
+				return INET_NEXT_PING_WAIT * 1000;
+			}
+			if (strncmp(new_gw_dev, server_opt.inet_gw_dev, IFNAMSIZ)
+				|| memcmp(new_gw.data, server_opt.inet_gw.data,
+						  MAX_IP_SZ)) {
+
+				/* New Internet gw (dialup connection ?) */
+				strncpy(server_opt.inet_gw_dev, new_gw_dev, IFNAMSIZ);
+				memcpy(&server_opt.inet_gw, &new_gw,
+					   sizeof(inet_prefix));
+				loginfo
+					("Our Internet gateway changed, now it is: %s dev %s",
+					 inet_to_str(new_gw), new_gw_dev);
+			} else
+				loginfo("Internet connection is alive again. "
+						"Inet connection sharing enabled");
 		}
-	  skip_it:
-		sleep(INET_NEXT_PING_WAIT);
+
+		/* Yay! We're connected, enable me.my_igws[0] */
+		map_owner_call(igw_inet_conn_back);
 	}
+
+	if (me.inet_connected && server_opt.share_internet)
+		map_owner_call(igw_update_my_bandwidth);
+
+	return INET_NEXT_PING_WAIT * 1000;
+}
+
+/*
+ * igw_update_my_bandwidth
+ *
+ * sets the bandwidth of me.my_igws[0] to the one still available on our
+ * Internet connection, as measured by the bandwidth monitor. It is never
+ * greater than `me.my_bandwidth'.
+ */
+void
+igw_update_my_bandwidth(void)
+{
+	u_int avail;
+	u_char bw;
+
+	if (!(avail = bw_inet_avail()))
+		return;
+
+	bw = bandwidth_in_8bit(avail);
+	if (bw > me.my_bandwidth)
+		bw = me.my_bandwidth;
+	if (bw == me.my_igws[0]->bandwidth)
+		return;
+
+	igw_update_gnode_bw(me.igws_counter, me.my_igws, me.my_igws[0], 0, 0,
+						me.cur_quadg.levels);
+	me.my_igws[0]->bandwidth = bw;
+	igw_update_gnode_bw(me.igws_counter, me.my_igws, me.my_igws[0], 1, 0,
+						me.cur_quadg.levels);
 }
 
 /*
@@ -825,66 +931,171 @@ igw_ping_igw(inet_gw * igw)
 }
 
 /*
- * igw_monitor_igws_t: it pings the Internet gateway which are currently
- * utilised in the kernel routing table and deletes the ones which don't
- * reply.
+ * igw_probe_igws
+ *
+ * pings the `n' `ips' igws and stores in `alive'[i] 1 if ips[i] replied.
+ * All the igws are pinged at the same time by the prober, if it is
+ * available, otherwise they are pinged one after the other.
  */
-void *
-igw_monitor_igws_t(void *null)
+void
+igw_probe_igws(u_int ips[][MAX_IP_INT], int n, u_char * alive)
 {
-	inet_gw *igw, *next, *old_igw;
-	int i, nexthops, ip[MAX_IP_INT], l, ni;
+	struct in_addr *addrs;
+	inet_gw igw;
+	int i;
 
-	nexthops = MAX_MULTIPATH_ROUTES / me.cur_quadg.levels;
-	for (;;) {
-		while (me.cur_node->flags & MAP_HNODE)
-			sleep(1);
+	if (prober_sk >= 0 && my_family == AF_INET) {
+		addrs = xmalloc(sizeof(struct in_addr) * n);
+		for (i = 0; i < n; i++)
+			addrs[i].s_addr = htonl(ips[i][0]);
+		probe_round(addrs, n, IGW_HOST_PING_TIMEOUT * 1000, 0, alive);
+		xfree(addrs);
+		return;
+	}
 
-		for (i = 0; i < me.cur_quadg.levels; i++) {
+	setzero(&igw, sizeof(igw));
+	for (i = 0; i < n; i++) {
+		memcpy(igw.ip, ips[i], MAX_IP_SZ);
+		alive[i] = igw_ping_igw(&igw) > 0;
+	}
+}
 
-			while (me.cur_node->flags & MAP_HNODE)
-				sleep(1);
+/*
+ * igw_monitor_collect
+ *
+ * saves in the igw_monitor_argv `argv' the ips of the active igws of the
+ * `argv'->level level, which are then probed all together, and returns their
+ * number. They are read from the map_snapshot, so the map owner isn't
+ * bothered.
+ */
+int
+igw_monitor_collect(struct igw_monitor_argv *m)
+{
+	struct map_snapshot live, *snap;
+	u_int epoch;
+	int n;
 
-			igw = me.igws[i];
+	snap = map_snapshot_read(&live, &epoch);
+	n = snap->igw_counter[m->level];
+	if (n > m->nexthops)
+		n = m->nexthops;
+	memcpy(m->ips, snap->igw_ips[m->level], n * MAX_IP_SZ);
+	m->ni = n;
+	map_snapshot_put(epoch);
 
-			ni = 0;
-			list_safe_for(igw, next) {
-				if (ni >= nexthops)
-					break;
+	return m->ni;
+}
 
-				if (!(igw->flags & IGW_ACTIVE))
-					continue;
+/*
+ * igw_monitor_apply
+ *
+ * deletes the igws of `argv' which didn't reply to the probes and reorders
+ * their level with the fresh rtts and losses. It returns 1 if the igws
+ * changed. It is called by the map owner.
+ */
+int
+igw_monitor_apply(void *argv)
+{
+	struct igw_monitor_argv *m = (struct igw_monitor_argv *) argv;
+	inet_gw *igw, *old_igw;
+	u_int ip[MAX_IP_INT];
+	int i = m->level, k, l, changed = 0;
+
+	for (k = 0; k < m->ni; k++) {
+		if (m->alive[k])
+			continue;
+		if (!(igw = igw_find_ip(me.igws, i, m->ips[k])))
+			continue;
+
+		memcpy(ip, igw->ip, MAX_IP_SZ);
+		loginfo("The Internet gw %s doesn't replies "
+				"to pings. It is dead.", ipraw_to_str(igw->ip, my_family));
+
+		for (l = i, old_igw = igw; l < me.cur_quadg.levels && old_igw; l++) {
+			igw_del(me.igws, me.igws_counter, old_igw, l);
+			if (l + 1 < me.cur_quadg.levels)
+				old_igw = igw_find_ip(me.igws, l + 1, ip);
+		}
+		changed = 1;
+	}
 
-				if (!memcmp
-					(igw->ip, me.cur_quadg.ipstart[0].data, MAX_IP_SZ))
-					continue;
+	/* Reorder the level with the fresh rtts and losses */
+	igw_order(me.igws, me.igws_counter, me.my_igws, i);
+	igw = me.igws[i];
+	k = 0;
+	list_for(igw) {
+		if (k >= m->ni)
+			break;
+		if (!(igw->flags & IGW_ACTIVE) ||
+			!memcmp(igw->ip, me.cur_quadg.ipstart[0].data, MAX_IP_SZ))
+			continue;
+		if (memcmp(igw->ip, m->ips[k++], MAX_IP_SZ))
+			changed = 1;
+	}
+
+	return changed;
+}
+
+/*
+ * igw_replace_my_def_igws
+ *
+ * replaces the default route with our current igws. It is called by the map
+ * owner.
+ */
+void
+igw_replace_my_def_igws(void)
+{
+	igw_replace_def_igws(me.igws, me.igws_counter, me.my_igws,
+						 me.cur_quadg.levels, my_family);
+}
+
+/*
+ * igw_monitor_igws_job: it pings the Internet gateway which are currently
+ * utilised in the kernel routing table and deletes the ones which don't
+ * reply. The igws are then reordered by their live quality, measured by the
+ * pings (see igw_quality()), and the default route is updated if the
+ * order changed.
+ * Only the pings are done by the igw_monitor_job, the igws are read from
+ * the map_snapshot and changed by the map owner.
+ * It returns the msecs after which it has to be run again.
+ */
+u_int
+igw_monitor_igws_job(void *null)
+{
+	struct igw_monitor_argv margv;
+	int i, changed;
 
-				if (!igw_ping_igw(igw)) {
-					memcpy(ip, igw->ip, MAX_IP_SZ);
+	if (me.cur_node->flags & MAP_HNODE)
+		return 1000;
 
-					loginfo("The Internet gw %s doesn't replies "
-							"to pings. It is dead.",
-							ipraw_to_str(igw->ip, my_family));
+	setzero(&margv, sizeof(margv));
+	margv.nexthops = MAX_MULTIPATH_ROUTES / me.cur_quadg.levels;
 
-					for (l = i, old_igw = igw; l < me.cur_quadg.levels;
-						 l++) {
-						igw_del(me.igws, me.igws_counter, old_igw, l);
-						if (l + 1 < me.cur_quadg.levels)
-							old_igw =
-								igw_find_ip(me.igws, l + 1, (u_int *) ip);
-					}
+	changed = 0;
+	for (i = 0; i < me.cur_quadg.levels; i++) {
+		if (me.cur_node->flags & MAP_HNODE)
+			break;
 
-					igw_replace_def_igws(me.igws, me.igws_counter,
-										 me.my_igws, me.cur_quadg.levels,
-										 my_family);
-				}
+		/* The igws are probed all together, so we save their ips,
+		 * the list may change in the meanwhile */
+		margv.level = i;
+		if (!igw_monitor_collect(&margv))
+			continue;
 
-				ni++;
-			}
-		}
+		igw_probe_igws(margv.ips, margv.ni, margv.alive);
 
-		sleep(INET_NEXT_PING_WAIT);
+		if (map_owner_run(igw_monitor_apply, &margv))
+			changed = 1;
 	}
+
+	if (changed)
+		map_owner_call(igw_replace_my_def_igws);
+
+	/* We are hooking again: retry as soon as it's finished */
+	if (me.cur_node->flags & MAP_HNODE)
+		return 1000;
+
+	return INET_NEXT_PING_WAIT * 1000;
 }
 
 /*
@@ -1021,8 +1232,10 @@ igw_replace_def_igws(inet_gw ** igws, int *igws_counter,
 	inet_prefix to, ip;
 
 	struct nexthop *nh = 0, nh_tmp[2];
+	void *nh_gw[MAX_MULTIPATH_ROUTES];
+	u_int nh_trtt[MAX_MULTIPATH_ROUTES], nh_bw[MAX_MULTIPATH_ROUTES];
 	int ni, ni_lvl, nexthops, level, max_multipath_routes, i, x;
-	int res, new_nexhtop;
+	int new_nexhtop, first_igw;
 
 #ifdef DEBUG
 #define MAX_GW_IP_STR_SIZE (MAX_MULTIPATH_ROUTES*((INET6_ADDRSTRLEN+1)+IFNAMSIZ)+1)
@@ -1051,6 +1264,7 @@ igw_replace_def_igws(inet_gw ** igws, int *igws_counter,
 		ni++;
 		max_multipath_routes--;
 	}
+	first_igw = ni;
 
 	/*
 	 * Set all our saved nexthop as inactives, then mark as "active" only
@@ -1168,12 +1382,15 @@ igw_replace_def_igws(inet_gw ** igws, int *igws_counter,
 					error("Cannote replace the default "
 						  "route of the table %d ", multigw_nh[x].table);
 
-				res = create_mark_rules(multigw_nh[x].tunl + 1);
-				if (res == -1)
-					error(err_str);
+				/* Written below, with the rules of the other
+				 * new tunnels */
+				mark_rules_want(multigw_nh[x].tunl + 1);
 			}
 			taken_nexthops[ni] = igw;
 
+			nh_gw[ni] = igw;
+			nh_trtt[ni] = igw->node->links ? igw->node->r_node[0].trtt : 0;
+			nh_bw[ni] = bandwidth_to_32bit(igw->bandwidth);
 			ni++;
 			ni_lvl++;
 		}
@@ -1185,6 +1402,15 @@ igw_replace_def_igws(inet_gw ** igws, int *igws_counter,
 	}
 	nh[ni].dev = 0;
 
+	/* A single netfilter transaction for all the new tunnels */
+	if (mark_rules_sync() < 0)
+		error(err_str);
+
+	/* Spread the traffic on the inet-gws by their bandwidth and trtt */
+	rt_nexthop_weight(&igw_nh_state, nh_gw + first_igw,
+					  nh_trtt + first_igw, nh_bw + first_igw,
+					  nh + first_igw, ni - first_igw);
+
 	if (!ni && active_gws) {
 #ifdef DEBUG
 		debug(DBG_INSANE, RED("igw_def_gw: no Internet gateways "
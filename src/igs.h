@@ -20,6 +20,7 @@
 #define IGS_H
 
 #include "route.h"
+#include "timer.h"
 
 
 /*
@@ -171,6 +172,20 @@ typedef struct default_inet_gw_nexthop igw_nexthop;
 										   contained in a single 
 										   QSPN chunk */
 
+/*
+ * The arguments of igw_monitor_collect() and igw_monitor_apply(): the
+ * igw_monitor_igws_job() probes the `ni' `ips' of the `level' level and
+ * stores in `alive' which ones replied.
+ */
+struct igw_monitor_argv {
+	int level;
+	int nexthops;
+
+	u_int ips[MAX_MULTIPATH_ROUTES][MAX_IP_INT];
+	u_char alive[MAX_MULTIPATH_ROUTES];
+	int ni;
+};
+
 
 /*\
  *
@@ -180,6 +195,10 @@ typedef struct default_inet_gw_nexthop igw_nexthop;
 
 int active_gws;
 igw_nexthop multigw_nh[MAX_MULTIPATH_ROUTES];
+struct rt_nh_state igw_nh_state;	/* weights of the default route */
+
+/* The periodic Internet ping and igw monitor, see igw_*_job() */
+struct timer_job igw_inet_conn_job, igw_monitor_job;
 
 
 /*\
@@ -214,9 +233,18 @@ void igw_update_gnode_bw(int *, inet_gw **, inet_gw *, int, int, int);
 void igw_order(inet_gw ** igws, int *igws_counter, inet_gw ** my_igws,
 			   int level);
 
+int igw_quality(inet_gw * igw);
 int igw_check_inet_conn(void);
-void *igw_check_inet_conn_t(void *null);
-void *igw_monitor_igws_t(void *null);
+void igw_inet_conn_lost(void);
+void igw_inet_conn_back(void);
+u_int igw_check_inet_conn_job(void *null);
+void igw_update_my_bandwidth(void);
+int igw_ping_igw(inet_gw * igw);
+void igw_probe_igws(u_int ips[][MAX_IP_INT], int n, u_char * alive);
+int igw_monitor_collect(struct igw_monitor_argv *m);
+int igw_monitor_apply(void *argv);
+void igw_replace_my_def_igws(void);
+u_int igw_monitor_igws_job(void *null);
 
 int igw_exec_masquerade_sh(char *script, int stop);
 int igw_exec_tcshaper_sh(char *script, int stop,
@@ -50,7 +50,9 @@
 #include <limits.h>
 #include <signal.h>
 
+#ifdef USE_GMP
 #include <gmp.h>
+#endif
 #include <pthread.h>
 
 
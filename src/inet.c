@@ -16,7 +16,10 @@
  * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#define _GNU_SOURCE				/* sendmmsg() */
 #include "includes.h"
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #include "common.h"
 #include "ipv6-gmp.h"
@@ -839,6 +842,93 @@ set_tos_sk(int socket, int lowdelay)
 	return 0;
 }
 
+/*
+ * set_timestamp_sk
+ *
+ * It asks the kernel to timestamp each packet received by `socket'. The
+ * timestamp can be retrieved with inet_recvfrom_stamp().
+ */
+int
+set_timestamp_sk(int socket)
+{
+	int on = 1;
+
+	if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &on,
+				   sizeof(on)) < 0) {
+		error("setsockopt SO_TIMESTAMPNS: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * set_tx_timestamp_sk
+ *
+ * It asks the kernel to report, in the error queue of `socket', the time
+ * when each packet has been handed to the device driver. The timestamps
+ * are then read with inet_get_tx_stamp(). Each of them carries the id of its
+ * pkt: the first pkt sent after this call has id 0, the next 1, and so on.
+ */
+int
+set_tx_timestamp_sk(int socket)
+{
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_OPT_TSONLY | SOF_TIMESTAMPING_OPT_ID;
+
+	if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+				   sizeof(flags)) < 0) {
+		debug(DBG_NOISE, "setsockopt SO_TIMESTAMPING: %s",
+			  strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * inet_get_tx_stamp
+ *
+ * It reads, without blocking, the next transmit timestamp queued in the
+ * error queue of `s' and stores it in `stamp' and the id of its pkt (see
+ * set_tx_timestamp_sk()) in `id'.
+ * If the error queue is empty -1 is returned. If the message read isn't a
+ * timestamp with its id, 1 is returned.
+ */
+int
+inet_get_tx_stamp(int s, struct timeval *stamp, u_int * id)
+{
+	char ctrl[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+			  CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	struct scm_timestamping *tss = 0;
+	struct sock_extended_err *serr = 0;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+
+	setzero(&msg, sizeof(msg));
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	if (recvmsg(s, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_TIMESTAMPING)
+			tss = (struct scm_timestamping *) CMSG_DATA(cmsg);
+		else if ((cmsg->cmsg_level == SOL_IP &&
+				  cmsg->cmsg_type == IP_RECVERR) ||
+				 (cmsg->cmsg_level == SOL_IPV6 &&
+				  cmsg->cmsg_type == IPV6_RECVERR))
+			serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+	if (!tss || !serr || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+		return 1;
+
+	stamp->tv_sec = tss->ts[0].tv_sec;
+	stamp->tv_usec = tss->ts[0].tv_nsec / 1000;
+	*id = serr->ee_data;
+	return 0;
+}
+
 /*\
  *
  *   *  *  Connection functions  *  *
@@ -1016,6 +1106,55 @@ inet_recvfrom(int s, void *buf, size_t len, int flags,
 	return err;
 }
 
+/*
+ * inet_recvfrom_stamp
+ *
+ * It is the same of inet_recvfrom(), but it also stores in `stamp' the time
+ * when the packet has been received. If `s' has been set with
+ * set_timestamp_sk(), the timestamp is the one taken by the kernel,
+ * otherwise it is taken just after the recvmsg().
+ */
+ssize_t
+inet_recvfrom_stamp(int s, void *buf, size_t len, int flags,
+					struct sockaddr * from, socklen_t * fromlen,
+					struct timeval * stamp)
+{
+	char ctrl[CMSG_SPACE(sizeof(struct timespec))];
+	struct timespec *ts;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t err;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	setzero(&msg, sizeof(msg));
+	msg.msg_name = from;
+	msg.msg_namelen = *fromlen;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	if ((err = recvmsg(s, &msg, flags)) < 0) {
+		error("inet_recvfrom: Cannot recv(): %s", strerror(errno));
+		return err;
+	}
+	*fromlen = msg.msg_namelen;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			ts = (struct timespec *) CMSG_DATA(cmsg);
+			stamp->tv_sec = ts->tv_sec;
+			stamp->tv_usec = ts->tv_nsec / 1000;
+			return err;
+		}
+
+	gettimeofday(stamp, 0);
+	return err;
+}
+
 /*
  * inet_recvfrom_timeout: is the same as inet_recvfrom() but if no reply is
  * received for `timeout' seconds it returns -1.
@@ -1135,6 +1274,49 @@ inet_sendto(int s, const void *msg, size_t len, int flags,
 	return err;
 }
 
+/*
+ * inet_sendmmsg
+ *
+ * sends the `n' buffers `bufs', each `lens'[i] bytes long, on the connected
+ * socket `s', with a single sendmmsg() call. If the kernel sends only the
+ * first ones, the others are sent with another call.
+ * It returns the number of buffers sent, or -1 if not a single one could
+ * be sent.
+ */
+int
+inet_sendmmsg(int s, char **bufs, size_t * lens, int n, int flags)
+{
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	int i, ret, err, sent = 0;
+
+	msgs = xzalloc(sizeof(struct mmsghdr) * n);
+	iov = xmalloc(sizeof(struct iovec) * n);
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < n) {
+		if ((ret = sendmmsg(s, msgs + sent, n - sent, flags)) <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			/* The caller may want to know why */
+			err = errno;
+			error("inet_sendmmsg: Cannot sendmmsg(): %s", strerror(err));
+			errno = err;
+			break;
+		}
+		sent += ret;
+	}
+
+	xfree(iov);
+	xfree(msgs);
+	return sent ? sent : -1;
+}
+
 /*
  * inet_sendto_timeout: is the same as inet_sendto() but if the packet isn't sent
  * in `timeout' seconds it timeouts and returns -1.
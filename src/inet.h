@@ -187,6 +187,9 @@ int set_broadcast_sk(int socket, int family, inet_prefix * host,
 					 short port, int dev_idx);
 int new_broadcast_sk(int family, int dev_idx);
 int set_tos_sk(int socket, int lowdelay);
+int set_timestamp_sk(int socket);
+int set_tx_timestamp_sk(int socket);
+int inet_get_tx_stamp(int s, struct timeval *stamp, u_int * id);
 
 int new_tcp_conn(inet_prefix * host, short port, char *dev);
 int new_udp_conn(inet_prefix * host, short port, char *dev);
@@ -195,6 +198,9 @@ int new_bcast_conn(inet_prefix * host, short port, int dev_idx);
 ssize_t inet_recv(int s, void *buf, size_t len, int flags);
 ssize_t inet_recvfrom(int s, void *buf, size_t len, int flags,
 					  struct sockaddr *from, socklen_t * fromlen);
+ssize_t inet_recvfrom_stamp(int s, void *buf, size_t len, int flags,
+							struct sockaddr *from, socklen_t * fromlen,
+							struct timeval *stamp);
 ssize_t inet_recv_timeout(int s, void *buf, size_t len, int flags,
 						  u_int timeout);
 ssize_t inet_recvfrom_timeout(int s, void *buf, size_t len, int flags,
@@ -205,6 +211,7 @@ ssize_t inet_sendto(int s, const void *msg, size_t len, int flags,
 					const struct sockaddr *to, socklen_t tolen);
 ssize_t inet_send_timeout(int s, const void *msg, size_t len, int flags,
 						  u_int timeout);
+int inet_sendmmsg(int s, char **bufs, size_t * lens, int n, int flags);
 ssize_t inet_sendto_timeout(int s, const void *msg, size_t len, int flags,
 							const struct sockaddr *to, socklen_t tolen,
 							u_int timeout);
@@ -23,6 +23,16 @@
 
 #include "ipv6-gmp.h"
 
+/*
+ * The 128bit numbers are arrays of four u_int, the least significant one
+ * first (see inet_ntohl()). All the operations are done modulo 2^128.
+ * By default they are done natively, with the unsigned __int128 of the
+ * compiler or, if it hasn't got one, carrying between the u_ints. If ntkd
+ * is built with `gmp=yes' they are done with the GMP library.
+ */
+
+#ifdef USE_GMP
+
 /*y=x+y*/
 int
 sum_128(unsigned int *x, unsigned int *y)
@@ -37,6 +47,7 @@ sum_128(unsigned int *x, unsigned int *y)
 	mpz_import(yy, 4, HOST_ORDER, sizeof(y[0]), NATIVE_ENDIAN, 0, y);
 
 	mpz_add(res, xx, yy);
+	mpz_fdiv_r_2exp(res, res, 128);
 	memset(y, '\0', sizeof(y[0]) * 4);
 	mpz_export(y, &count, HOST_ORDER, sizeof(x[0]), NATIVE_ENDIAN, 0, res);
 
@@ -46,16 +57,6 @@ sum_128(unsigned int *x, unsigned int *y)
 	return 0;
 }
 
-/*y=x+y*/
-int
-sum_int(unsigned int x, unsigned int *y)
-{
-	unsigned int z[4] = ZERO128;
-
-	z[3] = x;
-	return sum_128(z, y);
-}
-
 /*y=x-y*/
 int
 sub_128(unsigned int *x, unsigned int *y)
@@ -70,6 +71,7 @@ sub_128(unsigned int *x, unsigned int *y)
 	mpz_import(yy, 4, HOST_ORDER, sizeof(y[0]), NATIVE_ENDIAN, 0, y);
 
 	mpz_sub(res, xx, yy);
+	mpz_fdiv_r_2exp(res, res, 128);
 	memset(y, '\0', sizeof(y[0]) * 4);
 	mpz_export(y, &count, HOST_ORDER, sizeof(x[0]), NATIVE_ENDIAN, 0, res);
 
@@ -79,16 +81,6 @@ sub_128(unsigned int *x, unsigned int *y)
 	return 0;
 }
 
-/* y=y-x */
-int
-sub_int(unsigned int *y, unsigned int x)
-{
-	unsigned int z[4] = ZERO128;
-
-	z[3] = x;
-	return sub_128(z, y);
-}
-
 /*y=x/y*/
 int
 div_128(unsigned int *x, unsigned int *y)
@@ -102,6 +94,13 @@ div_128(unsigned int *x, unsigned int *y)
 	mpz_import(xx, 4, HOST_ORDER, sizeof(x[0]), NATIVE_ENDIAN, 0, x);
 	mpz_import(yy, 4, HOST_ORDER, sizeof(y[0]), NATIVE_ENDIAN, 0, y);
 
+	if (!mpz_sgn(yy)) {
+		mpz_clear(xx);
+		mpz_clear(yy);
+		mpz_clear(res);
+		return -1;
+	}
+
 	mpz_tdiv_q(res, xx, yy);
 	memset(y, '\0', sizeof(y[0]) * 4);
 	mpz_export(y, &count, HOST_ORDER, sizeof(x[0]), NATIVE_ENDIAN, 0, res);
@@ -112,16 +111,6 @@ div_128(unsigned int *x, unsigned int *y)
 	return 0;
 }
 
-/* y=y/x */
-int
-div_int(unsigned int *y, unsigned int x)
-{
-	unsigned int z[4] = ZERO128;
-
-	z[3] = x;
-	return div_128(z, y);
-}
-
 /* y=y/x */
 int
 div_mpz(unsigned int *y, mpz_t x)
@@ -148,13 +137,18 @@ htonl_128(unsigned int *x, unsigned int *y)
 {
 	mpz_t xx;
 	size_t count;
+	unsigned int t[4] = ZERO128;
 
 	mpz_init(xx);
 	mpz_import(xx, 4, HOST_ORDER, sizeof(x[0]), NATIVE_ENDIAN, 0, x);
-	memset(y, '\0', sizeof(y[0]) * 4);
-	mpz_export(y, &count, NETWORK_ORDER, sizeof(x[0]), NETWORK_ENDIAN, 0,
+	mpz_export(t, &count, NETWORK_ORDER, sizeof(x[0]), NETWORK_ENDIAN, 0,
 			   xx);
 	mpz_clear(xx);
+
+	/* The most significant word is the first, the missing ones are the
+	 * leading zeros */
+	memset(y, '\0', sizeof(y[0]) * 4);
+	memcpy(y + 4 - count, t, sizeof(t[0]) * count);
 	return 0;
 }
 
@@ -172,3 +166,219 @@ ntohl_128(unsigned int *x, unsigned int *y)
 
 	return 0;
 }
+
+#elif defined(__SIZEOF_INT128__)
+
+/*
+ * The compiler has a native 128bit integer: the u_ints are converted to it
+ * and back.
+ */
+
+unsigned __int128
+u128_get(unsigned int *x)
+{
+	return (unsigned __int128) x[3] << 96 | (unsigned __int128) x[2] << 64 |
+		(unsigned __int128) x[1] << 32 | x[0];
+}
+
+void
+u128_put(unsigned __int128 n, unsigned int *y)
+{
+	y[0] = (unsigned int) n;
+	y[1] = (unsigned int) (n >> 32);
+	y[2] = (unsigned int) (n >> 64);
+	y[3] = (unsigned int) (n >> 96);
+}
+
+/*y=x+y*/
+int
+sum_128(unsigned int *x, unsigned int *y)
+{
+	u128_put(u128_get(x) + u128_get(y), y);
+	return 0;
+}
+
+/*y=x-y*/
+int
+sub_128(unsigned int *x, unsigned int *y)
+{
+	u128_put(u128_get(x) - u128_get(y), y);
+	return 0;
+}
+
+/*y=x/y. If `y' is zero -1 is returned */
+int
+div_128(unsigned int *x, unsigned int *y)
+{
+	unsigned __int128 d;
+
+	if (!(d = u128_get(y)))
+		return -1;
+	u128_put(u128_get(x) / d, y);
+	return 0;
+}
+
+#else							/* !USE_GMP && !__SIZEOF_INT128__ */
+
+/*y=x+y*/
+int
+sum_128(unsigned int *x, unsigned int *y)
+{
+	uint64_t carry = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		carry += (uint64_t) x[i] + y[i];
+		y[i] = (unsigned int) carry;
+		carry >>= 32;
+	}
+
+	return 0;
+}
+
+/*y=x-y*/
+int
+sub_128(unsigned int *x, unsigned int *y)
+{
+	uint64_t diff, borrow = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		diff = (uint64_t) x[i] - y[i] - borrow;
+		y[i] = (unsigned int) diff;
+		/* If it wrapped, the high half is all ones */
+		borrow = (diff >> 32) & 1;
+	}
+
+	return 0;
+}
+
+/*
+ * div_128
+ *
+ * y=x/y. If `y' fits in an u_int, each u_int of `x' is divided with the
+ * remainder of the previous one, otherwise it is a binary long division.
+ * If `y' is zero -1 is returned.
+ */
+int
+div_128(unsigned int *x, unsigned int *y)
+{
+	unsigned int q[4] = ZERO128, r[4] = ZERO128, d[4], t[4];
+	uint64_t rem = 0;
+	int i, bit;
+
+	memcpy(d, y, sizeof(d));
+
+	if (!d[3] && !d[2] && !d[1]) {
+		if (!d[0])
+			return -1;
+
+		for (i = 3; i >= 0; i--) {
+			rem = (rem << 32) | x[i];
+			q[i] = (unsigned int) (rem / d[0]);
+			rem %= d[0];
+		}
+	} else {
+		/* The leading zero words of `x' don't add anything to `r' */
+		for (bit = 127; bit >= 0 && !x[bit / 32]; bit -= 32);
+		for (; bit >= 0; bit--) {
+			/* r = r<<1 | the `bit'th bit of x */
+			for (i = 3; i > 0; i--)
+				r[i] = (r[i] << 1) | (r[i - 1] >> 31);
+			r[0] = (r[0] << 1) | ((x[bit / 32] >> (bit % 32)) & 1);
+
+			if (cmp_128(r, d) >= 0) {
+				memcpy(t, d, sizeof(t));
+				sub_128(r, t);
+				memcpy(r, t, sizeof(r));
+				q[bit / 32] |= 1U << (bit % 32);
+			}
+		}
+	}
+
+	memcpy(y, q, sizeof(q));
+	return 0;
+}
+
+#endif							/* USE_GMP */
+
+#ifndef USE_GMP
+
+int
+htonl_128(unsigned int *x, unsigned int *y)
+{
+	unsigned int t[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		t[i] = htonl(x[3 - i]);
+	memcpy(y, t, sizeof(t));
+
+	return 0;
+}
+
+int
+ntohl_128(unsigned int *x, unsigned int *y)
+{
+	unsigned int t[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		t[i] = ntohl(x[3 - i]);
+	memcpy(y, t, sizeof(t));
+
+	return 0;
+}
+
+#endif							/* USE_GMP */
+
+/*
+ * cmp_128
+ *
+ * returns 1 if x > y, -1 if x < y and 0 if they are equal.
+ */
+int
+cmp_128(unsigned int *x, unsigned int *y)
+{
+	int i;
+
+	for (i = 3; i >= 0; i--)
+		if (x[i] != y[i])
+			return x[i] > y[i] ? 1 : -1;
+	return 0;
+}
+
+/*y=x+y*/
+int
+sum_int(unsigned int x, unsigned int *y)
+{
+	unsigned int z[4] = ZERO128;
+
+	z[0] = x;
+	return sum_128(z, y);
+}
+
+/* y=y-x */
+int
+sub_int(unsigned int *y, unsigned int x)
+{
+	unsigned int z[4] = ZERO128;
+
+	z[0] = x;
+	sub_128(y, z);
+	memcpy(y, z, sizeof(z));
+	return 0;
+}
+
+/* y=y/x */
+int
+div_int(unsigned int *y, unsigned int x)
+{
+	unsigned int z[4] = ZERO128;
+	int ret;
+
+	z[0] = x;
+	if (!(ret = div_128(y, z)))
+		memcpy(y, z, sizeof(z));
+	return ret;
+}
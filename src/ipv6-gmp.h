@@ -38,7 +38,14 @@ int sub_int(unsigned int *, unsigned int);
 int sub_128(unsigned int *, unsigned int *);
 int div_128(unsigned int *, unsigned int *);
 int div_int(unsigned int *, unsigned int);
+#ifdef USE_GMP
 int div_mpz(unsigned int *, mpz_t);
+#endif
+int cmp_128(unsigned int *, unsigned int *);
+#if !defined(USE_GMP) && defined(__SIZEOF_INT128__)
+unsigned __int128 u128_get(unsigned int *);
+void u128_put(unsigned __int128, unsigned int *);
+#endif
 int htonl_128(unsigned int *, unsigned int *);
 int ntohl_128(unsigned int *, unsigned int *);
 
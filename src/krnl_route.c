@@ -29,6 +29,7 @@
 #include "krnl_route.h"
 #include "libnetlink.h"
 #include "ll_map.h"
+#include "krnl_state.h"
 #include "common.h"
 
 #ifdef LINUX_2_6_14
@@ -224,7 +225,8 @@ route_exec(int route_cmd, int route_type, int route_scope, unsigned flags,
 	if (rtnl_open(&rth, 0) < 0)
 		return -1;
 
-	if (dev || nhops)
+	if ((dev || nhops) && !krnl_state_live)
+		/* Otherwise the ll_map is already up to date */
 		ll_init_map(&rth);
 
 #ifdef LINUX_2_6_14
@@ -269,6 +271,10 @@ route_exec(int route_cmd, int route_type, int route_scope, unsigned flags,
 	if (req.rt.rtm_family == AF_UNSPEC)
 		req.rt.rtm_family = AF_INET;
 
+	/* The mirror mustn't be trusted until the kernel notifies the change */
+	if (to && table != RT_TABLE_LOCAL)
+		krnl_rt_forget(req.rt.rtm_family, table, to);
+
 	/*Finaly stage: <<Hey krnl, r u there?>> */
 	if (rtnl_talk(&rth, &req.nh, 0, 0, NULL, NULL, NULL) < 0)
 		return -1;
@@ -439,6 +445,8 @@ route_get_gw(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
  * which has the prefix equal to `prefix', if it is found its destination
  * address is stored in `dst' and its interface name in `dev_name' (which must
  * be IFNAMSIZ big).
+ * The route is searched in the kernel state mirror first, the routing table
+ * is dumped only if it can't tell.
  */
 int
 route_get_exact_prefix_dst(inet_prefix prefix, inet_prefix * dst,
@@ -448,6 +456,9 @@ route_get_exact_prefix_dst(inet_prefix prefix, inet_prefix * dst,
 	struct rtnl_handle rth;
 	char dst_data[sizeof(inet_prefix) + IFNAMSIZ];
 
+	if (!krnl_rt_get_dst(prefix, dst, dev_name))
+		return 0;
+
 	route_reset_filter();
 	filter.tb = RT_TABLE_MAIN;
 
@@ -460,7 +471,8 @@ route_get_exact_prefix_dst(inet_prefix prefix, inet_prefix * dst,
 	if (rtnl_open(&rth, 0) < 0)
 		return -1;
 
-	ll_init_map(&rth);
+	if (!krnl_state_live)
+		ll_init_map(&rth);
 
 	if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
 		error(ERROR_MSG "Cannot send dump request" ERROR_POS);
@@ -0,0 +1,701 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * krnl_state.c
+ *
+ * The in-memory mirror of the links, addresses and routes of the kernel,
+ * kept updated by the rtnetlink events.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "inet.h"
+#include "hash.h"
+#include "request.h"
+#include "pkts.h"
+#include "bmap.h"
+#include "radar.h"
+#include "netsukuku.h"
+#include "libnetlink.h"
+#include "ll_map.h"
+#include "krnl_state.h"
+
+/*
+ * krnl_state_init
+ *
+ * opens the netlink socket subscribed to the KRNL_STATE_GROUPS and fills the
+ * mirror. The krnl_state_daemon() has to be started afterwards.
+ * On error -1 is returned and the mirror is disabled.
+ */
+int
+krnl_state_init(void)
+{
+	int rcvbuf = KRNL_STATE_RCVBUF;
+
+	krnl_state_live = 0;
+	krnl_addrs = 0;
+	krnl_addrs_counter = 0;
+	setzero(krnl_rt_hash, sizeof(krnl_rt_hash));
+	krnl_rts_counter = 0;
+	krnl_events = krnl_resyncs = krnl_lookups = krnl_rt_skipped = 0;
+	pthread_mutex_init(&krnl_state_mutex, 0);
+
+	if (rtnl_open(&krnl_state_rth, KRNL_STATE_GROUPS) < 0) {
+		error("krnl_state_init(): cannot open the netlink socket, the "
+			  "kernel state mirror is disabled");
+		krnl_state_rth.fd = -1;
+		return -1;
+	}
+
+	/* A burst of route events mustn't overrun the socket */
+	if (setsockopt(krnl_state_rth.fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+				   sizeof(rcvbuf)) < 0)
+		setsockopt(krnl_state_rth.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+				   sizeof(rcvbuf));
+
+	if (krnl_state_dump() < 0) {
+		rtnl_close(&krnl_state_rth);
+		krnl_state_rth.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * krnl_state_reset
+ *
+ * forgets all the addresses and routes of the mirror. The links stay in the
+ * ll_map. krnl_state_mutex must be locked.
+ */
+void
+krnl_state_reset(void)
+{
+	struct krnl_rt *rt, *next;
+	int i;
+
+	if (krnl_addrs_counter)
+		clist_destroy(&krnl_addrs, &krnl_addrs_counter);
+	krnl_addrs = 0;
+
+	for (i = 0; i < KRNL_RT_HASH_SZ; i++) {
+		rt = krnl_rt_hash[i];
+		list_safe_for(rt, next)
+			list_free(rt);
+		krnl_rt_hash[i] = 0;
+	}
+	krnl_rts_counter = 0;
+}
+
+/*
+ * krnl_state_dump
+ *
+ * fills the mirror from scratch, dumping the links, the addresses and the
+ * routes of the kernel. The events received meanwhile are queued in
+ * `krnl_state_rth' and they will be applied afterwards.
+ * On error -1 is returned and the mirror isn't live.
+ */
+int
+krnl_state_dump(void)
+{
+	struct rtnl_handle rth;
+	int types[] = { RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE };
+	int i, ret = 0;
+
+	pthread_mutex_lock(&krnl_state_mutex);
+	krnl_state_live = 0;
+	krnl_state_reset();
+	pthread_mutex_unlock(&krnl_state_mutex);
+
+	if (rtnl_open(&rth, 0) < 0) {
+		error("krnl_state_dump(): cannot open the netlink socket");
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(types) / sizeof(int); i++) {
+		if (rtnl_wilddump_request(&rth, AF_UNSPEC, types[i]) < 0) {
+			error(ERROR_MSG "Cannot send dump request", ERROR_POS);
+			ERROR_FINISH(ret, -1, finish);
+		}
+		if (rtnl_dump_filter(&rth, krnl_state_event, 0, NULL, NULL) < 0) {
+			error(ERROR_MSG "Dump terminated", ERROR_POS);
+			ERROR_FINISH(ret, -1, finish);
+		}
+	}
+
+	krnl_state_live = 1;
+	debug(DBG_NORMAL, "Kernel state mirror: %d addresses, %d routes",
+		  krnl_addrs_counter, krnl_rts_counter);
+
+  finish:
+	rtnl_close(&rth);
+	return ret;
+}
+
+/*
+ * krnl_state_event
+ *
+ * applies the rtnetlink message `n' to the mirror. It is the filter of
+ * both the dumps and the events.
+ */
+int
+krnl_state_event(const struct sockaddr_nl *who, struct nlmsghdr *n,
+				 void *arg)
+{
+	pthread_mutex_lock(&krnl_state_mutex);
+	switch (n->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		krnl_link_event(n);
+		break;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		krnl_addr_event(n);
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		krnl_rt_event(n);
+		break;
+	}
+	krnl_events++;
+	pthread_mutex_unlock(&krnl_state_mutex);
+
+	return 0;
+}
+
+/*
+ * krnl_link_event
+ *
+ * updates the ll_map. If one of me.cur_ifs has been removed or its flags
+ * changed, the radar is woken up.
+ */
+void
+krnl_link_event(struct nlmsghdr *n)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	unsigned old_flags;
+	int d;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return;
+
+	old_flags = ll_index_to_flags(ifi->ifi_index);
+	ll_remember_index(0, n, 0);
+
+	for (d = 0; d < me.cur_ifs_n; d++)
+		if (me.cur_ifs[d].dev_idx == ifi->ifi_index) {
+			if (n->nlmsg_type == RTM_DELLINK ||
+				old_flags != ll_index_to_flags(ifi->ifi_index))
+				radar_wakeup();
+			break;
+		}
+}
+
+/*
+ * krnl_addr_event
+ *
+ * adds or deletes the address carried by `n'. The addresses are kept in the
+ * same order of the kernel, so the primary one of each interface comes
+ * first.
+ */
+void
+krnl_addr_event(struct nlmsghdr *n)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	struct rtattr *tb[IFA_MAX + 1], *rta;
+	struct krnl_addr *a;
+	u_int data[MAX_IP_INT];
+	inet_prefix ip;
+	int len;
+
+	len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+	if (len < 0)
+		return;
+	if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+		return;
+
+	setzero(tb, sizeof(tb));
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+
+	/* On a point-to-point link IFA_ADDRESS is the peer */
+	if (!(rta = tb[IFA_LOCAL] ? tb[IFA_LOCAL] : tb[IFA_ADDRESS]))
+		return;
+	if (RTA_PAYLOAD(rta) > sizeof(data))
+		return;
+
+	setzero(data, sizeof(data));
+	memcpy(data, RTA_DATA(rta), RTA_PAYLOAD(rta));
+	setzero(&ip, sizeof(ip));
+	inet_setip(&ip, data, ifa->ifa_family);
+
+	a = krnl_addrs;
+	list_for(a)
+		if (a->dev_idx == ifa->ifa_index && a->ip.family == ip.family &&
+			!memcmp(a->ip.data, ip.data, sizeof(ip.data)))
+		break;
+
+	if (n->nlmsg_type == RTM_DELADDR) {
+		if (a)
+			clist_del(&krnl_addrs, &krnl_addrs_counter, a);
+		return;
+	}
+
+	if (!a) {
+		a = xzalloc(sizeof(struct krnl_addr));
+		a->dev_idx = ifa->ifa_index;
+		inet_copy(&a->ip, &ip);
+		clist_append(&krnl_addrs, 0, &krnl_addrs_counter, a);
+	}
+	a->prefixlen = ifa->ifa_prefixlen;
+	a->scope = ifa->ifa_scope;
+	a->flags = ifa->ifa_flags;
+}
+
+/*
+ * krnl_addr_get
+ *
+ * stores in `ip' the primary `family' address of the `dev_idx' interface.
+ * It returns 1 if it has been found, 0 if the interface hasn't any, -1 if
+ * the mirror can't tell.
+ */
+int
+krnl_addr_get(int dev_idx, int family, inet_prefix * ip)
+{
+	struct krnl_addr *a;
+	int ret = 0;
+
+	if (!krnl_state_live)
+		return -1;
+
+	pthread_mutex_lock(&krnl_state_mutex);
+	a = krnl_addrs;
+	list_for(a)
+		if (a->dev_idx == dev_idx && a->ip.family == family &&
+			!(a->flags & IFA_F_SECONDARY)) {
+		inet_copy(ip, &a->ip);
+		ret = 1;
+		break;
+	}
+	krnl_lookups++;
+	pthread_mutex_unlock(&krnl_state_mutex);
+
+	return ret;
+}
+
+/*
+ * krnl_rt_mask
+ *
+ * zeroes the bits of `dst' which are beyond its prefix, so that two equal
+ * prefixes have the same bytes.
+ */
+void
+krnl_rt_mask(inet_prefix * dst)
+{
+	u_char *p = (u_char *) dst->data;
+	int i;
+
+	dst->len = dst->family == AF_INET ? 4 : 16;
+	for (i = 0; i < dst->len; i++)
+		if (i * 8 >= dst->bits)
+			p[i] = 0;
+		else if ((i + 1) * 8 > dst->bits)
+			p[i] &= 0xff << (8 - (dst->bits - i * 8));
+}
+
+u_int
+krnl_rt_hash_key(int family, u_char table, inet_prefix * dst)
+{
+	u_long h;
+
+	h = fnv_32_buf(&family, sizeof(int), FNV1_32_INIT);
+	h = fnv_32_buf(&table, sizeof(u_char), h);
+	h = fnv_32_buf(&dst->bits, sizeof(dst->bits), h);
+	h = fnv_32_buf(dst->data, dst->len, h);
+
+	return h % KRNL_RT_HASH_SZ;
+}
+
+/*
+ * krnl_rt_find
+ *
+ * returns the mirrored route with the given key, or 0. `dst' must be
+ * masked with krnl_rt_mask(). krnl_state_mutex must be locked.
+ */
+struct krnl_rt *
+krnl_rt_find(int family, u_char table, inet_prefix * dst, u_char tos,
+			 u_int priority)
+{
+	struct krnl_rt *rt;
+
+	rt = krnl_rt_hash[krnl_rt_hash_key(family, table, dst)];
+	list_for(rt)
+		if (rt->family == family && rt->table == table &&
+			rt->dst.bits == dst->bits && rt->tos == tos &&
+			rt->priority == priority &&
+			!memcmp(rt->dst.data, dst->data, dst->len))
+		return rt;
+
+	return 0;
+}
+
+/*
+ * krnl_rt_event
+ *
+ * adds, updates or deletes the route carried by `n'. The cloned routes and
+ * the ones of the local table aren't mirrored.
+ */
+void
+krnl_rt_event(struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX + 1], *ntb[RTA_MAX + 1];
+	struct rtnexthop *rtnh;
+	struct krnl_rt *rt, **head;
+	struct krnl_nh *nh;
+	inet_prefix dst;
+	u_int table, priority;
+	int len;
+
+	len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	if (len < 0)
+		return;
+	if (r->rtm_family != AF_INET && r->rtm_family != AF_INET6)
+		return;
+	if (r->rtm_flags & RTM_F_CLONED)
+		return;
+
+	setzero(tb, sizeof(tb));
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	table = tb[RTA_TABLE] ? *(u_int *) RTA_DATA(tb[RTA_TABLE]) :
+		r->rtm_table;
+	if (table == RT_TABLE_LOCAL || table > 0xff)
+		return;
+	priority = tb[RTA_PRIORITY] ? *(u_int *) RTA_DATA(tb[RTA_PRIORITY]) : 0;
+
+	setzero(&dst, sizeof(dst));
+	dst.family = r->rtm_family;
+	dst.bits = r->rtm_dst_len;
+	if (tb[RTA_DST] && RTA_PAYLOAD(tb[RTA_DST]) <= sizeof(dst.data))
+		memcpy(dst.data, RTA_DATA(tb[RTA_DST]), RTA_PAYLOAD(tb[RTA_DST]));
+	krnl_rt_mask(&dst);
+
+	head = &krnl_rt_hash[krnl_rt_hash_key(dst.family, table, &dst)];
+	rt = krnl_rt_find(dst.family, table, &dst, r->rtm_tos, priority);
+
+	if (n->nlmsg_type == RTM_DELROUTE) {
+		if (rt) {
+			*head = list_del(*head, rt);
+			krnl_rts_counter--;
+		}
+		return;
+	}
+
+	if (!rt) {
+		rt = xzalloc(sizeof(struct krnl_rt));
+		rt->family = dst.family;
+		rt->table = table;
+		rt->tos = r->rtm_tos;
+		rt->priority = priority;
+		inet_copy(&rt->dst, &dst);
+		*head = list_add(*head, rt);
+		krnl_rts_counter++;
+	}
+	rt->protocol = r->rtm_protocol;
+	rt->scope = r->rtm_scope;
+	rt->type = r->rtm_type;
+	rt->flags &= ~KRNL_RT_STALE;
+
+	setzero(rt->nh, sizeof(rt->nh));
+	rt->nh_n = 0;
+	if (tb[RTA_MULTIPATH]) {
+		rtnh = RTA_DATA(tb[RTA_MULTIPATH]);
+		len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+		for (; len >= sizeof(*rtnh) && rtnh->rtnh_len <= len &&
+			 rt->nh_n < MAX_MULTIPATH_ROUTES; rtnh = RTNH_NEXT(rtnh)) {
+			nh = &rt->nh[rt->nh_n++];
+			nh->oif = rtnh->rtnh_ifindex;
+			nh->hops = rtnh->rtnh_hops;
+
+			setzero(ntb, sizeof(ntb));
+			if (rtnh->rtnh_len > sizeof(*rtnh))
+				parse_rtattr(ntb, RTA_MAX, RTNH_DATA(rtnh),
+							 rtnh->rtnh_len - sizeof(*rtnh));
+			if (ntb[RTA_GATEWAY] &&
+				RTA_PAYLOAD(ntb[RTA_GATEWAY]) <= sizeof(nh->gw.data)) {
+				nh->gw.family = rt->family;
+				nh->gw.len = RTA_PAYLOAD(ntb[RTA_GATEWAY]);
+				memcpy(nh->gw.data, RTA_DATA(ntb[RTA_GATEWAY]), nh->gw.len);
+			}
+			len -= NLMSG_ALIGN(rtnh->rtnh_len);
+		}
+	} else if (tb[RTA_GATEWAY] || tb[RTA_OIF]) {
+		nh = &rt->nh[rt->nh_n++];
+		if (tb[RTA_OIF])
+			nh->oif = *(int *) RTA_DATA(tb[RTA_OIF]);
+		if (tb[RTA_GATEWAY] &&
+			RTA_PAYLOAD(tb[RTA_GATEWAY]) <= sizeof(nh->gw.data)) {
+			nh->gw.family = rt->family;
+			nh->gw.len = RTA_PAYLOAD(tb[RTA_GATEWAY]);
+			memcpy(nh->gw.data, RTA_DATA(tb[RTA_GATEWAY]), nh->gw.len);
+		}
+	}
+}
+
+/*
+ * krnl_rt_forget
+ *
+ * marks as stale all the mirrored routes to `dst' (in network order) of the
+ * `table', because we are going to write them. If there isn't any, a stale
+ * placeholder is added: until the kernel notifies the change, nobody will
+ * trust the mirror about `dst'.
+ */
+void
+krnl_rt_forget(int family, u_char table, inet_prefix * dst)
+{
+	struct krnl_rt *rt, **head;
+	inet_prefix key;
+	int found = 0;
+
+	if (!table)
+		table = RT_TABLE_MAIN;
+	inet_copy(&key, dst);
+	key.family = family;
+	krnl_rt_mask(&key);
+
+	pthread_mutex_lock(&krnl_state_mutex);
+	head = &krnl_rt_hash[krnl_rt_hash_key(family, table, &key)];
+	rt = *head;
+	list_for(rt)
+		if (rt->family == family && rt->table == table &&
+			rt->dst.bits == key.bits &&
+			!memcmp(rt->dst.data, key.data, key.len)) {
+		rt->flags |= KRNL_RT_STALE;
+		found++;
+	}
+
+	if (!found) {
+		rt = xzalloc(sizeof(struct krnl_rt));
+		rt->family = family;
+		rt->table = table;
+		inet_copy(&rt->dst, &key);
+		rt->flags = KRNL_RT_STALE;
+		*head = list_add(*head, rt);
+		krnl_rts_counter++;
+	}
+	pthread_mutex_unlock(&krnl_state_mutex);
+}
+
+/*
+ * krnl_rt_uptodate
+ *
+ * tells if the kernel already has the route to `to' (in network order) via
+ * the `nh' nexthops, which route_replace() would write. If `nh' is null, it
+ * tells if the kernel hasn't any route to `to', as route_del() would leave
+ * it.
+ * It returns 1 if the route is up to date, 0 if it isn't, -1 if the mirror
+ * can't tell.
+ */
+int
+krnl_rt_uptodate(inet_prefix * to, struct nexthop *nh, int scope,
+				 u_char table)
+{
+	struct krnl_rt *rt, *found = 0;
+	inet_prefix key;
+	int i, hops, ret = -1;
+
+	if (!krnl_state_live)
+		return -1;
+
+	if (!table)
+		table = RT_TABLE_MAIN;
+	inet_copy(&key, to);
+	krnl_rt_mask(&key);
+
+	pthread_mutex_lock(&krnl_state_mutex);
+	krnl_lookups++;
+
+	rt = krnl_rt_hash[krnl_rt_hash_key(key.family, table, &key)];
+	list_for(rt)
+		if (rt->family == key.family && rt->table == table &&
+			rt->dst.bits == key.bits &&
+			!memcmp(rt->dst.data, key.data, key.len)) {
+		if (rt->flags & KRNL_RT_STALE)
+			goto finish;
+		if (!rt->tos && !rt->priority)
+			found = rt;
+		else if (!nh)
+			/* route_del() would delete it */
+			ERROR_FINISH(ret, 0, finish);
+	}
+
+	if (!nh) {
+		ret = !found;
+		goto finish;
+	}
+	if (!found)
+		ERROR_FINISH(ret, 0, finish);
+
+	rt = found;
+	ret = 0;
+	if (rt->protocol != RTPROT_NETSUKUKU || rt->type != RTN_UNICAST ||
+		rt->scope != (scope ? scope : RT_SCOPE_UNIVERSE))
+		goto finish;
+
+	for (i = 0; nh[i].dev; i++) {
+		if (i >= rt->nh_n || rt->nh[i].oif != ll_name_to_index(nh[i].dev))
+			goto finish;
+		if (rt->nh[i].gw.len != nh[i].gw.len ||
+			memcmp(rt->nh[i].gw.data, nh[i].gw.data, nh[i].gw.len))
+			goto finish;
+
+		/* The hops are written only in the multipath routes, and
+		 * the IPv6 ones ignore them */
+		hops = nh[i].hops ? nh[i].hops - 1 : 255;
+		if (nh[1].dev && key.family == AF_INET && rt->nh[i].hops != hops)
+			goto finish;
+	}
+	ret = i == rt->nh_n;
+
+  finish:
+	if (ret > 0)
+		krnl_rt_skipped++;
+	pthread_mutex_unlock(&krnl_state_mutex);
+	return ret;
+}
+
+/*
+ * krnl_rt_get_dst
+ *
+ * It is the route_get_exact_prefix_dst() of the mirror: it searches in the
+ * main table the route with the `prefix' (in host order) and stores its
+ * gateway in `dst' and its interface name in `dev_name' (IFNAMSIZ bytes).
+ * If there are many, the one with the lowest metric is taken. If there
+ * isn't any, they are zeroed.
+ * On error, or if the mirror can't tell, -1 is returned.
+ */
+int
+krnl_rt_get_dst(inet_prefix prefix, inet_prefix * dst, char *dev_name)
+{
+	struct krnl_rt *rt, *best = 0;
+	struct krnl_nh *nh = 0;
+	inet_prefix key;
+	u_char table = RT_TABLE_MAIN;
+	int i, ret = 0;
+
+	if (!krnl_state_live)
+		return -1;
+
+	inet_copy(&key, &prefix);
+	inet_htonl(key.data, key.family);
+	krnl_rt_mask(&key);
+
+	setzero(dst, sizeof(inet_prefix));
+	setzero(dev_name, IFNAMSIZ);
+
+	pthread_mutex_lock(&krnl_state_mutex);
+	krnl_lookups++;
+
+	rt = krnl_rt_hash[krnl_rt_hash_key(key.family, table, &key)];
+	list_for(rt)
+		if (rt->family == key.family && rt->table == table &&
+			rt->dst.bits == key.bits &&
+			!memcmp(rt->dst.data, key.data, key.len)) {
+		if (rt->flags & KRNL_RT_STALE)
+			ERROR_FINISH(ret, -1, finish);
+		if (!best || rt->priority < best->priority)
+			best = rt;
+	}
+	if (!best || !best->nh_n)
+		goto finish;
+
+	for (i = 0; i < best->nh_n && !nh; i++)
+		if (best->nh[i].gw.len)
+			nh = &best->nh[i];
+	if (!nh)
+		nh = &best->nh[0];
+
+	if (nh->gw.len)
+		inet_setip(dst, nh->gw.data, nh->gw.family);
+	if (nh->oif)
+		strncpy(dev_name, ll_index_to_name(nh->oif), IFNAMSIZ - 1);
+
+  finish:
+	pthread_mutex_unlock(&krnl_state_mutex);
+	return ret;
+}
+
+/*
+ * krnl_state_daemon
+ *
+ * It receives the rtnetlink events and applies them to the mirror. When the
+ * socket overruns the mirror is dumped again.
+ */
+void *
+krnl_state_daemon(void *null)
+{
+	struct sockaddr_nl nladdr;
+	struct nlmsghdr *h;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	char buf[16384];
+	int status;
+
+	debug(DBG_NORMAL, "Kernel state mirror up & running");
+	iov.iov_base = buf;
+	for (;;) {
+		iov.iov_len = sizeof(buf);
+		status = recvmsg(krnl_state_rth.fd, &msg, 0);
+
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				debug(DBG_NORMAL, "krnl_state_daemon(): events lost, "
+					  "dumping the kernel state again");
+				krnl_resyncs++;
+				if (krnl_state_dump() < 0)
+					break;
+				continue;
+			}
+			error("krnl_state_daemon(): recvmsg: %s", strerror(errno));
+			break;
+		}
+		if (!status) {
+			error("krnl_state_daemon(): EOF on netlink");
+			break;
+		}
+		if (nladdr.nl_pid)
+			/* Only the kernel sends events */
+			continue;
+
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, status);
+			 h = NLMSG_NEXT(h, status))
+			krnl_state_event(&nladdr, h, 0);
+	}
+
+	error("The kernel state mirror is disabled");
+	krnl_state_live = 0;
+	return 0;
+}
@@ -0,0 +1,135 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef KRNL_STATE_H
+#define KRNL_STATE_H
+
+#include "libnetlink.h"
+#include "krnl_route.h"
+#include "route.h"
+#include "llist.c"
+
+/*
+ * The kernel state mirror keeps in memory the links, the addresses and the
+ * routes of the kernel, so that ntkd doesn't have to ask them to the kernel
+ * each time it needs them.
+ *
+ * krnl_state_init() subscribes a netlink socket to the link, address and
+ * route groups and dumps the current state. Then the krnl_state_daemon()
+ * applies each event to the mirror as soon as it is received:
+ *  - the links are kept in the ll_map, which is used by all the
+ *    ll_name_to_index() and ll_index_to_name() of ntkd. When one of
+ *    me.cur_ifs is removed or changes its flags, the radar is woken up.
+ *  - the addresses are used by get_dev_ip().
+ *  - the routes are used by route_get_exact_prefix_dst() and by
+ *    rt_update_node(), which doesn't write a route that the kernel already
+ *    has.
+ *
+ * If the socket overruns, events have been lost: the mirror is dumped
+ * again. While `krnl_state_live' is zero the lookups fail and the callers
+ * ask the kernel directly, as they did before.
+ *
+ * When ntkd writes a route, route_exec() marks it KRNL_RT_STALE with
+ * krnl_rt_forget(), until the kernel notifies it back. A stale route is
+ * never trusted.
+ */
+
+#define KRNL_STATE_GROUPS	(RTMGRP_LINK | RTMGRP_IPV4_IFADDR |		\
+				 RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE |	\
+				 RTMGRP_IPV6_ROUTE)
+#define KRNL_STATE_RCVBUF	(1<<20)
+#define KRNL_RT_HASH_SZ		1024
+
+struct krnl_addr {
+	LLIST_HDR(struct krnl_addr);
+
+	int dev_idx;
+	inet_prefix ip;				/* in host order */
+	u_char prefixlen;
+	u_char scope;
+	u_char flags;				/* IFA_F_ flags */
+};
+
+struct krnl_nh {
+	inet_prefix gw;				/* in network order */
+	int oif;
+	u_char hops;				/* rtnh_hops, it is hops-1 */
+};
+
+/* krnl_rt flags */
+#define KRNL_RT_STALE		1	/* written by us, not yet notified back */
+
+struct krnl_rt {
+	LLIST_HDR(struct krnl_rt);
+
+	/* The key */
+	u_char family;
+	u_char table;
+	u_char tos;
+	u_int priority;
+	inet_prefix dst;			/* in network order, `bits' is the
+								   dst_len */
+
+	u_char protocol;
+	u_char scope;
+	u_char type;
+	u_char flags;
+
+	int nh_n;
+	struct krnl_nh nh[MAX_MULTIPATH_ROUTES];
+};
+
+struct rtnl_handle krnl_state_rth;	/* subscribed to KRNL_STATE_GROUPS */
+pthread_t krnl_state_thread;
+pthread_mutex_t krnl_state_mutex;
+int krnl_state_live;
+
+struct krnl_addr *krnl_addrs;
+int krnl_addrs_counter;
+struct krnl_rt *krnl_rt_hash[KRNL_RT_HASH_SZ];
+int krnl_rts_counter;
+
+u_int krnl_events;				/* Stupid statistics */
+u_int krnl_resyncs;
+u_int krnl_lookups;
+u_int krnl_rt_skipped;
+
+
+/* * * Functions declaration * * */
+int krnl_state_init(void);
+void krnl_state_reset(void);
+int krnl_state_dump(void);
+int krnl_state_event(const struct sockaddr_nl *who, struct nlmsghdr *n,
+					 void *arg);
+void *krnl_state_daemon(void *null);
+
+void krnl_link_event(struct nlmsghdr *n);
+void krnl_addr_event(struct nlmsghdr *n);
+int krnl_addr_get(int dev_idx, int family, inet_prefix * ip);
+
+void krnl_rt_mask(inet_prefix * dst);
+u_int krnl_rt_hash_key(int family, u_char table, inet_prefix * dst);
+struct krnl_rt *krnl_rt_find(int family, u_char table, inet_prefix * dst,
+							 u_char tos, u_int priority);
+void krnl_rt_event(struct nlmsghdr *n);
+void krnl_rt_forget(int family, u_char table, inet_prefix * dst);
+int krnl_rt_uptodate(inet_prefix * to, struct nexthop *nh, int scope,
+					 u_char table);
+int krnl_rt_get_dst(inet_prefix prefix, inet_prefix * dst, char *dev_name);
+
+#endif							/*KRNL_STATE_H */
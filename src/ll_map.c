@@ -10,6 +10,11 @@
  *
  *
  * Alpt: Added ll_first_up_if
+ *
+ * ll_remember_index() handles RTM_DELLINK too, so the map can be kept
+ * updated by the netlink events (see krnl_state.c). The entry of a removed
+ * link isn't freed, its index is just zeroed: the names returned by
+ * ll_index_to_name() stay valid.
  */
 
 #include "includes.h"
@@ -30,6 +35,9 @@ struct idxmap {
 };
 
 static struct idxmap *idxmap[16];
+static char ncache[16];
+static int icache;
+static int max_index;
 
 void
 ll_free_index(void)
@@ -51,30 +59,44 @@ ll_remember_index(struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	struct idxmap *im, **imp;
 	struct rtattr *tb[IFLA_MAX + 1];
 
-	if (n->nlmsg_type != RTM_NEWLINK)
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
 		return 0;
 
-	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(ifi)))
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return -1;
 
+	h = ifi->ifi_index & 0xF;
+
+	if (n->nlmsg_type == RTM_DELLINK) {
+		for (im = idxmap[h]; im; im = im->next)
+			if (im->index == ifi->ifi_index) {
+				im->index = 0;
+				im->flags = 0;
+			}
+		if (icache == ifi->ifi_index)
+			icache = 0;
+		return 0;
+	}
 
 	memset(tb, 0, sizeof(tb));
 	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
 	if (tb[IFLA_IFNAME] == NULL)
 		return 0;
 
-	h = ifi->ifi_index & 0xF;
-
 	for (imp = &idxmap[h]; (im = *imp) != NULL; imp = &im->next)
 		if (im->index == ifi->ifi_index)
 			break;
+	if (im == NULL)
+		/* Reuse the entry of a removed link */
+		for (im = idxmap[h]; im; im = im->next)
+			if (!im->index)
+				break;
 
 	if (im == NULL) {
-		im = xmalloc(sizeof(*im));
+		im = xzalloc(sizeof(*im));
 		if (im == NULL)
 			return 0;
 		im->next = *imp;
-		im->index = ifi->ifi_index;
 		*imp = im;
 	}
 
@@ -90,7 +112,12 @@ ll_remember_index(struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		im->alen = 0;
 		memset(im->addr, 0, sizeof(im->addr));
 	}
-	strcpy(im->name, RTA_DATA(tb[IFLA_IFNAME]));
+	strncpy(im->name, RTA_DATA(tb[IFLA_IFNAME]), sizeof(im->name) - 1);
+	if (icache == ifi->ifi_index)
+		icache = 0;
+	im->index = ifi->ifi_index;
+	if (im->index > max_index)
+		max_index = im->index;
 	return 0;
 }
 
@@ -147,8 +174,6 @@ ll_index_to_flags(int idx)
 int
 ll_name_to_index(const char *name)
 {
-	static char ncache[16];
-	static int icache;
 	struct idxmap *im;
 	int i;
 
@@ -158,7 +183,7 @@ ll_name_to_index(const char *name)
 		return icache;
 	for (i = 0; i < 16; i++) {
 		for (im = idxmap[i]; im; im = im->next) {
-			if (strcmp(im->name, name) == 0) {
+			if (im->index && strcmp(im->name, name) == 0) {
 				icache = im->index;
 				strcpy(ncache, name);
 				return im->index;
@@ -172,13 +197,13 @@ ll_name_to_index(const char *name)
 int
 ll_nth_up_if(int n)
 {
-	unsigned char i, found;
+	int i, found;
 	unsigned flags;
 
 	if (n <= 0)
 		fatal("%s:%d: Bad argument given", ERROR_POS);
 
-	for (found = 0, i = 1; i <= 16; i++) {
+	for (found = 0, i = 1; i <= max_index; i++) {
 		flags = ll_index_to_flags(i);
 		if ((flags & IFF_UP) && !(flags & IFF_LOOPBACK)) {
 			found++;
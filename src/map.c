@@ -266,17 +266,33 @@ reset_int_map(map_node * map, int maxgroupnode)
 		map_node_del(&map[i]);
 }
 
+/*
+ * rnode_cost
+ *
+ * returns the cost of the route of `rnode': its trtt plus the time needed
+ * to transfer RNODE_BW_REF_KBIT Kbit with its bandwidth. If the bandwidth
+ * isn't known only the trtt is used.
+ */
+u_int
+rnode_cost(map_rnode * rnode)
+{
+	if (!rnode->bw)
+		return rnode->trtt;
+	return rnode->trtt + RNODE_BW_REF_KBIT * 1000 / rnode->bw;
+}
+
 /*
  * rnode_trtt_compar: It's used by rnode_trtt_order
  */
 int
 rnode_trtt_compar(const void *a, const void *b)
 {
-	map_rnode *rnode_a = (map_rnode *) a, *rnode_b = (map_rnode *) b;
+	u_int cost_a = rnode_cost((map_rnode *) a);
+	u_int cost_b = rnode_cost((map_rnode *) b);
 
-	if (rnode_a->trtt > rnode_b->trtt)
+	if (cost_a > cost_b)
 		return 1;
-	else if (rnode_a->trtt == rnode_b->trtt)
+	else if (cost_a == cost_b)
 		return 0;
 	else
 		return -1;
@@ -285,7 +301,8 @@ rnode_trtt_compar(const void *a, const void *b)
 /* 
  * rnode_trtt_order
  *
- * It qsorts the rnodes of a map_node comparing their trtt. 
+ * It qsorts the rnodes of a map_node comparing their cost (trtt and
+ * bandwidth). 
  * It is used by map_routes_order.
  */
 void
@@ -325,6 +342,24 @@ get_route_trtt(map_node * node, u_short route)
 	return node->r_node[route].trtt;
 }
 
+/*
+ * get_route_cost
+ *
+ * the same of get_route_trtt(), but it returns the rnode_cost() of the
+ * `route'th route.
+ */
+u_int
+get_route_cost(map_node * node, u_short route)
+{
+	if (route >= node->links || node->flags & MAP_VOID || node->links <= 0)
+		return -1;
+
+	if (node->flags & MAP_ME)
+		return 0;
+
+	return rnode_cost(&node->r_node[route]);
+}
+
 /*
  * merge_maps: 
  *
@@ -340,7 +375,7 @@ merge_maps(map_node * base, map_node * new, map_node * base_root,
 		   map_node * new_root)
 {
 	int i, e, x, count = 0, base_root_pos, ngpos;
-	u_int base_trtt, new_trtt;
+	u_int base_cost, new_cost;
 	map_node *new_root_in_base, *node_gw;
 
 	base_root_pos = pos_from_node(base_root, base);
@@ -410,9 +445,9 @@ merge_maps(map_node * base, map_node * new, map_node * base_root,
 			 * If the worst route in base[i] is better than the best
 			 * route in new[i], let's go ahead.
 			 */
-			base_trtt = get_route_trtt(&base[i], base[i].links - 1);
-			new_trtt = get_route_trtt(&new[i], e);
-			if (base_trtt < new_trtt)
+			base_cost = get_route_cost(&base[i], base[i].links - 1);
+			new_cost = get_route_cost(&new[i], e);
+			if (base_cost < new_cost)
 				continue;
 
 			/* 
@@ -422,9 +457,9 @@ merge_maps(map_node * base, map_node * new, map_node * base_root,
 			 * deleted and replaced with new[i].r_node[e] itself.
 			 */
 			for (x = 0; x < base[i].links; x++) {
-				base_trtt = get_route_trtt(&base[i], x);
-				new_trtt = get_route_trtt(&new[i], e);
-				if (base_trtt > new_trtt) {
+				base_cost = get_route_cost(&base[i], x);
+				new_cost = get_route_cost(&new[i], e);
+				if (base_cost > new_cost) {
 					map_rnode_insert(&base[i], x, &new[i].r_node[e]);
 					base[i].flags |= MAP_UPDATE;
 					count++;
@@ -480,6 +515,9 @@ get_rnode_block(int *map, map_node * node, map_rnode * rblock, int rstart)
 		memcpy(p, &node->r_node[e].trtt, sizeof(u_int));
 		p += sizeof(u_int);
 
+		memcpy(p, &node->r_node[e].bw, sizeof(u_int));
+		p += sizeof(u_int);
+
 		mod_rnode_addr(&rblock[e + rstart], map, 0);
 
 		ints_host_to_network(&rblock[e + rstart], map_rnode_iinfo);
@@ -520,14 +558,35 @@ map_get_rblock(map_node * map, int *addr_map, int maxgroupnode, int *count)
 }
 
 
+/*
+ * rnode_pack_sz
+ *
+ * returns the size of each packed map_rnode of the `rblock_sz' bytes rnode
+ * block, which packs `links' rnodes: MAP_RNODE_PACK_SZ, or
+ * MAP_RNODE_PACK_SZ_V0 if it was packed by an older ntkd. If the size of
+ * the block doesn't match any of them, 0 is returned.
+ */
+size_t
+rnode_pack_sz(int links, size_t rblock_sz)
+{
+	if (links <= 0)
+		return 0;
+	if (rblock_sz == links * MAP_RNODE_PACK_SZ)
+		return MAP_RNODE_PACK_SZ;
+	if (rblock_sz == links * MAP_RNODE_PACK_SZ_V0)
+		return MAP_RNODE_PACK_SZ_V0;
+	return 0;
+}
+
 /* 
  * store_rnode_block: Given a correct `node' it restores in it all the r_node structs
  * contained in the rnode_block. It returns the number of rnode structs restored.
+ * Each packed rnode is `rnode_sz' bytes big (see rnode_pack_sz()).
  * Note that `rblock' will be modified during the restoration.
  */
 int
 store_rnode_block(int *map, map_node * node, map_rnode * rblock,
-				  int rstart)
+				  int rstart, size_t rnode_sz)
 {
 	int i;
 	char *p;
@@ -535,11 +594,14 @@ store_rnode_block(int *map, map_node * node, map_rnode * rblock,
 	if (!node->links)
 		return 0;
 
-	node->r_node = xmalloc(MAP_RNODE_PACK_SZ * node->links);
+	node->r_node = xmalloc(sizeof(map_rnode) * node->links);
 	for (i = 0; i < node->links; i++) {
-		p = (char *) &rblock[i + rstart];
+		p = (char *) rblock + (i + rstart) * rnode_sz;
 
-		ints_network_to_host(p, map_rnode_iinfo);
+		if (rnode_sz == MAP_RNODE_PACK_SZ_V0)
+			ints_network_to_host(p, map_rnode_v0_iinfo);
+		else
+			ints_network_to_host(p, map_rnode_iinfo);
 
 		memcpy(&node->r_node[i].r_node, p, sizeof(int *));
 		p += sizeof(int *);
@@ -547,6 +609,12 @@ store_rnode_block(int *map, map_node * node, map_rnode * rblock,
 		memcpy(&node->r_node[i].trtt, p, sizeof(u_int));
 		p += sizeof(u_int);
 
+		node->r_node[i].bw = 0;
+		if (rnode_sz == MAP_RNODE_PACK_SZ) {
+			memcpy(&node->r_node[i].bw, p, sizeof(u_int));
+			p += sizeof(u_int);
+		}
+
 		mod_rnode_addr(&node->r_node[i], 0, map);
 	}
 
@@ -555,18 +623,26 @@ store_rnode_block(int *map, map_node * node, map_rnode * rblock,
 
 /* 
  * map_store_rblock: Given a correct int_map with `maxgroupnode' nodes,
- * it restores all the r_node structs in the `map' from the `rblock' 
- * using store_rnode_block. `addr_map' is the address used to change 
- * the rnodes' pointers (read store_rnode_block).
+ * it restores all the r_node structs in the `map' from the `rblock_sz'
+ * bytes `rblock' using store_rnode_block. `addr_map' is the address used
+ * to change the rnodes' pointers (read store_rnode_block).
+ * It returns the number of rnodes restored, or -1 if the size of `rblock'
+ * doesn't match the rnodes of `map'.
  */
 int
 map_store_rblock(map_node * map, int *addr_map, int maxgroupnode,
-				 map_rnode * rblock)
+				 map_rnode * rblock, size_t rblock_sz)
 {
-	int i, c = 0;
+	int i, c = 0, links = 0;
+	size_t rnode_sz;
+
+	for (i = 0; i < maxgroupnode; i++)
+		links += map[i].links;
+	if (!(rnode_sz = rnode_pack_sz(links, rblock_sz)))
+		return -1;
 
 	for (i = 0; i < maxgroupnode; i++)
-		c += store_rnode_block(addr_map, &map[i], rblock, c);
+		c += store_rnode_block(addr_map, &map[i], rblock, c, rnode_sz);
 	return c;
 }
 
@@ -739,8 +815,9 @@ unpack_map(char *pack, int *addr_map, map_node ** new_root,
 		rblock = (map_rnode *) p;
 		if (!addr_map)
 			addr_map = (int *) map;
-		err = map_store_rblock(map, addr_map, nodes, rblock);
-		if (err != imap_hdr->rblock_sz / MAP_RNODE_PACK_SZ) {
+		err = map_store_rblock(map, addr_map, nodes, rblock,
+							   imap_hdr->rblock_sz);
+		if (err < 0) {
 			error
 				("An error occurred while storing the rnodes block in the int/bnode_map");
 			free_map(map, 0);
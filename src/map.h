@@ -88,19 +88,44 @@ typedef struct {
 	 * route_number_to_follow. Gotcha? I hope so.
 	 * Note: The trtt is mainly used to sort the routes
 	 */
+	u_int bw;					/* The bandwidth available on the route, that
+								   is the one of its bottleneck link (in Kb/s).
+								   If it isn't known it is 0 (see bw.h) */
 } map_rnode;
 
 /* Note: This int_info is used for the pack of a map_rnode struct (see 
  * get_rnode_block()). 
  * Since the r_node pointer, in the pack, is an integer, we add it in the
  * int_info as a normal 32bit int. */
-INT_INFO map_rnode_iinfo = { 2,
+INT_INFO map_rnode_iinfo = { 3,
+	{INT_TYPE_32BIT, INT_TYPE_32BIT, INT_TYPE_32BIT},
+	{0, sizeof(int *), sizeof(int *) + sizeof(u_int)},
+	{1, 1, 1}
+};
+
+#define MAP_RNODE_PACK_SZ	(sizeof(int *)+sizeof(u_int)*2)
+
+/* 
+ * The map_rnode packed by an older ntkd, which doesn't know the bandwidth
+ * of the routes. The unpackers recognize it from the size of the rnode
+ * block and set the `bw' to 0 (unknown). See rnode_pack_sz().
+ * Its offsets are the ones used by the older packer, which placed the
+ * second int at sizeof(int) and not after the r_node pointer.
+ */
+INT_INFO map_rnode_v0_iinfo = { 2,
 	{INT_TYPE_32BIT, INT_TYPE_32BIT},
 	{0, sizeof(int)},
 	{1, 1}
 };
 
-#define MAP_RNODE_PACK_SZ	(sizeof(int *)+sizeof(u_int))
+#define MAP_RNODE_PACK_SZ_V0	(sizeof(int *)+sizeof(u_int))
+
+/*
+ * The routes are sorted by their cost, which is their trtt plus the
+ * millisec needed to transfer RNODE_BW_REF_KBIT Kbit with their bandwidth
+ * (see rnode_cost()).
+ */
+#define RNODE_BW_REF_KBIT	100
 
 /*
  * 		****) The qspn int_map (****
@@ -193,11 +218,13 @@ void rnode_del(map_node * node, size_t pos);
 void rnode_destroy(map_node * node);
 int rnode_find(map_node * node, void *n);
 
+u_int rnode_cost(map_rnode * rnode);
 int rnode_trtt_compar(const void *a, const void *b);
 void rnode_trtt_order(map_node * node);
 void map_routes_order(map_node * map);
 
 u_int get_route_trtt(map_node * node, u_short route);
+u_int get_route_cost(map_node * node, u_short route);
 void rnode_set_trtt(map_node * node);
 void rnode_recurse_trtt(map_rnode * rnode, int route,
 						struct timeval *trtt);
@@ -212,10 +239,11 @@ int get_rnode_block(int *map, map_node * node, map_rnode * rblock,
 					int rstart);
 map_rnode *map_get_rblock(map_node * map, int *addr_map, int maxgroupnode,
 						  int *count);
+size_t rnode_pack_sz(int links, size_t rblock_sz);
 int store_rnode_block(int *map, map_node * node, map_rnode * rblock,
-					  int rstart);
+					  int rstart, size_t rnode_sz);
 int map_store_rblock(map_node * map, int *addr_map, int maxgroupnode,
-					 map_rnode * rblock);
+					 map_rnode * rblock, size_t rblock_sz);
 
 int verify_int_map_hdr(struct int_map_hdr *imap_hdr, int maxgroupnode,
 					   int maxrnodeblock);
@@ -0,0 +1,1037 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * mapowner.c
+ *
+ * The map owner thread, which applies all the changes to the maps, and the
+ * snapshots of the maps it publishes for the other threads.
+ */
+
+#include "includes.h"
+
+#include "llist.c"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "pkts.h"
+#include "netsukuku.h"
+#include "request.h"
+#include "igs.h"
+#include "mapowner.h"
+#include "common.h"
+
+void
+map_owner_init(void)
+{
+	map_jobs = 0;
+	map_jobs_counter = 0;
+	pthread_mutex_init(&map_jobs_mutex, 0);
+	pthread_cond_init(&map_jobs_cond, 0);
+	pthread_cond_init(&map_jobs_done_cond, 0);
+
+	setzero(map_lanes, sizeof(map_lanes));
+	map_lanes_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	map_lanes_busy = 0;
+	pthread_cond_init(&map_lanes_cond, 0);
+	pthread_cond_init(&map_lanes_done_cond, 0);
+
+	map_snap = map_snap_retired = 0;
+	map_snap_epoch = 0;
+	setzero(map_snap_readers, sizeof(map_snap_readers));
+}
+
+/*
+ * map_owner_post
+ *
+ * queues the `exec'(`pkt') job, which will be executed by the map owner.
+ * `pkt' is copied, so the caller can free it.
+ * If the map owner isn't running, `exec'(`pkt') is called immediately and
+ * its return value is returned, otherwise 0 is returned.
+ */
+int
+map_owner_post(int (*exec) (PACKET), PACKET pkt)
+{
+	struct map_job *job;
+
+	if (!map_owner_running)
+		return exec(pkt);
+
+	job = xzalloc(sizeof(struct map_job));
+	job->flags = MAP_JOB_PKT;
+	job->exec = exec;
+	pkt_copy(&job->pkt, &pkt);
+
+	pthread_mutex_lock(&map_jobs_mutex);
+	clist_append(&map_jobs, 0, &map_jobs_counter, job);
+	pthread_cond_signal(&map_jobs_cond);
+	pthread_mutex_unlock(&map_jobs_mutex);
+
+	return 0;
+}
+
+/*
+ * map_owner_wait
+ *
+ * queues the MAP_JOB_CALL `job' and waits until the map owner has executed
+ * it.
+ */
+void
+map_owner_wait(struct map_job *job)
+{
+	job->flags = MAP_JOB_CALL;
+
+	pthread_mutex_lock(&map_jobs_mutex);
+	clist_append(&map_jobs, 0, &map_jobs_counter, job);
+	pthread_cond_signal(&map_jobs_cond);
+	while (!(job->flags & MAP_JOB_DONE))
+		pthread_cond_wait(&map_jobs_done_cond, &map_jobs_mutex);
+	pthread_mutex_unlock(&map_jobs_mutex);
+}
+
+/*
+ * map_owner_self
+ *
+ * returns 1 if the caller can touch the maps by itself: it is the map owner,
+ * one of its lanes, which run while the owner waits them, or the owner
+ * isn't running.
+ */
+int
+map_owner_self(void)
+{
+	return !map_owner_running ||
+		pthread_equal(pthread_self(), map_owner_thread) ||
+		map_lane_self() >= 0;
+}
+
+/*
+ * map_owner_call
+ *
+ * makes the map owner call `call'() and waits until it's done.
+ */
+void
+map_owner_call(void (*call) (void))
+{
+	struct map_job *job;
+
+	if (map_owner_self()) {
+		call();
+		return;
+	}
+
+	job = xzalloc(sizeof(struct map_job));
+	job->call = call;
+	map_owner_wait(job);
+	xfree(job);
+}
+
+/*
+ * map_owner_run
+ *
+ * makes the map owner call `run'(`arg'), waits until it's done and returns
+ * what `run' returned.
+ */
+int
+map_owner_run(int (*run) (void *), void *arg)
+{
+	struct map_job *job;
+	int ret;
+
+	if (map_owner_self())
+		return run(arg);
+
+	job = xzalloc(sizeof(struct map_job));
+	job->run = run;
+	job->arg = arg;
+	map_owner_wait(job);
+	ret = job->ret;
+	xfree(job);
+
+	return ret;
+}
+
+/*
+ * map_owner_sync
+ *
+ * publishes a new snapshot of the current maps. It is used after the maps
+ * have been replaced, i.e. at the end of a hook.
+ */
+void
+map_owner_sync(void)
+{
+	map_owner_call(map_snapshot_publish);
+}
+
+/*
+ * map_owner_daemon
+ *
+ * It executes the queued map_jobs and, after each batch, publishes the new
+ * snapshot of the maps, if they changed. While we are hooking the maps are
+ * incomplete, so they aren't published.
+ */
+void *
+map_owner_daemon(void *null)
+{
+	struct map_job *jobs, *job, *next;
+
+	map_owner_thread = pthread_self();
+
+	/* The readers find a snapshot as soon as we are running */
+	map_snapshot_publish();
+	map_owner_running = 1;
+
+	debug(DBG_NORMAL, "Map owner up & running");
+	for (;;) {
+		pthread_mutex_lock(&map_jobs_mutex);
+		while (!map_jobs_counter)
+			pthread_cond_wait(&map_jobs_cond, &map_jobs_mutex);
+		jobs = map_jobs;
+		map_jobs = 0;
+		map_jobs_counter = 0;
+		pthread_mutex_unlock(&map_jobs_mutex);
+
+		for (job = jobs; job; job = next) {
+			if (map_lanes_cpus > 1 && map_job_lane(job) >= 0) {
+				next = map_lanes_run(job);
+				continue;
+			}
+
+			next = job->next;
+			if (job->flags & MAP_JOB_PKT) {
+				job->exec(job->pkt);
+				pkt_free(&job->pkt, 0);
+				xfree(job);
+			} else if (job->flags & MAP_JOB_CALL) {
+				if (job->run)
+					job->ret = job->run(job->arg);
+				else
+					job->call();
+
+				/* The caller will free it */
+				pthread_mutex_lock(&map_jobs_mutex);
+				job->flags |= MAP_JOB_DONE;
+				pthread_cond_broadcast(&map_jobs_done_cond);
+				pthread_mutex_unlock(&map_jobs_mutex);
+			}
+			map_jobs_done++;
+		}
+		map_batches++;
+
+		if (!(me.cur_node->flags & MAP_HNODE))
+			map_snapshot_publish();
+	}
+
+	return 0;
+}
+
+/*
+ * map_lane_self
+ *
+ * returns the level of the lane which is calling it, or -1 if the caller
+ * isn't a lane.
+ */
+int
+map_lane_self(void)
+{
+	pthread_t self;
+	int i;
+
+	self = pthread_self();
+	for (i = 0; i < MAP_LANES; i++)
+		if (map_lanes[i].running && pthread_equal(self, map_lanes[i].thread))
+			return i;
+	return -1;
+}
+
+/*
+ * map_job_lane
+ *
+ * returns the level of the lane which can execute the `job', or -1 if it
+ * has to be executed by the owner alone. It is called by the owner when no
+ * lane is working, so `me' can be read safely.
+ */
+int
+map_job_lane(struct map_job *job)
+{
+	brdcast_hdr *bcast_hdr;
+	int level;
+
+	if (!(job->flags & MAP_JOB_PKT) || !job->pkt.msg ||
+		job->pkt.hdr.sz < sizeof(brdcast_hdr))
+		return -1;
+
+	/* The same level used by tracer_pkt_recv() and qspn_unpack_pkt().
+	 * The brdcast_hdr is still in network order, but `level' is a
+	 * single byte. */
+	bcast_hdr = BRDCAST_HDR_PTR(job->pkt.msg);
+	level = bcast_hdr->level;
+	if (level)
+		level--;
+	if (level >= me.cur_quadg.levels || level >= MAP_LANES)
+		return -1;
+
+	if (job->pkt.hdr.op == QSPN_CLOSE &&
+		job->pkt.hdr.id >= me.cur_qspn_id[level] + 1)
+		/* qspn_close() will call qspn_new_round() */
+		return -1;
+
+	return level;
+}
+
+/*
+ * map_msg_post
+ *
+ * If it is called by a lane, it queues a map_msg, which will be applied by
+ * the owner at the end of the phase, otherwise `apply' is called
+ * immediately. The fields of the message are set to the other arguments.
+ * When the message is queued, `buf' is copied.
+ */
+void
+map_msg_post(void (*apply) (struct map_msg *), u_char level, void *ptr,
+			 int arg0, int arg1, char *buf, size_t sz)
+{
+	struct map_msg msg, *m;
+	struct map_lane *lane;
+	int l;
+
+	setzero(&msg, sizeof(struct map_msg));
+	msg.apply = apply;
+	msg.level = level;
+	msg.ptr = ptr;
+	msg.arg[0] = arg0;
+	msg.arg[1] = arg1;
+	msg.buf = buf;
+	msg.sz = sz;
+
+	if ((l = map_lane_self()) < 0) {
+		apply(&msg);
+		return;
+	}
+
+	lane = &map_lanes[l];
+	m = xmalloc(sizeof(struct map_msg));
+	memcpy(m, &msg, sizeof(struct map_msg));
+	if (buf && sz) {
+		m->buf = xmalloc(sz);
+		memcpy(m->buf, buf, sz);
+	} else
+		m->buf = 0;
+
+	clist_append(&lane->msgs, &lane->msgs_tail, &lane->msgs_counter, m);
+	lane->msgs_posted++;
+}
+
+/*
+ * map_lane_take
+ *
+ * detaches and returns the jobs queued in the `lane'.
+ */
+struct map_job *
+map_lane_take(struct map_lane *lane)
+{
+	struct map_job *jobs;
+
+	jobs = lane->jobs;
+	lane->jobs = lane->jobs_tail = 0;
+	lane->jobs_counter = 0;
+
+	return jobs;
+}
+
+/*
+ * map_lane_exec
+ *
+ * executes and frees the pkt `jobs' of the `lane'.
+ */
+void
+map_lane_exec(struct map_lane *lane, struct map_job *jobs)
+{
+	struct map_job *job, *next;
+	struct timeval t1, t2, t;
+
+	gettimeofday(&t1, 0);
+
+	job = jobs;
+	list_safe_for(job, next) {
+		job->exec(job->pkt);
+		pkt_free(&job->pkt, 0);
+		xfree(job);
+		lane->pkts++;
+	}
+
+	gettimeofday(&t2, 0);
+	timersub(&t2, &t1, &t);
+	lane->usecs += MICROSEC(t);
+	lane->phases++;
+}
+
+/*
+ * map_lane_daemon
+ *
+ * The thread of a lane. It executes the pkts given to it at each phase.
+ */
+void *
+map_lane_daemon(void *l)
+{
+	struct map_lane *lane = (struct map_lane *) l;
+	struct map_job *jobs;
+
+	pthread_mutex_lock(&map_jobs_mutex);
+	for (;;) {
+		while (!lane->jobs_counter)
+			pthread_cond_wait(&map_lanes_cond, &map_jobs_mutex);
+		jobs = map_lane_take(lane);
+		pthread_mutex_unlock(&map_jobs_mutex);
+
+		map_lane_exec(lane, jobs);
+
+		pthread_mutex_lock(&map_jobs_mutex);
+		if (!--map_lanes_busy)
+			pthread_cond_signal(&map_lanes_done_cond);
+	}
+
+	return 0;
+}
+
+/*
+ * map_lane_start
+ *
+ * starts the thread of the `lane', if it isn't running yet.
+ * On error -1 is returned.
+ */
+int
+map_lane_start(struct map_lane *lane)
+{
+	pthread_attr_t t_attr;
+	int ret;
+
+	if (lane->running)
+		return 0;
+
+	pthread_attr_init(&t_attr);
+	pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&lane->thread, &t_attr, map_lane_daemon, lane);
+	pthread_attr_destroy(&t_attr);
+	if (ret) {
+		error("Cannot start the map lane %d: %s",
+			  (int) (lane - map_lanes), strerror(ret));
+		return -1;
+	}
+	lane->running = 1;
+
+	return 0;
+}
+
+/*
+ * map_lanes_flush
+ *
+ * applies, lane after lane, the messages posted during the last phase.
+ */
+void
+map_lanes_flush(void)
+{
+	struct map_msg *msg, *next;
+	int l;
+
+	for (l = 0; l < MAP_LANES; l++) {
+		msg = map_lanes[l].msgs;
+		list_safe_for(msg, next) {
+			msg->apply(msg);
+			if (msg->buf)
+				xfree(msg->buf);
+			xfree(msg);
+		}
+		map_lanes[l].msgs = map_lanes[l].msgs_tail = 0;
+		map_lanes[l].msgs_counter = 0;
+	}
+}
+
+/*
+ * map_lanes_run
+ *
+ * splits by level the run of pkt jobs which begins with `jobs', executes
+ * it in a phase and applies the messages posted by the lanes.
+ * It returns the first job which isn't part of the run.
+ */
+struct map_job *
+map_lanes_run(struct map_job *jobs)
+{
+	struct map_lane *lane = 0;
+	struct map_job *job, *next;
+	int l, lanes = 0;
+
+	pthread_mutex_lock(&map_jobs_mutex);
+	for (job = jobs; job && (l = map_job_lane(job)) >= 0; job = next) {
+		next = job->next;
+		if (!map_lanes[l].jobs_counter) {
+			lane = &map_lanes[l];
+			lanes++;
+		}
+		clist_append(&map_lanes[l].jobs, &map_lanes[l].jobs_tail,
+					 &map_lanes[l].jobs_counter, job);
+		map_jobs_done++;
+	}
+
+	if (lanes == 1) {
+		/* There's nothing to do in parallel */
+		jobs = map_lane_take(lane);
+		pthread_mutex_unlock(&map_jobs_mutex);
+		map_lane_exec(lane, jobs);
+		return job;
+	}
+
+	for (l = 0; l < MAP_LANES; l++)
+		if (map_lanes[l].jobs_counter &&
+			!map_lane_start(&map_lanes[l]))
+			map_lanes_busy++;
+	pthread_cond_broadcast(&map_lanes_cond);
+	while (map_lanes_busy)
+		pthread_cond_wait(&map_lanes_done_cond, &map_jobs_mutex);
+	pthread_mutex_unlock(&map_jobs_mutex);
+	map_phases++;
+
+	map_lanes_flush();
+
+	/* The lanes which couldn't be started are executed by us */
+	for (l = 0; l < MAP_LANES; l++)
+		if (map_lanes[l].jobs_counter && !map_lanes[l].running)
+			map_lane_exec(&map_lanes[l], map_lane_take(&map_lanes[l]));
+
+	return job;
+}
+
+/*
+ * map_snap_level_put
+ *
+ * drops a reference to `level', which is freed if it was the last one.
+ */
+void
+map_snap_level_put(struct map_snap_level *level)
+{
+	int i;
+
+	if (!level || --level->refs > 0)
+		return;
+
+	if (level->int_map)
+		free_map(level->int_map, 0);
+	if (level->ernodes)
+		xfree(level->ernodes);
+	if (level->erc)
+		xfree(level->erc);
+	if (level->gmap) {
+		for (i = 0; i < MAXGROUPNODE; i++)
+			rnode_destroy(&level->gmap[i].g);
+		xfree(level->gmap);
+	}
+	xfree(level);
+}
+
+/*
+ * map_snapshot_free
+ */
+void
+map_snapshot_free(struct map_snapshot *snap)
+{
+	int i, e, levels;
+
+	for (i = 0; i < MAX_LEVELS; i++)
+		map_snap_level_put(snap->level[i]);
+
+	/* The unity level isn't shared */
+	levels = snap->cur_quadg.levels;
+	if (levels && snap->ext_map[_EL(levels)])
+		xfree(snap->ext_map[_EL(levels)]);
+
+	if (snap->bnode_map) {
+		for (i = 0; i < BMAP_LEVELS(levels); i++) {
+			for (e = 0; e < snap->bmap_nodes[i]; e++)
+				rnode_destroy(&snap->bnode_map[i][e]);
+			if (snap->bnode_map[i])
+				xfree(snap->bnode_map[i]);
+		}
+		bmap_levels_free(snap->bnode_map, snap->bmap_nodes);
+	}
+	xfree(snap);
+}
+
+/*
+ * map_snapshot_reclaim
+ *
+ * If the readers of the previous epoch are all gone, it advances the epoch
+ * and frees the snapshots which can't be seen by anyone anymore.
+ */
+void
+map_snapshot_reclaim(void)
+{
+	struct map_snapshot *snap, **p;
+
+	/* The counter of the next epoch is the same of the previous one */
+	if (!map_snap_readers[(map_snap_epoch + 1) & 1]) {
+		__sync_synchronize();
+		map_snap_epoch++;
+		__sync_synchronize();
+	}
+
+	for (p = &map_snap_retired; (snap = *p);) {
+		if (snap->epoch + 2 <= map_snap_epoch) {
+			*p = snap->next;
+			map_snapshot_free(snap);
+		} else
+			p = &snap->next;
+	}
+}
+
+/*
+ * map_snapshot_reloc
+ *
+ * converts `ptr', which points to a (g)node or an ext_rnode of the live
+ * maps, to the pointer of its copy in `snap'. The levels of `snap' which
+ * `ptr' may point to must be already set. If `ptr' isn't part of the maps,
+ * 0 is returned.
+ */
+void *
+map_snapshot_reloc(struct map_snapshot *snap, void *ptr)
+{
+	ext_rnode_cache *erc;
+	char *p = (char *) ptr, *live;
+	int i, levels = me.cur_quadg.levels;
+
+	live = (char *) me.int_map;
+	if (snap->int_map && p >= live &&
+		p < live + sizeof(map_node) * MAXGROUPNODE)
+		return (char *) snap->int_map + (p - live);
+
+	for (i = 0; i < levels; i++) {
+		live = (char *) me.ext_map[i];
+		if (!snap->ext_map[i] || p < live ||
+			p >= live + sizeof(map_gnode) * (i == _EL(levels) ? 1 :
+											 MAXGROUPNODE))
+			continue;
+		return (char *) snap->ext_map[i] + (p - live);
+	}
+
+	if (snap->level[0] && snap->level[0]->ernodes) {
+		erc = me.cur_erc;
+		i = 0;
+		list_for(erc) {
+			if (i >= snap->level[0]->erc_counter)
+				break;
+			if (!erc->e)
+				continue;
+			if ((char *) erc->e == p)
+				return &snap->level[0]->ernodes[i];
+			i++;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * map_snapshot_rnodes
+ *
+ * `node' is a copy of a live node, which still shares its r_node array with
+ * it. map_snapshot_rnodes() gives to `node' its own r_node array, pointing
+ * to the nodes of `snap'. The rnodes which point outside the maps are
+ * dropped. The number of rnodes kept is returned.
+ */
+int
+map_snapshot_rnodes(struct map_snapshot *snap, map_node * node)
+{
+	map_rnode *rnodes;
+	void *p;
+	int i, e;
+
+	if (!node->links || !node->r_node) {
+		node->r_node = 0;
+		node->links = 0;
+		return 0;
+	}
+
+	rnodes = xmalloc(sizeof(map_rnode) * node->links);
+	for (i = 0, e = 0; i < node->links; i++) {
+		if (!(p = map_snapshot_reloc(snap, node->r_node[i].r_node)))
+			continue;
+		memcpy(&rnodes[e], &node->r_node[i], sizeof(map_rnode));
+		rnodes[e++].r_node = p;
+	}
+	node->r_node = rnodes;
+	node->links = e;
+	if (!e) {
+		xfree(rnodes);
+		node->r_node = 0;
+	}
+
+	return e;
+}
+
+/*
+ * map_snapshot_int_map
+ *
+ * copies me.int_map and the ext_rnodes of our root_node in a new level of
+ * `snap', whose upper levels must be already set.
+ */
+struct map_snap_level *
+map_snapshot_int_map(struct map_snapshot *snap)
+{
+	struct map_snap_level *level;
+	ext_rnode_cache *erc;
+	int i, e;
+
+	level = xzalloc(sizeof(struct map_snap_level));
+	level->refs = 1;
+	level->live = me.int_map;
+	level->int_map = xmalloc(sizeof(map_node) * MAXGROUPNODE);
+	memcpy(level->int_map, me.int_map, sizeof(map_node) * MAXGROUPNODE);
+	snap->level[0] = level;
+	snap->int_map = level->int_map;
+
+	if (me.cur_erc_counter) {
+		level->ernodes = xzalloc(sizeof(ext_rnode) * me.cur_erc_counter);
+		level->erc = xzalloc(sizeof(ext_rnode_cache) * me.cur_erc_counter);
+		erc = me.cur_erc;
+		e = 0;
+		list_for(erc) {
+			if (e >= me.cur_erc_counter)
+				break;
+			if (!erc->e)
+				continue;
+
+			memcpy(&level->ernodes[e], erc->e, sizeof(ext_rnode));
+			level->ernodes[e].node.r_node = 0;
+			level->ernodes[e].node.links = 0;
+			for (i = 0; i < MAX_LEVELS - ZERO_LEVEL; i++)
+				if (level->ernodes[e].quadg.gnode[i])
+					level->ernodes[e].quadg.gnode[i] =
+						map_snapshot_reloc(snap,
+										   erc->e->quadg.gnode[i]);
+
+			level->erc[e].e = &level->ernodes[e];
+			level->erc[e].rnode_pos = erc->rnode_pos;
+			if (e) {
+				level->erc[e].prev = &level->erc[e - 1];
+				level->erc[e - 1].next = &level->erc[e];
+			}
+			e++;
+		}
+		level->erc_counter = e;
+	}
+
+	for (i = 0; i < MAXGROUPNODE; i++)
+		map_snapshot_rnodes(snap, &level->int_map[i]);
+
+	return level;
+}
+
+/*
+ * map_snapshot_gmap
+ *
+ * copies me.ext_map[_EL(`level')] in a new level of `snap'.
+ */
+struct map_snap_level *
+map_snapshot_gmap(struct map_snapshot *snap, int level)
+{
+	struct map_snap_level *l;
+	int i;
+
+	l = xzalloc(sizeof(struct map_snap_level));
+	l->refs = 1;
+	l->live = me.ext_map[_EL(level)];
+	l->gmap = xmalloc(sizeof(map_gnode) * MAXGROUPNODE);
+	memcpy(l->gmap, me.ext_map[_EL(level)], sizeof(map_gnode) * MAXGROUPNODE);
+	snap->level[level] = l;
+	snap->ext_map[_EL(level)] = l->gmap;
+
+	for (i = 0; i < MAXGROUPNODE; i++)
+		map_snapshot_rnodes(snap, &l->gmap[i].g);
+
+	return l;
+}
+
+/*
+ * map_snapshot_bmaps
+ *
+ * copies the bnode maps in `snap', whose levels must be already set.
+ */
+void
+map_snapshot_bmaps(struct map_snapshot *snap)
+{
+	int i, e, levels = BMAP_LEVELS(me.cur_quadg.levels);
+
+	bmap_levels_init(levels, &snap->bnode_map, &snap->bmap_nodes);
+	for (i = 0; i < levels; i++) {
+		if (!me.bmap_nodes[i] || !me.bnode_map[i])
+			continue;
+
+		snap->bmap_nodes[i] = me.bmap_nodes[i];
+		snap->bnode_map[i] = xmalloc(sizeof(map_bnode) * me.bmap_nodes[i]);
+		memcpy(snap->bnode_map[i], me.bnode_map[i],
+			   sizeof(map_bnode) * me.bmap_nodes[i]);
+		for (e = 0; e < me.bmap_nodes[i]; e++)
+			map_snapshot_rnodes(snap, &snap->bnode_map[i][e]);
+	}
+}
+
+/*
+ * map_snapshot_igws
+ *
+ * stores in `snap' the ips of the active igws of each level, excluding
+ * ourself.
+ */
+void
+map_snapshot_igws(struct map_snapshot *snap)
+{
+	inet_gw *igw;
+	int i, n;
+
+	setzero(snap->igw_ips, sizeof(snap->igw_ips));
+	setzero(snap->igw_counter, sizeof(snap->igw_counter));
+	if (!me.igws)
+		return;
+
+	for (i = 0; i < me.cur_quadg.levels && i < MAX_LEVELS; i++) {
+		igw = me.igws[i];
+		n = 0;
+		list_for(igw) {
+			if (n >= MAX_MULTIPATH_ROUTES)
+				break;
+			if (!(igw->flags & IGW_ACTIVE) ||
+				!memcmp(igw->ip, me.cur_quadg.ipstart[0].data, MAX_IP_SZ))
+				continue;
+			memcpy(snap->igw_ips[i][n++], igw->ip, MAX_IP_SZ);
+		}
+		snap->igw_counter[i] = n;
+	}
+}
+
+/*
+ * map_snapshot_publish
+ *
+ * copies the current maps in a new map_snapshot and swaps it with the
+ * published one, which is retired. Only the levels which changed are
+ * copied. If nothing changed, nothing is published.
+ * It must be called only by the map owner.
+ */
+void
+map_snapshot_publish(void)
+{
+	struct map_snapshot *snap, *old;
+	struct map_snap_level *l;
+	int i, levels = me.cur_quadg.levels, changed;
+	u_int gen;
+
+	old = map_snap;
+	snap = xzalloc(sizeof(struct map_snapshot));
+	for (i = 0; i < MAX_LEVELS; i++)
+		snap->gen[i] = *(volatile u_int *) &map_gen[i];
+	map_snapshot_igws(snap);
+
+	if (old && !memcmp(old->gen, snap->gen, sizeof(snap->gen)) &&
+		!memcmp(old->igw_ips, snap->igw_ips, sizeof(snap->igw_ips)) &&
+		!memcmp(old->igw_counter, snap->igw_counter,
+				sizeof(snap->igw_counter))) {
+		/* Nothing new */
+		xfree(snap);
+		return;
+	}
+
+	/* The upper levels, which point only to themselves */
+	for (i = 1, changed = 0; i < levels; i++) {
+		gen = snap->gen[0] + snap->gen[i];
+		l = old ? old->level[i] : 0;
+		if (l && l->gen == gen && l->live == me.ext_map[_EL(i)]) {
+			l->refs++;
+			snap->level[i] = l;
+			snap->ext_map[_EL(i)] = l->gmap;
+		} else {
+			map_snapshot_gmap(snap, i)->gen = gen;
+			changed = 1;
+		}
+	}
+
+	/* The unity level */
+	snap->ext_map[_EL(levels)] = xmalloc(sizeof(map_gnode));
+	memcpy(snap->ext_map[_EL(levels)], me.ext_map[_EL(levels)],
+		   sizeof(map_gnode));
+	snap->ext_map[_EL(levels)]->g.r_node = 0;
+	snap->ext_map[_EL(levels)]->g.links = 0;
+
+	/* The int_map and the ext_rnodes, which point to the upper levels */
+	gen = snap->gen[0];
+	l = old ? old->level[0] : 0;
+	if (l && l->gen == gen && l->live == me.int_map &&
+		!(changed && l->erc_counter) &&
+		l->erc_counter == me.cur_erc_counter) {
+		l->refs++;
+		snap->level[0] = l;
+		snap->int_map = l->int_map;
+	} else
+		map_snapshot_int_map(snap)->gen = gen;
+	snap->cur_erc = snap->level[0]->erc;
+	snap->live_int_map = me.int_map;
+	snap->cur_node = map_snapshot_reloc(snap, me.cur_node);
+
+	memcpy(&snap->cur_quadg, &me.cur_quadg, sizeof(quadro_group));
+	for (i = 0; i < MAX_LEVELS - ZERO_LEVEL; i++)
+		if (snap->cur_quadg.gnode[i])
+			snap->cur_quadg.gnode[i] =
+				map_snapshot_reloc(snap, me.cur_quadg.gnode[i]);
+
+	map_snapshot_bmaps(snap);
+
+	__sync_synchronize();
+	old = __sync_lock_test_and_set(&map_snap, snap);
+	snap->version = old ? old->version + 1 : 1;
+
+	if (old) {
+		old->epoch = map_snap_epoch;
+		old->next = map_snap_retired;
+		map_snap_retired = old;
+	}
+
+	map_snapshot_reclaim();
+}
+
+/*
+ * map_snapshot_get
+ *
+ * returns the published map_snapshot, which can be read until
+ * map_snapshot_put(`*epoch') is called. If no snapshot has been published
+ * yet, 0 is returned (map_snapshot_put() must be called anyway).
+ */
+struct map_snapshot *
+map_snapshot_get(u_int * epoch)
+{
+	u_int e;
+
+	for (;;) {
+		e = map_snap_epoch;
+		__sync_fetch_and_add(&map_snap_readers[e & 1], 1);
+		if (e == map_snap_epoch)
+			break;
+		__sync_fetch_and_sub(&map_snap_readers[e & 1], 1);
+	}
+
+	*epoch = e;
+	return *(struct map_snapshot *volatile *) &map_snap;
+}
+
+void
+map_snapshot_put(u_int epoch)
+{
+	__sync_fetch_and_sub(&map_snap_readers[epoch & 1], 1);
+}
+
+/*
+ * map_snapshot_read
+ *
+ * It is the map_snapshot_get() used by the readers of the maps. If the map
+ * owner isn't running, the caller can read the live maps: `live' is filled
+ * with their pointers and returned.
+ * map_snapshot_put(`*epoch') must be called when the caller is done.
+ */
+struct map_snapshot *
+map_snapshot_read(struct map_snapshot *live, u_int * epoch)
+{
+	struct map_snapshot *snap;
+	int i;
+
+	snap = map_snapshot_get(epoch);
+	if (snap && map_owner_running)
+		return snap;
+
+	setzero(live, sizeof(struct map_snapshot));
+	for (i = 0; i < MAX_LEVELS; i++)
+		live->gen[i] = map_gen[i];
+	live->int_map = live->live_int_map = me.int_map;
+	live->cur_node = me.cur_node;
+	for (i = 0; me.ext_map && i < me.cur_quadg.levels; i++)
+		live->ext_map[i] = me.ext_map[i];
+	live->bnode_map = me.bnode_map;
+	live->bmap_nodes = me.bmap_nodes;
+	memcpy(&live->cur_quadg, &me.cur_quadg, sizeof(quadro_group));
+	live->cur_erc = me.cur_erc;
+	map_snapshot_igws(live);
+
+	return live;
+}
+
+/*
+ * map_snapshot_gen
+ *
+ * the map_gen_sum(`level') of `snap'.
+ */
+u_int
+map_snapshot_gen(struct map_snapshot *snap, int level)
+{
+	u_int sum = 0;
+	int i;
+
+	for (i = 0; i <= level && i < MAX_LEVELS; i++)
+		sum += snap->gen[i];
+	return sum;
+}
+
+/*
+ * map_snapshot_live
+ *
+ * returns the pointer of the live node of which `node', a node of the
+ * int_map of `snap', is the copy. It is the key used by the rnode_list,
+ * it must not be dereferenced. If `node' isn't in the int_map, 0 is
+ * returned.
+ */
+map_node *
+map_snapshot_live(struct map_snapshot *snap, map_node * node)
+{
+	if (node < snap->int_map || node >= snap->int_map + MAXGROUPNODE)
+		return 0;
+	return snap->live_int_map + (node - snap->int_map);
+}
+
+/*
+ * map_snapshot_pack
+ *
+ * packs the `which' map (MAP_SNAP_*) of the published snapshot and stores
+ * the size of the pack in `sz'. If there isn't any snapshot, 0 is returned
+ * and the caller has to pack the live map by itself.
+ */
+char *
+map_snapshot_pack(int which, size_t * sz)
+{
+	struct map_snapshot *snap;
+	char *pack = 0;
+	u_int e;
+
+	snap = map_snapshot_get(&e);
+	if (!snap)
+		goto finish;
+
+	if (which == MAP_SNAP_INT_MAP)
+		pack = pack_map(snap->int_map, 0, MAXGROUPNODE, snap->cur_node,
+						sz);
+	else if (which == MAP_SNAP_EXT_MAP)
+		pack = pack_extmap(snap->ext_map, MAXGROUPNODE, &snap->cur_quadg,
+						   sz);
+	else if (which == MAP_SNAP_BNODE_MAP)
+		pack = pack_all_bmaps(snap->bnode_map, snap->bmap_nodes,
+							  snap->ext_map, snap->cur_quadg, sz);
+
+  finish:
+	map_snapshot_put(e);
+	return pack;
+}
@@ -0,0 +1,238 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef MAPOWNER_H
+#define MAPOWNER_H
+
+#include "pkts.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "route.h"
+
+/*
+ * The map owner is the only thread which modifies me.int_map, me.ext_map,
+ * me.bnode_map and me.igws while ntkd is running. The packet handlers which
+ * update the maps (the tracer and qspn ones) are queued as map_job and
+ * executed by the map_owner_daemon() in batches, the radar delegates to it
+ * its radar_update_map(), the qspn scheduler its new qspn_rounds, the hook,
+ * the route-sync stage and the igw monitor the changes they make to the
+ * maps.
+ * After each batch in which the maps changed the owner copies them in a new
+ * map_snapshot and publishes it. The other threads which have to walk the
+ * maps, like the andna searching a hash_gnode or the replies to the
+ * GET_*_MAP requests, read the snapshot without locks and without waiting
+ * the owner.
+ *
+ * The tracer and qspn pkts of different levels update different parts of
+ * the maps: me.ext_map[_EL(level)], qspn_b[level], me.cur_qspn_id[level],
+ * me.bmap_nodes_closed/opened[level-1]. For this reason the map owner has a
+ * lane for each level. A run of consecutive pkt jobs is split by level and
+ * each lane executes the pkts of its level, in their order, while the other
+ * lanes execute theirs. The owner waits for all the lanes to finish (a
+ * phase) before executing the next MAP_JOB_CALL or the next run.
+ * A lane writes only the state of its level. The changes which touch the
+ * other levels are posted as map_msg with map_msg_post() and the owner
+ * applies them, in the order they were posted, at the end of the phase:
+ * the qspn_gnode_count updates, the new_rehook() checks, the seeds of the
+ * upper gnode and the bnode blocks to be stored in the bnode maps.
+ * The route updates don't need it, rt_sync_node() is already a message to
+ * the rt_sync_daemon().
+ * The lanes are used only if there is more than one cpu.
+ * The QSPN_CLOSE pkts which start a new qspn_round aren't given to the
+ * lanes, because qspn_new_round() resets the state of all the levels. If
+ * only one lane has pkts in a run, the owner executes them by itself.
+ */
+
+#define MAP_JOB_PKT		1			/* job.exec(job.pkt) */
+#define MAP_JOB_CALL		(1<<1)		/* job.call() or job.run(job.arg) */
+#define MAP_JOB_DONE		(1<<2)		/* The job has been executed */
+
+struct map_job {
+	LLIST_HDR(struct map_job);
+
+	u_char flags;
+	int (*exec) (PACKET);
+	PACKET pkt;
+	void (*call) (void);
+	int (*run) (void *);
+	void *arg;
+	int ret;					/* What job.run() returned */
+};
+struct map_job *map_jobs;
+int map_jobs_counter;
+pthread_mutex_t map_jobs_mutex;
+pthread_cond_t map_jobs_cond;		/* A new job has been queued */
+pthread_cond_t map_jobs_done_cond;	/* A MAP_JOB_CALL job has been executed */
+
+pthread_t map_owner_thread;
+int map_owner_running;
+
+#define MAP_LANES		MAX_LEVELS
+
+/*
+ * A change posted by a lane, which will be applied by the owner calling
+ * msg.apply(msg). The meaning of the other fields depends on `apply'.
+ * `buf', if not null, is freed after it.
+ */
+struct map_msg {
+	LLIST_HDR(struct map_msg);
+
+	void (*apply) (struct map_msg *);
+	u_char level;
+	void *ptr;
+	int arg[2];
+	char *buf;
+	size_t sz;
+};
+
+struct map_lane {
+	pthread_t thread;
+	int running;
+
+	struct map_job *jobs, *jobs_tail;	/* The pkts of the current phase */
+	int jobs_counter;
+	struct map_msg *msgs, *msgs_tail;	/* The messages posted in this phase */
+	int msgs_counter;
+
+	u_int pkts;					/* Stupid statistics */
+	u_int phases;
+	u_int msgs_posted;
+	uint64_t usecs;				/* Time spent executing the pkts */
+};
+struct map_lane map_lanes[MAP_LANES];
+int map_lanes_cpus;				/* With a single cpu the lanes aren't used */
+int map_lanes_busy;				/* Lanes still working in this phase */
+pthread_cond_t map_lanes_cond;	/* A phase has begun */
+pthread_cond_t map_lanes_done_cond;	/* A lane has finished its phase */
+
+/*
+ * A map_snapshot is a copy of the maps as they were at the end of a batch.
+ * It can be walked as the live maps: the rnodes of its nodes point to the
+ * nodes of its own copies. It is never modified after its publication.
+ *
+ * Each level is copied in a map_snap_level: the level 0 is the int_map,
+ * with the copies of the ext_rnodes of the root_node, the level `l' is
+ * ext_map[_EL(l)]. A level whose map_gen (and the one of the level 0)
+ * didn't change since the previous snapshot isn't copied again, but shared
+ * with it. The level 0 is copied again also when an upper level changed and
+ * the root_node has ext_rnodes, since their quadg point to the upper levels.
+ * The bnode maps, the unity level, the quadro_group and the igws are small,
+ * they are copied in each snapshot.
+ * The qspn flags of the nodes (QSPN_OLD, QSPN_CLOSED, ...) change during a
+ * qspn_round without a map_gen_bump(), so the snapshot can have older ones.
+ */
+struct map_snap_level {
+	int refs;					/* Only the owner touches it */
+	u_int gen;					/* The map_gen of the level (plus the
+								   level 0 one) when it was copied */
+	void *live;					/* The live map it was copied from */
+
+	map_node *int_map;			/* The level 0 */
+	ext_rnode *ernodes;			/* and the ext_rnodes of its root_node */
+	ext_rnode_cache *erc;
+	int erc_counter;
+
+	map_gnode *gmap;			/* The upper levels */
+};
+
+struct map_snapshot {
+	u_int version;
+	u_int gen[MAX_LEVELS];		/* map_gen when it was copied */
+
+	struct map_snap_level *level[MAX_LEVELS];
+	map_node *int_map;
+	map_node *cur_node;
+	map_gnode *ext_map[MAX_LEVELS];
+	map_bnode **bnode_map;
+	u_int *bmap_nodes;
+	quadro_group cur_quadg;
+	ext_rnode_cache *cur_erc;
+
+	map_node *live_int_map;		/* me.int_map, see map_snapshot_live() */
+
+	/* The active igws of each level, but us, in their order */
+	u_int igw_ips[MAX_LEVELS][MAX_MULTIPATH_ROUTES][MAX_IP_INT];
+	int igw_counter[MAX_LEVELS];
+
+	u_int epoch;				/* The epoch in which it was retired */
+	struct map_snapshot *next;	/* Next retired snapshot */
+};
+
+/* map_snapshot_pack() `which' values */
+#define MAP_SNAP_INT_MAP	0
+#define MAP_SNAP_EXT_MAP	1
+#define MAP_SNAP_BNODE_MAP	2
+
+/*
+ * The published snapshot is read without locks. An old snapshot is freed
+ * only when all the readers which could have seen it are gone: each reader
+ * enters the current epoch, incrementing map_snap_readers[epoch&1], and
+ * leaves it when it's done. The owner advances the epoch only when no reader
+ * is left in the previous one.
+ */
+struct map_snapshot *map_snap;
+struct map_snapshot *map_snap_retired;
+u_int map_snap_epoch;
+int map_snap_readers[2];
+
+u_int map_jobs_done;			/* Stupid statistics */
+u_int map_batches;
+u_int map_phases;				/* Phases run in parallel */
+
+
+/* * * Functions declaration * * */
+void map_owner_init(void);
+void map_owner_wait(struct map_job *job);
+int map_owner_self(void);
+int map_owner_post(int (*exec) (PACKET), PACKET pkt);
+void map_owner_call(void (*call) (void));
+int map_owner_run(int (*run) (void *), void *arg);
+void map_owner_sync(void);
+void *map_owner_daemon(void *null);
+
+int map_lane_self(void);
+int map_job_lane(struct map_job *job);
+void map_msg_post(void (*apply) (struct map_msg *), u_char level,
+				  void *ptr, int arg0, int arg1, char *buf, size_t sz);
+struct map_job *map_lane_take(struct map_lane *lane);
+void map_lane_exec(struct map_lane *lane, struct map_job *jobs);
+void *map_lane_daemon(void *l);
+int map_lane_start(struct map_lane *lane);
+void map_lanes_flush(void);
+struct map_job *map_lanes_run(struct map_job *jobs);
+
+void map_snap_level_put(struct map_snap_level *level);
+void map_snapshot_free(struct map_snapshot *snap);
+void map_snapshot_reclaim(void);
+void *map_snapshot_reloc(struct map_snapshot *snap, void *ptr);
+int map_snapshot_rnodes(struct map_snapshot *snap, map_node * node);
+struct map_snap_level *map_snapshot_int_map(struct map_snapshot *snap);
+struct map_snap_level *map_snapshot_gmap(struct map_snapshot *snap,
+										 int level);
+void map_snapshot_bmaps(struct map_snapshot *snap);
+void map_snapshot_igws(struct map_snapshot *snap);
+void map_snapshot_publish(void);
+struct map_snapshot *map_snapshot_get(u_int * epoch);
+void map_snapshot_put(u_int epoch);
+struct map_snapshot *map_snapshot_read(struct map_snapshot *live,
+									   u_int * epoch);
+u_int map_snapshot_gen(struct map_snapshot *snap, int level);
+map_node *map_snapshot_live(struct map_snapshot *snap, map_node * node);
+char *map_snapshot_pack(int which, size_t * sz);
+
+#endif							/*MAPOWNER_H */
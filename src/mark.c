@@ -38,6 +38,7 @@
 #include <fcntl.h>
 
 #include "iptunnel.h"
+#include "misc.h"
 #include "mark.h"
 #include "err_errno.h"
 #include "log.h"
@@ -499,6 +500,8 @@ mark_init(int igw)
 		error("Netfilter mangle table was not altered!");
 		goto cannot_init;
 	}
+	/* ntk_mark_chain is empty now */
+	mark_rules_n = mark_rules_wanted = 0;
 	res = store_rules();
 	if (res) {
 		error(err_str);
@@ -544,50 +547,120 @@ count_ntk_mark_chain(iptc_handle_t * t)
 }
 
 /*
- * This function build the rules:
+ * Tells if the rule -e- of ntk_mark_chain is
+ * the one built by:
  *
- * -A ntk_mark_chain -o ntk_tunl<m>
- *  -j CONNMARK --set-mark m
+ * 	mark_rule_init(rule, NTK_TUNL_PREFIX, i)
  *
- * If:
+ * The counters and the kernel fields of -e-
+ * are not compared.
+ * Returns:
+ * 	1 if it is
+ * 	0 otherwise
+ */
+int
+mark_rule_match(const struct ipt_entry *e, int i)
+{
+	char outiface[IFNAMSIZ];
+	const struct ipt_entry_target *et;
+	const struct ipt_connmark_target_info *icmi;
+
+	if (e->target_offset + TARGET_SZ > e->next_offset)
+		return 0;
+	et = (const struct ipt_entry_target *) ((char *) e + e->target_offset);
+	icmi = (const struct ipt_connmark_target_info *) et->data;
+
+	snprintf(outiface, IFNAMSIZ, "%s%d", NTK_TUNL_PREFIX, i);
+	return !strcmp(e->ip.outiface, outiface) &&
+		!strcmp(et->u.user.name, MOD_CONNMARK) &&
+		icmi->mode == IPT_CONNMARK_SET && icmi->mark == i + 1;
+}
+
+/*
+ * Asks for the first -n- marking rules of
+ * ntk_mark_chain, the ones of ntk_tunl0 ...
+ * ntk_tunl<n-1>. Nothing is written until
+ * mark_rules_sync() is called.
+ */
+void
+mark_rules_want(int n)
+{
+	if (n > MAX_MARK_RULES)
+		n = MAX_MARK_RULES;
+	if (n > mark_rules_wanted)
+		mark_rules_wanted = n;
+}
+
+/*
+ * Writes in a single transaction the marking
+ * rules asked with mark_rules_want() which
+ * are missing from ntk_mark_chain:
  *
- * s= n-number_of_rules_present
- * then:
- * 	if s>0, will be created s rules,
- * else:
- * 	nothing.
+ * -A ntk_mark_chain -o ntk_tunl<m>
+ *  -j CONNMARK --set-mark m+1
  *
+ * If the model says that no rule is missing,
+ * the table isn't touched at all. Otherwise
+ * the chain is diffed with the wanted rules:
+ * the ones already there are kept and only
+ * the missing ones are appended. If the chain
+ * has been altered by someone else, it is
+ * rebuilt in the same transaction.
+ * The time taken is kept in mark_sync_last_us.
  * Returns:
  * 	0
  * 	-1
  */
 int
-create_mark_rules(int n)
+mark_rules_sync(void)
 {
-	int nchain;
-	int res, i;
+	struct timeval t0, t1, diff;
+	const struct ipt_entry *e;
 	char rule[MARK_RULE_SZ];
 	iptc_handle_t t;
+	int res, i, ok, total;
 
+	if (mark_rules_wanted <= mark_rules_n) {
+		mark_syncs_skipped++;
+		return 0;
+	}
+
+	gettimeofday(&t0, 0);
 	res = table_init(MANGLE_TABLE, &t);
 	if (res) {
 		error(err_str);
 		err_ret(ERR_NETRUL, -1);
 	}
-	nchain = count_ntk_mark_chain(&t);
-	if (nchain == -1) {
-		error("In create_mark_rules: can not read ntk_mark_chain.");
-		err_ret(ERR_NETRUL, -1);
-	}
-	if (nchain >= n) {
-		debug(DBG_NORMAL, "In create_mark_rules: rules present yet.");
+
+	/* Count the rules at the head of the chain which are already right */
+	for (ok = total = 0, e = iptc_first_rule(NTK_MARK_CHAIN, &t); e;
+		 e = iptc_next_rule(e, &t), total++)
+		if (ok == total && mark_rule_match(e, total))
+			ok++;
+
+	if (ok < total) {
+		debug(DBG_NORMAL, "In mark_rules_sync: %s has been altered, "
+			  "rebuilding it.", NTK_MARK_CHAIN);
+		if (!iptc_flush_entries(NTK_MARK_CHAIN, &t)) {
+			error("In mark_rules_sync: -> %s", iptc_strerror(errno));
+			iptc_free(&t);
+			err_ret(ERR_NETRUL, -1);
+		}
+		ok = 0;
+		mark_rebuilds++;
+	} else if (ok >= mark_rules_wanted) {
+		/* Our model was behind */
+		iptc_free(&t);
+		mark_rules_n = ok;
 		return 0;
 	}
-	for (i = nchain; i < n; i++) {
+
+	for (i = ok; i < mark_rules_wanted; i++) {
 		mark_rule_init(rule, NTK_TUNL_PREFIX, i);
 		res = append_rule(rule, &t, NTK_MARK_CHAIN);
 		if (res) {
 			error(err_str);
+			iptc_free(&t);
 			err_ret(ERR_NETRUL, -1);
 		}
 	}
@@ -596,10 +669,36 @@ create_mark_rules(int n)
 		error(err_str);
 		err_ret(ERR_NETRUL, -1);
 	}
-	debug(DBG_NORMAL, "Created %d marking rules.", n - nchain);
+
+	gettimeofday(&t1, 0);
+	timersub(&t1, &t0, &diff);
+	mark_sync_last_us = MICROSEC(diff);
+	if (mark_sync_last_us > mark_sync_max_us)
+		mark_sync_max_us = mark_sync_last_us;
+	mark_syncs++;
+	mark_rules_added += mark_rules_wanted - ok;
+
+	debug(DBG_NORMAL, "Created %d marking rules in %u us.",
+		  mark_rules_wanted - ok, mark_sync_last_us);
+	mark_rules_n = mark_rules_wanted;
 	return 0;
 }
 
+/*
+ * Makes sure that ntk_mark_chain has the first
+ * -n- marking rules. It is mark_rules_want()
+ * plus mark_rules_sync().
+ * Returns:
+ * 	0
+ * 	-1
+ */
+int
+create_mark_rules(int n)
+{
+	mark_rules_want(n);
+	return mark_rules_sync();
+}
+
 /*
  * Deltion function:
  * this delete the chain ntk_mark_chain
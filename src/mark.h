@@ -93,6 +93,25 @@ typedef struct rule_store {
 	char *chain;
 } rule_store;
 
+/*
+ * The marking rules of ntk_mark_chain are updated incrementally.
+ * `mark_rules_n' is the model of the chain: the number of marking rules
+ * we have committed in it, the i-th marking ntk_tunl<i>.
+ * An IGW change collects the rules it needs with mark_rules_want(), then
+ * mark_rules_sync() writes all of them in one transaction: it appends only
+ * the rules missing from the chain and, if none is missing, it doesn't even
+ * take the snapshot of the mangle table.
+ */
+int mark_rules_n;
+int mark_rules_wanted;
+
+u_int mark_syncs;				/* Stupid statistics */
+u_int mark_syncs_skipped;
+u_int mark_rules_added;
+u_int mark_rebuilds;
+u_int mark_sync_last_us;		/* Time taken by the last transaction */
+u_int mark_sync_max_us;
+
 /* Functions */
 
 int table_init(const char *table, iptc_handle_t * t);
@@ -108,6 +127,9 @@ int ntk_mark_chain_init(iptc_handle_t * t);
 int store_rules();
 int mark_init(int igw);
 int count_ntk_mark_chain(iptc_handle_t * t);
+int mark_rule_match(const struct ipt_entry *e, int i);
+void mark_rules_want(int n);
+int mark_rules_sync(void);
 int create_mark_rules(int n);
 int delete_ntk_forward_chain(iptc_handle_t * t);
 int delete_first_rule(iptc_handle_t * t, const char *chain);
@@ -241,6 +241,64 @@ find_int(int x, int *ia, int nmemb)
 	return 0;
 }
 
+/*
+ * bits_next_set
+ *
+ * returns the position of the first bit set in the `bits' bitmap, which has
+ * `nbits' bits, starting from the `from' bit and going up. If there isn't
+ * any, -1 is returned.
+ */
+int
+bits_next_set(unsigned int *bits, int nbits, int from)
+{
+	unsigned int w;
+	int i;
+
+	if (from < 0)
+		from = 0;
+	if (from >= nbits)
+		return -1;
+
+	i = from / 32;
+	w = bits[i] & (~0U << (from % 32));
+	for (;;) {
+		if (w) {
+			from = i * 32 + __builtin_ctz(w);
+			return from < nbits ? from : -1;
+		}
+		if (++i >= BITS_WORDS(nbits))
+			return -1;
+		w = bits[i];
+	}
+}
+
+/*
+ * bits_prev_set
+ *
+ * the same of bits_next_set(), but it goes down from the `from' bit.
+ */
+int
+bits_prev_set(unsigned int *bits, int nbits, int from)
+{
+	unsigned int w;
+	int i;
+
+	if (from >= nbits)
+		from = nbits - 1;
+	if (from < 0)
+		return -1;
+
+	i = from / 32;
+	w = bits[i] & (~0U >> (31 - from % 32));
+	for (;;) {
+		if (w)
+			return i * 32 + 31 - __builtin_clz(w);
+		if (--i < 0)
+			return -1;
+		w = bits[i];
+	}
+}
+
 
 /*
  *  *  *  *  Time functions  *  *  *  *
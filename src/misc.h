@@ -30,6 +30,11 @@
  */
 #define MILLISEC(x)		(((x).tv_sec*1000)+((x).tv_usec/1000))
 
+/*
+ * MICROSEC: like MILLISEC, but in microseconds
+ */
+#define MICROSEC(x)		(((x).tv_sec*1000000)+(x).tv_usec)
+
 /*
  * MILLISEC_TO_TV: Converts `x', which is an int into `t', a timeval struct
  */
@@ -46,6 +51,13 @@ do{									\
 #define CLR_BIT(a,i)     ((a)[(i)/CHAR_BIT] &= ~(1<<((i)%CHAR_BIT)))
 #define TEST_BIT(a,i)    (((a)[(i)/CHAR_BIT] & (1<<((i)%CHAR_BIT))) ? 1 : 0)
 
+/* The same, but on arrays of u_int, which can be searched a word at a time
+ * with bits_next_set() and bits_prev_set() */
+#define BITS_WORDS(nbits)	(((nbits) + 31) / 32)
+#define SET_BITW(a,i)	((a)[(i)/32] |= 1U<<((i)%32))
+#define CLR_BITW(a,i)	((a)[(i)/32] &= ~(1U<<((i)%32)))
+#define TEST_BITW(a,i)	(((a)[(i)/32] & (1U<<((i)%32))) ? 1 : 0)
+
 /*
  * FIND_PTR
  *
@@ -95,6 +107,8 @@ char **split_string(char *str, const char *div_str, int *substrings,
 
 
 int find_int(int x, int *ia, int nmemb);
+int bits_next_set(unsigned int *bits, int nbits, int from);
+int bits_prev_set(unsigned int *bits, int nbits, int from);
 
 void xtimer(u_int secs, u_int steps, int *counter);
 
@@ -38,6 +38,11 @@
 #include "andna_cache.h"
 #include "andna.h"
 #include "radar.h"
+#include "mapowner.h"
+#include "flood.h"
+#include "bw.h"
+#include "krnl_state.h"
+#include "snapshot.h"
 #include "hook.h"
 #include "rehook.h"
 #include "ntk-console-server.h"
@@ -161,12 +166,13 @@ void
 usage(void)
 {
 	printf("Usage:\n"
-		   "     ntkd [-hvaldrRD46] [-i net_interface] [-c conf_file] [-l logfile]\n\n"
+		   "     ntkd [-hvaldrRwD46] [-i net_interface] [-c conf_file] [-l logfile]\n\n"
 		   " -4	ipv4\n"
 		   " -6	ipv6\n"
 		   " -i	Specify the interface after this\n\n"
 		   " -a	Prevents running the ANDNA daemon\n"
 		   " -R	Prevents editting /etc/resolv.conf\n"
+		   " -w	Warm restart from the last state snapshot\n"
 		   " -D	Prevents running as daemon (Does not fork to the background)\n"
 		   "\n"
 		   " -r	Runs in restricted mode\n"
@@ -200,6 +206,7 @@ fill_default_options(void)
 	server_opt.int_map_file = INT_MAP_FILE;
 	server_opt.ext_map_file = EXT_MAP_FILE;
 	server_opt.bnode_map_file = BNODE_MAP_FILE;
+	server_opt.snapshot_file = SNAPSHOT_FILE;
 
 	server_opt.andna_hnames_file = ANDNA_HNAMES_FILE;
 	server_opt.snsd_nodes_file = SNSD_NODES_FILE;
@@ -214,6 +221,7 @@ fill_default_options(void)
 
 	server_opt.disable_andna = 0;
 	server_opt.disable_resolvconf = 0;
+	server_opt.warm_restart = 0;
 	server_opt.restricted = 0;
 	server_opt.restricted_class = 0;
 
@@ -243,6 +251,8 @@ fill_loaded_cfg_options(void)
 						&server_opt.bnode_map_file, NAME_MAX - 1);
 	CONF_GET_STRN_VALUE(CONF_NTK_EXT_MAP_FILE, &server_opt.ext_map_file,
 						NAME_MAX - 1);
+	CONF_GET_STRN_VALUE(CONF_NTK_SNAPSHOT_FILE, &server_opt.snapshot_file,
+						NAME_MAX - 1);
 
 	CONF_GET_STRN_VALUE(CONF_ANDNA_HNAMES_FILE,
 						&server_opt.andna_hnames_file, NAME_MAX - 1);
@@ -272,6 +282,7 @@ fill_loaded_cfg_options(void)
 	CONF_GET_INT_VALUE(CONF_DISABLE_ANDNA, server_opt.disable_andna);
 	CONF_GET_INT_VALUE(CONF_DISABLE_RESOLVCONF,
 					   server_opt.disable_resolvconf);
+	CONF_GET_INT_VALUE(CONF_NTK_WARM_RESTART, server_opt.warm_restart);
 	CONF_GET_INT_VALUE(CONF_NTK_RESTRICTED_MODE, server_opt.restricted);
 	CONF_GET_INT_VALUE(CONF_NTK_RESTRICTED_CLASS,
 					   server_opt.restricted_class);
@@ -330,6 +341,8 @@ free_server_opt(void)
 		xfree(server_opt.ext_map_file);
 	if (server_opt.bnode_map_file != BNODE_MAP_FILE)
 		xfree(server_opt.bnode_map_file);
+	if (server_opt.snapshot_file != SNAPSHOT_FILE)
+		xfree(server_opt.snapshot_file);
 
 	if (server_opt.andna_hnames_file != ANDNA_HNAMES_FILE)
 		xfree(server_opt.andna_hnames_file);
@@ -417,6 +430,7 @@ parse_options(int argc, char **argv)
 			{"no_andna", 0, 0, 'a'},
 			{"no_daemon", 0, 0, 'D'},
 			{"no_resolv", 0, 0, 'R'},
+			{"warm", 0, 0, 'w'},
 
 			{"restricted", 0, 0, 'r'},
 			{"share-inet", 0, 0, 'I'},
@@ -430,7 +444,7 @@ parse_options(int argc, char **argv)
 			{0, 0, 0, 0}
 		};
 
-		c = getopt_long(argc, argv, "i:c:l:e:n:hvd64DRrIakC", long_options,
+		c = getopt_long(argc, argv, "i:c:l:e:n:hvd64DRwrIakC", long_options,
 						&option_index);
 		if (c == -1)
 			break;
@@ -510,6 +524,9 @@ parse_options(int argc, char **argv)
 		case 'R':
 			server_opt.disable_resolvconf = 1;
 			break;
+		case 'w':
+			server_opt.warm_restart = 1;
+			break;
 		case 'r':
 			server_opt.restricted = 1;
 
@@ -659,6 +676,9 @@ init_netsukuku(char **argv)
 					me.cur_ifs, &me.cur_ifs_n) < 0)
 		fatal("Cannot initialize any network interfaces");
 
+	/* The periodic jobs are added to the timer wheel from now on */
+	timer_init();
+
 	/*
 	 * ANDNA init
 	 */
@@ -680,11 +700,17 @@ init_netsukuku(char **argv)
 
 	/* Radar init */
 	rq_wait_idx_init(rq_wait_idx);
+	rq_adm_init();
+	flood_dedup_init();
 	first_init_radar();
 	total_radars = 0;
 
 	ntk_load_maps();
 
+	snapshot_init();
+	if (server_opt.warm_restart)
+		snapshot_open(server_opt.snapshot_file);
+
 #if 0
 	/* TODO: activate and test it !! */
 	debug(DBG_NORMAL, "ACPT: Initializing the accept_tbl: \n"
@@ -720,6 +746,8 @@ destroy_netsukuku(void)
 
 	unlink(server_opt.pid_file);
 
+	if (server_opt.warm_restart && total_hooks)
+		snapshot_save();
 	ntk_save_maps();
 	ntk_free_maps();
 	if (!server_opt.disable_andna)
@@ -728,6 +756,7 @@ destroy_netsukuku(void)
 	close_internet_gateway_search();
 	last_close_radar();
 	e_rnode_free(&me.cur_erc, &me.cur_erc_counter);
+	rt_nh_states_reset();
 	destroy_accept_tbl();
 	if_close_all();
 	qspn_free();
@@ -788,7 +817,9 @@ rh_cache_flush_thread(void *null)
 	 * Flush the resolved hostnames cache.
 	 */
 	loginfo("Flush the resolved hostnames cache");
+	pthread_mutex_lock(&andna_cache_mutex);
 	rh_cache_flush();
+	pthread_mutex_unlock(&andna_cache_mutex);
 
 	return 0;
 }
@@ -820,7 +851,7 @@ main(int argc, char **argv)
 	struct udp_daemon_argv ud_argv;
 	u_short *port;
 	pthread_t daemon_tcp_thread, daemon_udp_thread, andna_thread;
-	pthread_t ping_igw_thread;
+	pthread_t rt_sync_thread;
 	pthread_attr_t t_attr;
 
 	log_init(argv[0], 0, 1);
@@ -875,6 +906,31 @@ main(int argc, char **argv)
 	pthread_mutex_init(&udp_daemon_lock, 0);
 	pthread_mutex_init(&tcp_daemon_lock, 0);
 
+	debug(DBG_SOFT, "Evoking the timer daemon.");
+	pthread_create(&timer_daemon_thread, &t_attr, timer_daemon, 0);
+
+	debug(DBG_SOFT, "Evoking the qspn scheduler.");
+	qspn_sched_init();
+	pthread_create(&qspn_sched_thread, &t_attr, qspn_sched_daemon, 0);
+
+	debug(DBG_SOFT, "Evoking the kernel state mirror.");
+	if (!krnl_state_init())
+		pthread_create(&krnl_state_thread, &t_attr, krnl_state_daemon, 0);
+
+	debug(DBG_SOFT, "Starting the bandwidth monitor.");
+	if (!bw_init())
+		timer_job_start(&bw_job, 0, bw_update_job, 0);
+
+	debug(DBG_SOFT, "Evoking the route sync daemon.");
+	rt_sync_init();
+	gw_cache_init();
+	gnode_live_init();
+	pthread_create(&rt_sync_thread, &t_attr, rt_sync_daemon, 0);
+
+	debug(DBG_SOFT, "Evoking the map owner daemon.");
+	map_owner_init();
+	pthread_create(&map_owner_thread, &t_attr, map_owner_daemon, 0);
+
 	debug(DBG_SOFT, "Evoking the netsukuku udp radar daemon.");
 	ud_argv.port = ntk_udp_radar_port;
 	pthread_mutex_lock(&udp_daemon_lock);
@@ -891,8 +947,15 @@ main(int argc, char **argv)
 	pthread_mutex_unlock(&tcp_daemon_lock);
 
 
-	/* Now we hook in Netsukuku */
-	netsukuku_hook(0, 0);
+	/* Now we hook in Netsukuku, if we cannot restart from the snapshot */
+	if (snapshot_warm_hook() < 0)
+		netsukuku_hook(0, 0);
+
+	if (server_opt.warm_restart) {
+		debug(DBG_SOFT, "Starting the snapshot job.");
+		timer_job_start(&snapshot_job, SNAPSHOT_INTERVAL * 1000,
+						snapshot_job_save, 0);
+	}
 
 	/*
 	 * If not disabled, start the ANDNA daemon
@@ -904,8 +967,8 @@ main(int argc, char **argv)
 
 	if (restricted_mode && (server_opt.share_internet ||
 							server_opt.use_shared_inet)) {
-		debug(DBG_SOFT, "Evoking the Internet Gateway Pinger daemon");
-		pthread_create(&ping_igw_thread, &t_attr, igw_monitor_igws_t, 0);
+		debug(DBG_SOFT, "Starting the Internet Gateway monitor job");
+		timer_job_start(&igw_monitor_job, 0, igw_monitor_igws_job, 0);
 	}
 
 	/* We use this same process for the radar_daemon. */
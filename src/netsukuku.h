@@ -120,6 +120,7 @@ const static u_short andna_udp_port = ANDNA_UDP_PORT,
 #define INT_MAP_FILE		DATA_DIR "/ntk_internal_map"
 #define EXT_MAP_FILE		DATA_DIR "/ntk_external_map"
 #define BNODE_MAP_FILE		DATA_DIR "/ntk_bnode_map"
+#define SNAPSHOT_FILE		DATA_DIR "/ntk_snapshot"
 
 #define ANDNA_HNAMES_FILE	CONF_DIR "/andna_hostnames"
 #define SNSD_NODES_FILE		CONF_DIR "/snsd_nodes"
@@ -149,6 +150,7 @@ typedef struct {
 	char *int_map_file;
 	char *ext_map_file;
 	char *bnode_map_file;
+	char *snapshot_file;
 
 	char *andna_hnames_file;
 	char *snsd_nodes_file;
@@ -182,6 +184,7 @@ typedef struct {
 
 	char disable_andna;
 	char disable_resolvconf;
+	char warm_restart;			/* Restart from the snapshot */
 
 	int max_connections;
 	int max_accepts_per_host;
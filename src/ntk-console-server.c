@@ -9,6 +9,19 @@
 
 #include "console.h"
 #include "netsukuku.h"
+#include "pkts.h"
+#include "hook.h"
+#include "radar.h"
+#include "route.h"
+#include "codec.h"
+#include "flood.h"
+#include "timer.h"
+#include "bw.h"
+#include "qspn.h"
+#include "mapowner.h"
+#include "krnl_state.h"
+#include "mark.h"
+#include "snapshot.h"
 
 
 /* Variable and structure defintions, serverfd refers to socket file descriptor
@@ -146,6 +159,223 @@ request_processing(int session_fd, cmd_packet_t packet)
 	case COMMAND_IFSCT:
 		//send_response(session_fd, "IFS: TODO");
 		break;
+	case COMMAND_HOOKSTATS:
+		snprintf(buffer, maxBuffer, "hooks: %d, last hook: %u ms "
+				 "(scan %u, free_nodes %u, ext_map %u, maps %u, "
+				 "routes %u)", total_hooks, hook_total_ms,
+				 hook_phase_ms[HOOK_PHASE_SCAN],
+				 hook_phase_ms[HOOK_PHASE_FREE_NODES],
+				 hook_phase_ms[HOOK_PHASE_EXT_MAP],
+				 hook_phase_ms[HOOK_PHASE_MAPS],
+				 hook_phase_ms[HOOK_PHASE_ROUTES]);
+		break;
+	case COMMAND_RNODERTT:
+		{
+			struct rtt_est *re;
+			int len = 0;
+
+			pthread_mutex_lock(&rtt_est_mutex);
+			re = rtt_est_list;
+			list_for(re) {
+				len += snprintf(buffer + len, maxBuffer - len,
+								"%s %u/%u ", inet_to_str(re->ip),
+								re->srtt, re->rttvar);
+				if (len >= maxBuffer)
+					break;
+			}
+			pthread_mutex_unlock(&rtt_est_mutex);
+			break;
+		}
+	case COMMAND_RADARSTATS:
+		{
+			struct radar_sched *rs;
+			time_t up;
+			int d, len;
+
+			len = snprintf(buffer, maxBuffer, "keepalives: %u (%u failed)",
+						   radar_keepalives, radar_keepalives_failed);
+			pthread_mutex_lock(&radar_sched_mutex);
+			for (d = 0; d < me.cur_ifs_n && len < maxBuffer; d++) {
+				rs = &radar_sched[d];
+				up = rs->first_scan ? time(0) - rs->first_scan : 0;
+				len += snprintf(buffer + len, maxBuffer - len,
+								", %s: every %us, %u scans (%u/min), "
+								"detected in %u ms",
+								me.cur_ifs[d].dev_name, rs->interval,
+								rs->scans,
+								up ? (u_int) (rs->scans * 60 / up) : 0,
+								rs->detect_ms);
+			}
+			pthread_mutex_unlock(&radar_sched_mutex);
+			break;
+		}
+	case COMMAND_ROUTESYNC:
+		snprintf(buffer, maxBuffer, "marked: %u, written: %u, "
+				 "coalesced: %u, latency: last %u ms, avg %u ms",
+				 rt_sync_marks, rt_sync_updates,
+				 rt_sync_marks - rt_sync_updates, rt_sync_last_ms,
+				 rt_sync_avg_ms);
+		break;
+	case COMMAND_CODECSTATS:
+		{
+			struct codec_op_stat *st;
+			int op, c, len = 0;
+
+			for (op = 0; op < TOTAL_OPS && len < maxBuffer; op++) {
+				st = &codec_op_stats[op];
+				if (!st->pkts)
+					continue;
+
+				len += snprintf(buffer + len, maxBuffer - len,
+								"%s%s: %u pkts, %lu -> %lu bytes, using %s (",
+								len ? "; " : "",
+								!re_verify(op) ? re_to_str(op) :
+								rq_to_str(op), st->pkts, st->in_bytes,
+								st->out_bytes,
+								pkt_codecs[st->cur].name);
+				for (c = 0; c < PKT_CODECS && len < maxBuffer; c++)
+					len += snprintf(buffer + len, maxBuffer - len,
+									"%s%s %u.%u%% %u us/KB",
+									c ? ", " : "", pkt_codecs[c].name,
+									st->codec[c].ratio / 10,
+									st->codec[c].ratio % 10,
+									st->codec[c].us_kb);
+				if (len < maxBuffer)
+					len += snprintf(buffer + len, maxBuffer - len, ")");
+			}
+			if (!len)
+				snprintf(buffer, maxBuffer, "no compressed packets");
+			break;
+		}
+	case COMMAND_ADMISSION:
+		{
+			int rq, len = 0;
+
+			for (rq = 0; rq < TOTAL_REQUESTS && len < maxBuffer; rq++) {
+				if (!rq_adm_admitted[rq] && !rq_adm_rejected[rq])
+					continue;
+				len += snprintf(buffer + len, maxBuffer - len,
+								"%s%s: %u admitted, %u rejected",
+								len ? ", " : "", rq_to_str(rq),
+								rq_adm_admitted[rq], rq_adm_rejected[rq]);
+			}
+			if (!len)
+				snprintf(buffer, maxBuffer, "no limited requests received");
+			break;
+		}
+	case COMMAND_FLOODSTATS:
+		{
+			int op, len = 0;
+
+			for (op = 0; op < TOTAL_OPS && len < maxBuffer; op++) {
+				if (!flood_dedup_checks[op])
+					continue;
+				len += snprintf(buffer + len, maxBuffer - len,
+								"%s%s: %u dups of %u (%u%%)",
+								len ? ", " : "", rq_to_str(op),
+								flood_dedup_dups[op], flood_dedup_checks[op],
+								flood_dedup_dups[op] * 100 /
+								flood_dedup_checks[op]);
+			}
+			if (!len)
+				snprintf(buffer, maxBuffer, "no flooded pkts received");
+			break;
+		}
+	case COMMAND_TIMERSTATS:
+		snprintf(buffer, maxBuffer, "pending: %u, added: %u, fired: %u",
+				 timer_pending, timers_added, timers_fired);
+		break;
+	case COMMAND_BWSTATS:
+		{
+			int i, len;
+
+			pthread_mutex_lock(&bw_mutex);
+			len = snprintf(buffer, maxBuffer, "passive samples: %u",
+						   bw_passive_samples);
+			for (i = 0; i < bw_ifs_n && len < maxBuffer; i++)
+				len += snprintf(buffer + len, maxBuffer - len,
+								", %s: capacity %u, used %u, avail %u Kb/s",
+								bw_ifs[i].dev_name, bw_ifs[i].capacity,
+								bw_ifs[i].used, bw_ifs[i].avail);
+			pthread_mutex_unlock(&bw_mutex);
+			break;
+		}
+	case COMMAND_QSPNSTATS:
+		{
+			int level, len = 0;
+
+			for (level = 0; level < me.cur_quadg.levels &&
+				 len < maxBuffer; level++)
+				len += snprintf(buffer + len, maxBuffer - len,
+								"%slvl %d: %u requested, %u coalesced, "
+								"%u sent", len ? ", " : "", level,
+								qspn_rounds_requested[level],
+								qspn_rounds_coalesced[level],
+								qspn_rounds_sent[level]);
+			break;
+		}
+	case COMMAND_GWCACHESTATS:
+		{
+			u_int lookups;
+
+			pthread_mutex_lock(&gw_cache_mutex);
+			lookups = gw_cache_hits + gw_cache_misses;
+			snprintf(buffer, maxBuffer,
+					 "%u lookups, %u hits (%u%%), %u misses, %u of them "
+					 "invalidated by a map change", lookups, gw_cache_hits,
+					 lookups ? gw_cache_hits * 100 / lookups : 0,
+					 gw_cache_misses, gw_cache_stale);
+			pthread_mutex_unlock(&gw_cache_mutex);
+			break;
+		}
+	case COMMAND_LANESTATS:
+		{
+			struct map_lane *lane;
+			int level, len;
+
+			len = snprintf(buffer, maxBuffer, "%u parallel phases",
+						   map_phases);
+			for (level = 0; level < me.cur_quadg.levels &&
+				 len < maxBuffer; level++) {
+				lane = &map_lanes[level];
+				len += snprintf(buffer + len, maxBuffer - len,
+								", lvl %d: %u pkts in %u phases, %u msgs, "
+								"%u us/pkt", level, lane->pkts,
+								lane->phases, lane->msgs_posted,
+								lane->pkts ? (u_int) (lane->usecs /
+													  lane->pkts) : 0);
+			}
+			break;
+		}
+	case COMMAND_KRNLSTATS:
+		snprintf(buffer, maxBuffer,
+				 "mirror %s, %d addresses, %d routes, %u events, "
+				 "%u resyncs, %u lookups, %u route writes skipped",
+				 krnl_state_live ? "live" : "off", krnl_addrs_counter,
+				 krnl_rts_counter, krnl_events, krnl_resyncs, krnl_lookups,
+				 krnl_rt_skipped);
+		break;
+	case COMMAND_MARKSTATS:
+		snprintf(buffer, maxBuffer,
+				 "%d marking rules, %u transactions (%u skipped), "
+				 "%u rules added, %u rebuilds, last %u.%03u ms, "
+				 "max %u.%03u ms", mark_rules_n, mark_syncs,
+				 mark_syncs_skipped, mark_rules_added, mark_rebuilds,
+				 mark_sync_last_us / 1000, mark_sync_last_us % 1000,
+				 mark_sync_max_us / 1000, mark_sync_max_us % 1000);
+		break;
+	case COMMAND_SNAPSTATS:
+		snprintf(buffer, maxBuffer,
+				 "%u snapshots written, last %u bytes in %u us. "
+				 "Warm restart: %s, routes in %u ms, confirmed in %u ms "
+				 "by %d of %d rnodes (%d saved)", snap_written,
+				 snap_last_sz, snap_last_us,
+				 snap_warm_state == SNAP_WARM_DONE ? "done" :
+				 snap_warm_state == SNAP_WARM_UNCONFIRMED ? "unconfirmed" :
+				 snap_warm_state == SNAP_WARM_INVALID ? "invalid" : "off",
+				 snap_warm_ms, snap_confirm_ms, snap_warm_known,
+				 snap_warm_found, snap_warm_rnodes);
+		break;
 	default:
 		snprintf(buffer, maxBuffer,
 				 "Provided command is invalid or not implemented in this API");
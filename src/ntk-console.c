@@ -60,8 +60,47 @@ const struct supported_commands {
 			"List the number of interfaces present in server_opt.ifs", 0},
 	{
 	COMMAND_QUIT, "quit", "Exit the console", 0}, {
-COMMAND_CONSUPTIME, "console_uptime",
-			"Get the uptime of this console", 0},};
+	COMMAND_CONSUPTIME, "console_uptime",
+			"Get the uptime of this console", 0}, {
+	COMMAND_HOOKSTATS, "hook_stats",
+			"Time spent in each phase of the last hook", 0}, {
+	COMMAND_RNODERTT, "rnode_rtt",
+			"Smoothed rtt and jitter (in usec) of each rnode", 0}, {
+	COMMAND_RADARSTATS, "radar_stats",
+			"Scan interval, scans and detection latency of each "
+			"interface", 0}, {
+COMMAND_ROUTESYNC, "route_sync_stats",
+			"Routes written in the kernel, coalesced updates and "
+			"their latency", 0}, {
+COMMAND_CODECSTATS, "codec_stats",
+			"Compression ratio and time of each codec, for each "
+			"op", 0}, {
+COMMAND_ADMISSION, "admission_stats",
+			"Admitted and rejected requests, for each request", 0}, {
+COMMAND_FLOODSTATS, "flood_stats",
+			"Duplicated copies of the flooded pkts, for each op", 0}, {
+COMMAND_TIMERSTATS, "timer_stats",
+			"Pending, added and fired timers of the timer wheel", 0}, {
+COMMAND_BWSTATS, "bw_stats",
+			"Capacity, throughput and available bandwidth of each "
+			"interface", 0}, {
+COMMAND_QSPNSTATS, "qspn_stats",
+			"Requested, coalesced and sent qspn_rounds, for each "
+			"level", 0}, {
+COMMAND_GWCACHESTATS, "gw_cache_stats",
+			"Hits and misses of the gateway lookup cache", 0}, {
+COMMAND_LANESTATS, "lane_stats",
+			"Tracer and qspn pkts processed by the map lane of each "
+			"level", 0}, {
+COMMAND_KRNLSTATS, "krnl_stats",
+			"Addresses and routes mirrored from the kernel and the route "
+			"writes it saved", 0}, {
+COMMAND_MARKSTATS, "mark_stats",
+			"Firewall marking rules and the time taken to update them at "
+			"each IGW change", 0}, {
+COMMAND_SNAPSTATS, "snapshot_stats",
+			"State snapshots written and the time-to-routes of the last "
+			"warm restart", 0},};
 
 
 command_t
@@ -272,6 +311,21 @@ console(char *request)
 	case COMMAND_CURNODE:
 	case COMMAND_IFS:
 	case COMMAND_IFSCT:
+	case COMMAND_HOOKSTATS:
+	case COMMAND_RNODERTT:
+	case COMMAND_RADARSTATS:
+	case COMMAND_ROUTESYNC:
+	case COMMAND_CODECSTATS:
+	case COMMAND_ADMISSION:
+	case COMMAND_FLOODSTATS:
+	case COMMAND_TIMERSTATS:
+	case COMMAND_BWSTATS:
+	case COMMAND_QSPNSTATS:
+	case COMMAND_GWCACHESTATS:
+	case COMMAND_LANESTATS:
+	case COMMAND_KRNLSTATS:
+	case COMMAND_MARKSTATS:
+	case COMMAND_SNAPSTATS:
 		ntkd_request(commandID);
 		millisleep(200);
 		break;
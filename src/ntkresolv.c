@@ -17,6 +17,8 @@
  */
 
 #include <netinet/in.h>
+#include <poll.h>
+#include <netinet/tcp.h>
 
 #include "includes.h"
 
@@ -27,6 +29,7 @@
 #include "common.h"
 
 static ntkresolv_opts globopts;
+static ntkresolv_bulk bulk;
 static struct timeval time_start, time_stop;
 uint8_t mode_compute_hash = 0;
 uint8_t mode_parsable_output = 0;
@@ -49,7 +52,8 @@ usage(void)
 {
 	say("Usage:\n"
 		"\tntk-resolv [OPTIONS] host\n"
-		"\tntk-resolv -H host\n\n"
+		"\tntk-resolv -H host\n"
+		"\tntk-resolv [OPTIONS] -f file\n\n"
 		" -v --version          print version, then exit.\n"
 		" -n --nameserver=ns    use nameserver `ns' instead of localhost.\n"
 		" -P --port=port        nameserver port, default 53.\n"
@@ -62,8 +66,14 @@ usage(void)
 		" -m --md5-hash         hostname specified is hash-ed.\n"
 		" -H --compute-hash     print the hash'ed hostname.\n"
 		" -l --parsable-output  print answers in a synthetic way.\n"
+		" -f --bulk=file        resolve all the questions listed in `file'\n"
+		"                       (`-' is stdin) and report the statistics.\n"
+		" -c --in-flight=n      bulk mode: queries kept in flight, default %d.\n"
+		" -T --tcp              bulk mode: send the queries over TCP.\n"
+		" -w --timeout=secs     bulk mode: query timeout, default %d.\n"
 		" -h --help             display this help, then exit.\n\n"
-		"Report bugs and ideas to <%s>.\n", NTK_RESOLV_MAIL_BUGS);
+		"Report bugs and ideas to <%s>.\n", BULK_INFLIGHT_DEFAULT,
+		BULK_TIMEOUT, NTK_RESOLV_MAIL_BUGS);
 	ntkresolv_safe_exit(1);
 }
 
@@ -170,6 +180,7 @@ opts_init(void)
 	GQT->service = SNSD_SERVICE_DEFAULT;
 	GQT->r = 1;
 	xsrand();
+	bulk_init();
 }
 
 void
@@ -295,6 +306,45 @@ opts_set_parsable_output(void)
 	AMISILENT = 1;
 }
 
+void
+opts_set_bulk_file(char *arg)
+{
+	bulk.file = arg;
+}
+
+void
+opts_set_in_flight(char *arg)
+{
+	int n;
+
+	n = atoi(arg);
+	if (n < 1 || n > BULK_MAX_INFLIGHT) {
+		say("The queries in flight must be between 1 and %d.\n",
+			BULK_MAX_INFLIGHT);
+		ntkresolv_safe_exit(1);
+	}
+	bulk.max_in_flight = n;
+}
+
+void
+opts_set_tcp(void)
+{
+	bulk.type = SOCK_STREAM;
+}
+
+void
+opts_set_bulk_timeout(char *arg)
+{
+	int n;
+
+	n = atoi(arg);
+	if (n < 1) {
+		say("Bad timeout %s.\n", arg);
+		ntkresolv_safe_exit(1);
+	}
+	bulk.timeout = n;
+}
+
 void
 opts_set_question(char *arg)
 {
@@ -568,6 +618,577 @@ do_command(void)
 	destroy_andns_pkt(GQT);
 }
 
+/*
+ * bulk_init
+ *
+ * sets the defaults of the bulk mode.
+ */
+void
+bulk_init(void)
+{
+	memset(&bulk, 0, sizeof(bulk));
+	memset(bulk.slot, 0xff, sizeof(bulk.slot));
+	bulk.type = SOCK_DGRAM;
+	bulk.max_in_flight = BULK_INFLIGHT_DEFAULT;
+	bulk.timeout = BULK_TIMEOUT;
+	bulk.sk = -1;
+	bulk.next_id = rand() & BULK_MAX_ID;
+}
+
+/*
+ * bulk_check_question
+ *
+ * returns -1 if opts_set_question() would refuse `name' with the current
+ * GQT.
+ */
+int
+bulk_check_question(char *name)
+{
+	struct in6_addr i6a;
+	int len;
+
+	len = strlen(name);
+	if (len > NTKRESOLV_MAX_OBJ_LEN)
+		return -1;
+
+	switch (GQT->qtype) {
+	case QTYPE_A:
+		if (GQT->nk == REALM_NTK)
+			return GOP.hash && len != 2 * ANDNS_HASH_H ? -1 : 0;
+		return len > 255 ? -1 : 0;
+	case QTYPE_PTR:
+		if (GOP.hash)
+			return -1;
+		if (inet_pton(AF_INET, name, &i6a) <= 0 &&
+			inet_pton(AF_INET6, name, &i6a) <= 0)
+			return -1;
+		return 0;
+	case QTYPE_G:
+		if (GQT->nk != REALM_NTK)
+			return -1;
+		return GOP.hash && len != 2 * ANDNS_HASH_H ? -1 : 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * bulk_set_question
+ *
+ * creates in GQT the question of the `line' read from the bulk file.
+ * It returns 1 if the line is empty or a comment, -1 if it is malformed.
+ * In both cases GQT isn't created.
+ */
+int
+bulk_set_question(char *line)
+{
+	char *tok[4], *save;
+	int i, n, res;
+
+	for (n = 0, save = 0; n < 4; n++)
+		if (!(tok[n] = strtok_r(n ? 0 : line, " \t\r\n", &save)))
+			break;
+	if (!n || *tok[0] == '#')
+		return 1;
+
+	/* Start from the question given on the command line */
+	GQT = create_andns_pkt();
+	memcpy(GQT, &bulk.def, sizeof(andns_pkt));
+
+	for (i = 1; i < n; i++) {
+		if (!strcmp(tok[i], "-"))
+			continue;
+		switch (i) {
+		case 1:
+			if (!strcmp(tok[i], HELP_STR) ||
+				(res = QTFROMPREF(tok[i])) == -1)
+				goto bad;
+			opts_set_qt(tok[i]);
+			break;
+		case 2:
+			if (!strcmp(tok[i], HELP_STR) || !REALMFROMPREF(tok[i]))
+				goto bad;
+			opts_set_realm(tok[i]);
+			break;
+		case 3:
+			if (str_to_snsd_service(tok[i], (int *) &GQT->service,
+									&GQT->p) < 0)
+				goto bad;
+			GQT->p -= 1;
+			break;
+		}
+	}
+
+	if (bulk_check_question(tok[0]) < 0)
+		goto bad;
+	opts_set_question(tok[0]);
+
+	return 0;
+
+  bad:
+	destroy_andns_pkt(GQT);
+	GQT = 0;
+	return -1;
+}
+
+/*
+ * bulk_connect
+ *
+ * opens the socket of the bulk mode. On error -1 is returned.
+ */
+int
+bulk_connect(void)
+{
+	int one = 1;
+
+	bulk.sk = host_connect(GOP.nsserver, GOP.port, bulk.type, 0);
+	if (bulk.sk < 0)
+		return -1;
+
+	/* The queries are small, don't let them wait each other */
+	if (bulk.type == SOCK_STREAM)
+		setsockopt(bulk.sk, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (fcntl(bulk.sk, F_SETFL, O_NONBLOCK) < 0) {
+		close(bulk.sk);
+		bulk.sk = -1;
+		return -1;
+	}
+	bulk.rbuf_len = bulk.sbuf_len = bulk.sbuf_off = 0;
+
+	return 0;
+}
+
+/*
+ * bulk_query_done
+ *
+ * removes bulk.q[`i'] from the queries in flight.
+ */
+void
+bulk_query_done(int i)
+{
+	int last;
+
+	bulk.slot[bulk.q[i].id] = -1;
+	last = --bulk.in_flight;
+	if (i != last) {
+		memcpy(&bulk.q[i], &bulk.q[last], sizeof(struct bulk_query));
+		bulk.slot[bulk.q[i].id] = i;
+	}
+}
+
+/*
+ * bulk_query_send
+ *
+ * puts in flight the `id' query, built in `buf', for the `nk' realm.
+ * Over TCP the query is only queued in bulk.sbuf, see bulk_flush().
+ * On error -1 is returned.
+ */
+int
+bulk_query_send(char *buf, int len, uint16_t id, uint8_t nk)
+{
+	struct bulk_query *q;
+	struct bulk_stats *st;
+	uint16_t s;
+	int i;
+
+	i = bulk.in_flight++;
+	q = &bulk.q[i];
+	q->id = id;
+	q->realm = BULK_REALM_IDX(nk);
+	bulk.slot[q->id] = i;
+
+	st = &bulk.st[q->realm];
+	st->sent++;
+	gettimeofday(&q->sent, 0);
+
+	if (bulk.type == SOCK_STREAM) {
+		s = htons(len);
+		memcpy(bulk.sbuf, &s, 2);
+		memcpy(bulk.sbuf + 2, buf, len);
+		bulk.sbuf_len = len + 2;
+		bulk.sbuf_off = 0;
+		return bulk_flush();
+	}
+
+	if (send(bulk.sk, buf, len, 0) != len) {
+		st->errors++;
+		bulk_query_done(i);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * bulk_fill
+ *
+ * reads the next questions and sends them, until bulk.max_in_flight
+ * queries are in flight.
+ */
+void
+bulk_fill(void)
+{
+	char line[BULK_LINE_LEN], buf[ANDNS_MAX_SZ];
+	uint16_t id;
+	uint8_t nk;
+	int c, len, res;
+
+	while (!bulk.eof && !bulk.sbuf_len &&
+		   bulk.in_flight < bulk.max_in_flight) {
+		if (!fgets(line, BULK_LINE_LEN, bulk.input)) {
+			bulk.eof = 1;
+			break;
+		}
+		bulk.lines++;
+
+		if (!strchr(line, '\n') && !feof(bulk.input)) {
+			/* Too long, skip the rest of the line */
+			while ((c = fgetc(bulk.input)) != EOF && c != '\n');
+			bulk.skipped++;
+			continue;
+		}
+
+		if ((res = bulk_set_question(line))) {
+			if (res < 0)
+				bulk.skipped++;
+			continue;
+		}
+
+		while (bulk.slot[bulk.next_id] != -1)
+			bulk.next_id = (bulk.next_id + 1) & BULK_MAX_ID;
+		id = GQT->id = bulk.next_id;
+		bulk.next_id = (bulk.next_id + 1) & BULK_MAX_ID;
+		nk = GQT->nk;
+
+		/* a_p() destroys GQT */
+		len = a_p(GQT, buf);
+		GQT = 0;
+		if (len < 0) {
+			bulk.skipped++;
+			continue;
+		}
+
+		bulk_query_send(buf, len, id, nk);
+	}
+}
+
+/*
+ * bulk_flush
+ *
+ * sends what is left of the TCP query in bulk.sbuf. On error -1 is
+ * returned.
+ */
+int
+bulk_flush(void)
+{
+	ssize_t ret;
+
+	if (!bulk.sbuf_len)
+		return 0;
+
+	ret = send(bulk.sk, bulk.sbuf + bulk.sbuf_off,
+			   bulk.sbuf_len - bulk.sbuf_off, MSG_NOSIGNAL);
+	if (ret < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	bulk.sbuf_off += ret;
+	if (bulk.sbuf_off == bulk.sbuf_len)
+		bulk.sbuf_len = bulk.sbuf_off = 0;
+
+	return 0;
+}
+
+/*
+ * bulk_reply
+ *
+ * matches the `buf' reply, received at the `now' time, with its query.
+ * Only the header is unpacked.
+ */
+void
+bulk_reply(char *buf, int len, struct timeval *now)
+{
+	struct bulk_stats *st;
+	struct timeval diff;
+	andns_pkt ap;
+	int i;
+
+	if (len < ANDNS_HDR_SZ)
+		return;
+
+	a_hdr_u(buf, &ap);
+	if (!ap.qr || (i = bulk.slot[ap.id & BULK_MAX_ID]) < 0)
+		/* Not a reply, or it arrived too late */
+		return;
+
+	st = &bulk.st[bulk.q[i].realm];
+	timersub(now, &bulk.q[i].sent, &diff);
+	if (st->lat_n == st->lat_sz) {
+		st->lat_sz += BULK_LAT_STEP;
+		st->lat = xrealloc(st->lat, st->lat_sz * sizeof(u_int));
+	}
+	st->lat[st->lat_n++] = diff.tv_sec * 1000000 + diff.tv_usec;
+
+	st->answered++;
+	if (ap.rcode != ANDNS_RCODE_NOERR)
+		st->errors++;
+
+	bulk_query_done(i);
+}
+
+/*
+ * bulk_recv
+ *
+ * receives all the pending replies. On UDP each datagram is a reply, on
+ * TCP the stream is split in the rfc 1035 frames.
+ * It returns -1 if the TCP connection has been lost.
+ */
+int
+bulk_recv(void)
+{
+	char buf[ANDNS_MAX_SZ];
+	struct timeval now;
+	uint16_t s;
+	ssize_t ret;
+	int flen;
+
+	for (;;) {
+		if (bulk.type == SOCK_DGRAM)
+			ret = recv(bulk.sk, buf, ANDNS_MAX_SZ, 0);
+		else
+			ret = recv(bulk.sk, bulk.rbuf + bulk.rbuf_len,
+					   BULK_TCP_BUF_SZ - bulk.rbuf_len, 0);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+			if (bulk.type == SOCK_DGRAM)
+				/* i.e. ECONNREFUSED, the query will expire */
+				continue;
+			return -1;
+		}
+		if (!ret && bulk.type == SOCK_STREAM)
+			return -1;
+
+		gettimeofday(&now, 0);
+		if (bulk.type == SOCK_DGRAM) {
+			bulk_reply(buf, ret, &now);
+			continue;
+		}
+
+		bulk.rbuf_len += ret;
+		while (bulk.rbuf_len >= 2) {
+			memcpy(&s, bulk.rbuf, 2);
+			flen = ntohs(s);
+			if (bulk.rbuf_len < flen + 2)
+				break;
+			bulk_reply(bulk.rbuf + 2, flen, &now);
+			bulk.rbuf_len -= flen + 2;
+			memmove(bulk.rbuf, bulk.rbuf + flen + 2, bulk.rbuf_len);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * bulk_expire
+ *
+ * drops the queries which are in flight since more than bulk.timeout
+ * seconds.
+ */
+void
+bulk_expire(struct timeval *now)
+{
+	int i;
+
+	/* bulk_query_done() moves the last query in `i' */
+	for (i = bulk.in_flight - 1; i >= 0; i--)
+		if (now->tv_sec - bulk.q[i].sent.tv_sec >= bulk.timeout) {
+			bulk.st[bulk.q[i].realm].timeouts++;
+			bulk_query_done(i);
+		}
+}
+
+/*
+ * bulk_abort_in_flight
+ *
+ * The TCP connection has been lost: the queries in flight are counted as
+ * errors and the socket is closed.
+ */
+void
+bulk_abort_in_flight(void)
+{
+	while (bulk.in_flight) {
+		bulk.st[bulk.q[0].realm].errors++;
+		bulk_query_done(0);
+	}
+	close(bulk.sk);
+	bulk.sk = -1;
+}
+
+int
+bulk_lat_cmp(const void *a, const void *b)
+{
+	u_int x = *(u_int *) a, y = *(u_int *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * bulk_percentile
+ *
+ * returns the `perc' percentile, with the nearest rank method, of the
+ * sorted latencies of `st'.
+ */
+u_int
+bulk_percentile(struct bulk_stats *st, int perc)
+{
+	u_int rank;
+
+	if (!st->lat_n)
+		return 0;
+	rank = (st->lat_n * perc + 99) / 100;
+	return st->lat[rank ? rank - 1 : 0];
+}
+
+void
+bulk_print_stats(void)
+{
+	char *realm_str[BULK_REALMS] = { REALM_NTK_STR, REALM_INT_STR };
+	struct bulk_stats *st;
+	double secs;
+	int i;
+
+	secs = diff_time(bulk.start, bulk.stop);
+	if (secs <= 0)
+		secs = 1 / TIME_SCALE;
+
+	if (!mode_parsable_output)
+		say("\n - Bulk Section:\n"
+			"\tproto ~ %s\tin flight ~ %d\ttimeout ~ %ds\n"
+			"\tlines ~ %u\tskipped ~ %u\n"
+			"\ttime ~ %f seconds\n",
+			bulk.type == SOCK_STREAM ? "tcp" : "udp",
+			bulk.max_in_flight, bulk.timeout,
+			bulk.lines, bulk.skipped, secs);
+
+	for (i = 0; i < BULK_REALMS; i++) {
+		st = &bulk.st[i];
+		if (!st->sent)
+			continue;
+		qsort(st->lat, st->lat_n, sizeof(u_int), bulk_lat_cmp);
+
+		if (mode_parsable_output) {
+			/* realm sent answered errors timeouts qps p50 p90 p99 max,
+			 * the latencies are in usec */
+			say("%s %u %u %u %u %.1f %u %u %u %u\n", realm_str[i],
+				st->sent, st->answered, st->errors, st->timeouts,
+				st->answered / secs, bulk_percentile(st, 50),
+				bulk_percentile(st, 90), bulk_percentile(st, 99),
+				bulk_percentile(st, 100));
+			continue;
+		}
+
+		say("\n - %s Realm:\n"
+			"\tsent ~ %u\tanswered ~ %u\terrors ~ %u\ttimeouts ~ %u\n"
+			"\tthroughput ~ %.1f answers/s\n"
+			"\tlatency ~ p50 %.3fms  p90 %.3fms  p99 %.3fms  max %.3fms\n",
+			i ? "Inet" : "Ntk",
+			st->sent, st->answered, st->errors, st->timeouts,
+			st->answered / secs, bulk_percentile(st, 50) / 1000.0,
+			bulk_percentile(st, 90) / 1000.0,
+			bulk_percentile(st, 99) / 1000.0,
+			bulk_percentile(st, 100) / 1000.0);
+	}
+}
+
+/*
+ * do_bulk
+ *
+ * The bulk mode: it keeps bulk.max_in_flight queries in flight until all
+ * the questions of bulk.file have been answered or have expired.
+ */
+void
+do_bulk(void)
+{
+	struct pollfd pfd;
+	struct timeval now;
+	int i, ret;
+
+	if (!strcmp(bulk.file, "-"))
+		bulk.input = stdin;
+	else if (!(bulk.input = fopen(bulk.file, "r"))) {
+		say("Cannot open %s: %s\n", bulk.file, strerror(errno));
+		ntkresolv_safe_exit(1);
+	}
+
+	if (bulk.type == SOCK_STREAM)
+		bulk.rbuf = xmalloc(BULK_TCP_BUF_SZ);
+	if (bulk_connect() < 0) {
+		say("Unable to connect to %s.\n", GOP.nsserver);
+		ntkresolv_safe_exit(1);
+	}
+
+	/* Each line creates its own GQT */
+	memcpy(&bulk.def, GQT, sizeof(andns_pkt));
+	bulk.def.qstdata = 0;
+	bulk.def.pkt_answ = 0;
+	destroy_andns_pkt(GQT);
+	GQT = 0;
+
+	gettimeofday(&bulk.start, 0);
+	for (;;) {
+		bulk_fill();
+		if (bulk.eof && !bulk.in_flight)
+			break;
+
+		pfd.fd = bulk.sk;
+		pfd.events = POLLIN | (bulk.sbuf_len ? POLLOUT : 0);
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, BULK_POLL_MS);
+		if (ret < 0 && errno != EINTR) {
+			say("poll: %s\n", strerror(errno));
+			break;
+		}
+
+		if ((pfd.revents & POLLOUT && bulk_flush() < 0) ||
+			(pfd.revents & (POLLIN | POLLERR | POLLHUP) &&
+			 bulk_recv() < 0)) {
+			say("Connection with %s lost, reconnecting.\n",
+				GOP.nsserver);
+			bulk_abort_in_flight();
+			if (bulk_connect() < 0) {
+				say("Unable to connect to %s.\n", GOP.nsserver);
+				break;
+			}
+		}
+
+		gettimeofday(&now, 0);
+		bulk_expire(&now);
+	}
+	gettimeofday(&bulk.stop, 0);
+
+	/* What is still in flight won't be answered anymore */
+	while (bulk.in_flight) {
+		bulk.st[bulk.q[0].realm].timeouts++;
+		bulk_query_done(0);
+	}
+
+	bulk_print_stats();
+
+	if (bulk.sk >= 0)
+		close(bulk.sk);
+	if (bulk.input != stdin)
+		fclose(bulk.input);
+	if (bulk.rbuf)
+		xfree(bulk.rbuf);
+	for (i = 0; i < BULK_REALMS; i++)
+		if (bulk.st[i].lat)
+			xfree(bulk.st[i].lat);
+
+	GQT = create_andns_pkt();
+}
+
 void
 ntkresolv_exit(int i)
 {
@@ -605,6 +1226,10 @@ main(int argc, char **argv)
 		{"md5-hash", 0, 0, 'm'},
 		{"compute-hash", 0, 0, 'H'},
 		{"parsable-output", 0, 0, 'l'},
+		{"bulk", 1, 0, 'f'},
+		{"in-flight", 1, 0, 'c'},
+		{"tcp", 0, 0, 'T'},
+		{"timeout", 1, 0, 'w'},
 		{"help", 0, 0, 'h'},
 		{0, 0, 0, 0}
 	};
@@ -612,7 +1237,7 @@ main(int argc, char **argv)
 	while (1) {
 		int oindex = 0;
 		c = getopt_long(argc, argv,
-						"vn:P:t:r:s:p:ShbmHl", longopts, &oindex);
+						"vn:P:t:r:s:p:ShbmHlf:c:Tw:", longopts, &oindex);
 		if (c == -1)
 			break;
 		switch (c) {
@@ -653,10 +1278,26 @@ main(int argc, char **argv)
 		case 'l':
 			opts_set_parsable_output();
 			break;
+		case 'f':
+			opts_set_bulk_file(optarg);
+			break;
+		case 'c':
+			opts_set_in_flight(optarg);
+			break;
+		case 'T':
+			opts_set_tcp();
+			break;
+		case 'w':
+			opts_set_bulk_timeout(optarg);
+			break;
 		default:
 			usage();
 		}
 	}
+	if (bulk.file) {
+		do_bulk();
+		ntkresolv_safe_exit(0);
+	}
 	if (optind == argc)
 		usage();
 	opts_finish(argv[optind]);
@@ -95,7 +95,7 @@ int QT_LEN = 4;
 		__res=REALM_NTK;					\
 	else if (!strncasecmp(REALM_INT_STR,s,strlen(s)))		\
  		__res=REALM_INT; 					\
-		__res; })
+	__res; })
 #define PROTOFROMPREF(s)						\
 ({									\
  	uint8_t __res=-1;						\
@@ -103,7 +103,7 @@ int QT_LEN = 4;
 		__res=SNSD_PROTO_UDP;					\
 	else if (!strncasecmp(SNSD_PROTO_TCP_STR,s,strlen(s)))		\
  		__res=SNSD_PROTO_TCP; 					\
-		__res; })
+	__res; })
 
 
 
@@ -119,6 +119,82 @@ typedef struct ntkresolv_opts {
 
 #define NTKRESOLV_OPTS_SZ	sizeof(ntkresolv_opts)
 
+/*
+ * Bulk mode
+ *
+ * With `-f file' ntk-resolv reads the questions from `file' (or stdin, if
+ * it is "-"), one per line:
+ *
+ *	name [query-type [realm [service[/proto]]]]
+ *
+ * The omitted fields, or the ones set to "-", take the value given on the
+ * command line. Up to `-c' queries are kept in flight at the same time, on a
+ * single UDP socket or, with `-T', pipelined on a single TCP connection,
+ * where each pkt is prefixed by its length as in rfc 1035 4.2.2.
+ * The replies are matched to their queries by the andns id, which is
+ * 15 bits long.
+ * At the end, the throughput and the latency percentiles of each realm are
+ * printed.
+ */
+#define BULK_INFLIGHT_DEFAULT	32
+#define BULK_MAX_INFLIGHT	1024
+#define BULK_TIMEOUT		5	/* seconds */
+#define BULK_LINE_LEN		(NTKRESOLV_MAX_OBJ_LEN + 64)
+#define BULK_MAX_ID		0x7fff
+#define BULK_TCP_BUF_SZ		(2 + 0xffff)
+#define BULK_REALMS		2	/* REALM_NTK, REALM_INT */
+#define BULK_REALM_IDX(nk)	((nk) == REALM_INT ? 1 : 0)
+#define BULK_LAT_STEP		4096
+#define BULK_POLL_MS		100
+
+struct bulk_query {
+	uint16_t id;
+	uint8_t realm;				/* index in ntkresolv_bulk.st */
+	struct timeval sent;
+};
+
+struct bulk_stats {
+	u_int sent;
+	u_int answered;
+	u_int errors;				/* error rcodes, failed sends */
+	u_int timeouts;
+	u_int *lat;					/* latencies of the answers, in usec */
+	u_int lat_n;
+	u_int lat_sz;
+};
+
+typedef struct ntkresolv_bulk {
+	char *file;
+	FILE *input;
+	int eof;
+	u_int lines;
+	u_int skipped;				/* malformed lines */
+
+	int type;					/* SOCK_DGRAM or SOCK_STREAM */
+	int max_in_flight;
+	int timeout;				/* seconds */
+	int sk;
+
+	andns_pkt def;				/* The question set on the cmd line */
+
+	/* The queries in flight are packed in q[0 .. in_flight-1] */
+	struct bulk_query q[BULK_MAX_INFLIGHT];
+	int in_flight;
+	short slot[BULK_MAX_ID + 1];	/* id -> q[] index, -1 if unused */
+	uint16_t next_id;
+
+	/* The TCP framing buffers */
+	char *rbuf;
+	int rbuf_len;
+	char sbuf[2 + ANDNS_MAX_SZ];
+	int sbuf_len;
+	int sbuf_off;
+
+	struct timeval start;
+	struct timeval stop;
+	struct bulk_stats st[BULK_REALMS];
+} ntkresolv_bulk;
+
 #define QR_STR(ap)	((ap)->qr==0)?"QUERY":"ANSWER"
 #define QTYPE_STR(ap)						\
 ({								\
@@ -308,6 +384,10 @@ void opts_set_recursion(void);
 void opts_set_hash(void);
 void opts_set_compute_hash(void);
 void opts_set_parsable_output(void);
+void opts_set_bulk_file(char *arg);
+void opts_set_in_flight(char *arg);
+void opts_set_tcp(void);
+void opts_set_bulk_timeout(char *arg);
 void opts_set_question(char *arg);
 void opts_finish(char *arg);
 void print_headers();
@@ -318,6 +398,22 @@ void print_answers();
 void print_parsable_answers(void);
 void print_results(void);
 void do_command(void);
+void bulk_init(void);
+int bulk_check_question(char *name);
+int bulk_set_question(char *line);
+int bulk_connect(void);
+void bulk_query_done(int i);
+int bulk_query_send(char *buf, int len, uint16_t id, uint8_t nk);
+void bulk_fill(void);
+int bulk_flush(void);
+void bulk_reply(char *buf, int len, struct timeval *now);
+int bulk_recv(void);
+void bulk_expire(struct timeval *now);
+void bulk_abort_in_flight(void);
+int bulk_lat_cmp(const void *a, const void *b);
+u_int bulk_percentile(struct bulk_stats *st, int perc);
+void bulk_print_stats(void);
+void do_bulk(void);
 void ntkresolv_exit(int i);
 void ntkresolv_safe_exit(int i);
 int main(int argc, char **argv);
@@ -28,7 +28,11 @@
 #include "request.h"
 #include "endianness.h"
 #include "pkts.h"
+#include "codec.h"
+#include "flood.h"
 #include "accept.h"
+#include "mapowner.h"
+#include "bw.h"
 #include "common.h"
 
 interface cur_ifs[MAX_INTERFACES];
@@ -193,6 +197,9 @@ pkt_free(PACKET * pkt, int close_socket)
  * `dst_msg' must have at least `newhdr'->sz bytes big.
  * It is also assumed that `pkt'->msg is not 0.
  *
+ * The codec is chosen with codec_select(), between the ones known by
+ * `pkt'->to, and its id is written in the high byte of
+ * `newhdr'->uncompress_sz, see PKT_HDR_CODEC.
  * The size of the compressed msg is stored in `newhdr'->sz, while
  * the size of the orignal one is written in `newhdr'->uncompress_sz.
  * If the compression doesn't fail, `newhdr'->sz will be always less than
@@ -207,18 +214,29 @@ pkt_free(PACKET * pkt, int close_socket)
 int
 pkt_compress(PACKET * pkt, pkt_hdr * newhdr, char *dst_msg)
 {
-	uLongf bound_sz;
-	int ret;
+	struct timeval t1, t2, t;
+	size_t bound_sz;
+	int ret, codec;
 
-	bound_sz = compressBound(pkt->hdr.sz);
+	codec = codec_select(pkt->hdr.op, codec_peer_get(&pkt->to));
+	bound_sz = pkt_codecs[codec].bound(pkt->hdr.sz);
 
 	unsigned char dst[bound_sz];
 
-	ret = compress2(dst, &bound_sz, (u_char *) pkt->msg, pkt->hdr.sz,
-					PKT_COMPRESS_LEVEL);
-	if (ret != Z_OK) {
-		error(RED(ERROR_MSG) "cannot compress the pkt. "
-			  "It will be sent uncompressed.", ERROR_FUNC);
+	gettimeofday(&t1, 0);
+	ret = pkt_codecs[codec].compress(dst, &bound_sz, (u_char *) pkt->msg,
+									 pkt->hdr.sz);
+	gettimeofday(&t2, 0);
+	timersub(&t2, &t1, &t);
+
+	codec_update(pkt->hdr.op, codec, pkt->hdr.sz,
+				 ret || bound_sz >= pkt->hdr.sz ? pkt->hdr.sz : bound_sz,
+				 MICROSEC(t));
+
+	if (ret) {
+		error(RED(ERROR_MSG) "cannot compress the pkt with %s. "
+			  "It will be sent uncompressed.", ERROR_FUNC,
+			  pkt_codecs[codec].name);
 		return -1;
 	}
 
@@ -227,7 +245,7 @@ pkt_compress(PACKET * pkt, pkt_hdr * newhdr, char *dst_msg)
 		return -pkt->hdr.sz;
 
 	memcpy(dst_msg, dst, bound_sz);
-	newhdr->uncompress_sz = pkt->hdr.sz;
+	newhdr->uncompress_sz = pkt->hdr.sz | ((u_int) codec << PKT_CODEC_SHIFT);
 	newhdr->sz = bound_sz;
 	newhdr->flags |= COMPRESSED_PKT;
 
@@ -291,25 +309,25 @@ pkt_pack(PACKET * pkt)
 int
 pkt_uncompress(PACKET * pkt)
 {
-	uLongf dstlen;
+	size_t dstlen;
 	int ret = 0;
 	unsigned char *dst = 0;
 
-	dstlen = pkt->hdr.uncompress_sz;
+	dstlen = PKT_HDR_UNCOMPRESS_SZ(pkt->hdr);
 	dst = xmalloc(dstlen);
 
-	ret = uncompress(dst, &dstlen, (u_char *) pkt->msg, pkt->hdr.sz);
-	if (ret != Z_OK)
+	ret = pkt_codecs[PKT_HDR_CODEC(pkt->hdr)].uncompress(dst, &dstlen,
+														 (u_char *) pkt->msg,
+														 pkt->hdr.sz);
+	if (ret || dstlen != PKT_HDR_UNCOMPRESS_SZ(pkt->hdr))
 		ERROR_FINISH(ret, -1, finish);
-	else
-		ret = 0;
 
 	/**
 	 * Restore the uncompressed packet
 	 */
 	xfree(pkt->msg);
 	pkt->msg = (char *) dst;
-	pkt->hdr.sz = pkt->hdr.uncompress_sz;
+	pkt->hdr.sz = PKT_HDR_UNCOMPRESS_SZ(pkt->hdr);
 	pkt->hdr.uncompress_sz = 0;
 	pkt->hdr.flags &= ~COMPRESSED_PKT;
    /**/ finish:
@@ -340,8 +358,9 @@ pkt_verify_hdr(PACKET pkt)
 		return 1;
 
 	if (pkt.hdr.flags & COMPRESSED_PKT &&
-		(pkt.hdr.sz >= pkt.hdr.uncompress_sz ||
-		 pkt.hdr.uncompress_sz > PKT_MAX_MSG_SZ))
+		(pkt.hdr.sz >= PKT_HDR_UNCOMPRESS_SZ(pkt.hdr) ||
+		 PKT_HDR_UNCOMPRESS_SZ(pkt.hdr) > PKT_MAX_MSG_SZ ||
+		 PKT_HDR_CODEC(pkt.hdr) >= PKT_CODECS))
 		/* Invalid compression */
 		return 1;
 
@@ -417,13 +436,16 @@ pkt_recv_udp(PACKET * pkt)
 									pkt->flags, &from, &fromlen,
 									pkt->timeout);
 	else
-		err = inet_recvfrom(pkt->sk, buf, PACKET_SZ(MAXMSGSZ),
-							pkt->flags, &from, &fromlen);
+		err = inet_recvfrom_stamp(pkt->sk, buf, PACKET_SZ(MAXMSGSZ),
+								  pkt->flags, &from, &fromlen,
+								  &pkt->stamp);
 
 	if (err < sizeof(pkt_hdr)) {
 		debug(DBG_NOISE, "inet_recvfrom() of the hdr aborted!");
 		return -1;
 	}
+	if (pkt->pkt_flags & PKT_RECV_TIMEOUT)
+		gettimeofday(&pkt->stamp, 0);
 
 	/* then we extract the hdr... and verify it */
 	memcpy(&pkt->hdr, buf, sizeof(pkt_hdr));
@@ -453,7 +475,9 @@ pkt_recv_udp(PACKET * pkt)
 ssize_t
 pkt_recv_tcp(PACKET * pkt)
 {
+	struct timeval t0, t1;
 	ssize_t err = -1;
+	int queued = -1;
 
 	/* we get the hdr... */
 	if (pkt->pkt_flags & PKT_RECV_TIMEOUT)
@@ -476,6 +500,14 @@ pkt_recv_tcp(PACKET * pkt)
 		/* let's get the body */
 		pkt->msg = xmalloc(pkt->hdr.sz);
 
+		/* Time the big bodies for the bandwidth monitor. What is already
+		 * queued in the socket doesn't count */
+		if (pkt->hdr.sz >= BW_PASSIVE_MIN_SZ &&
+			ioctl(pkt->sk, FIONREAD, &queued) >= 0)
+			gettimeofday(&t0, 0);
+		else
+			queued = -1;
+
 		if (pkt->pkt_flags & PKT_RECV_TIMEOUT)
 			err = inet_recv_timeout(pkt->sk, pkt->msg, pkt->hdr.sz,
 									pkt->flags, pkt->timeout);
@@ -487,11 +519,67 @@ pkt_recv_tcp(PACKET * pkt)
 				  "pkt's body", ERROR_FUNC);
 			return -1;
 		}
+
+		if (queued >= 0 && pkt->hdr.sz > queued) {
+			gettimeofday(&t1, 0);
+			timersub(&t1, &t0, &t1);
+			bw_passive_sample(pkt->sk, pkt->hdr.sz - queued, MICROSEC(t1));
+		}
 	}
 
 	return err;
 }
 
+/*
+ * pkt_flood_key_seen
+ *
+ * calls flood_seen() for the flood of `pkt', identified by its op, its id
+ * and the first pkt_op_tbl[op].flood_key_sz bytes of its uncompressed msg.
+ */
+int
+pkt_flood_key_seen(PACKET * pkt)
+{
+	size_t key_sz = pkt_op_tbl[pkt->hdr.op].flood_key_sz;
+
+	if (!pkt->msg || pkt->hdr.sz < key_sz)
+		key_sz = 0;
+
+	return flood_seen(pkt->hdr.op, pkt->hdr.id, key_sz ? pkt->msg : 0,
+					  key_sz);
+}
+
+/*
+ * pkt_flood_fwd
+ *
+ * returns 1 if `pkt' is a BCAST_PKT copy of a flood (see PKT_OP_FLOOD). Only
+ * its header is read.
+ */
+int
+pkt_flood_fwd(PACKET * pkt)
+{
+	return (pkt->hdr.flags & BCAST_PKT) && !rq_verify(pkt->hdr.op) &&
+		(pkt_op_tbl[pkt->hdr.op].flags & PKT_OP_FLOOD);
+}
+
+/*
+ * pkt_flood_seen
+ *
+ * returns 1 if `pkt' is a copy of a flood (see PKT_OP_FLOOD) which has been
+ * already received, otherwise the flood is remembered and 0 is returned.
+ */
+int
+pkt_flood_seen(PACKET * pkt)
+{
+	if (!pkt_flood_fwd(pkt))
+		return 0;
+
+	/* The key is in the msg */
+	if (pkt_unpack(pkt))
+		return 0;
+
+	return pkt_flood_key_seen(pkt);
+}
+
 ssize_t
 pkt_recv(PACKET * pkt)
 {
@@ -512,6 +600,24 @@ pkt_recv(PACKET * pkt)
 		break;
 	}
 
+	/* Drop the flooded requests before wasting time on them: only the
+	 * header is read */
+	if (err >= 0 && pkt->pkt_flags & PKT_ADMIT &&
+		rq_admit(pkt->hdr.op, pkt->from, pkt_flood_fwd(pkt))) {
+		debug(DBG_INSANE, "Rejected %s from %s: too many requests",
+			  rq_to_str(pkt->hdr.op), inet_to_str(pkt->from));
+		if (pkt->sk_type == SKT_TCP)
+			pkt_err(*pkt, E_REQUEST_TBL_FULL, 1);
+		return -1;
+	}
+
+	/* Drop the copies of a flood we already received */
+	if (err >= 0 && pkt_flood_seen(pkt)) {
+		debug(DBG_INSANE, "Dropped %s 0x%x, we already received it",
+			  rq_to_str(pkt->hdr.op), pkt->hdr.id);
+		return -1;
+	}
+
 	/* let's finish it */
 	pkt_unpack(pkt);
 
@@ -844,10 +950,12 @@ pkt_err(PACKET pkt, u_char err, int free_pkt)
 int
 pkt_exec(PACKET pkt, int acpt_idx)
 {
+#ifdef DEBUG
 	const char *ntop;
+#endif
 	const u_char *op_str;
 	int (*exec_f) (PACKET pkt);
-	int err = 0;
+	int err = 0, compat = 0;
 
 	if (!re_verify(pkt.hdr.op))
 		op_str = re_to_str(pkt.hdr.op);
@@ -859,14 +967,6 @@ pkt_exec(PACKET pkt, int acpt_idx)
 		return -1;				/* bad op */
 	}
 
-	if ((err = add_rq(pkt.hdr.op, &accept_tbl[acpt_idx].rqtbl))) {
-		ntop = inet_to_str(pkt.from);
-		error("From %s: Cannot process the %s request: %s", ntop,
-			  op_str, rq_strerror(err));
-		pkt_err(pkt, err, 1);
-		return -1;
-	}
-
 	if (op_filter_test(pkt.hdr.op)) {
 		/* Drop the pkt, `pkt.hdr.op' has been filtered */
 #ifdef DEBUG
@@ -887,7 +987,20 @@ pkt_exec(PACKET pkt, int acpt_idx)
 	}
 #endif
 
-	if (exec_f)
+	/* 
+	 * If the pkt has been sent by an older ntkd, convert it. The
+	 * converted pkt.msg is a new buffer, freed after the execution.
+	 */
+	if (exec_f && pkt_op_tbl[pkt.hdr.op].compat_func &&
+		(compat = pkt_op_tbl[pkt.hdr.op].compat_func(&pkt)) < 0) {
+		debug(DBG_SOFT, "Dropped %s from %s: messed pkt", op_str,
+			  inet_to_str(pkt.from));
+		return -1;
+	}
+
+	if (exec_f && (pkt_op_tbl[pkt.hdr.op].flags & PKT_OP_MAP_WRITER))
+		err = map_owner_post(exec_f, pkt);
+	else if (exec_f)
 		err = (*exec_f) (pkt);
 	else if (pkt_q_counter) {
 		debug(DBG_INSANE, "pkt_exec: %s Async reply, id 0x%x", op_str,
@@ -899,6 +1012,8 @@ pkt_exec(PACKET pkt, int acpt_idx)
 		pkt_q_add_pkt(pkt);
 	}
 
+	if (compat > 0)
+		xfree(pkt.msg);
 	return err;
 }
 
@@ -906,15 +1021,10 @@ pkt_exec(PACKET pkt, int acpt_idx)
  * * * Pkt queue functions * * *
  */
 
-pthread_attr_t wait_and_unlock_attr;
 void
 pkt_queue_init(void)
 {
 	pkt_q = (pkt_queue *) clist_init(&pkt_q_counter);
-
-	pthread_attr_init(&wait_and_unlock_attr);
-	pthread_attr_setdetachstate(&wait_and_unlock_attr,
-								PTHREAD_CREATE_DETACHED);
 }
 
 void
@@ -924,48 +1034,29 @@ pkt_queue_close(void)
 	if (pkt_q_counter)
 		list_safe_for(pq, next)
 			pkt_q_del(pq, 1);
-	pthread_attr_destroy(&wait_and_unlock_attr);
 }
 
-/* 
- * wait_and_unlock
- * 
- * It waits REQUEST_TIMEOUT seconds, then it unlocks `pq'->mtx.
+/*
+ * pkt_q_timeout
+ *
+ * It is called by the timer of `pq' after REQUEST_TIMEOUT seconds, and
+ * unlocks `pq'->mtx if the reply hasn't been received yet.
  * This prevents the dead lock in pkt_q_wait_recv()
  */
-void *
-wait_and_unlock(void *m)
+void
+pkt_q_timeout(void *arg)
 {
-	pkt_queue *pq, **pq_ptr;
-	int i;
-
-	pq_ptr = (pkt_queue **) m;
-	pq = *pq_ptr;
-	if (!pq)
-		return 0;
-
-	for (i = 0; i < REQUEST_TIMEOUT; i++) {
-		sleep(1);
-		if (!(*pq_ptr) || (pq->flags & PKT_Q_PKT_RECEIVED) ||
-			!(pq->flags & PKT_Q_MTX_LOCKED) ||
-			pthread_mutex_trylock(&pq->mtx) != EBUSY)
-			break;
-	}
+	pkt_queue *pq = (pkt_queue *) arg;
 
-	if (!(*pq_ptr) || (pq->flags & PKT_Q_PKT_RECEIVED) ||
+	if ((pq->flags & PKT_Q_PKT_RECEIVED) ||
 		!(pq->flags & PKT_Q_MTX_LOCKED) ||
 		pthread_mutex_trylock(&pq->mtx) != EBUSY)
-		goto finish;
+		return;
 
 	debug(DBG_INSANE, "pq->pkt.hdr.id: 0x%x Timeoutted. mtx: 0x%X",
 		  pq->pkt.hdr.id, &pq->mtx);
-	pthread_mutex_unlock(&pq->mtx);
 	pq->flags |= PKT_Q_TIMEOUT;
-
-  finish:
-	if (pq_ptr)
-		xfree(pq_ptr);
-	return 0;
+	pthread_mutex_unlock(&pq->mtx);
 }
 
 /*
@@ -984,13 +1075,9 @@ int
 pkt_q_wait_recv(int id, inet_prefix * from, PACKET * rpkt,
 				pkt_queue ** ret_pq)
 {
-	pthread_t thread;
-	pkt_queue *pq, **pq_ptr;
-
+	pkt_queue *pq;
 
 	pq = xzalloc(sizeof(pkt_queue));
-	pq_ptr = xmalloc(sizeof(pkt_queue *));
-	*pq_ptr = pq;
 
 	pthread_mutex_init(&pq->mtx, 0);
 	pq->flags |= PKT_Q_MTX_LOCKED;
@@ -1010,8 +1097,7 @@ pkt_q_wait_recv(int id, inet_prefix * from, PACKET * rpkt,
 	clist_add(&pkt_q, &pkt_q_counter, pq);
 
 	/* Be sure to unlock me after the timeout */
-	pthread_create(&thread, &wait_and_unlock_attr, wait_and_unlock,
-				   (void *) pq_ptr);
+	timer_add(&pq->timer, REQUEST_TIMEOUT * 1000, pkt_q_timeout, pq);
 
 	if (pq->flags & PKT_Q_MTX_LOCKED) {
 		debug(DBG_INSANE, "pkt_q_wait_recv: Locking 0x%x!", &pq->mtx);
@@ -1020,6 +1106,7 @@ pkt_q_wait_recv(int id, inet_prefix * from, PACKET * rpkt,
 		pthread_mutex_lock(&pq->mtx);
 		pthread_mutex_lock(&pq->mtx);
 	}
+	timer_del(&pq->timer);
 
 	debug(DBG_INSANE, "We've been unlocked: timeout %d",
 		  (pq->flags & PKT_Q_TIMEOUT));
@@ -1029,9 +1116,6 @@ pkt_q_wait_recv(int id, inet_prefix * from, PACKET * rpkt,
 	if (rpkt)
 		pkt_copy(rpkt, &pq->pkt);
 
-	/* When *pq_ptr is set to 0, the wait_and_unlock thread exits */
-	*pq_ptr = 0;
-
 	return 0;
 }
 
@@ -1085,6 +1169,7 @@ pkt_q_add_pkt(PACKET pkt)
 void
 pkt_q_del(pkt_queue * pq, int close_socket)
 {
+	timer_del(&pq->timer);
 	pthread_mutex_unlock(&pq->mtx);
 	pthread_mutex_destroy(&pq->mtx);
 
@@ -22,6 +22,7 @@
 #include "if.h"
 #include "request.h"
 #include "llist.c"
+#include "timer.h"
 
 #define NETSUKUKU_ID		"ntk"
 #define MAXMSGSZ		65536
@@ -45,10 +46,12 @@
 #define PKT_RECV_TIMEOUT	(1<<1)
 #define PKT_SEND_TIMEOUT	(1<<2)
 #define PKT_SET_LOWDELAY	(1<<3)
-#define PKT_COMPRESSED		(1<<4)	/* If set the packet will be Z 
+#define PKT_COMPRESSED		(1<<4)	/* If set the packet will be
 									   compressed before being sent */
 #define PKT_KEEPALIVE		(1<<5)	/* Let the pkt.sk socket be alive */
 #define PKT_NONBLOCK		(1<<6)	/* Socket must not block */
+#define PKT_ADMIT		(1<<7)	/* The received requests must pass
+								   rq_admit() */
 
 /* 
  * Pkt.hdr flags 
@@ -65,7 +68,8 @@
 #define LOOPBACK_PKT		(1<<5)	/* This is a packet destinated to me */
 #define RESTRICTED_PKT		(1<<6)	/* Packet sent from a node in restricted 
 									   mode */
-#define COMPRESSED_PKT		(1<<7)	/* The whole packet is Z compressed */
+#define COMPRESSED_PKT		(1<<7)	/* The whole packet is compressed
+									   with the PKT_HDR_CODEC codec */
 
 
 /*
@@ -83,7 +87,6 @@
 
 /* General defines */
 #define PKT_MAX_MSG_SZ		1048576	/* bytes */
-#define PKT_COMPRESS_LEVEL	Z_DEFAULT_COMPRESSION
 #define PKT_COMPRESS_THRESHOLD	1024	/* If the flag PKT_COMPRESSED is set 
 										   and hdr.sz > PKT_COMPRESS_THRESHOLD,
 										   then compress the packet */
@@ -98,7 +101,9 @@ typedef struct {
 	u_char flags;
 	u_char op;
 	size_t sz;					/* The size of the message */
-	size_t uncompress_sz;		/* The size of the decompressed packet. */
+	size_t uncompress_sz;		/* The size of the decompressed packet.
+								   Its high byte is the PKT_CODEC_ used
+								   to compress it (see PKT_HDR_CODEC) */
 } _PACKED_ pkt_hdr;
 INT_INFO pkt_hdr_iinfo = { 3,
 	{INT_TYPE_32BIT, INT_TYPE_32BIT, INT_TYPE_32BIT},
@@ -110,6 +115,18 @@ INT_INFO pkt_hdr_iinfo = { 3,
 
 #define PACKET_SZ(sz) (sizeof(pkt_hdr)+(sz))
 
+/*
+ * The codec of a compressed packet is carried in the bits of
+ * hdr.uncompress_sz above PKT_MAX_MSG_SZ, so the header isn't changed.
+ * PKT_CODEC_ZLIB is 0: a zlib packet is the same of the older ntkd.
+ */
+#define PKT_CODEC_SHIFT		24
+#define PKT_CODEC_MASK		(0xffU << PKT_CODEC_SHIFT)
+#define PKT_HDR_CODEC(hdr)	(((u_int)(hdr).uncompress_sz & PKT_CODEC_MASK) \
+					>> PKT_CODEC_SHIFT)
+#define PKT_HDR_UNCOMPRESS_SZ(hdr)	((u_int)(hdr).uncompress_sz &	\
+					~PKT_CODEC_MASK)
+
 /*
  * PACKET
  *
@@ -144,6 +161,11 @@ typedef struct {
 								   used to determine its scope (send, 
 								   recv or both). */
 
+	struct timeval stamp;		/* When the udp packet was received. If
+								   the socket has been set with
+								   set_timestamp_sk() it is the kernel
+								   timestamp. */
+
 	/* Body of the packet */
 	pkt_hdr hdr;
 	char *msg;
@@ -175,11 +197,25 @@ INT_INFO brdcast_hdr_iinfo =
  * with `sk_type', and the `port' where the pkt will be sent or received.
  * Each element in the table is equivalent to a request or reply, ie the
  * function to handle the x request is at pkt_op_table[x].exec_func;
+ * The ops flagged with PKT_OP_MAP_WRITER modify the maps, thus their
+ * exec_func is executed by the map owner (see mapowner.h).
+ * The ops flagged with PKT_OP_FLOOD are identified by their hdr.id and the
+ * first `flood_key_sz' bytes of their msg, i.e. the address of the node
+ * which started the flood, so their duplicates are dropped by pkt_recv()
+ * itself, after rq_admit() has counted them in the forwarders' bucket.
  */
+#define PKT_OP_MAP_WRITER	1
+#define PKT_OP_FLOOD		(1<<1)	/* The op is flooded, its BCAST_PKT
+									   copies pass flood_seen() */
+
 struct pkt_op_table {
 	char sk_type;
 	u_short port;
 	void *exec_func;
+	u_char flags;
+	u_short flood_key_sz;		/* See PKT_OP_FLOOD */
+	int (*compat_func) (PACKET *);	/* It converts the pkts of an older
+									   ntkd, see pkt_exec() */
 } pkt_op_tbl[TOTAL_OPS];
 
 /* pkt_queue's flags */
@@ -197,6 +233,8 @@ struct pkt_op_table {
  * and pkt_q->pkt.hdr.op is set to the waited reply op.
  * The function x() it's started as a new thread and the request is sent; to 
  * receive the reply, x() locks twice `mtx'. The thread is now freezed.
+ * If the reply doesn't arrive in REQUEST_TIMEOUT seconds, the `timer' expires
+ * and pkt_q_timeout() unlocks `mtx'.
  * The reply is received by pkt_exec() which passes the pkt to the function
  * y(). y() searches in the pkt_q a struct which has the same pkt.hdr.id of
  * the received pkt. The reply pkt is copied in the found struct and `mtx' is
@@ -208,6 +246,7 @@ struct pkt_queue {
 
 	PACKET pkt;
 	pthread_mutex_t mtx;
+	struct ntk_timer timer;
 
 	char flags;
 };
@@ -239,6 +278,9 @@ char *pkt_pack(PACKET * pkt);
 
 int pkt_verify_hdr(PACKET pkt);
 ssize_t pkt_send(PACKET * pkt);
+int pkt_flood_key_seen(PACKET * pkt);
+int pkt_flood_fwd(PACKET * pkt);
+int pkt_flood_seen(PACKET * pkt);
 ssize_t pkt_recv(PACKET * pkt);
 int pkt_tcp_connect(inet_prefix * host, short port, interface * dev);
 
@@ -268,6 +310,7 @@ int pkt_exec(PACKET pkt, int acpt_idx);
 
 void pkt_queue_init(void);
 void pkt_queue_close(void);
+void pkt_q_timeout(void *arg);
 int pkt_q_wait_recv(int id, inet_prefix * from, PACKET * rpkt,
 					pkt_queue ** ret_pq);
 int pkt_q_add_pkt(PACKET pkt);
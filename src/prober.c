@@ -0,0 +1,383 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * prober.c
+ *
+ * The asynchronous ICMP prober used to monitor the Internet hosts and
+ * gateways.
+ */
+
+#include "includes.h"
+#include <netdb.h>
+
+#include "libping.h"
+#include "hash.h"
+#include "prober.h"
+#include "common.h"
+
+/*
+ * prober_init
+ *
+ * opens the raw ICMP socket of the prober. The prober_daemon() has to be
+ * started afterwards. On error -1 is returned and the prober is disabled.
+ */
+int
+prober_init(void)
+{
+	setzero(probe_hash, sizeof(probe_hash));
+	probe_targets = 0;
+	prober_ident = getpid() & 0xffff;
+	prober_seq = rand();
+	pthread_mutex_init(&prober_mutex, 0);
+	pthread_cond_init(&prober_cond, 0);
+
+	if ((prober_sk = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
+		error("prober_init(): Cannot open the ICMP socket: %s",
+			  strerror(errno));
+		prober_sk = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * probe_resolve
+ *
+ * stores in `addr' the IPv4 address of `host', which can be an IP string or
+ * a hostname. On error -1 is returned.
+ */
+int
+probe_resolve(const char *host, struct in_addr *addr)
+{
+	struct addrinfo filter, *ai;
+
+	if (inet_aton(host, addr))
+		return 0;
+
+	setzero(&filter, sizeof(filter));
+	filter.ai_family = AF_INET;
+	if (getaddrinfo(host, 0, &filter, &ai))
+		return -1;
+	*addr = ((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+	freeaddrinfo(ai);
+
+	return 0;
+}
+
+/*
+ * probe_target_find
+ *
+ * returns the probe_target of `addr', or 0 if it isn't probed.
+ * prober_mutex must be locked.
+ */
+struct probe_target *
+probe_target_find(struct in_addr addr)
+{
+	struct probe_target *t;
+
+	t = probe_hash[inthash(addr.s_addr) % PROBE_HASH_SZ];
+	list_for(t)
+		if (t->addr.s_addr == addr.s_addr)
+		return t;
+
+	return 0;
+}
+
+/*
+ * probe_target_get
+ *
+ * the same of probe_target_find(), but if `addr' isn't probed yet, a new
+ * probe_target is added.
+ */
+struct probe_target *
+probe_target_get(struct in_addr addr)
+{
+	struct probe_target *t, **head;
+
+	if ((t = probe_target_find(addr)))
+		return t;
+
+	t = xzalloc(sizeof(struct probe_target));
+	t->addr = addr;
+
+	head = &probe_hash[inthash(addr.s_addr) % PROBE_HASH_SZ];
+	*head = list_add(*head, t);
+	probe_targets++;
+
+	return t;
+}
+
+/*
+ * probe_target_purge
+ *
+ * forgets the targets which haven't been probed in the last
+ * PROBE_TARGET_TTL seconds. prober_mutex must be locked.
+ */
+void
+probe_target_purge(void)
+{
+	struct probe_target *t, *next;
+	time_t cur_t;
+	int i;
+
+	cur_t = time(0);
+	for (i = 0; i < PROBE_HASH_SZ; i++) {
+		t = probe_hash[i];
+		list_safe_for(t, next)
+			if (!(t->flags & PROBE_PENDING) &&
+				t->sent.tv_sec + PROBE_TARGET_TTL < cur_t) {
+			probe_hash[i] = list_del(probe_hash[i], t);
+			probe_targets--;
+		}
+	}
+}
+
+u_short
+probe_checksum(u_short * buf, int len)
+{
+	u_int sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *buf++;
+	if (len)
+		sum += *(u_char *) buf;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+
+	return ~sum;
+}
+
+/*
+ * probe_send
+ *
+ * sends a new echo request to `t'. prober_mutex must be locked.
+ * On error -1 is returned.
+ */
+int
+probe_send(struct probe_target *t)
+{
+	u_char buf[PROBE_PKT_SZ];
+	struct icmp *icp = (struct icmp *) buf;
+	struct sockaddr_in sin;
+
+	t->seq = prober_seq++;
+
+	setzero(buf, sizeof(buf));
+	icp->icmp_type = ICMP_ECHO;
+	icp->icmp_id = prober_ident;
+	icp->icmp_seq = htons(t->seq);
+	icp->icmp_cksum = probe_checksum((u_short *) buf, sizeof(buf));
+
+	setzero(&sin, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr = t->addr;
+
+	gettimeofday(&t->sent, 0);
+	t->flags = PROBE_PENDING;
+	t->probes++;
+
+	if (sendto(prober_sk, buf, sizeof(buf), 0, (struct sockaddr *) &sin,
+			   sizeof(sin)) != sizeof(buf)) {
+		debug(DBG_NOISE, "probe_send(): sendto %s: %s",
+			  inet_ntoa(t->addr), strerror(errno));
+		t->flags = 0;
+		t->loss = (t->loss * 7 + 1000) / 8;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * probe_reply
+ *
+ * updates the statistics of `t' after the reply to the `seq' probe has been
+ * received. prober_mutex must be locked.
+ */
+void
+probe_reply(struct probe_target *t, u_short seq)
+{
+	struct timeval cur_t, rtt_t;
+	u_int rtt, delta;
+
+	if (!(t->flags & PROBE_PENDING) || t->seq != seq)
+		/* Too late, or not ours */
+		return;
+
+	gettimeofday(&cur_t, 0);
+	timersub(&cur_t, &t->sent, &rtt_t);
+	rtt = MICROSEC(rtt_t);
+
+	/* The same estimators of the TCP rto */
+	if (!t->replies) {
+		t->srtt = rtt;
+		t->rttvar = rtt / 2;
+	} else {
+		delta = rtt > t->srtt ? rtt - t->srtt : t->srtt - rtt;
+		t->rttvar = (t->rttvar * 3 + delta) / 4;
+		t->srtt = (t->srtt * 7 + rtt) / 8;
+	}
+	t->loss = t->loss * 7 / 8;
+	t->replies++;
+
+	t->flags = PROBE_REPLIED;
+	pthread_cond_broadcast(&prober_cond);
+}
+
+/*
+ * probe_round
+ *
+ * probes all the `n' `addrs' at the same time and waits until all of them
+ * replied or `timeout_ms' milliseconds passed. If `wait_any' is non zero, it
+ * returns as soon as the first reply arrives.
+ * If `replied' isn't null, replied[i] is set to 1 if addrs[i] replied.
+ * It returns the number of targets which replied, or -1 if the prober isn't
+ * available.
+ */
+int
+probe_round(struct in_addr *addrs, int n, u_int timeout_ms, int wait_any,
+			u_char * replied)
+{
+	struct probe_target **targets;
+	struct timeval cur_t, end_t, tv;
+	struct timespec abstime;
+	int i, pending, ret;
+
+	if (prober_sk < 0)
+		return -1;
+
+	targets = xzalloc(sizeof(struct probe_target *) * n);
+
+	pthread_mutex_lock(&prober_mutex);
+	probe_target_purge();
+	for (i = 0; i < n; i++) {
+		targets[i] = probe_target_get(addrs[i]);
+		probe_send(targets[i]);
+	}
+
+	gettimeofday(&cur_t, 0);
+	MILLISEC_TO_TV(timeout_ms, tv);
+	timeradd(&cur_t, &tv, &end_t);
+	abstime.tv_sec = end_t.tv_sec;
+	abstime.tv_nsec = end_t.tv_usec * 1000;
+
+	for (;;) {
+		for (i = pending = ret = 0; i < n; i++) {
+			pending += !!(targets[i]->flags & PROBE_PENDING);
+			ret += !!(targets[i]->flags & PROBE_REPLIED);
+		}
+		if (!pending || (wait_any && ret))
+			break;
+		if (pthread_cond_timedwait(&prober_cond, &prober_mutex,
+								   &abstime) == ETIMEDOUT)
+			break;
+	}
+
+	for (i = ret = 0; i < n; i++)
+		ret += !!(targets[i]->flags & PROBE_REPLIED);
+	for (i = 0; i < n; i++) {
+		if (targets[i]->flags & PROBE_PENDING) {
+			/* Lost, or still in flight if `wait_any' is set */
+			if (!wait_any || !ret)
+				targets[i]->loss = (targets[i]->loss * 7 + 1000) / 8;
+			targets[i]->flags = 0;
+		}
+		if (replied)
+			replied[i] = !!(targets[i]->flags & PROBE_REPLIED);
+	}
+	pthread_mutex_unlock(&prober_mutex);
+
+	xfree(targets);
+	return ret;
+}
+
+/*
+ * probe_quality
+ *
+ * stores in `rtt_us' the smoothed rtt plus the jitter of `addr' and in
+ * `loss' its loss rate (per mille).
+ * If `addr' has never replied -1 is returned.
+ */
+int
+probe_quality(struct in_addr addr, u_int * rtt_us, u_int * loss)
+{
+	struct probe_target *t;
+	int ret = -1;
+
+	if (prober_sk < 0)
+		return -1;
+
+	pthread_mutex_lock(&prober_mutex);
+	if ((t = probe_target_find(addr)) && t->replies) {
+		*rtt_us = t->srtt + t->rttvar;
+		*loss = t->loss;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&prober_mutex);
+
+	return ret;
+}
+
+/*
+ * prober_daemon
+ *
+ * It receives the echo replies and passes them to the probe_target which
+ * sent the request.
+ */
+void *
+prober_daemon(void *null)
+{
+	u_char buf[PROBE_RECV_SZ];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	struct probe_target *t;
+	struct icmp *icp;
+	struct ip *iph;
+	ssize_t len;
+	int hlen;
+
+	debug(DBG_NORMAL, "Prober up & running");
+	for (;;) {
+		fromlen = sizeof(from);
+		len = recvfrom(prober_sk, buf, sizeof(buf), 0,
+					   (struct sockaddr *) &from, &fromlen);
+		if (len < 0) {
+			if (errno != EINTR)
+				error("prober_daemon(): recvfrom: %s", strerror(errno));
+			continue;
+		}
+
+		/* The raw socket gives us the IP header too */
+		iph = (struct ip *) buf;
+		hlen = iph->ip_hl << 2;
+		if (len < hlen + ICMP_MINLEN)
+			continue;
+		icp = (struct icmp *) (buf + hlen);
+		if (icp->icmp_type != ICMP_ECHOREPLY ||
+			icp->icmp_id != prober_ident)
+			continue;
+
+		pthread_mutex_lock(&prober_mutex);
+		if ((t = probe_target_find(from.sin_addr)))
+			probe_reply(t, ntohs(icp->icmp_seq));
+		pthread_mutex_unlock(&prober_mutex);
+	}
+
+	return 0;
+}
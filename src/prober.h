@@ -0,0 +1,86 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef PROBER_H
+#define PROBER_H
+
+#include "llist.c"
+
+/*
+ * The prober pings many hosts at the same time using a single raw ICMP
+ * socket. All the echo requests carry the same id, `prober_ident', and a
+ * different seq, so the prober_daemon() can match each echo reply with its
+ * probe_target.
+ * For each target it keeps the smoothed rtt, its jitter and the loss rate,
+ * which are used by igw_cmp() to measure the quality of the Internet
+ * gateways.
+ *
+ * The prober works only with IPv4 hosts, as libping did.
+ */
+
+#define PROBE_PKT_SZ		64	/* ICMP header + data */
+#define PROBE_RECV_SZ		1024
+#define PROBE_HASH_SZ		64
+#define PROBE_TARGET_TTL	600	/* A target which isn't probed for
+								   PROBE_TARGET_TTL seconds is forgotten */
+
+/* probe_target flags */
+#define PROBE_PENDING		1	/* The last probe is still in flight */
+#define PROBE_REPLIED		(1<<1)	/* The last probe has been answered */
+
+struct probe_target {
+	LLIST_HDR(struct probe_target);
+
+	struct in_addr addr;
+
+	u_short seq;				/* seq of the last probe */
+	struct timeval sent;		/* when the last probe was sent */
+	u_char flags;
+
+	u_int srtt;					/* smoothed rtt, in usec */
+	u_int rttvar;				/* mean deviation of the rtt (jitter) */
+	u_int loss;					/* loss rate, in per mille */
+	u_int probes;				/* Stupid statistics */
+	u_int replies;
+};
+
+struct probe_target *probe_hash[PROBE_HASH_SZ];
+int probe_targets;
+
+int prober_sk;					/* -1 if the prober isn't available */
+u_short prober_ident;
+u_short prober_seq;
+pthread_mutex_t prober_mutex;
+pthread_cond_t prober_cond;		/* A probe has been answered */
+
+
+/* * * Functions declaration * * */
+int prober_init(void);
+int probe_resolve(const char *host, struct in_addr *addr);
+struct probe_target *probe_target_find(struct in_addr addr);
+struct probe_target *probe_target_get(struct in_addr addr);
+void probe_target_purge(void);
+u_short probe_checksum(u_short * buf, int len);
+int probe_send(struct probe_target *t);
+void probe_reply(struct probe_target *t, u_short seq);
+int probe_round(struct in_addr *addrs, int n, u_int timeout_ms,
+				int wait_any, u_char * replied);
+int probe_quality(struct in_addr addr, u_int * rtt_us, u_int * loss);
+void *prober_daemon(void *null);
+
+#endif							/*PROBER_H */
@@ -32,6 +32,7 @@
 #include "tracer.h"
 #include "qspn.h"
 #include "igs.h"
+#include "mapowner.h"
 #include "netsukuku.h"
 #include "common.h"
 
@@ -96,7 +97,6 @@ void
 qspn_reset(u_char levels)
 {
 	setzero(qspn_b, sizeof(struct qspn_buffer *) * levels);
-	setzero(qspn_send_mutex, sizeof(int) * levels);
 	setzero(me.cur_qspn_id, sizeof(int) * levels);
 
 	qspn_reset_counters(levels);
@@ -111,12 +111,23 @@ qspn_init(u_char levels)
 	add_pkt_op(QSPN_CLOSE, SKT_TCP, ntk_tcp_port, qspn_close);
 	add_pkt_op(QSPN_OPEN, SKT_TCP, ntk_tcp_port, qspn_open);
 
+	/* they update the maps, let the map owner execute them */
+	pkt_op_tbl[TRACER_PKT].flags |= PKT_OP_MAP_WRITER;
+	pkt_op_tbl[TRACER_PKT_CONNECT].flags |= PKT_OP_MAP_WRITER;
+	pkt_op_tbl[QSPN_CLOSE].flags |= PKT_OP_MAP_WRITER;
+	pkt_op_tbl[QSPN_OPEN].flags |= PKT_OP_MAP_WRITER;
+
+	/* they may come from an older ntkd, without the links' bw */
+	pkt_op_tbl[TRACER_PKT].compat_func = tracer_pkt_compat;
+	pkt_op_tbl[TRACER_PKT_CONNECT].compat_func = tracer_pkt_compat;
+	pkt_op_tbl[QSPN_CLOSE].compat_func = tracer_pkt_compat;
+	pkt_op_tbl[QSPN_OPEN].compat_func = tracer_pkt_compat;
+
 	/* 
 	 * Alloc the qspn stuff 
 	 */
 
 	qspn_b = xmalloc(sizeof(struct qspn_buffer *) * levels);
-	qspn_send_mutex = xmalloc(sizeof(int) * levels);
 	me.cur_qspn_id = xmalloc(sizeof(int) * levels);
 	me.cur_qspn_time = xmalloc(sizeof(struct timeval) * levels);
 
@@ -128,8 +139,6 @@ qspn_free(void)
 {
 	if (qspn_b)
 		xfree(qspn_b);
-	if (qspn_send_mutex)
-		xfree(qspn_send_mutex);
 	if (me.cur_qspn_id)
 		xfree(me.cur_qspn_id);
 	if (me.cur_qspn_time)
@@ -251,7 +260,7 @@ qspn_round_left(u_char level)
 		 * millisec.
 		 */
 		wait_round = QSPN_WAIT_ROUND_LVL(level);
-		cur_elapsed = t.tv_usec;
+		cur_elapsed = t.tv_sec;
 		diff = wait_round - cur_elapsed;
 
 		/* 
@@ -390,7 +399,7 @@ qspn_backup_gcount(u_int * old_gcount, int *gcount)
 void
 qspn_remove_deads(u_char level)
 {
-	int bm, i, l, node_pos, ip[MAX_IP_INT];
+	int bm, i, l, node_pos, ip[MAX_IP_INT], removed = 0;
 	map_node *map, *node;
 	map_gnode *gmap, *gnode = 0;
 	inet_gw *igw;
@@ -482,15 +491,20 @@ qspn_remove_deads(u_char level)
 				gmap_node_del(gnode);
 			}
 			gnode_dec_seeds(&me.cur_quadg, level);
+			removed++;
 
 			/* Delete its route */
-			rt_update_node(0, node, 0, 0, 0, level);
+			rt_sync_node(node, level);
 		} else
 			/* We are going to start a new QSPN, but first mark
 			 * this node as OLD, in this way we will be able to
 			 * see if it was updated during the new QSPN. */
 			node->flags |= QSPN_OLD;
 	}
+
+	/* The bnode_maps of all the levels may have been touched */
+	if (removed)
+		map_gen_bump(0);
 }
 
 /* 
@@ -602,21 +616,172 @@ exclude_from_and_glevel_and_notstarter(TRACER_PKT_EXCLUDE_VARS)
 }
 
 
+void
+qspn_sched_init(void)
+{
+	int i;
+
+	setzero(qspn_sched, sizeof(qspn_sched));
+	for (i = 0; i < MAX_LEVELS; i++)
+		qspn_sched[i].level = i;
+	setzero(qspn_rounds_requested, sizeof(qspn_rounds_requested));
+	setzero(qspn_rounds_coalesced, sizeof(qspn_rounds_coalesced));
+	setzero(qspn_rounds_sent, sizeof(qspn_rounds_sent));
+
+	pthread_mutex_init(&qspn_sched_mutex, 0);
+	pthread_cond_init(&qspn_sched_cond, 0);
+}
+
+/*
+ * qspn_sched_arm
+ *
+ * schedules the round of `s' for the end of the current qspn_round of its
+ * level. qspn_sched_mutex must be locked.
+ */
+void
+qspn_sched_arm(struct qspn_sched *s)
+{
+	int round_ms;
+
+	s->flags |= QSPN_SCHED_PENDING;
+	s->qid = me.cur_qspn_id[s->level];
+
+	round_ms = qspn_round_left(s->level);
+	debug(DBG_INSANE, "New qspn_round lvl %d scheduled in %dms", s->level,
+		  round_ms);
+	timer_add(&s->timer, round_ms > 0 ? round_ms : 0, qspn_sched_fire, s);
+}
+
+/*
+ * qspn_schedule
+ *
+ * requests a new qspn_round in the `level' level. If a round is already
+ * scheduled, the request is coalesced in it.
+ */
+void
+qspn_schedule(u_char level)
+{
+	struct qspn_sched *s = &qspn_sched[level];
+
+	pthread_mutex_lock(&qspn_sched_mutex);
+	qspn_rounds_requested[level]++;
+
+	if (s->flags & (QSPN_SCHED_PENDING | QSPN_SCHED_READY))
+		qspn_rounds_coalesced[level]++;
+	else if (s->flags & QSPN_SCHED_SENDING)
+		/* The daemon will schedule it after the current one */
+		s->flags |= QSPN_SCHED_AGAIN;
+	else
+		qspn_sched_arm(s);
+
+	pthread_mutex_unlock(&qspn_sched_mutex);
+}
+
+/*
+ * qspn_sched_fire
+ *
+ * The timer callback of a scheduled round: it passes the round to the
+ * qspn_sched_daemon(), which waits the map owner to send it.
+ */
+void
+qspn_sched_fire(void *arg)
+{
+	struct qspn_sched *s = (struct qspn_sched *) arg;
+
+	pthread_mutex_lock(&qspn_sched_mutex);
+	s->flags = (s->flags & ~QSPN_SCHED_PENDING) | QSPN_SCHED_READY;
+	pthread_cond_signal(&qspn_sched_cond);
+	pthread_mutex_unlock(&qspn_sched_mutex);
+}
+
+/*
+ * qspn_sched_run
+ *
+ * sends the round of the qspn_sched `arg'. qspn_new_round() resets the
+ * qspn state and removes the dead nodes from the maps, so it is called by
+ * the map owner.
+ * It returns 1 if the round has been dropped, otherwise what qspn_send()
+ * returned.
+ */
+int
+qspn_sched_run(void *arg)
+{
+	struct qspn_sched *s = (struct qspn_sched *) arg;
+
+	/* 
+	 * If the qspn_id of the level changed, we received already a
+	 * new qspn_round in this level, so forget about ours ;) 
+	 */
+	if (s->qid != me.cur_qspn_id[s->level]) {
+		debug(DBG_INSANE, "Qspn_round lvl %d dropped: 0x%x received",
+			  s->level, me.cur_qspn_id[s->level]);
+		return 1;
+	}
+
+	return qspn_send(s->level);
+}
+
+/*
+ * qspn_sched_daemon
+ *
+ * It sends, through the map owner, the scheduled qspn_rounds when their
+ * timer expires.
+ */
+void *
+qspn_sched_daemon(void *null)
+{
+	struct qspn_sched *s;
+	int i;
+
+	debug(DBG_NORMAL, "Qspn scheduler up & running");
+	pthread_mutex_lock(&qspn_sched_mutex);
+	for (;;) {
+		for (i = 0, s = 0; i < MAX_LEVELS && !s; i++)
+			if (qspn_sched[i].flags & QSPN_SCHED_READY)
+				s = &qspn_sched[i];
+		if (!s) {
+			pthread_cond_wait(&qspn_sched_cond, &qspn_sched_mutex);
+			continue;
+		}
+
+		/* s->qid doesn't change while the round is being sent */
+		s->flags = (s->flags & ~QSPN_SCHED_READY) | QSPN_SCHED_SENDING;
+		pthread_mutex_unlock(&qspn_sched_mutex);
+
+		i = map_owner_run(qspn_sched_run, s);
+
+		pthread_mutex_lock(&qspn_sched_mutex);
+		if (i == 1)
+			qspn_rounds_coalesced[s->level]++;
+		else if (!i)
+			qspn_rounds_sent[s->level]++;
+
+		s->flags &= ~QSPN_SCHED_SENDING;
+		if (s->flags & QSPN_SCHED_AGAIN) {
+			s->flags &= ~QSPN_SCHED_AGAIN;
+			qspn_sched_arm(s);
+		}
+	}
+	pthread_mutex_unlock(&qspn_sched_mutex);
+
+	return 0;
+}
+
 /*
  * The Holy qspn_send. It is used to send a new qspn_round when something 
  * changes around the root_node (me).
+ * It doesn't wait the end of the previous qspn_round: use qspn_schedule().
  */
 int
 qspn_send(u_char level)
 {
 	PACKET pkt;
 	map_node *from;
-	int round_ms, ret = 0, ret_err, upper_gid, root_node_pos, qid;
+	int ret = 0, ret_err, upper_gid, root_node_pos;
 	map_node *map, *root_node;
 	map_gnode *gmap;
 	u_char upper_level;
 
-	qid = me.cur_qspn_id[level];
 	from = me.cur_node;
 	upper_level = level + 1;
 	qspn_set_map_vars(level, &map, &root_node, &root_node_pos, &gmap);
@@ -638,31 +803,6 @@ qspn_send(u_char level)
 	if (me.cur_node->flags & MAP_HNODE)
 		return 0;
 
-
-	if (qspn_send_mutex[level])
-		return 0;
-	else
-		qspn_send_mutex[level] = 1;
-
-	/*
-	 * We have to wait the finish of the old qspn_round to start the 
-	 * new one.
-	 */
-	while ((round_ms = qspn_round_left(level)) > 0) {
-		debug(DBG_INSANE, "Waiting %dms to send a new qspn_round, lvl:"
-			  " %d", round_ms, level);
-		usleep(round_ms * 1000);
-		update_qspn_time(level, 0);
-	}
-
-	/* 
-	 * If, after the above wait, the old saved qspn_id (`qid') it's not the
-	 * same of the current it means that we receveid already a new 
-	 * qspn_round in this level, so forget about it ;) 
-	 */
-	if (qid != me.cur_qspn_id[level])
-		return 0;
-
 	qspn_new_round(level, 0, 0);
 	root_node->flags |= QSPN_STARTER;
 
@@ -686,7 +826,6 @@ qspn_send(u_char level)
 		  me.cur_qspn_id[level]);
 
   finish:
-	qspn_send_mutex[level] = 0;
 	return ret;
 }
 
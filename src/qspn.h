@@ -20,6 +20,7 @@
 #define QSPN_H
 
 #include "gmap.h"
+#include "timer.h"
 
 #define QSPN_WAIT_ROUND 	32	/*This is a crucial value. It is the number of 
 								   seconds to be waited before the next qspn_round 
@@ -63,7 +64,43 @@ struct qspn_buffer {
 
 struct qspn_buffer **qspn_b;	/*It is sizeof(struct qspn_buffer *)*levels big */
 
-int *qspn_send_mutex;			/*It is sizeof(int)*levels big. */
+/*
+ * The qspn scheduler
+ *
+ * When something changes around us, qspn_schedule() is called to start a
+ * new qspn_round in the level. When the QSPN_WAIT_ROUND of the previous one
+ * expires, the qspn_sched_daemon() makes the map owner send the round, since
+ * qspn_new_round() resets the qspn state of all the levels. The requests
+ * received meanwhile are coalesced in the already scheduled round, so each
+ * level has at most one round waiting.
+ * If a new round of the same level is received from another node before
+ * ours is sent, ours is dropped: the received one already propagates the
+ * changes.
+ */
+
+/* qspn_sched flags */
+#define QSPN_SCHED_PENDING	1		/* The round is waiting its timer */
+#define QSPN_SCHED_READY	(1<<1)	/* The timer expired, send it */
+#define QSPN_SCHED_SENDING	(1<<2)	/* The daemon is sending it */
+#define QSPN_SCHED_AGAIN	(1<<3)	/* Requested while it was being sent */
+
+struct qspn_sched {
+	struct ntk_timer timer;
+	u_char level;
+	u_char flags;
+	int qid;					/* The qspn_id of the level when the round
+								   was scheduled */
+};
+struct qspn_sched qspn_sched[MAX_LEVELS];
+pthread_mutex_t qspn_sched_mutex;
+pthread_cond_t qspn_sched_cond;	/* A round is ready */
+pthread_t qspn_sched_thread;
+
+/* Stupid statistics */
+u_int qspn_rounds_requested[MAX_LEVELS];
+u_int qspn_rounds_coalesced[MAX_LEVELS];	/* Merged in a scheduled or
+											   received round */
+u_int qspn_rounds_sent[MAX_LEVELS];
 
 #define GCOUNT_LEVELS		(MAX_LEVELS-ZERO_LEVEL+UNITY_LEVEL)
 /*
@@ -107,6 +144,12 @@ void qspn_backup_gcount(u_int * old_gcount, int *gcount);
 
 void qspn_new_round(u_char level, int new_qspn_id, u_int new_qspn_time);
 
+void qspn_sched_init(void);
+void qspn_sched_arm(struct qspn_sched *s);
+void qspn_schedule(u_char level);
+void qspn_sched_fire(void *arg);
+int qspn_sched_run(void *arg);
+void *qspn_sched_daemon(void *null);
 int qspn_send(u_char level);
 int qspn_close(PACKET rpkt);
 int qspn_open(PACKET rpkt);
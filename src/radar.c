@@ -31,27 +31,29 @@
 
 #include "llist.c"
 #include "endianness.h"
+#include "hash.h"
 #include "if.h"
 #include "bmap.h"
 #include "route.h"
 #include "request.h"
 #include "pkts.h"
 #include "qspn.h"
+#include "tracer.h"
 #include "radar.h"
+#include "libnetlink.h"
+#include "ll_map.h"
+#include "krnl_state.h"
+#include "mapowner.h"
+#include "bw.h"
+#include "codec.h"
 #include "netsukuku.h"
 #include "common.h"
 
-pthread_attr_t radar_qspn_send_t_attr;
-
 void
 first_init_radar(void)
 {
 	max_radar_wait = MAX_RADAR_WAIT;
 
-	pthread_attr_init(&radar_qspn_send_t_attr);
-	pthread_attr_setdetachstate(&radar_qspn_send_t_attr,
-								PTHREAD_CREATE_DETACHED);
-
 	/* register the radar's ops in the pkt_op_table */
 	add_pkt_op(ECHO_ME, SKT_BCAST, ntk_udp_radar_port, radard);
 	add_pkt_op(ECHO_REPLY, SKT_UDP, ntk_udp_radar_port, radar_recv_reply);
@@ -59,16 +61,29 @@ first_init_radar(void)
 	rlist = (struct rnode_list *) clist_init(&rlist_counter);
 	alwd_rnodes =
 		(struct allowed_rnode *) clist_init(&alwd_rnodes_counter);
+	rtt_est_list = (struct rtt_est *) clist_init(&rtt_est_counter);
+	pthread_mutex_init(&rtt_est_mutex, 0);
+	pthread_mutex_init(&radar_sched_mutex, 0);
 
 	radar_daemon_ctl = 0;
+	radar_wake = 0;
+	pthread_mutex_init(&radar_wake_mutex, 0);
+	pthread_cond_init(&radar_wake_cond, 0);
+	setzero(radar_bcast_sk, sizeof(radar_bcast_sk));
+	setzero(radar_bcast_dev_idx, sizeof(radar_bcast_dev_idx));
 	init_radar();
 }
 
 void
 last_close_radar(void)
 {
+	int d;
+
 	close_radar();
 	rnl_reset(&rlist, &rlist_counter);
+	rtt_est_reset();
+	for (d = 0; d < MAX_INTERFACES; d++)
+		radar_bcast_sk_close(d);
 }
 
 void
@@ -83,6 +98,7 @@ init_radar(void)
 	radar_q = (struct radar_queue *) clist_init(&radar_q_counter);
 
 	setzero(send_qspn_now, sizeof(u_char) * MAX_LEVELS);
+	setzero(radar_bw_qspn_t, sizeof(radar_bw_qspn_t));
 }
 
 
@@ -91,6 +107,8 @@ close_radar(void)
 {
 	if (radar_q_counter)
 		clist_destroy(&radar_q, &radar_q_counter);
+	setzero(radar_q_node_hash, sizeof(radar_q_node_hash));
+	setzero(radar_q_ip_hash, sizeof(radar_q_ip_hash));
 }
 
 void
@@ -120,8 +138,64 @@ free_new_node(void)
 	list_for(rq)
 		if (rq->node && ((int) rq->node != RADQ_EXT_RNODE)) {
 		xfree(rq->node);
-		rq->node = 0;
+		radar_q_set_node(rq, 0);
+	}
+}
+
+/*
+ * radar_q_hash_add, radar_q_hash_del
+ *
+ * add/remove `rq' to/from the radar_q_node_hash and radar_q_ip_hash indexes.
+ */
+void
+radar_q_hash_add(struct radar_queue *rq)
+{
+	int h;
+
+	if ((u_long) rq->node > RADQ_EXT_RNODE) {
+		h = RADAR_HASH_PTR(rq->node);
+		rq->node_hnext = radar_q_node_hash[h];
+		radar_q_node_hash[h] = rq;
 	}
+
+	h = RADAR_HASH_IP(&rq->ip);
+	rq->ip_hnext = radar_q_ip_hash[h];
+	radar_q_ip_hash[h] = rq;
+}
+
+void
+radar_q_hash_del(struct radar_queue *rq)
+{
+	struct radar_queue **p;
+
+	if ((u_long) rq->node > RADQ_EXT_RNODE)
+		for (p = &radar_q_node_hash[RADAR_HASH_PTR(rq->node)]; *p;
+			 p = &(*p)->node_hnext)
+			if (*p == rq) {
+				*p = rq->node_hnext;
+				break;
+			}
+
+	for (p = &radar_q_ip_hash[RADAR_HASH_IP(&rq->ip)]; *p;
+		 p = &(*p)->ip_hnext)
+		if (*p == rq) {
+			*p = rq->ip_hnext;
+			break;
+		}
+	rq->node_hnext = rq->ip_hnext = 0;
+}
+
+/*
+ * radar_q_set_node
+ *
+ * sets rq->node to `node', updating the radar_q indexes.
+ */
+void
+radar_q_set_node(struct radar_queue *rq, map_node * node)
+{
+	radar_q_hash_del(rq);
+	rq->node = node;
+	radar_q_hash_add(rq);
 }
 
 /*
@@ -135,10 +209,18 @@ find_node_radar_q(map_node * node)
 {
 	struct radar_queue *rq;
 
-	rq = radar_q;
-	list_for(rq)
+	if ((u_long) node <= RADQ_EXT_RNODE) {
+		rq = radar_q;
+		list_for(rq)
+			if (rq->node == node)
+			return rq;
+		return 0;
+	}
+
+	for (rq = radar_q_node_hash[RADAR_HASH_PTR(node)]; rq;
+		 rq = rq->node_hnext)
 		if (rq->node == node)
-		return rq;
+			return rq;
 	return 0;
 }
 
@@ -153,14 +235,41 @@ find_ip_radar_q(inet_prefix * ip)
 {
 	struct radar_queue *rq;
 
-	rq = radar_q;
-	list_for(rq)
+	for (rq = radar_q_ip_hash[RADAR_HASH_IP(ip)]; rq; rq = rq->ip_hnext)
 		if (!memcmp(rq->ip.data, ip->data, MAX_IP_SZ))
-		return rq;
+			return rq;
 
 	return 0;
 }
 
+/*
+ * rnl_hash_add, rnl_hash_del
+ *
+ * add/remove `rnl' to/from the rlist_hash index. Only the structs of the
+ * global `rlist' are indexed.
+ */
+void
+rnl_hash_add(struct rnode_list *rnl)
+{
+	int h = RADAR_HASH_PTR(rnl->node);
+
+	rnl->hnext = rlist_hash[h];
+	rlist_hash[h] = rnl;
+}
+
+void
+rnl_hash_del(struct rnode_list *rnl)
+{
+	struct rnode_list **p;
+
+	for (p = &rlist_hash[RADAR_HASH_PTR(rnl->node)]; *p; p = &(*p)->hnext)
+		if (*p == rnl) {
+			*p = rnl->hnext;
+			break;
+		}
+	rnl->hnext = 0;
+}
+
 /*
  * rnl_add
  * 
@@ -180,6 +289,8 @@ rnl_add(struct rnode_list **rnlist, int *rnlist_counter,
 	rnl->dev_n++;
 
 	clist_add(rnlist, rnlist_counter, rnl);
+	if (rnlist == &rlist)
+		rnl_hash_add(rnl);
 
 	return rnl;
 }
@@ -197,6 +308,8 @@ rnl_del(struct rnode_list **rnlist, int *rnlist_counter,
 	if (rnl) {
 		if (close_socket && rnl->tcp_sk)
 			inet_close(&rnl->tcp_sk);
+		if (rnlist == &rlist)
+			rnl_hash_del(rnl);
 		clist_del(rnlist, rnlist_counter, rnl);
 	}
 	if (!(*rnlist_counter))
@@ -253,6 +366,13 @@ rnl_find_node(struct rnode_list *rnlist, map_node * node)
 {
 	struct rnode_list *rnl = rnlist;
 
+	if (rnlist == rlist) {
+		for (rnl = rlist_hash[RADAR_HASH_PTR(node)]; rnl; rnl = rnl->hnext)
+			if (rnl->node == node)
+				return rnl;
+		return 0;
+	}
+
 	list_for(rnl)
 		if (rnl->node == node)
 		return rnl;
@@ -377,6 +497,10 @@ rnl_update_devs(struct rnode_list **rnlist, int *rnlist_counter,
 			rnl_add_dev(rnlist, rnlist_counter, new_rnl, node, devs[i]);
 
 		new_rnl->tcp_sk = (old_rnl) ? old_rnl->tcp_sk : 0;
+		if (old_rnl) {
+			new_rnl->ka_rtt = old_rnl->ka_rtt;
+			new_rnl->ka_time = old_rnl->ka_time;
+		}
 		rnl_del(rnlist, rnlist_counter, old_rnl, 0);
 	}
 
@@ -636,27 +760,108 @@ count_hooking_nodes(void)
 }
 
 
+/*
+ * rtt_est_find
+ *
+ * returns the rtt_est struct of the node which has the `ip' address.
+ * The caller holds rtt_est_mutex.
+ */
+struct rtt_est *
+rtt_est_find(inet_prefix * ip)
+{
+	struct rtt_est *re = rtt_est_list;
+
+	list_for(re)
+		if (!memcmp(re->ip.data, ip->data, MAX_IP_SZ))
+		return re;
+
+	return 0;
+}
+
+void
+rtt_est_reset(void)
+{
+	pthread_mutex_lock(&rtt_est_mutex);
+	if (rtt_est_counter)
+		clist_destroy(&rtt_est_list, &rtt_est_counter);
+	rtt_est_list = (struct rtt_est *) clist_init(&rtt_est_counter);
+	pthread_mutex_unlock(&rtt_est_mutex);
+}
+
+/*
+ * rtt_est_update
+ *
+ * It adds the `rtt' sample, measured by the last scan, to the smoothed rtt of
+ * the `ip' node, in the same way TCP does (rfc 2988).
+ * The updated rtt_est struct is returned. The caller holds rtt_est_mutex.
+ */
+struct rtt_est *
+rtt_est_update(inet_prefix * ip, u_int rtt)
+{
+	struct rtt_est *re;
+	int delta;
+
+	if (!(re = rtt_est_find(ip))) {
+		re = xzalloc(sizeof(struct rtt_est));
+		inet_copy(&re->ip, ip);
+		re->srtt = rtt;
+		re->rttvar = rtt >> 1;
+		clist_add(&rtt_est_list, &rtt_est_counter, re);
+	} else {
+		delta = rtt - re->srtt;
+		re->rttvar += ((int) abs(delta) - (int) re->rttvar) >>
+			RTTVAR_EST_SHIFT;
+		re->srtt += delta >> RTT_EST_SHIFT;
+	}
+
+	re->samples++;
+	re->idle = 0;
+	return re;
+}
+
 /*
  * final_radar_queue
  * 
  * analyses the received ECHO_REPLY pkt and write the
  * average rtt of each found node in the radar_queue.
+ * The average is then smoothed with the rtts measured by the previous scans.
  */
 void
 final_radar_queue(void)
 {
 	struct radar_queue *rq;
+	struct rtt_est *re, *next;
 	int e;
 	struct timeval sum;
 	u_int f_rtt;
 
-	setzero(&sum, sizeof(struct timeval));
+	pthread_mutex_lock(&rtt_est_mutex);
+	re = rtt_est_list;
+	list_for(re)
+		re->idle++;
 
 	rq = radar_q;
 	list_for(rq) {
 		if (!rq->node)
 			continue;
 
+		if (rq->keepalive) {
+			/* 
+			 * The keepalive rtt includes the tcp and the userspace
+			 * delays: it only tells the node is alive, the rtt
+			 * remains the one estimated by the scans.
+			 */
+			if ((re = rtt_est_find(&rq->ip))) {
+				re->idle = 0;
+				MILLISEC_TO_TV(re->srtt / 1000, rq->final_rtt);
+				rq->rttvar = re->rttvar;
+			} else
+				rq->final_rtt = rq->rtt[0];
+			continue;
+		}
+
+		setzero(&sum, sizeof(struct timeval));
+
 		/* Sum the rtt of all the received pongs */
 		for (e = 0; e < rq->pongs; e++)
 			timeradd(&rq->rtt[e], &sum, &sum);
@@ -665,10 +870,30 @@ final_radar_queue(void)
 		for (; e < MAX_RADAR_SCANS; e++)
 			timeradd(&rq->rtt[e - rq->pongs], &sum, &sum);
 
-		f_rtt = MILLISEC(sum) / MAX_RADAR_SCANS;
-		MILLISEC_TO_TV(f_rtt, rq->final_rtt);
+		if (!rq->pongs) {
+			/* No samples in this scan, use the old estimate */
+			if ((re = rtt_est_find(&rq->ip))) {
+				MILLISEC_TO_TV(re->srtt / 1000, rq->final_rtt);
+				rq->rttvar = re->rttvar;
+			}
+			continue;
+		}
+
+		f_rtt = (sum.tv_sec * 1000000 + sum.tv_usec) / MAX_RADAR_SCANS;
+		re = rtt_est_update(&rq->ip, f_rtt);
+
+		rq->final_rtt.tv_sec = re->srtt / 1000000;
+		rq->final_rtt.tv_usec = re->srtt % 1000000;
+		rq->rttvar = re->rttvar;
 	}
 
+	/* Forget the nodes which aren't replying since a long time */
+	re = rtt_est_list;
+	list_safe_for(re, next)
+		if (re->idle > RTT_EST_MAX_IDLE)
+		clist_del(&rtt_est_list, &rtt_est_counter, re);
+	pthread_mutex_unlock(&rtt_est_mutex);
+
 	my_echo_id = 0;
 }
 
@@ -721,6 +946,8 @@ radar_remove_old_rnodes(char *rnode_deleted)
 
 			/* delete the rnode from the rnode_list */
 			rnl = rnl_find_node(rlist, node);
+			for (e = 0; rnl && e < rnl->dev_n; e++)
+				radar_sched_changed(rnl->dev[e]);
 			rnl_del(&rlist, &rlist_counter, rnl, 1);
 
 			/*
@@ -898,6 +1125,7 @@ radar_update_bmap(struct radar_queue *rq, int level, int gnode_level)
 
 	rnode = &me.bnode_map[level][bm].r_node[rnode_pos];
 	rnode->trtt = MILLISEC(rq->final_rtt);
+	rnode->bw = bw_devs_avail(rq->dev, rq->dev_n);
 }
 
 /* 
@@ -921,11 +1149,12 @@ radar_update_map(void)
 	ext_rnode *e_rnode;
 
 	int i, diff, rnode_pos;
+	u_int bw;
 	u_char rnode_added[MAX_LEVELS / 8], rnode_deleted[MAX_LEVELS / 8];
 	int level, external_node, total_levels, root_node_pos, node_update;
 	void *void_map;
 	const char *ntop;
-	char updated_rnodes, routes_update, devs_update;
+	char updated_rnodes, routes_update, devs_update, rq_update;
 
 	updated_rnodes = routes_update = devs_update = 0;
 	setzero(rnode_added, sizeof(rnode_added));
@@ -957,6 +1186,10 @@ radar_update_map(void)
 			external_node = 0;
 			total_levels = 1;
 		}
+		rq_update = 0;
+
+		/* The bandwidth of the link to the rnode */
+		bw = bw_devs_avail(rq->dev, rq->dev_n);
 
 		for (level = total_levels - 1; level >= 0; level--) {
 			qspn_set_map_vars(level, 0, &root_node, &root_node_pos, 0);
@@ -1026,7 +1259,8 @@ radar_update_map(void)
 					e_rnode->node.flags =
 						MAP_BNODE | MAP_GNODE | MAP_RNODE | MAP_ERNODE;
 					rnn.r_node = (int *) e_rnode;
-					node = rq->node = &e_rnode->node;
+					radar_q_set_node(rq, &e_rnode->node);
+					node = rq->node;
 					new_root_rnode = &rnn;
 
 					/* Update the external_rnode_cache list */
@@ -1086,17 +1320,34 @@ radar_update_map(void)
 			} else {
 				/* 
 				 * Nah, We have the node in the map. Let's see if 
-				 * its rtt is changed
+				 * its rtt or its bandwidth are changed
 				 */
 
 				if (!send_qspn_now[level] && node->links) {
 					diff = abs(root_node->r_node[rnode_pos].trtt -
 							   MILLISEC(rq->final_rtt));
-					if (diff >= RTT_DELTA) {
+
+					/* Ignore the changes which are within the
+					 * jitter of the node */
+					if (diff >= RTT_DELTA &&
+						diff * 1000 > RTT_VAR_MUL * rq->rttvar) {
 						node_update = 1;
 						send_qspn_now[level] = 1;
 						debug(DBG_NOISE, "node %s rtt changed, diff: %d",
 							  inet_to_str(rq->ip), diff);
+					} else if (!BW_SIMILAR(root_node->r_node[rnode_pos].bw,
+										   bw) &&
+							   time(0) - radar_bw_qspn_t[level] >=
+							   BW_QSPN_MIN_INTERVAL) {
+						/* The bandwidth changes more often than the rtt,
+						 * so it starts a qspn at most once each
+						 * BW_QSPN_MIN_INTERVAL seconds. The rnode keeps
+						 * its old bandwidth until then */
+						radar_bw_qspn_t[level] = time(0);
+						node_update = 1;
+						send_qspn_now[level] = 1;
+						debug(DBG_NOISE, "node %s bw changed: %u Kb/s",
+							  inet_to_str(rq->ip), bw);
 					}
 				}
 			}
@@ -1118,12 +1369,16 @@ radar_update_map(void)
 			}
 
 
+			if (node_update || devs_update)
+				rq_update = 1;
+
 			/* Nothing is really changed */
 			if (!node_update)
 				continue;
 
-			/* Update the rtt */
+			/* Update the rtt and the bandwidth */
 			root_node->r_node[rnode_pos].trtt = MILLISEC(rq->final_rtt);
+			root_node->r_node[rnode_pos].bw = bw;
 
 			/* Bnode map stuff */
 			if (external_node && level) {
@@ -1150,6 +1405,12 @@ radar_update_map(void)
 
 		}						/*for(level=0, ...) */
 
+		/* A new, moved or lossy rnode keeps its interfaces under
+		 * close watch */
+		if (rq_update || (rq->pongs && rq->pongs < MAX_RADAR_SCANS))
+			for (i = 0; i < rq->dev_n; i++)
+				radar_sched_changed(rq->dev[i]);
+
 		updated_rnodes++;
 	}							/*list_for(rq) */
 
@@ -1173,6 +1434,9 @@ radar_update_map(void)
 			/* adjust the rnode_pos variables in the ext_rnode_cache list */
 			erc_reorder_rnodepos(&me.cur_erc, &me.cur_erc_counter,
 								 me.cur_node);
+
+		/* Our rnodes, ext_rnodes and bnodes changed */
+		map_gen_bump(0);
 	}
 
 	/* Give a refresh to the kernel */
@@ -1257,6 +1521,7 @@ add_radar_q(PACKET pkt)
 		rq->dev_n++;
 
 		clist_add(&radar_q, &radar_q_counter, rq);
+		radar_q_hash_add(rq);
 	} else {
 		/*
 		 * Check if the input device is in the rq->dev array,
@@ -1272,6 +1537,21 @@ add_radar_q(PACKET pkt)
 	return rq;
 }
 
+/*
+ * radar_reply_codecs
+ *
+ * saves the codecs advertised by the ECHO_REPLY `pkt', see ECHO_REPLY_SZ.
+ */
+void
+radar_reply_codecs(PACKET * pkt)
+{
+	u_char codecs = 0;
+
+	if (pkt->hdr.sz >= ECHO_REPLY_SZ && pkt->msg)
+		codecs = pkt->msg[1];
+	codec_peer_set(&pkt->from, codecs);
+}
+
 /* 
  * radar_exec_reply
  * 
@@ -1282,17 +1562,16 @@ add_radar_q(PACKET pkt)
 int
 radar_exec_reply(PACKET pkt)
 {
-	struct timeval t;
+	struct timeval *sent;
 	struct radar_queue *rq;
 	u_int rtt_ms = 0;
-	int dev_pos;
-
-	gettimeofday(&t, 0);
+	int dev_pos, e;
 
 	/*
 	 * Get the radar_queue struct relative to pkt.from
 	 */
 	rq = add_radar_q(pkt);
+	radar_reply_codecs(&pkt);
 
 	dev_pos = ifs_get_pos(me.cur_ifs, me.cur_ifs_n, pkt.dev);
 	if (dev_pos < 0)
@@ -1317,10 +1596,21 @@ radar_exec_reply(PACKET pkt)
 		}
 	}
 
-	if (rq->pongs < radar_scans[dev_pos]) {
-		timersub(&t, &scan_start, &rq->rtt[(int) rq->pongs]);
+	if (dev_pos >= 0 && rq->pongs < radar_scans[dev_pos]) {
+		/*
+		 * The e-th pong received on this interface is the reply to
+		 * our e-th ECHO_ME sent on it.
+		 */
+		e = rq->dev_pongs[dev_pos];
+		if (e >= radar_scans[dev_pos])
+			e = radar_scans[dev_pos] - 1;
+		else
+			rq->dev_pongs[dev_pos]++;
+		sent = &radar_tx_stamp[dev_pos][e];
+
+		timersub(&pkt.stamp, sent, &rq->rtt[(int) rq->pongs]);
 		/* 
-		 * Now we divide the rtt, because (t - scan_start) is the time
+		 * Now we divide the rtt, because (stamp - sent) is the time
 		 * the pkt used to reach B from A and to return to A from B
 		 */
 		rtt_ms = MILLISEC(rq->rtt[(int) rq->pongs]) / 2;
@@ -1370,27 +1660,489 @@ radar_recv_reply(PACKET pkt)
 	return radar_exec_reply(pkt);
 }
 
-/* 
- * radar_qspn_send_t
- * 
- * This function is used only by radar_scan().
- * It just call the qspn_send() function. We use a thread
- * because the qspn_send() may sleep, and we don't want to halt the
- * radar_scan().
+/*
+ * radar_sched_changed
+ *
+ * The scan found a change on the `dev' interface: it will be scanned again
+ * as soon as possible.
+ */
+void
+radar_sched_changed(interface * dev)
+{
+	int dev_pos;
+
+	if ((dev_pos = ifs_get_pos(me.cur_ifs, me.cur_ifs_n, dev)) < 0)
+		return;
+
+	pthread_mutex_lock(&radar_sched_mutex);
+	radar_sched[dev_pos].changed = 1;
+	pthread_mutex_unlock(&radar_sched_mutex);
+}
+
+/*
+ * radar_sched_reset
+ *
+ * A node we don't know has appeared on the `dev' interface: its schedule is
+ * reset and the radar is woken up, so that the interface is scanned at once,
+ * even if its backoff interval hasn't expired yet.
+ */
+void
+radar_sched_reset(interface * dev)
+{
+	int dev_pos, wake;
+
+	if ((dev_pos = ifs_get_pos(me.cur_ifs, me.cur_ifs_n, dev)) < 0)
+		return;
+
+	pthread_mutex_lock(&radar_sched_mutex);
+	wake = radar_sched[dev_pos].next_scan || radar_sched[dev_pos].interval;
+	radar_sched[dev_pos].next_scan = 0;
+	radar_sched[dev_pos].interval = 0;
+	radar_sched[dev_pos].changed = 1;
+	pthread_mutex_unlock(&radar_sched_mutex);
+
+	if (wake)
+		radar_wakeup();
+}
+
+/*
+ * radar_sched_due
+ *
+ * It marks with the `skip' flag the interfaces which haven't to be scanned
+ * yet and returns the number of interfaces which have to.
+ */
+int
+radar_sched_due(void)
+{
+	time_t cur_t;
+	int d, due = 0;
+
+	cur_t = time(0);
+	pthread_mutex_lock(&radar_sched_mutex);
+	for (d = 0; d < me.cur_ifs_n; d++) {
+		radar_sched[d].skip = radar_sched[d].next_scan > cur_t;
+		if (!radar_sched[d].skip)
+			due++;
+	}
+	pthread_mutex_unlock(&radar_sched_mutex);
+
+	return due;
+}
+
+/*
+ * radar_wakeup
+ *
+ * wakes up the radar_daemon() if it is idle.
+ */
+void
+radar_wakeup(void)
+{
+	pthread_mutex_lock(&radar_wake_mutex);
+	radar_wake = 1;
+	pthread_cond_signal(&radar_wake_cond);
+	pthread_mutex_unlock(&radar_wake_mutex);
+}
+
+/*
+ * radar_idle
+ *
+ * sleeps for `msecs' milliseconds or until radar_wakeup() is called.
+ */
+void
+radar_idle(u_int msecs)
+{
+	struct timeval cur_t, t;
+	struct timespec abstime;
+
+	gettimeofday(&cur_t, 0);
+	MILLISEC_TO_TV(msecs, t);
+	timeradd(&cur_t, &t, &t);
+	abstime.tv_sec = t.tv_sec;
+	abstime.tv_nsec = t.tv_usec * 1000;
+
+	pthread_mutex_lock(&radar_wake_mutex);
+	while (!radar_wake)
+		if (pthread_cond_timedwait(&radar_wake_cond, &radar_wake_mutex,
+								   &abstime) == ETIMEDOUT)
+			break;
+	radar_wake = 0;
+	pthread_mutex_unlock(&radar_wake_mutex);
+}
+
+/*
+ * radar_ifs_check
+ *
+ * An interface of me.cur_ifs which has been removed, or which went up or
+ * down, is scanned immediately, without waiting for its schedule. The link
+ * flags are read from the kernel state mirror, which wakes up the radar
+ * as soon as they change.
  */
+void
+radar_ifs_check(void)
+{
+	struct radar_sched *rs;
+	u_int flags;
+	int d;
+
+	if (!krnl_state_live)
+		return;
+
+	pthread_mutex_lock(&radar_sched_mutex);
+	for (d = 0; d < me.cur_ifs_n; d++) {
+		rs = &radar_sched[d];
+		if (ll_index_to_type(me.cur_ifs[d].dev_idx) < 0)
+			/* Removed: the scan will fail with ENODEV */
+			flags = 0;
+		else
+			flags = ll_index_to_flags(me.cur_ifs[d].dev_idx) &
+				(IFF_UP | IFF_RUNNING);
+
+		if (flags != rs->if_flags && rs->scans) {
+			debug(DBG_NOISE, "radar_ifs_check(): the %s interface "
+				  "changed, scanning it", me.cur_ifs[d].dev_name);
+			rs->next_scan = 0;
+			rs->interval = 0;
+		}
+		rs->if_flags = flags;
+	}
+	pthread_mutex_unlock(&radar_sched_mutex);
+}
+
+/*
+ * radar_sched_update
+ *
+ * It is called at the end of each scan and sets the time of the next scan of
+ * each scanned interface: if the scan found a change, the next one will be
+ * done immediately, otherwise the interval between two scans is doubled.
+ */
+void
+radar_sched_update(void)
+{
+	struct radar_sched *rs;
+	struct timeval cur_t, t;
+	int d;
+
+	gettimeofday(&cur_t, 0);
+	pthread_mutex_lock(&radar_sched_mutex);
+	for (d = 0; d < me.cur_ifs_n; d++) {
+		rs = &radar_sched[d];
+		if (rs->skip) {
+			rs->skip = 0;
+			continue;
+		}
+
+		if (!rs->first_scan)
+			rs->first_scan = cur_t.tv_sec;
+		rs->scans++;
+
+		if (rs->changed) {
+			if (rs->last_check.tv_sec) {
+				timersub(&cur_t, &rs->last_check, &t);
+				rs->detect_ms = MILLISEC(t);
+			}
+			rs->interval = 0;
+		} else if (!rs->interval)
+			rs->interval = max_radar_wait;
+		else if ((rs->interval <<= 1) > RADAR_SCAN_MAX_INTERVAL)
+			rs->interval = RADAR_SCAN_MAX_INTERVAL;
+
+		rs->changed = 0;
+		rs->last_check = cur_t;
+		rs->next_scan = cur_t.tv_sec + rs->interval;
+	}
+	pthread_mutex_unlock(&radar_sched_mutex);
+}
+
+/*
+ * radar_bcast_sk_close
+ */
+void
+radar_bcast_sk_close(int d)
+{
+	if (radar_bcast_sk[d] > 0)
+		inet_close(&radar_bcast_sk[d]);
+	radar_bcast_sk[d] = 0;
+	radar_bcast_dev_idx[d] = 0;
+	radar_bcast_tx_id[d] = 0;
+}
+
+/*
+ * radar_bcast_sk_sync
+ *
+ * closes the broadcast sockets of the interfaces which have been removed or
+ * replaced in me.cur_ifs since the last scan.
+ */
+void
+radar_bcast_sk_sync(void)
+{
+	int d;
+
+	for (d = 0; d < MAX_INTERFACES; d++)
+		if (radar_bcast_sk[d] && (d >= me.cur_ifs_n ||
+								  radar_bcast_dev_idx[d] !=
+								  me.cur_ifs[d].dev_idx))
+			radar_bcast_sk_close(d);
+}
+
+/*
+ * radar_bcast_sk_get
+ *
+ * returns the broadcast socket of the me.cur_ifs[`d'] interface, creating it
+ * if it isn't open yet. The transmit timestamps left in its error queue by
+ * the previous scan are discarded.
+ * On error -1 is returned.
+ */
+int
+radar_bcast_sk_get(int d)
+{
+	struct timeval stale;
+	inet_prefix to;
+	u_int id;
+	int sk;
+
+	if ((sk = radar_bcast_sk[d]) > 0) {
+		while (inet_get_tx_stamp(sk, &stale, &id) >= 0);
+		return sk;
+	}
+
+	inet_setip_bcast(&to, my_family);
+	sk = new_bcast_conn(&to, ntk_udp_radar_port, me.cur_ifs[d].dev_idx);
+	if (sk <= 0)
+		return -1;
+
+	/* It reports the time when each ECHO_ME leaves the interface */
+	set_tx_timestamp_sk(sk);
+	radar_bcast_tx_id[d] = 0;
+
+	radar_bcast_sk[d] = sk;
+	radar_bcast_dev_idx[d] = me.cur_ifs[d].dev_idx;
+	return sk;
+}
+
+/*
+ * radar_bouquet_build
+ *
+ * packs the MAX_RADAR_SCANS ECHO_ME pkts of the current scan in
+ * radar_bouquet. `pkt' has to be already set up by radar_scan().
+ */
+void
+radar_bouquet_build(PACKET * pkt)
+{
+	u_char echo_scan;
+	int i;
+
+	for (i = 0, echo_scan = 0; i < MAX_RADAR_SCANS; i++, echo_scan++) {
+		if (me.cur_node->flags & MAP_HNODE)
+			memcpy(pkt->msg, &echo_scan, sizeof(u_char));
+
+		pkt_fill_hdr(&pkt->hdr, pkt->hdr.flags, my_echo_id, ECHO_ME,
+					 pkt->hdr.sz);
+		radar_bouquet[i] = pkt_pack(pkt);
+		radar_bouquet_sz[i] = PACKET_SZ(pkt->hdr.sz);
+	}
+}
+
+void
+radar_bouquet_free(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_RADAR_SCANS; i++)
+		if (radar_bouquet[i]) {
+			xfree(radar_bouquet[i]);
+			radar_bouquet[i] = 0;
+		}
+}
+
+/*
+ * radar_rnl_skipped
+ *
+ * Returns 1 if all the interfaces which link us to `rnl' are skipped by the
+ * current scan.
+ */
+int
+radar_rnl_skipped(struct rnode_list *rnl)
+{
+	int i, dev_pos;
+
+	for (i = 0; i < rnl->dev_n; i++) {
+		dev_pos = ifs_get_pos(me.cur_ifs, me.cur_ifs_n, rnl->dev[i]);
+		if (dev_pos < 0 || !radar_sched[dev_pos].skip)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * The keepalives of a round are sent at the same time, each by its own
+ * radar_keepalive_t() thread.
+ */
+struct radar_ka {
+	pthread_t thread;
+	struct rnode_list *rnl;
+	int err;
+};
+
+/*
+ * radar_keepalive_rnode
+ *
+ * It sends an ECHO_ME to `rnl'->node through its tcp connection and waits
+ * the ECHO_REPLY. The measured rtt is saved in `rnl'->ka_rtt.
+ * On error -1 is returned.
+ */
+int
+radar_keepalive_rnode(struct rnode_list *rnl)
+{
+	PACKET pkt, rpkt;
+	struct timeval sent, t;
+	int err;
+
+	setzero(&pkt, sizeof(PACKET));
+	setzero(&rpkt, sizeof(PACKET));
+
+	pkt.sk_type = SKT_TCP;
+	pkt_addtimeout(&pkt, RADAR_KEEPALIVE_TIMEOUT, 1, 1);
+	if (restricted_mode)
+		pkt.hdr.flags |= RESTRICTED_PKT;
+
+	gettimeofday(&sent, 0);
+	err = rnl_send_rq(rnl->node, &pkt, 0, ECHO_ME, 0, ECHO_REPLY, 1, &rpkt);
+	gettimeofday(&t, 0);
+
+	if (err >= 0)
+		radar_reply_codecs(&rpkt);
+	pkt_free(&pkt, 0);
+	pkt_free(&rpkt, 0);
+
+	if (err < 0)
+		return -1;
+
+	timersub(&t, &sent, &rnl->ka_rtt);
+	MILLISEC_TO_TV(MILLISEC(rnl->ka_rtt) / 2, rnl->ka_rtt);
+	rnl->ka_time = t.tv_sec;
+
+	return 0;
+}
+
 void *
-radar_qspn_send_t(void *level)
+radar_keepalive_t(void *arg)
+{
+	struct radar_ka *ka = (struct radar_ka *) arg;
+
+	ka->err = radar_keepalive_rnode(ka->rnl);
+	return 0;
+}
+
+/*
+ * radar_keepalive
+ *
+ * It checks, with radar_keepalive_rnode(), the rnodes which can be reached
+ * only by interfaces which are not going to be scanned. All the rnodes are
+ * checked at the same time, so a round lasts at most one
+ * RADAR_KEEPALIVE_TIMEOUT. If an rnode doesn't reply, its interfaces are
+ * removed from the skipped ones, otherwise they are considered checked.
+ * The number of interfaces which have to be scanned after all is returned.
+ */
+int
+radar_keepalive(void)
+{
+	struct rnode_list *rnl;
+	struct radar_ka *ka;
+	struct timeval cur_t;
+	int i, e, d, n, due = 0;
+
+	if (me.cur_node->flags & MAP_HNODE)
+		return 0;
+
+	radar_keepalive_time = time(0);
+
+	ka = xzalloc(sizeof(struct radar_ka) * (rlist_counter + 1));
+	rnl = rlist;
+	n = 0;
+	list_for(rnl) {
+		if (n >= rlist_counter || !radar_rnl_skipped(rnl))
+			continue;
+
+		ka[n].rnl = rnl;
+		if (pthread_create(&ka[n].thread, 0, radar_keepalive_t, &ka[n])) {
+			/* Do it by ourself */
+			radar_keepalive_t(&ka[n]);
+			ka[n].thread = 0;
+		}
+		n++;
+	}
+
+	for (i = 0; i < n; i++)
+		if (ka[i].thread)
+			pthread_join(ka[i].thread, 0);
+
+	pthread_mutex_lock(&radar_sched_mutex);
+	for (i = 0; i < n; i++) {
+		radar_keepalives++;
+		if (!ka[i].err)
+			continue;
+		radar_keepalives_failed++;
+
+		rnl = ka[i].rnl;
+		debug(DBG_NOISE, "radar: keepalive failed, rescanning the "
+			  "interfaces of the rnode");
+		for (e = 0; e < rnl->dev_n; e++) {
+			d = ifs_get_pos(me.cur_ifs, me.cur_ifs_n, rnl->dev[e]);
+			if (d < 0 || !radar_sched[d].skip)
+				continue;
+			radar_sched[d].skip = 0;
+			radar_sched[d].changed = 1;
+			due++;
+		}
+	}
+	xfree(ka);
+
+	gettimeofday(&cur_t, 0);
+	for (d = 0; d < me.cur_ifs_n; d++)
+		if (radar_sched[d].skip)
+			radar_sched[d].last_check = cur_t;
+	pthread_mutex_unlock(&radar_sched_mutex);
+
+	return due;
+}
+
+/*
+ * radar_keepalive_queue
+ *
+ * The rnodes which are linked to us only by the interfaces skipped by the
+ * current scan would be considered dead by radar_update_map(). This function
+ * adds them in the radar_queue as alive. Their rtt isn't updated, see
+ * final_radar_queue().
+ */
+void
+radar_keepalive_queue(void)
 {
-	int *p;
-	u_char i;
+	struct rnode_list *rnl;
+	struct radar_queue *rq;
+	PACKET pkt;
+	int i;
 
-	p = (int *) level;
-	i = (u_char) * p;
+	rnl = rlist;
+	list_for(rnl) {
+		if (rnl->ka_time < radar_keepalive_time || !radar_rnl_skipped(rnl))
+			continue;
 
-	xfree(p);
-	qspn_send(i);
+		setzero(&pkt, sizeof(PACKET));
+		rnodetoip((u_int) me.int_map, (u_int) rnl->node,
+				  me.cur_quadg.ipstart[1], &pkt.from);
 
-	return NULL;
+		for (i = 0, rq = 0; i < rnl->dev_n; i++) {
+			pkt.dev = rnl->dev[i];
+			rq = add_radar_q(pkt);
+		}
+
+		if (!rq || rq->pongs)
+			continue;
+		rq->rtt[0] = rnl->ka_rtt;
+		rq->pongs = MAX_RADAR_SCANS;
+		rq->keepalive = 1;
+	}
 }
 
 /* 
@@ -1411,11 +2163,10 @@ radar_qspn_send_t(void *level)
 int
 radar_scan(int activate_qspn)
 {
-	pthread_t thread;
 	PACKET pkt;
-	int i, d, *p;
-	ssize_t err;
-	u_char echo_scan;
+	struct timeval stamp;
+	u_int tx_id, id;
+	int i, d, sk, sent, err;
 
 	/* We are already doing a radar scan, that's not good */
 	if (radar_scan_mutex)
@@ -1446,71 +2197,86 @@ radar_scan(int activate_qspn)
 	if (restricted_mode)
 		pkt.hdr.flags |= RESTRICTED_PKT;
 
+	radar_bouquet_build(&pkt);
+	radar_bcast_sk_sync();
+
 	/* Loop through the me.cur_ifs array, sending the bouquet using all the
 	 * interfaces we have */
 	for (d = 0; d < me.cur_ifs_n; d++) {
+		if (radar_sched[d].skip)
+			continue;
 
-		pkt_add_dev(&pkt, &me.cur_ifs[d], 1);
-		pkt.sk = 0;				/* Create a new socket */
-
-		/* Send MAX_RADAR_SCANS# packets using me.cur_ifs[d] as
-		 * outgoing interface */
-		for (i = 0, echo_scan = 0; i < MAX_RADAR_SCANS; i++, echo_scan++) {
-			if (me.cur_node->flags & MAP_HNODE)
-				memcpy(pkt.msg, &echo_scan, sizeof(u_char));
+		if ((sk = radar_bcast_sk_get(d)) < 0) {
+			error("radar_scan(): Cannot open the broadcast socket of the "
+				  "%s interface", me.cur_ifs[d].dev_name);
+			continue;
+		}
 
-			err = send_rq(&pkt, 0, ECHO_ME, my_echo_id, 0, 0, 0);
-			if (err < 0) {
-				if (errno == ENODEV) {
-					/* 
-					 * The me.cur_ifs[d] device doesn't
-					 * exist anymore. Delete it.
-					 */
-					fatal("The device \"%s\" has been removed",
-						  me.cur_ifs[d].dev_name);
-					ifs_del(me.cur_ifs, &me.cur_ifs_n, d);
-					d--;
-				} else
-					error(ERROR_MSG "Error while sending the"
-						  " scan 0x%x... skipping",
-						  ERROR_FUNC, my_echo_id);
-				break;
+		/* Send the MAX_RADAR_SCANS# packets of the bouquet using
+		 * me.cur_ifs[d] as outgoing interface */
+		gettimeofday(&radar_tx_stamp[d][0], 0);
+		sent = inet_sendmmsg(sk, radar_bouquet, radar_bouquet_sz,
+							 MAX_RADAR_SCANS, 0);
+		if (sent < 0) {
+			if (errno == ENODEV) {
+				/* 
+				 * The me.cur_ifs[d] device doesn't
+				 * exist anymore. Delete it.
+				 */
+				fatal("The device \"%s\" has been removed",
+					  me.cur_ifs[d].dev_name);
+				ifs_del(me.cur_ifs, &me.cur_ifs_n, d);
+				radar_bcast_sk_sync();
+				d--;
+				continue;
 			}
-			radar_scans[d]++;
-			total_radar_scans++;
-		}
 
-		if (!radar_scans[d])
-			error("radar_scan(): The scan 0x%x on the %s interface failed."
-				  " Not a single scan was sent", my_echo_id,
-				  pkt.dev->dev_name);
+			error(ERROR_MSG "Error while sending the scan 0x%x on the "
+				  "%s interface", ERROR_FUNC, my_echo_id,
+				  me.cur_ifs[d].dev_name);
+			radar_bcast_sk_close(d);
+			continue;
+		}
 
-		if (pkt.sk > 0)
-			inet_close(&pkt.sk);
+		for (i = 1; i < sent; i++)
+			radar_tx_stamp[d][i] = radar_tx_stamp[d][0];
+		radar_scans[d] += sent;
+		total_radar_scans += sent;
+
+		/* Replace our timestamps with the kernel ones, if any. Their id
+		 * tells which ECHO_ME of the bouquet they belong to */
+		tx_id = radar_bcast_tx_id[d];
+		radar_bcast_tx_id[d] += sent;
+		while ((err = inet_get_tx_stamp(sk, &stamp, &id)) >= 0)
+			if (!err && id - tx_id < (u_int) sent)
+				radar_tx_stamp[d][id - tx_id] = stamp;
 	}
 
+	radar_bouquet_free();
 	pkt_free(&pkt, 1);
 
 	if (!total_radar_scans) {
 		error("radar_scan(): The scan 0x%x failed. It wasn't possible "
 			  "to send a single scan", my_echo_id);
+		for (d = 0; d < me.cur_ifs_n; d++)
+			radar_sched[d].skip = 0;
+		radar_scan_mutex = 0;
 		return -1;
 	}
 
 	xtimer(max_radar_wait, max_radar_wait << 1, &radar_wait_counter);
 
+	radar_keepalive_queue();
 	final_radar_queue();
-	radar_update_map();
+	/* Only the map owner writes the maps */
+	map_owner_call(radar_update_map);
+	radar_sched_update();
 
 	if (activate_qspn)
 		for (i = 0; i < me.cur_quadg.levels; i++)
-			if (send_qspn_now[i]) {
-				p = xmalloc(sizeof(int));
-				*p = i;
+			if (send_qspn_now[i])
 				/* We start a new qspn_round in the `i'-th level */
-				pthread_create(&thread, &radar_qspn_send_t_attr,
-							   radar_qspn_send_t, (void *) p);
-			}
+				qspn_schedule(i);
 
 	if (!(me.cur_node->flags & MAP_HNODE))
 		reset_radar();
@@ -1575,10 +2341,17 @@ radard(PACKET rpkt)
 		}
 	}
 
-	/* We create the ECHO_REPLY pkt */
+	/* We create the ECHO_REPLY pkt. A keepalive, received through a tcp
+	 * connection, is answered on the same connection. */
 	setzero(&pkt, sizeof(PACKET));
 	pkt_addto(&pkt, &rpkt.from);
-	pkt_addsk(&pkt, rpkt.from.family, rpkt.sk, SKT_UDP);
+	pkt_addsk(&pkt, rpkt.from.family, rpkt.sk,
+			  rpkt.sk_type == SKT_TCP ? SKT_TCP : SKT_UDP);
+
+	/* Advertise the codecs we can uncompress */
+	pkt.hdr.sz = ECHO_REPLY_SZ;
+	pkt.msg = xzalloc(pkt.hdr.sz);
+	pkt.msg[1] = PKT_CODECS_ALL;
 
 	if (me.cur_node->flags & MAP_HNODE) {
 		/* 
@@ -1590,9 +2363,7 @@ radard(PACKET rpkt)
 		 */
 		u_char scanning = 1;
 
-		pkt.hdr.sz = sizeof(u_char);
 		pkt.hdr.flags |= HOOK_PKT;
-		pkt.msg = xmalloc(pkt.hdr.sz);
 		if (radar_scans[dev_pos] == MAX_RADAR_SCANS)
 			scanning = 0;
 		memcpy(pkt.msg, &scanning, sizeof(u_char));
@@ -1614,11 +2385,19 @@ radard(PACKET rpkt)
 		return -1;
 	}
 
+	/*
+	 * A node we don't know is scanning us: it is new or it came back, so
+	 * we don't wait for the backoff of the interface to scan it.
+	 */
+	if (rpkt.sk_type != SKT_TCP && !(me.cur_node->flags & MAP_HNODE) &&
+		dev_pos >= 0 && ip_to_rfrom(rpkt.from, 0, 0, 0) < 0)
+		radar_sched_reset(rpkt.dev);
+
 	/* 
 	 * Ok, we have sent the reply, now we can update the radar_queue with
-	 * calm.
+	 * calm. The keepalives aren't part of any scan, so they are left out.
 	 */
-	if (radar_q) {
+	if (radar_q && rpkt.sk_type != SKT_TCP) {
 		rq = add_radar_q(rpkt);
 		rq->pings++;
 
@@ -1657,9 +2436,9 @@ refresh_hook_root_node(void)
 		ret = iptomap((u_int) me.int_map, rq->ip, me.cur_quadg.ipstart[1],
 					  &rnode);
 		if (ret)
-			rq->node = (map_node *) RADQ_EXT_RNODE;
+			radar_q_set_node(rq, (map_node *) RADQ_EXT_RNODE);
 		else
-			rq->node = rnode;
+			radar_q_set_node(rq, rnode);
 	}
 
 	radar_update_map();
@@ -1684,6 +2463,8 @@ refresh_hook_root_node(void)
 void *
 radar_daemon(void *null)
 {
+	int d, due;
+
 	/* If `radar_daemon_ctl' is set to 0 the radar_daemon will stop.
 	 * It will restart when it becomes again 1 */
 	radar_daemon_ctl = 1;
@@ -1693,6 +2474,25 @@ radar_daemon(void *null)
 		while (!radar_daemon_ctl)
 			sleep(1);
 
+		radar_ifs_check();
+
+		/* 
+		 * The interfaces where nothing changed since a while are
+		 * skipped by the scan, and their rnodes are just checked with
+		 * a keepalive.
+		 */
+		due = radar_sched_due();
+		if (due < me.cur_ifs_n && (due || time(0) >= radar_keepalive_time +
+								   RADAR_KEEPALIVE_INTERVAL))
+			due += radar_keepalive();
+
+		if (!due) {
+			for (d = 0; d < me.cur_ifs_n; d++)
+				radar_sched[d].skip = 0;
+			radar_idle(1000);
+			continue;
+		}
+
 		radar_scan(1);
 	}
 }
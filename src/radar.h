@@ -26,12 +26,44 @@
 #define RTT_DELTA		1000	/*If the change delta of the new rtt is
 								   >= RTT_DELTA, the qspn_q.send_qspn 
 								   will be set. (It's in millisec) */
+#define RTT_VAR_MUL		4	/*A change of the rtt of an rnode is
+								   considered only if it is also greater
+								   than RTT_VAR_MUL times its rttvar */
+#define RTT_EST_SHIFT		3	/*Gain of the smoothed rtt: 1/8 */
+#define RTTVAR_EST_SHIFT	2	/*Gain of the rtt variation: 1/4 */
+#define RTT_EST_MAX_IDLE	8	/*After RTT_EST_MAX_IDLE scans without
+								   replies, the rtt_est of a node is
+								   forgotten */
+
+#define RADAR_SCAN_MAX_INTERVAL	60	/*Max seconds between two scans of a
+								   stable interface */
+#define RADAR_KEEPALIVE_INTERVAL	MAX_RADAR_WAIT	/*Seconds between two
+												   keepalive rounds */
+#define RADAR_KEEPALIVE_TIMEOUT	2	/*Seconds to wait the reply to a
+									   keepalive */
+
+#define RADAR_HASH_SZ		64	/*Buckets of the radar_queue and
+								   rnode_list indexes. It must be a
+								   power of 2 */
+#define RADAR_HASH_PTR(p)	(inthash((u_long)(p)) & (RADAR_HASH_SZ-1))
+#define RADAR_HASH_IP(ip)	(fnv_32_buf((ip)->data, MAX_IP_SZ,		\
+					    FNV1_32_INIT) & (RADAR_HASH_SZ-1))
 
 #ifdef DEBUG
 #undef MAX_RADAR_WAIT
 #define MAX_RADAR_WAIT          3
 #endif
 
+/*
+ * The ECHO_REPLY body is:
+ *	u_char	scanning;	Read only if the pkt has the HOOK_PKT flag
+ *	u_char	codecs;		The PKT_CODEC_BIT()s of the codecs the
+ *				replier can uncompress
+ * An older ntkd sends only `scanning', or nothing, so it isn't sent other
+ * codecs than PKT_CODEC_ZLIB, nor tracer chunks with the `bw' (see TRCR_BW).
+ */
+#define ECHO_REPLY_SZ		2
+
 int max_radar_wait;
 int radar_wait_counter;			/* During the scan, it is incremented 
 								   every 500 ms */
@@ -46,6 +78,8 @@ int my_echo_id;
 u_char send_qspn_now[MAX_LEVELS];	/* Shall we send the qspn in level? 
 									   If yes send_qspn_now[level] is 
 									   != 0 */
+time_t radar_bw_qspn_t[MAX_LEVELS];	/* When a bandwidth change started
+										   the last qspn of each level */
 int hook_retry;					/* If we've seen, while hooking, a 
 								   node who was trying to hook before 
 								   us, `hook_retry' is set to 1. */
@@ -71,16 +105,118 @@ struct radar_queue {
 
 	char pings;					/*The total ECHO_ME pkts received from this node */
 	char pongs;					/*The total pongs (ECHO_REPLY) received from this node */
+	char dev_pongs[MAX_INTERFACES];	/*The pongs received on each
+									   interface of me.cur_ifs */
 	struct timeval rtt[MAX_RADAR_SCANS];	/*The round rtt of each pong */
 	struct timeval final_rtt;	/*When all the rtt is filled, or when MAX_RADAR_WAIT
-								   is expired, final_rtt will keep the average of all
-								   the rtts */
+								   is expired, final_rtt will keep the smoothed
+								   rtt of the node (see rtt_est) */
+	u_int rttvar;				/*The rtt variation of the node, in
+								   microseconds */
+	u_char keepalive;			/*The node has been checked only by a
+								   keepalive: its pongs prove that it is
+								   alive, but its rtt isn't a scan
+								   sample (see final_radar_queue) */
+
+	struct radar_queue *node_hnext;	/*Next rq in the same bucket of
+									   radar_q_node_hash */
+	struct radar_queue *ip_hnext;	/*Next rq in the same bucket of
+									   radar_q_ip_hash */
 };
 struct radar_queue *radar_q;	/*the start of the linked list of radar_queue */
 int radar_q_counter;
 
+/*
+ * The radar_q is also indexed by rq->node and by rq->ip, so the replies of
+ * the scan don't have to walk the whole queue to find their rq. The fake
+ * RADQ_VOID_RNODE and RADQ_EXT_RNODE nodes aren't indexed by node.
+ * Use radar_q_set_node() to change rq->node.
+ */
+struct radar_queue *radar_q_node_hash[RADAR_HASH_SZ];
+struct radar_queue *radar_q_ip_hash[RADAR_HASH_SZ];
+
 struct timeval scan_start;		/*the start of the scan */
 
+/* When each ECHO_ME pkt of the current scan was sent on each interface. */
+struct timeval radar_tx_stamp[MAX_INTERFACES][MAX_RADAR_SCANS];
+
+/*
+ * The broadcast sockets used to send the scans, one for each interface of
+ * me.cur_ifs. They are kept open between the scans and are recreated only
+ * when the interface in the same position changes or when a send fails.
+ * radar_bcast_tx_id[d] is the id the kernel gives to the transmit timestamp
+ * of the next pkt sent on radar_bcast_sk[d] (see set_tx_timestamp_sk()).
+ */
+int radar_bcast_sk[MAX_INTERFACES];
+int radar_bcast_dev_idx[MAX_INTERFACES];
+u_int radar_bcast_tx_id[MAX_INTERFACES];
+
+/*
+ * The bouquet of ECHO_ME pkts of the current scan. It is packed once and
+ * sent on each interface with a single sendmmsg().
+ */
+char *radar_bouquet[MAX_RADAR_SCANS];
+size_t radar_bouquet_sz[MAX_RADAR_SCANS];
+
+/*
+ * rtt_est keeps, for each node replying to our scans, the smoothed rtt and
+ * its mean deviation (the jitter), which are updated after each scan with
+ * the rtt measured by the scan itself. Differently from the radar_queue, it
+ * isn't reset after each scan, so the rtt used by the maps isn't polluted
+ * by a single noisy scan.
+ * The list is read by the console too: it is accessed only holding
+ * rtt_est_mutex.
+ */
+struct rtt_est {
+	LLIST_HDR(struct rtt_est);
+
+	inet_prefix ip;
+	u_int srtt;					/* smoothed rtt, in microseconds */
+	u_int rttvar;				/* rtt variation, in microseconds */
+	u_int samples;				/* number of scans considered */
+	u_char idle;				/* consecutive scans without replies */
+};
+struct rtt_est *rtt_est_list;
+int rtt_est_counter;
+pthread_mutex_t rtt_est_mutex;
+
+/*
+ * radar_sched keeps the scan schedule of each interface of me.cur_ifs.
+ * An interface where nothing changes is scanned less and less frequently,
+ * doubling its `interval' up to RADAR_SCAN_MAX_INTERVAL, while its rnodes
+ * are probed with a cheap unicast keepalive. As soon as a change is noticed
+ * the interval falls back to zero.
+ * radar_sched is changed by radard() too and read by the console, so it is
+ * accessed holding radar_sched_mutex. Only `skip' is private to the radar
+ * thread, which is the only one using it.
+ */
+struct radar_sched {
+	u_int interval;				/* seconds between two scans */
+	time_t next_scan;			/* when the next scan is due */
+	u_char skip;				/* the current scan skips this interface */
+	u_char changed;				/* the current scan found a change */
+
+	struct timeval last_check;	/* when the rnodes of the interface were
+								   last seen alive, by a scan or a
+								   keepalive */
+	time_t first_scan;
+	u_int scans;				/* scans done on this interface */
+	u_int detect_ms;			/* how much the last change may have
+								   gone unnoticed */
+	u_int if_flags;				/* IFF_UP and IFF_RUNNING of the
+								   interface, see radar_ifs_check() */
+};
+struct radar_sched radar_sched[MAX_INTERFACES];
+pthread_mutex_t radar_sched_mutex;
+time_t radar_keepalive_time;	/* when the last keepalive round was done */
+u_int radar_keepalives;			/* Stupid statistics */
+u_int radar_keepalives_failed;
+
+/* The idle radar_daemon() is woken up by radar_wakeup() */
+pthread_mutex_t radar_wake_mutex;
+pthread_cond_t radar_wake_cond;
+int radar_wake;
+
 /*
  * rnode_list keeps the list of all the rnodes. It is used to know on what
  * interface can be reached a wanted rnode.
@@ -97,10 +233,19 @@ struct rnode_list {
 
 	int tcp_sk;					/* The direct tcp connection to this rnode uses
 								   this socket. */
+
+	struct timeval ka_rtt;		/* rtt measured by the last keepalive */
+	time_t ka_time;				/* when the last keepalive was answered */
+
+	struct rnode_list *hnext;	/* Next rnl in the same bucket of
+								   rlist_hash */
 };
 struct rnode_list *rlist;
 int rlist_counter;
 
+/* The `rlist' llist indexed by rnl->node */
+struct rnode_list *rlist_hash[RADAR_HASH_SZ];
+
 /*
  * When this list isn't empty, the radar will receive only the ECHO_REPLY sent
  * from rnodes which are in the allowed_rnode list.
@@ -139,10 +284,19 @@ void close_radar(void);
 void reset_radar(void);
 void free_new_node(void);
 
+void radar_q_hash_add(struct radar_queue *rq);
+void radar_q_hash_del(struct radar_queue *rq);
+void radar_q_set_node(struct radar_queue *rq, map_node * node);
 struct radar_queue *find_node_radar_q(map_node * node);
 struct radar_queue *find_ip_radar_q(inet_prefix * ip);
 int count_hooking_nodes(void);
 
+void rnl_hash_add(struct rnode_list *rnl);
+void rnl_hash_del(struct rnode_list *rnl);
+struct rnode_list *rnl_add(struct rnode_list **rnlist, int *rnlist_counter,
+						   map_node * rnode, interface * dev);
+struct rnode_list *rnl_find_node(struct rnode_list *rnlist,
+								 map_node * node);
 void rnl_reset(struct rnode_list **rnlist, int *rnlist_counter);
 interface **rnl_get_dev(struct rnode_list *rnlist, map_node * node);
 interface *rnl_get_rand_dev(struct rnode_list *rnlist, map_node * node);
@@ -157,11 +311,27 @@ void new_rnode_allowed(struct allowed_rnode **alr, int *alr_counter,
 					   int *gid, int min_lvl, int max_lvl);
 void reset_rnode_allowed(struct allowed_rnode **alr, int *alr_counter);
 
+struct rtt_est *rtt_est_find(inet_prefix * ip);
+void rtt_est_reset(void);
 void final_radar_queue(void);
 void radar_update_map(void);
 
 struct radar_queue *add_radar_q(PACKET pkt);
+void radar_reply_codecs(PACKET * pkt);
 int radar_exec_reply(PACKET pkt);
+void radar_sched_changed(interface * dev);
+void radar_sched_reset(interface * dev);
+int radar_sched_due(void);
+void radar_wakeup(void);
+void radar_idle(u_int msecs);
+void radar_ifs_check(void);
+void radar_sched_update(void);
+void radar_bcast_sk_close(int d);
+void radar_bcast_sk_sync(void);
+int radar_bcast_sk_get(int d);
+void radar_bouquet_build(PACKET * pkt);
+void radar_bouquet_free(void);
+int radar_keepalive(void);
 int radar_scan(int activate_qspn);
 int radard(PACKET rpkt);
 int radar_recv_reply(PACKET pkt);
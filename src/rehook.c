@@ -43,6 +43,7 @@
 #include "hook.h"
 #include "rehook.h"
 #include "radar.h"
+#include "mapowner.h"
 #include "netsukuku.h"
 #include "common.h"
 
@@ -352,27 +353,16 @@ new_rehook(map_gnode * gnode, int gid, int level, int gnode_count)
 }
 
 /*
- * rehook: resets all the global variables set during the last hook/rehook,
- * and launches the netsukuku_hook() again. All the previous map will be lost
- * if not saved, the IP will also change. 
- * During the rehook, the radar_daemon and andna_maintain_hnames_active() are
- * stopped.
- * After the rehook, the andna_hook will be launched and the stopped daemon
- * reactivated.
+ * rehook_reset
+ *
+ * resets the rnode lists, the route states and the igws set during the last
+ * hook/rehook. It is called by the map owner.
  */
-int
-rehook(map_gnode * hook_gnode, int hook_level)
+void
+rehook_reset(void)
 {
-	int ret = 0;
-
-	/* Stop the radar_daemon */
-	radar_daemon_ctl = 0;
-
-	/* Wait the end of the current radar */
-	radar_wait_new_scan();
-
 	/* Mark ourself as hooking, this will stop
-	 * andna_maintain_hnames_active() daemon too. */
+	 * andna_maintain_hnames_job() too. */
 	me.cur_node->flags |= MAP_HNODE;
 
 	/* 
@@ -380,6 +370,10 @@ rehook(map_gnode * hook_gnode, int hook_level)
 	 */
 	rnl_reset(&rlist, &rlist_counter);
 	e_rnode_free(&me.cur_erc, &me.cur_erc_counter);
+	rt_nh_states_reset();
+	rt_sync_reset();
+	gw_cache_reset();
+	map_gen_bump(0);
 
 	if (restricted_mode) {
 		/* 
@@ -393,12 +387,38 @@ rehook(map_gnode * hook_gnode, int hook_level)
 		reset_igw_rules();
 		free_my_igws(&me.my_igws);
 	}
+}
+
+/*
+ * rehook: resets all the global variables set during the last hook/rehook,
+ * and launches the netsukuku_hook() again. All the previous map will be lost
+ * if not saved, the IP will also change. 
+ * During the rehook, the radar_daemon and andna_maintain_hnames_job() are
+ * stopped.
+ * After the rehook, the andna_hook will be launched and the stopped daemon
+ * reactivated.
+ */
+int
+rehook(map_gnode * hook_gnode, int hook_level)
+{
+	int ret = 0;
+
+	/* Stop the radar_daemon */
+	radar_daemon_ctl = 0;
+
+	/* Wait the end of the current radar */
+	radar_wait_new_scan();
+
+	/* Reset the maps and the igws */
+	map_owner_call(rehook_reset);
 
 	/* Andna reset */
 	if (!server_opt.disable_andna) {
+		pthread_mutex_lock(&andna_cache_mutex);
 		andna_cache_destroy();
 		counter_c_destroy();
 		rh_cache_flush();
+		pthread_mutex_unlock(&andna_cache_mutex);
 	}
 
 	/* Clear the uptime */
@@ -54,6 +54,7 @@ inet_prefix rk_gnode_ip;
 /*  *  *  Functions declaration  *  *  */
 void rehook_init(void);
 void new_rehook(map_gnode * gnode, int gid, int level, int gnode_count);
+void rehook_reset(void);
 int rehook(map_gnode * hook_gnode, int hook_level);
 
 #endif							/*REHOOK_H */
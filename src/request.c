@@ -18,7 +18,9 @@
 
 #include "includes.h"
 #include "request.h"
+#include "hash.h"
 #include "xmalloc.h"
+#include "buffer.h"
 #include "log.h"
 
 const static u_char request_str[][30] = {
@@ -141,7 +143,8 @@ const static u_char error_str[][40] = {
 
 /*Max simultaneous requests*/
 #define ECHO_ME_MAXRQ			0	/*NO LIMITS */
-#define ECHO_REPLY_MAXRQ		20
+#define ECHO_REPLY_MAXRQ		0	/*NO LIMITS: the radar receives
+										   MAX_RADAR_SCANS replies in a burst */
 #define GET_FREE_NODES_MAXRQ		5
 #define GET_QSPN_ROUND_MAXRQ		5
 
@@ -158,8 +161,8 @@ const static u_char error_str[][40] = {
 #define QSPN_RFR_MAXRQ			10
 #define GET_DNODEBLOCK_MAXRQ		1
 #define GET_DNODEIP_MAXRQ		10
-#define TRACER_PKT_MAXRQ		20
-#define TRACER_PKT_CONNECT_MAXRQ	10
+#define TRACER_PKT_MAXRQ		0	/*NO LIMITS: a neighbour forwards */
+#define TRACER_PKT_CONNECT_MAXRQ	0	/*the floods of all the others */
 
 #define DEL_SNODE_MAXRQ			20
 #define DEL_GNODE_MAXRQ			5
@@ -365,6 +368,108 @@ add_rq(u_char rq, rq_tbl * tbl)
 	return 0;
 }
 
+void
+rq_adm_init(void)
+{
+	setzero(rq_adm_tbl, sizeof(rq_adm_tbl));
+	setzero(rq_adm_admitted, sizeof(rq_adm_admitted));
+	setzero(rq_adm_rejected, sizeof(rq_adm_rejected));
+	gettimeofday(&rq_adm_start, 0);
+}
+
+/*
+ * rq_adm_now
+ *
+ * returns the ms passed since rq_adm_init(). It wraps after ~49 days, so the
+ * `tat's must be compared with it only by difference.
+ */
+u_int
+rq_adm_now(void)
+{
+	struct timeval cur_t, t;
+
+	gettimeofday(&cur_t, 0);
+	timersub(&cur_t, &rq_adm_start, &t);
+	return MILLISEC(t);
+}
+
+/*
+ * rq_adm_bucket
+ *
+ * returns the bucket of `key'. If it doesn't exist, a free bucket is taken
+ * or the one idle since the longest time is recycled.
+ */
+struct rq_adm_bucket *
+rq_adm_bucket(u_int key, u_int now)
+{
+	struct rq_adm_bucket *b, *oldest = 0;
+	int i;
+
+	for (i = 0; i < RQ_ADM_PROBES; i++) {
+		b = &rq_adm_tbl[(key + i) & (RQ_ADM_BUCKETS - 1)];
+
+		if (!b->key)
+			__sync_bool_compare_and_swap(&b->key, 0, key);
+		if (b->key == key)
+			return b;
+
+		if (!oldest || (int) (now - b->tat) > (int) (now - oldest->tat))
+			oldest = b;
+	}
+
+	oldest->key = key;
+	oldest->tat = now;
+	return oldest;
+}
+
+/*
+ * rq_admit
+ *
+ * decides if the `rq' request received from `from' can be executed.
+ * If `fwd' is non zero, `rq' is the copy of a flood forwarded by `from' and
+ * it is counted in the forwarders' bucket (see RQ_ADM_FWD).
+ * If it can, 0 is returned, otherwise E_REQUEST_TBL_FULL.
+ * The replies and the requests without limits are always admitted.
+ */
+int
+rq_admit(u_char rq, inet_prefix from, int fwd)
+{
+	struct rq_adm_bucket *b;
+	u_int key, now, old, tat, cost, burst;
+
+	if (rq_verify(rq) || !request_array[rq][RQ_MAXRQ] ||
+		!request_array[rq][RQ_WAIT])
+		return 0;
+
+	burst = request_array[rq][RQ_WAIT] * 1000;
+	cost = burst / request_array[rq][RQ_MAXRQ];
+	if (fwd)
+		cost = cost / RQ_ADM_FWD ? cost / RQ_ADM_FWD : 1;
+
+	key = fnv_32_buf(from.data, MAX_IP_SZ, FNV1_32_INIT);
+	key = fnv_32_buf(&rq, sizeof(u_char), key);
+	key = fnv_32_buf(&fwd, sizeof(int), key) | 1;
+
+	now = rq_adm_now();
+	b = rq_adm_bucket(key, now);
+	do {
+		old = tat = b->tat;
+		if ((int) (tat - now) < 0 || tat - now > burst)
+			/* The bucket is full, or it has been idle since a
+			 * whole wrap of the clock */
+			tat = now;
+
+		tat += cost;
+		if (tat - now > burst) {
+			__sync_fetch_and_add(&rq_adm_rejected[rq], 1);
+			return E_REQUEST_TBL_FULL;
+		}
+	} while (!__sync_bool_compare_and_swap(&b->tat, old, tat));
+
+	__sync_fetch_and_add(&rq_adm_admitted[rq], 1);
+	return 0;
+}
+
 /*
  * op_filter_reset_re: resets all the replies
  */
@@ -20,6 +20,7 @@
 #define REQUEST_H
 
 #include "misc.h"
+#include "inet.h"
 
 #define REQUEST_TIMEOUT		300	/* The timeout in seconds for all the 
 								   requests */
@@ -150,6 +151,40 @@ int rq_wait_idx[TOTAL_REQUESTS];
 
 int update_rq_tbl_mutex;
 
+/*
+ * Admission control
+ *
+ * Each (source ip, request) couple has its own token bucket, implemented as
+ * a GCRA: `tat' is the theoretical arrival time, in ms, of the next request.
+ * Each request moves `tat' forward by its cost, which is
+ * [REQUEST]_WAIT/[REQUEST]_MAXRQ seconds, and it is rejected if `tat' would
+ * go further than [REQUEST]_WAIT seconds from now. Thus a source can send
+ * [REQUEST]_MAXRQ requests in a burst, and then one every cost seconds.
+ *
+ * The buckets are kept in the fixed rq_adm_tbl hash table and are updated
+ * with compare-and-swap, so the daemons never wait on a lock. When all the
+ * RQ_ADM_PROBES buckets of a key are taken, the one idle since the longest
+ * time is recycled.
+ *
+ * The copies of a flood forwarded by a rnode come from all the nodes of its
+ * gnode, so they have a bucket of their own, where the cost is RQ_ADM_FWD
+ * times smaller.
+ */
+#define RQ_ADM_BUCKETS		1024
+#define RQ_ADM_PROBES		8
+#define RQ_ADM_FWD		8
+
+struct rq_adm_bucket {
+	u_int key;					/* Hash of the source and of the
+								   request, 0 if the bucket is free */
+	u_int tat;
+};
+struct rq_adm_bucket rq_adm_tbl[RQ_ADM_BUCKETS];
+struct timeval rq_adm_start;	/* `tat' is relative to it */
+
+u_int rq_adm_admitted[TOTAL_REQUESTS];
+u_int rq_adm_rejected[TOTAL_REQUESTS];
+
 /* 
  * Each bit of this array corresponds to a request or a reply. If the bit is 
  * set, the request or reply will be dropped, otherwise it will be executed by
@@ -180,6 +215,9 @@ int is_rq_full(u_char, rq_tbl *);
 int find_free_rq_wait(u_char, rq_tbl *);
 int add_rq(u_char, rq_tbl *);
 
+void rq_adm_init(void);
+int rq_admit(u_char rq, inet_prefix from, int fwd);
+
 void op_filter_reset_re(int bit);
 void op_filter_reset_rq(int bit);
 
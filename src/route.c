@@ -26,18 +26,20 @@
 #include "libnetlink.h"
 #include "inet.h"
 #include "krnl_route.h"
+#include "krnl_state.h"
 #include "request.h"
 #include "endianness.h"
 #include "pkts.h"
 #include "bmap.h"
 #include "qspn.h"
 #include "radar.h"
+#include "mapowner.h"
 #include "netsukuku.h"
 #include "route.h"
 
 int get_gw_gnode_recurse(map_node *, map_gnode **, map_bnode **, u_int *,
-						 map_gnode *, map_gnode *, map_node *, u_char,
-						 u_char, void **, int, int);
+						 ext_rnode_cache *, map_gnode *, map_gnode *,
+						 map_node *, u_char, u_char, void **, int, int);
 
 /*
  * get_gw_bnode_recurse: this function is part of get_gw_gnode_recurse(). 
@@ -47,13 +49,13 @@ int get_gw_gnode_recurse(map_node *, map_gnode **, map_bnode **, u_int *,
 int
 get_gw_bnode_recurse(map_node * int_map, map_gnode ** ext_map,
 					 map_bnode ** bnode_map, u_int * bmap_nodes,
-					 map_gnode * find_gnode, map_gnode * gnode_gw,
+					 ext_rnode_cache * cur_erc, map_gnode * find_gnode, map_gnode * gnode_gw,
 					 map_node * node_gw, u_char gnode_level,
 					 u_char gw_level, void **gateways, int gateways_nmembs,
 					 int single_gw)
 {
 	map_gnode *gnode = 0;
-	map_node *node, *root_node;
+	map_node *node;
 	ext_rnode_cache *erc;
 	int i, bpos;
 
@@ -85,13 +87,11 @@ get_gw_bnode_recurse(map_node * int_map, map_gnode ** ext_map,
 
 		/* If we are a bnode and the `gnode', the found bnode, is us,
 		 * let's check if we have `gnode_gw' in our external rnode
-		 * cache. If we have, the gw has been found */
-		qspn_set_map_vars(i - 1, 0, &root_node, 0, 0);
-		if (me.cur_node->flags & MAP_BNODE &&
-			gnode == (map_gnode *) root_node) {
+		 * cache (`cur_erc'). If we have, the gw has been found */
+		if (cur_erc && node->flags & MAP_ME) {
 			/* debug(DBG_INSANE, "get_gw: bmap searching ernode for gnode 0x%x",node_gw); */
 
-			erc = erc_find_gnode(me.cur_erc, gnode_gw, i);
+			erc = erc_find_gnode(cur_erc, gnode_gw, i);
 			if (erc) {
 				gateways[0] = (void *) erc->e;
 				return 0;
@@ -104,9 +104,9 @@ get_gw_bnode_recurse(map_node * int_map, map_gnode ** ext_map,
 	/* Descend in the lower level */
 	if ((--i) >= gw_level)
 		return get_gw_gnode_recurse(int_map, ext_map, bnode_map,
-									bmap_nodes, find_gnode, gnode, node, i,
-									gw_level, gateways, gateways_nmembs,
-									single_gw);
+									bmap_nodes, cur_erc, find_gnode, gnode,
+									node, i, gw_level, gateways,
+									gateways_nmembs, single_gw);
 	return -1;
 }
 
@@ -121,9 +121,10 @@ get_gw_bnode_recurse(map_node * int_map, map_gnode ** ext_map,
 int
 get_gw_gnode_recurse(map_node * int_map, map_gnode ** ext_map,
 					 map_bnode ** bnode_map, u_int * bmap_nodes,
-					 map_gnode * find_gnode, map_gnode * gnode,
-					 map_node * node, u_char gnode_level, u_char gw_level,
-					 void **gateways, int gateways_nmembs, int single_gw)
+					 ext_rnode_cache * cur_erc, map_gnode * find_gnode,
+					 map_gnode * gnode, map_node * node, u_char gnode_level,
+					 u_char gw_level, void **gateways, int gateways_nmembs,
+					 int single_gw)
 {
 	map_gnode *gnode_gw = 0;
 	map_node *node_gw;
@@ -198,8 +199,8 @@ get_gw_gnode_recurse(map_node * int_map, map_gnode ** ext_map,
 
 			ret +=
 				get_gw_bnode_recurse(int_map, ext_map, bnode_map,
-									 bmap_nodes, find_gnode, gnode_gw,
-									 node_gw, i, gw_level,
+									 bmap_nodes, cur_erc, find_gnode,
+									 gnode_gw, node_gw, i, gw_level,
 									 &gateways[e * sub_routes], sub_routes,
 									 single_gw);
 		}
@@ -207,10 +208,116 @@ get_gw_gnode_recurse(map_node * int_map, map_gnode ** ext_map,
 	}
 
 	return get_gw_bnode_recurse(int_map, ext_map, bnode_map, bmap_nodes,
-								find_gnode, gnode_gw, node_gw, i, gw_level,
-								gateways, gateways_nmembs, single_gw);
+								cur_erc, find_gnode, gnode_gw, node_gw, i,
+								gw_level, gateways, gateways_nmembs,
+								single_gw);
+}
+
+
+void
+gw_cache_init(void)
+{
+	setzero(gw_cache, sizeof(gw_cache));
+	gw_cache_hits = gw_cache_misses = gw_cache_stale = 0;
+	pthread_mutex_init(&gw_cache_mutex, 0);
+}
+
+void
+gw_cache_reset(void)
+{
+	int i;
+
+	pthread_mutex_lock(&gw_cache_mutex);
+	for (i = 0; i < MAX_LEVELS; i++)
+		if (gw_cache[i]) {
+			xfree(gw_cache[i]);
+			gw_cache[i] = 0;
+		}
+	pthread_mutex_unlock(&gw_cache_mutex);
+}
+
+/*
+ * gw_cache_entry_get
+ *
+ * returns the gw_cache_entry of the get_gw_gnode() query described by the
+ * arguments, or 0 if the query can't be cached, i.e. if the maps aren't the
+ * ones of `me' or the gateways aren't searched in the level 0.
+ * gw_cache_mutex must be locked.
+ */
+struct gw_cache_entry *
+gw_cache_entry_get(map_node * int_map, map_gnode ** ext_map,
+				   map_bnode ** bnode_map, map_gnode * find_gnode,
+				   u_char gnode_level, u_char gw_level, int single_gw)
+{
+	int pos;
+
+	if (gw_level || gnode_level >= MAX_LEVELS || int_map != me.int_map ||
+		ext_map != me.ext_map || bnode_map != me.bnode_map)
+		return 0;
+
+	pos = pos_from_gnode(find_gnode, ext_map[_EL(gnode_level)]);
+	if (pos < 0 || pos >= MAXGROUPNODE)
+		return 0;
+
+	if (!gw_cache[gnode_level])
+		gw_cache[gnode_level] = xzalloc(sizeof(struct gw_cache_entry) *
+										MAXGROUPNODE * 2);
+
+	return &gw_cache[gnode_level][(!!single_gw) * MAXGROUPNODE + pos];
 }
 
+/*
+ * gw_cache_find
+ *
+ * If `entry' is still valid, its gateways are copied in `gateways' and 1 is
+ * returned, or -1 if it recorded that there isn't any gateway. If it isn't
+ * valid 0 is returned. gw_cache_mutex must be locked.
+ */
+int
+gw_cache_find(struct gw_cache_entry *entry, u_char gnode_level,
+			  void **gateways)
+{
+	if (!(entry->flags & GW_CACHE_VALID)) {
+		gw_cache_misses++;
+		return 0;
+	}
+	if (entry->gen != map_gen_sum(gnode_level)) {
+		entry->flags = 0;
+		gw_cache_misses++;
+		gw_cache_stale++;
+		return 0;
+	}
+
+	gw_cache_hits++;
+	if (entry->flags & GW_CACHE_NONE)
+		return -1;
+	memcpy(gateways, entry->gw, sizeof(entry->gw));
+	return 1;
+}
+
+/*
+ * gw_cache_store
+ *
+ * stores in `entry' the `gateways' found when the maps of `gnode_level' had
+ * the `gen' generation. If `gateways' is null, no gateway was found.
+ * gw_cache_mutex must be locked.
+ */
+void
+gw_cache_store(struct gw_cache_entry *entry, u_char gnode_level,
+			   u_int gen, void **gateways)
+{
+	/* The maps changed while we were reading them */
+	if (gen != map_gen_sum(gnode_level))
+		return;
+
+	setzero(entry, sizeof(struct gw_cache_entry));
+	entry->flags = GW_CACHE_VALID;
+	entry->gen = gen;
+	if (gateways)
+		memcpy(entry->gw, gateways, sizeof(entry->gw));
+	else
+		entry->flags |= GW_CACHE_NONE;
+}
 
 /* 
  * get_gw_gnode: It finds the MAX_MULTIPATH_ROUTES best gateway present in the 
@@ -222,22 +329,37 @@ get_gw_gnode_recurse(map_node * int_map, map_gnode ** ext_map,
  * MAX_MULTIPATH_ROUTES+1 nmembs. Some member of the array can be NULL, ignore
  * them. Remember to xfree the array of pointers!
  * If `single_gw' is not 0, only one gateway will be returned.
+ * `cur_erc' is the ext_rnode_cache of the root_node of `int_map'.
+ * The result is kept in the gw_cache until the maps change.
  */
 void **
 get_gw_gnode(map_node * int_map, map_gnode ** ext_map,
 			 map_bnode ** bnode_map, u_int * bmap_nodes,
-			 map_gnode * find_gnode, u_char gnode_level,
-			 u_char gw_level, int single_gw)
+			 ext_rnode_cache * cur_erc, map_gnode * find_gnode,
+			 u_char gnode_level, u_char gw_level, int single_gw)
 {
 	map_gnode *gnode;
 	map_node *node;
+	struct gw_cache_entry *entry;
 	void **gateways = 0;
+	u_int gen;
 	int ret;
 
 	if (!gnode_level || gw_level > gnode_level)
 		goto error;
 
-	gateways = xzalloc(sizeof(void *) * MAX_MULTIPATH_ROUTES + 1);
+	gateways = xzalloc(sizeof(void *) * (MAX_MULTIPATH_ROUTES + 1));
+
+	gen = map_gen_sum(gnode_level);
+	pthread_mutex_lock(&gw_cache_mutex);
+	entry = gw_cache_entry_get(int_map, ext_map, bnode_map, find_gnode,
+							   gnode_level, gw_level, single_gw);
+	ret = entry ? gw_cache_find(entry, gnode_level, gateways) : 0;
+	pthread_mutex_unlock(&gw_cache_mutex);
+	if (ret > 0)
+		return gateways;
+	else if (ret < 0)
+		goto error;
 
 	/* 
 	 * In order to find the gateway at level `gw_level', which will be
@@ -288,10 +410,16 @@ get_gw_gnode(map_node * int_map, map_gnode ** ext_map,
 	}
 
 	ret = get_gw_gnode_recurse(int_map, ext_map, bnode_map, bmap_nodes,
-							   find_gnode, gnode, node, gnode_level,
+							   cur_erc, find_gnode, gnode, node, gnode_level,
 							   gw_level, gateways, MAX_MULTIPATH_ROUTES,
 							   single_gw);
 
+	pthread_mutex_lock(&gw_cache_mutex);
+	if ((entry = gw_cache_entry_get(int_map, ext_map, bnode_map, find_gnode,
+									gnode_level, gw_level, single_gw)))
+		gw_cache_store(entry, gnode_level, gen, ret < 0 ? 0 : gateways);
+	pthread_mutex_unlock(&gw_cache_mutex);
+
 	if (ret < 0)
 		goto error;
 
@@ -320,7 +448,7 @@ get_gw_gnode(map_node * int_map, map_gnode ** ext_map,
 int
 get_gw_ips(map_node * int_map, map_gnode ** ext_map,
 		   map_bnode ** bnode_map, u_int * bmap_nodes,
-		   quadro_group * cur_quadg,
+		   ext_rnode_cache * cur_erc, quadro_group * cur_quadg,
 		   map_gnode * find_gnode, u_char gnode_level,
 		   u_char gw_level, inet_prefix * gw_ip, map_node ** gw_nodes,
 		   int single_gw)
@@ -334,8 +462,8 @@ get_gw_ips(map_node * int_map, map_gnode ** ext_map,
 
 	gw_node =
 		(map_node **) get_gw_gnode(int_map, ext_map, bnode_map, bmap_nodes,
-								   find_gnode, gnode_level, gw_level,
-								   single_gw);
+								   cur_erc, find_gnode, gnode_level,
+								   gw_level, single_gw);
 
 	if (!gw_node)
 		return -1;
@@ -362,6 +490,117 @@ get_gw_ips(map_node * int_map, map_gnode ** ext_map,
 	return e ? e : -1;
 }
 
+/*
+ * rt_nh_state_get
+ *
+ * returns the rt_nh_state of the route to the (g)node which is at the `pos'
+ * position of the map of `level'. rt_nh_mutex must be locked, and kept
+ * locked while the returned state is used.
+ */
+struct rt_nh_state *
+rt_nh_state_get(int level, int pos)
+{
+	if (level < 0 || level >= MAX_LEVELS || pos < 0 || pos >= MAXGROUPNODE)
+		return 0;
+
+	if (!rt_nh_states[level])
+		rt_nh_states[level] =
+			xzalloc(sizeof(struct rt_nh_state) * MAXGROUPNODE);
+
+	return &rt_nh_states[level][pos];
+}
+
+/*
+ * rt_nh_state_del
+ *
+ * forgets the weights of the route to the (g)node at the `pos' position of
+ * the map of `level'.
+ */
+void
+rt_nh_state_del(int level, int pos)
+{
+	if (level < 0 || level >= MAX_LEVELS || pos < 0 || pos >= MAXGROUPNODE)
+		return;
+
+	pthread_mutex_lock(&rt_nh_mutex);
+	if (rt_nh_states[level])
+		setzero(&rt_nh_states[level][pos], sizeof(struct rt_nh_state));
+	pthread_mutex_unlock(&rt_nh_mutex);
+}
+
+void
+rt_nh_states_reset(void)
+{
+	int i;
+
+	pthread_mutex_lock(&rt_nh_mutex);
+	for (i = 0; i < MAX_LEVELS; i++)
+		if (rt_nh_states[i]) {
+			xfree(rt_nh_states[i]);
+			rt_nh_states[i] = 0;
+		}
+	pthread_mutex_unlock(&rt_nh_mutex);
+}
+
+/*
+ * rt_nexthop_weight
+ *
+ * sets the multipath weight (nh[i].hops) of the `n' nexthops of `nh'.
+ * The i-th nexthop uses the `gw[i]' gateway, which is reached with a
+ * total rtt of `trtt[i]' millisec and has a bandwidth of `bw[i]' Kb/s. If
+ * `bw' is null all the gateways have the same bandwidth, while a gateway
+ * whose bandwidth is 0 (unknown) is given the smallest known one.
+ * The weight is proportional to bw/trtt and the best nexthop gets
+ * RT_NH_WEIGHT_MAX. 
+ * To avoid flapping routes, the trtt and the bandwidth used the last time, 
+ * which are saved in `st', are kept until the new ones differ more than 
+ * RT_NH_HYSTERESIS% from them. `st' can be null.
+ */
+void
+rt_nexthop_weight(struct rt_nh_state *st, void **gw, u_int * trtt,
+				  u_int * bw, struct nexthop *nh, int n)
+{
+	struct rt_nh_weight new[MAX_MULTIPATH_ROUTES];
+	double q[MAX_MULTIPATH_ROUTES], q_max = 0;
+	u_int bw_min = 0;
+	int i, e, w;
+
+	n = n > MAX_MULTIPATH_ROUTES ? MAX_MULTIPATH_ROUTES : n;
+	for (i = 0; bw && i < n; i++)
+		if (bw[i] && (!bw_min || bw[i] < bw_min))
+			bw_min = bw[i];
+
+	for (i = 0; i < n; i++) {
+		new[i].gw = gw[i];
+		new[i].trtt = trtt[i] ? trtt[i] : 1;
+		new[i].bw = bw && bw[i] ? bw[i] : (bw_min ? bw_min : 1);
+
+		for (e = 0; st && e < st->n; e++)
+			if (st->nh[e].gw == gw[i]) {
+				if (RT_NH_SIMILAR(st->nh[e].trtt, new[i].trtt) &&
+					RT_NH_SIMILAR(st->nh[e].bw, new[i].bw)) {
+					new[i].trtt = st->nh[e].trtt;
+					new[i].bw = st->nh[e].bw;
+				}
+				break;
+			}
+
+		q[i] = (double) new[i].bw / new[i].trtt;
+		if (q[i] > q_max)
+			q_max = q[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		w = (int) (RT_NH_WEIGHT_MAX * q[i] / q_max + 0.5);
+		new[i].weight = nh[i].hops = w < 1 ? 1 : w;
+	}
+
+	if (st) {
+		memcpy(st->nh, new, sizeof(struct rt_nh_weight) * n);
+		st->n = n;
+	}
+}
+
 /*
  * find_rnode_dev_and_retry
  *
@@ -385,7 +624,7 @@ find_rnode_dev_and_retry(map_node * node)
 /*
  * rt_build_nexthop_gw: returns an array of nexthop structs, which has a 
  * maximum of `maxhops' members. The nexthop are all gateway which can be used
- * to reach `node' or `gnode'.
+ * to reach `node' or `gnode'. Their weights are set by rt_nexthop_weight().
  * The array is xmallocateed.
  * On error NULL is returned.
  */
@@ -396,7 +635,10 @@ rt_build_nexthop_gw(map_node * node, map_gnode * gnode, int level,
 	map_node *tmp_node;
 	struct nexthop *nh = 0;
 	interface **devs;
-	int n, i, ips, routes;
+	void *gws[MAX_MULTIPATH_ROUTES];
+	u_int trtt[MAX_MULTIPATH_ROUTES], bw[MAX_MULTIPATH_ROUTES];
+	u_int max_trtt = 0;
+	int n, i, ips, routes, pos;
 
 	if (!level) {
 		nh = xmalloc(sizeof(struct nexthop) * (node->links + 1));
@@ -413,19 +655,27 @@ rt_build_nexthop_gw(map_node * node, map_gnode * gnode, int level,
 				continue;
 			nh[n].dev = devs[0]->dev_name;
 
-			nh[n].hops = node->links - i;	/* multipath weigth */
+			gws[n] = tmp_node;
+			trtt[n] = node->r_node[i].trtt;
+			bw[n] = node->r_node[i].bw;
 			n++;
 
-			if (maxhops && n >= maxhops)
+			if (n >= MAX_MULTIPATH_ROUTES || (maxhops && n >= maxhops))
 				break;
 		}
 		nh[n].dev = 0;
+
+		pthread_mutex_lock(&rt_nh_mutex);
+		rt_nexthop_weight(rt_nh_state_get(level,
+										  pos_from_node(node, me.int_map)),
+						  gws, trtt, bw, nh, n);
+		pthread_mutex_unlock(&rt_nh_mutex);
 	} else if (level) {
 		inet_prefix gnode_gws[MAX_MULTIPATH_ROUTES];
 		map_node *gw_nodes[MAX_MULTIPATH_ROUTES];
 
 		routes = get_gw_ips(me.int_map, me.ext_map, me.bnode_map,
-							me.bmap_nodes, &me.cur_quadg,
+							me.bmap_nodes, me.cur_erc, &me.cur_quadg,
 							gnode, level, 0, gnode_gws, gw_nodes, 0);
 		if (routes < 0)
 			goto finish;
@@ -434,6 +684,12 @@ rt_build_nexthop_gw(map_node * node, map_gnode * gnode, int level,
 		setzero(nh, sizeof(struct nexthop) * (routes + 1));
 
 		for (ips = 0, n = 0; ips < routes; ips++) {
+			/* Different bnodes can be reached by the same rnode, which
+			 * would be counted twice in the route */
+			for (i = 0; i < n && gws[i] != gw_nodes[ips]; i++);
+			if (i < n)
+				continue;
+
 			inet_copy(&nh[n].gw, &gnode_gws[ips]);
 			inet_htonl(nh[n].gw.data, nh[n].gw.family);
 
@@ -441,7 +697,14 @@ rt_build_nexthop_gw(map_node * node, map_gnode * gnode, int level,
 				continue;
 			nh[n].dev = devs[0]->dev_name;
 
-			nh[n].hops = routes - ips;	/* multipath weigth */
+			/* Of the route to the gnode we know only the rtt and
+			 * the bandwidth of its first hop */
+			gws[n] = gw_nodes[ips];
+			pos = rnode_find(me.cur_node, gw_nodes[ips]);
+			trtt[n] = pos < 0 ? (u_int) - 1 : me.cur_node->r_node[pos].trtt;
+			bw[n] = pos < 0 ? 0 : me.cur_node->r_node[pos].bw;
+			if (pos >= 0 && trtt[n] > max_trtt)
+				max_trtt = trtt[n];
 			n++;
 
 			if (maxhops && n >= maxhops)
@@ -449,6 +712,19 @@ rt_build_nexthop_gw(map_node * node, map_gnode * gnode, int level,
 		}
 
 		nh[n].dev = 0;
+
+		/* The gateways we don't know are the worst ones */
+		for (i = 0; i < n; i++)
+			if (trtt[i] == (u_int) - 1)
+				trtt[i] = max_trtt;
+
+		pthread_mutex_lock(&rt_nh_mutex);
+		rt_nexthop_weight(rt_nh_state_get(level,
+										  pos_from_gnode(gnode,
+														 me.ext_map[_EL
+																	(level)])),
+						  gws, trtt, bw, nh, n);
+		pthread_mutex_unlock(&rt_nh_mutex);
 	}
   finish:
 	return nh;
@@ -622,13 +898,21 @@ rt_update_node(inet_prefix * dst_ip, void *dst_node,
 		/* The dst node is a node directly linked to us */
 		route_scope = RT_SCOPE_LINK;
 
+	/* 
+	 * The routes which the kernel already has, as the kernel state
+	 * mirror tells, aren't written again.
+	 */
 	if (node->flags & MAP_VOID) {
 		/* Ok, let's delete it */
-		if (route_del(RTN_UNICAST, 0, 0, &to, 0, 0, 0))
+		if (!dst_ip)
+			rt_nh_state_del(level, node_pos);
+		if (krnl_rt_uptodate(&to, 0, 0, 0) <= 0 &&
+			route_del(RTN_UNICAST, 0, 0, &to, 0, 0, 0))
 			error("WARNING: Cannot delete the route entry for the"
 				  "%snode %d lvl %d!", !level ? " " : " g",
 				  node_pos, level);
-	} else if (route_replace(0, route_scope, 0, &to, nh, 0, 0))
+	} else if (krnl_rt_uptodate(&to, nh, route_scope, 0) <= 0 &&
+			   route_replace(0, route_scope, 0, &to, nh, 0, 0))
 		error("WARNING: Cannot update the route entry for the"
 			  "%snode %d lvl %d", !level ? " " : " g", node_pos, level);
   finish:
@@ -640,6 +924,134 @@ rt_update_node(inet_prefix * dst_ip, void *dst_node,
 		xfree(nh);
 }
 
+void
+rt_sync_init(void)
+{
+	pthread_mutex_init(&rt_nh_mutex, 0);
+	pthread_mutex_init(&rt_sync_mutex, 0);
+	pthread_cond_init(&rt_sync_cond, 0);
+	rt_sync_reset();
+}
+
+/*
+ * rt_sync_node
+ *
+ * marks the route of `node' (which is a gnode if `level' is > 0) to be
+ * updated by the rt_sync_daemon().
+ */
+void
+rt_sync_node(map_node * node, u_char level)
+{
+	int pos;
+
+	if (!level)
+		pos = pos_from_node(node, me.int_map);
+	else
+		pos = pos_from_gnode((map_gnode *) node, me.ext_map[_EL(level)]);
+	if (level >= MAX_LEVELS || pos < 0 || pos >= MAXGROUPNODE)
+		return;
+
+	pthread_mutex_lock(&rt_sync_mutex);
+	rt_sync_marks++;
+	if (!TEST_BIT(rt_sync_dirty[level], pos)) {
+		SET_BIT(rt_sync_dirty[level], pos);
+		gettimeofday(&rt_sync_dirty_t[level][pos], 0);
+		if (!rt_sync_dirty_n++)
+			pthread_cond_signal(&rt_sync_cond);
+	}
+	pthread_mutex_unlock(&rt_sync_mutex);
+}
+
+/*
+ * rt_sync_reset
+ *
+ * forgets all the marked routes. It is used when the maps are reset.
+ */
+void
+rt_sync_reset(void)
+{
+	pthread_mutex_lock(&rt_sync_mutex);
+	setzero(rt_sync_dirty, sizeof(rt_sync_dirty));
+	rt_sync_dirty_n = 0;
+	pthread_mutex_unlock(&rt_sync_mutex);
+}
+
+/*
+ * rt_sync_flush
+ *
+ * updates the routes of all the marked (g)nodes. It reads the maps, so it
+ * must be called by the map owner.
+ */
+void
+rt_sync_flush(void)
+{
+	static u_char dirty[MAX_LEVELS][MAXGROUPNODE / 8];
+	static struct timeval dirty_t[MAX_LEVELS][MAXGROUPNODE];
+	struct timeval cur_t, t;
+	map_node *node;
+	u_int lat, max_lat = 0;
+	int level, i;
+
+	pthread_mutex_lock(&rt_sync_mutex);
+	memcpy(dirty, rt_sync_dirty, sizeof(dirty));
+	memcpy(dirty_t, rt_sync_dirty_t, sizeof(dirty_t));
+	setzero(rt_sync_dirty, sizeof(rt_sync_dirty));
+	rt_sync_dirty_n = 0;
+	pthread_mutex_unlock(&rt_sync_mutex);
+
+	if (me.cur_node->flags & MAP_HNODE)
+		/* The hook will update all the routes by itself */
+		return;
+
+	for (level = 0; level < me.cur_quadg.levels; level++)
+		for (i = 0; i < MAXGROUPNODE; i++) {
+			if (!TEST_BIT(dirty[level], i))
+				continue;
+
+			if (!level)
+				node = node_from_pos(i, me.int_map);
+			else
+				node = &gnode_from_pos(i, me.ext_map[_EL(level)])->g;
+
+			rt_update_node(0, node, 0, 0, 0, level);
+			rt_sync_updates++;
+
+			gettimeofday(&cur_t, 0);
+			timersub(&cur_t, &dirty_t[level][i], &t);
+			lat = MILLISEC(t);
+			max_lat = lat > max_lat ? lat : max_lat;
+			rt_sync_avg_ms = rt_sync_avg_ms ?
+				(rt_sync_avg_ms * 7 + lat) / 8 : lat;
+		}
+
+	rt_sync_last_ms = max_lat;
+}
+
+/*
+ * rt_sync_daemon
+ *
+ * It waits for marked routes and writes them in the kernel, in batches of
+ * RT_SYNC_DELAY ms.
+ */
+void *
+rt_sync_daemon(void *null)
+{
+	debug(DBG_NORMAL, "Route sync daemon up & running");
+	for (;;) {
+		pthread_mutex_lock(&rt_sync_mutex);
+		while (!rt_sync_dirty_n)
+			pthread_cond_wait(&rt_sync_cond, &rt_sync_mutex);
+		pthread_mutex_unlock(&rt_sync_mutex);
+
+		/* Let the other updates of this round pile up */
+		usleep(RT_SYNC_DELAY * 1000);
+
+		map_owner_call(rt_sync_flush);
+	}
+
+	return 0;
+}
+
 /* 
  * rt_rnodes_update
  * 
@@ -739,6 +1151,45 @@ rt_full_update(int check_update_flag)
 	route_flush_cache(my_family);
 }
 
+/*
+ * rt_full_delete
+ *
+ * It deletes all the routes that rt_full_update() writes for the current
+ * maps. Each node is marked MAP_VOID only while its route is deleted.
+ */
+void
+rt_full_delete(void)
+{
+	map_node *node;
+	u_short i, l, flags;
+
+	for (l = me.cur_quadg.levels - 1; l >= 1; l--)
+		for (i = 0; i < MAXGROUPNODE; i++) {
+			node = &me.ext_map[_EL(l)][i].g;
+			if (node->flags & MAP_VOID || node->flags & MAP_ME ||
+				me.ext_map[_EL(l)][i].flags & GMAP_VOID)
+				continue;
+
+			flags = node->flags;
+			node->flags |= MAP_VOID;
+			rt_update_node(0, node, 0, 0, 0, l);
+			node->flags = flags;
+		}
+
+	for (i = 0; i < MAXGROUPNODE; i++) {
+		node = &me.int_map[i];
+		if (node->flags & MAP_VOID || node->flags & MAP_ME)
+			continue;
+
+		flags = node->flags;
+		node->flags |= MAP_VOID;
+		rt_update_node(0, node, 0, 0, 0, 0);
+		node->flags = flags;
+	}
+
+	route_flush_cache(my_family);
+}
+
 /*
  * rt_get_default_gw
  * 
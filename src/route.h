@@ -27,6 +27,70 @@
 										   nexthops used to create a 
 										   single multipath route. */
 
+#define RT_NH_WEIGHT_MAX		64	/* The weight of the best nexthop of a
+										   multipath route. The kernel
+										   accepts weights up to 256 */
+#define RT_NH_HYSTERESIS		25	/* The weight of a nexthop isn't
+										   recomputed until its trtt or
+										   bandwidth changes by more
+										   than RT_NH_HYSTERESIS% */
+#define RT_NH_SIMILAR(old, new)						\
+	(abs((int)(new) - (int)(old)) * 100 <= RT_NH_HYSTERESIS * (int)(old))
+
+/*
+ * The weights given to the nexthops of a multipath route, and the trtt and
+ * bandwidth which were used to compute them.
+ */
+struct rt_nh_weight {
+	void *gw;					/* The gateway node */
+	u_int trtt;					/* in millisec */
+	u_int bw;					/* in Kb/s */
+	u_char weight;
+};
+struct rt_nh_state {
+	struct rt_nh_weight nh[MAX_MULTIPATH_ROUTES];
+	int n;
+};
+
+/*
+ * rt_nh_states[level][pos] keeps the rt_nh_state of the route to the
+ * (g)node at the `pos' position of the map of `level'. Each level is
+ * allocated the first time one of its routes is updated.
+ * They can be reset by a thread while another builds a route, so they are
+ * accessed only with rt_nh_mutex locked.
+ */
+struct rt_nh_state *rt_nh_states[MAX_LEVELS];
+pthread_mutex_t rt_nh_mutex;
+
+#define RT_SYNC_DELAY			200	/* For how many millisec the route
+										   updates are collected before
+										   being written to the kernel */
+
+/*
+ * The route-sync stage: the packet handlers don't write the routes in the
+ * kernel, they just mark with rt_sync_node() the (g)nodes whose route
+ * changed. The rt_sync_daemon() waits RT_SYNC_DELAY ms after the first mark,
+ * then it makes the map owner update all the marked routes at once, between
+ * two batches of pkts: the routes are built by walking the maps. In this way
+ * a route changed many times during the same qspn round is written only
+ * once.
+ */
+u_char rt_sync_dirty[MAX_LEVELS][MAXGROUPNODE / 8];
+struct timeval rt_sync_dirty_t[MAX_LEVELS][MAXGROUPNODE];	/* when each 
+															   route was
+															   marked */
+int rt_sync_dirty_n;
+pthread_mutex_t rt_sync_mutex;
+pthread_cond_t rt_sync_cond;
+
+u_int rt_sync_marks;			/* Routes marked */
+u_int rt_sync_updates;			/* Routes written in the kernel. The
+								   difference with rt_sync_marks is what
+								   has been saved */
+u_int rt_sync_last_ms;			/* The max latency, from the mark to the
+								   kernel, of the last batch */
+u_int rt_sync_avg_ms;			/* The average latency */
+
 /* 
  * get_gw_gnode_recurse() uses this array to decide the number of forks per
  * level. The number of forks for the level `x' is located at
@@ -44,19 +108,68 @@ const static int sub_gw_links[MAX_LEVELS] = { 4, 3, 2, 1, 1, 1, 1, 1,
 	1, 1, 1, 1, 1, 1, 1, 1
 };
 
+/*
+ * The gateway cache keeps the result of get_gw_gnode() for each gnode of
+ * me.ext_map, when the gateways are searched in the level 0. An entry is
+ * valid as long as map_gen_sum() of its level doesn't change, i.e. until
+ * one of the maps it was computed from is modified.
+ * gw_cache[level][single_gw*MAXGROUPNODE + pos] is the entry of the gnode
+ * at the `pos' position of the ext_map of `level'. Each level is allocated
+ * the first time it is used.
+ */
+#define GW_CACHE_VALID		1
+#define GW_CACHE_NONE		(1<<1)	/* No gateway was found */
+
+struct gw_cache_entry {
+	u_char flags;
+	u_int gen;					/* map_gen_sum(level) when it was stored */
+	void *gw[MAX_MULTIPATH_ROUTES];
+};
+struct gw_cache_entry *gw_cache[MAX_LEVELS];
+pthread_mutex_t gw_cache_mutex;
+
+u_int gw_cache_hits;			/* Stupid statistics */
+u_int gw_cache_misses;
+u_int gw_cache_stale;			/* Misses of invalidated entries */
+
 /* * * Functions declaration * * */
+struct nexthop;
+void gw_cache_init(void);
+void gw_cache_reset(void);
+struct gw_cache_entry *gw_cache_entry_get(map_node * int_map,
+										  map_gnode ** ext_map,
+										  map_bnode ** bnode_map,
+										  map_gnode * find_gnode,
+										  u_char gnode_level,
+										  u_char gw_level, int single_gw);
+int gw_cache_find(struct gw_cache_entry *entry, u_char gnode_level,
+				  void **gateways);
+void gw_cache_store(struct gw_cache_entry *entry, u_char gnode_level,
+					u_int gen, void **gateways);
 void **get_gw_gnode(map_node *, map_gnode **, map_bnode **,
-					u_int *, map_gnode *, u_char, u_char, int);
+					u_int *, ext_rnode_cache *, map_gnode *, u_char, u_char,
+					int);
 int get_gw_ips(map_node *, map_gnode **, map_bnode **, u_int *,
-			   quadro_group *, map_gnode *, u_char, u_char,
+			   ext_rnode_cache *, quadro_group *, map_gnode *, u_char, u_char,
 			   inet_prefix *, map_node **, int);
+struct rt_nh_state *rt_nh_state_get(int level, int pos);
+void rt_nh_state_del(int level, int pos);
+void rt_nh_states_reset(void);
+void rt_nexthop_weight(struct rt_nh_state *st, void **gw, u_int * trtt,
+					   u_int * bw, struct nexthop *nh, int n);
 struct nexthop *rt_build_nexthop_gw(map_node * node, map_gnode * gnode,
 									int level, int maxhops);
 void rt_update_node(inet_prefix * dst_ip, void *dst_node,
 					quadro_group * dst_quadg, void *void_gw, interface **,
 					u_char level);
+void rt_sync_init(void);
+void rt_sync_node(map_node * node, u_char level);
+void rt_sync_reset(void);
+void rt_sync_flush(void);
+void *rt_sync_daemon(void *null);
 void rt_rnodes_update(int check_update_flag);
 void rt_full_update(int check_update_flag);
+void rt_full_delete(void);
 
 int rt_get_default_gw(inet_prefix * gw, char *dev_name);
 int rt_add_gw(char *dev, inet_prefix to, inet_prefix gw, u_char table);
@@ -0,0 +1,872 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * snapshot.c
+ *
+ * The state snapshot used by the warm restart (see snapshot.h).
+ */
+
+#include "includes.h"
+#include <sys/mman.h>
+
+#include "common.h"
+#include "inet.h"
+#include "if.h"
+#include "request.h"
+#include "pkts.h"
+#include "bmap.h"
+#include "igs.h"
+#include "iptunnel.h"
+#include "route.h"
+#include "radar.h"
+#include "tracer.h"
+#include "qspn.h"
+#include "hook.h"
+#include "mapowner.h"
+#include "andna_cache.h"
+#include "hash.h"
+#include "netsukuku.h"
+#include "timer.h"
+#include "snapshot.h"
+
+/* What snapshot_collect() gathered in the map owner */
+static struct snapshot_hdr snap_hdr;
+static char *snap_rnodes, *snap_igws;
+static size_t snap_rnodes_sz, snap_igws_sz;
+
+void
+snapshot_init(void)
+{
+	snap_warm = 0;
+	snap_warm_sz = 0;
+	snap_written = snap_last_sz = snap_last_us = 0;
+	snap_warm_state = SNAP_WARM_OFF;
+	snap_warm_ms = snap_confirm_ms = 0;
+	snap_warm_rnodes = snap_warm_found = snap_warm_known = 0;
+	pthread_mutex_init(&snap_mutex, 0);
+}
+
+/*
+ * snapshot_collect
+ *
+ * It is called by the map owner: it fills `snap_hdr' and packs our rnodes
+ * and our igws. If we are hooking there's nothing worth saving and
+ * snap_hdr.magic is left to 0.
+ */
+void
+snapshot_collect(void)
+{
+	struct snapshot_rnode *r;
+	struct rnode_list *rnl;
+	map_node *node;
+	inet_prefix ip;
+	int i, e, level;
+
+	setzero(&snap_hdr, sizeof(struct snapshot_hdr));
+	snap_rnodes = snap_igws = 0;
+	snap_rnodes_sz = snap_igws_sz = 0;
+
+	if (!me.cur_node || me.cur_node->flags & MAP_HNODE)
+		return;
+
+	snap_hdr.magic = SNAPSHOT_MAGIC;
+	snap_hdr.family = my_family;
+	snap_hdr.levels = me.cur_quadg.levels;
+	snap_hdr.restricted = restricted_mode;
+	snap_hdr.restricted_class = restricted_class;
+	memcpy(snap_hdr.ip, me.cur_ip.data, MAX_IP_SZ);
+	for (level = 0; level < me.cur_quadg.levels && level < MAX_LEVELS;
+		 level++)
+		snap_hdr.qspn_id[level] = me.cur_qspn_id[level];
+	memcpy(snap_hdr.gcount, qspn_gnode_count, sizeof(snap_hdr.gcount));
+
+	if (me.cur_node->links) {
+		snap_rnodes_sz = sizeof(struct snapshot_rnode) * me.cur_node->links;
+		snap_rnodes = xzalloc(snap_rnodes_sz);
+	}
+	r = (struct snapshot_rnode *) snap_rnodes;
+	for (i = 0; i < me.cur_node->links; i++, r++) {
+		node = (map_node *) me.cur_node->r_node[i].r_node;
+		if (node->flags & MAP_ERNODE)
+			inet_copy(&ip, &((ext_rnode *) node)->quadg.ipstart[0]);
+		else
+			postoip(pos_from_node(node, me.int_map),
+					me.cur_quadg.ipstart[1], &ip);
+		memcpy(r->ip, ip.data, MAX_IP_SZ);
+		r->trtt = me.cur_node->r_node[i].trtt;
+		r->bw = me.cur_node->r_node[i].bw;
+
+		e = 0;
+		if ((rnl = rnl_find_node(rlist, node)))
+			for (; e < rnl->dev_n && e < MAX_INTERFACES; e++)
+				snprintf(r->dev[e], IFNAMSIZ, "%s",
+						 rnl->dev[e]->dev_name);
+		r->dev_n = e;
+	}
+
+	if (me.igws)
+		snap_igws = pack_igws(me.igws, me.igws_counter,
+							  me.cur_quadg.levels, (int *) &snap_igws_sz);
+}
+
+/*
+ * snapshot_csum
+ *
+ * returns the checksum of the snapshot `buf', calculated with its csum
+ * field set to 0.
+ */
+u_int
+snapshot_csum(char *buf, size_t sz)
+{
+	struct snapshot_hdr *hdr = (struct snapshot_hdr *) buf;
+	u_int csum, saved;
+
+	saved = hdr->csum;
+	hdr->csum = 0;
+	csum = fnv_32_buf(buf, sz, FNV1_32_INIT);
+	hdr->csum = saved;
+
+	return csum;
+}
+
+/*
+ * snapshot_write
+ *
+ * writes `buf' in `file'.tmp and then renames it to `file', so that a
+ * crash never leaves a half written snapshot.
+ */
+int
+snapshot_write(char *file, char *buf, size_t sz)
+{
+	char tmp_file[NAME_MAX + 8];
+	ssize_t n;
+	size_t done;
+	int fd;
+
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", file);
+	if ((fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		error("Cannot write the snapshot in %s: %s", tmp_file,
+			  strerror(errno));
+		return -1;
+	}
+
+	for (done = 0; done < sz; done += n)
+		if ((n = write(fd, buf + done, sz - done)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			error("Cannot write the snapshot in %s: %s", tmp_file,
+				  strerror(errno));
+			close(fd);
+			unlink(tmp_file);
+			return -1;
+		}
+	close(fd);
+
+	if (rename(tmp_file, file) < 0) {
+		error("Cannot rename %s to %s: %s", tmp_file, file,
+			  strerror(errno));
+		unlink(tmp_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * snapshot_save
+ *
+ * writes the snapshot of the current state in `server_opt.snapshot_file'.
+ * The maps are packed from the map_snapshot published by the map owner,
+ * which at most lags one batch behind the rest of the state. The qspn
+ * rounds following the warm restart fix that.
+ * If we are hooking, or a snapshot is already being written, nothing is
+ * done and -1 is returned.
+ */
+int
+snapshot_save(void)
+{
+	struct snapshot_hdr *hdr;
+	struct timeval t0, t1, diff;
+	char *sec_buf[SNAP_SECTIONS], *buf = 0;
+	size_t sec_sz[SNAP_SECTIONS], sz;
+	int i, ret = 0;
+
+	if (pthread_mutex_trylock(&snap_mutex))
+		return -1;
+	gettimeofday(&t0, 0);
+
+	setzero(sec_buf, sizeof(sec_buf));
+	setzero(sec_sz, sizeof(sec_sz));
+
+	map_owner_call(snapshot_collect);
+	if (!snap_hdr.magic)
+		ERROR_FINISH(ret, -1, finish);
+
+	sec_buf[SNAP_SEC_RNODES] = snap_rnodes;
+	sec_sz[SNAP_SEC_RNODES] = snap_rnodes_sz;
+	sec_buf[SNAP_SEC_IGWS] = snap_igws;
+	sec_sz[SNAP_SEC_IGWS] = snap_igws_sz;
+
+	if (!server_opt.disable_andna) {
+		pthread_mutex_lock(&andna_cache_mutex);
+		sec_buf[SNAP_SEC_ANDNA_CACHE] =
+			pack_andna_cache(andna_c, &sec_sz[SNAP_SEC_ANDNA_CACHE],
+							 ACACHE_PACK_FILE);
+		sec_buf[SNAP_SEC_COUNTER_C] =
+			pack_counter_cache(andna_counter_c,
+							   &sec_sz[SNAP_SEC_COUNTER_C]);
+		sec_buf[SNAP_SEC_RH_CACHE] =
+			pack_rh_cache(andna_rhc, &sec_sz[SNAP_SEC_RH_CACHE]);
+		pthread_mutex_unlock(&andna_cache_mutex);
+		for (i = SNAP_SEC_ANDNA_CACHE; i <= SNAP_SEC_RH_CACHE; i++)
+			if (!sec_buf[i])
+				sec_sz[i] = 0;
+	}
+
+	sec_buf[SNAP_SEC_INT_MAP] =
+		map_snapshot_pack(MAP_SNAP_INT_MAP, &sec_sz[SNAP_SEC_INT_MAP]);
+	sec_buf[SNAP_SEC_EXT_MAP] =
+		map_snapshot_pack(MAP_SNAP_EXT_MAP, &sec_sz[SNAP_SEC_EXT_MAP]);
+	sec_buf[SNAP_SEC_BNODE_MAP] =
+		map_snapshot_pack(MAP_SNAP_BNODE_MAP, &sec_sz[SNAP_SEC_BNODE_MAP]);
+	if (!sec_buf[SNAP_SEC_INT_MAP] || !sec_buf[SNAP_SEC_EXT_MAP] ||
+		!sec_buf[SNAP_SEC_BNODE_MAP])
+		ERROR_FINISH(ret, -1, finish);
+
+	sz = SNAPSHOT_ALIGN_SZ(sizeof(struct snapshot_hdr));
+	for (i = 0; i < SNAP_SECTIONS; i++)
+		sz += SNAPSHOT_ALIGN_SZ(sec_sz[i]);
+
+	buf = xzalloc(sz);
+	hdr = (struct snapshot_hdr *) buf;
+	memcpy(hdr, &snap_hdr, sizeof(struct snapshot_hdr));
+
+	hdr->sec[0].off = SNAPSHOT_ALIGN_SZ(sizeof(struct snapshot_hdr));
+	for (i = 0; i < SNAP_SECTIONS; i++) {
+		if (i)
+			hdr->sec[i].off = hdr->sec[i - 1].off +
+				SNAPSHOT_ALIGN_SZ(hdr->sec[i - 1].sz);
+		hdr->sec[i].sz = sec_sz[i];
+		if (sec_sz[i])
+			memcpy(buf + hdr->sec[i].off, sec_buf[i], sec_sz[i]);
+	}
+
+	hdr->version = SNAPSHOT_VERSION;
+	hdr->size = sz;
+	hdr->stamp = time(0);
+	hdr->csum = snapshot_csum(buf, sz);
+
+	if (snapshot_write(server_opt.snapshot_file, buf, sz) < 0)
+		ERROR_FINISH(ret, -1, finish);
+
+	gettimeofday(&t1, 0);
+	timersub(&t1, &t0, &diff);
+	snap_written++;
+	snap_last_sz = sz;
+	snap_last_us = MICROSEC(diff);
+	debug(DBG_NOISE, "Snapshot of %u bytes written in %u us", snap_last_sz,
+		  snap_last_us);
+
+  finish:
+	if (buf)
+		xfree(buf);
+	if (snap_rnodes)
+		xfree(snap_rnodes);
+	if (snap_igws)
+		xfree(snap_igws);
+	for (i = SNAP_SEC_INT_MAP; i <= SNAP_SEC_BNODE_MAP; i++)
+		if (sec_buf[i])
+			xfree(sec_buf[i]);
+	for (i = SNAP_SEC_ANDNA_CACHE; i <= SNAP_SEC_RH_CACHE; i++)
+		if (sec_buf[i])
+			xfree(sec_buf[i]);
+	snap_rnodes = snap_igws = 0;
+	pthread_mutex_unlock(&snap_mutex);
+	return ret;
+}
+
+/*
+ * snapshot_job_save
+ *
+ * The snapshot_job: it writes the snapshot every SNAPSHOT_INTERVAL seconds.
+ */
+u_int
+snapshot_job_save(void *null)
+{
+	snapshot_save();
+	return SNAPSHOT_INTERVAL * 1000;
+}
+
+/*
+ * snapshot_sec
+ *
+ * returns the start of the `sec' section of `hdr' and stores its size in
+ * `*sz'. If the section is empty 0 is returned.
+ */
+char *
+snapshot_sec(struct snapshot_hdr *hdr, int sec, size_t * sz)
+{
+	*sz = hdr->sec[sec].sz;
+	return *sz ? (char *) hdr + hdr->sec[sec].off : 0;
+}
+
+/*
+ * snapshot_verify
+ *
+ * checks that the `sz' bytes long snapshot `hdr' is intact, recent and
+ * written by a ntkd configured as we are. It returns 0 if it can be used.
+ */
+int
+snapshot_verify(struct snapshot_hdr *hdr, size_t sz)
+{
+	time_t now = time(0);
+	size_t hdr_sz = SNAPSHOT_ALIGN_SZ(sizeof(struct snapshot_hdr));
+	int i;
+
+	if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION) {
+		loginfo("The snapshot has an unknown format, ignoring it");
+		return -1;
+	}
+	if (hdr->size != sz) {
+		loginfo("The snapshot is truncated, ignoring it");
+		return -1;
+	}
+
+	for (i = 0; i < SNAP_SECTIONS; i++)
+		if (hdr->sec[i].sz && (hdr->sec[i].off < hdr_sz ||
+							   hdr->sec[i].off % SNAPSHOT_ALIGN ||
+							   hdr->sec[i].off > sz ||
+							   hdr->sec[i].sz > sz - hdr->sec[i].off)) {
+			loginfo("The snapshot section %d is corrupted, ignoring it", i);
+			return -1;
+		}
+	if (!hdr->sec[SNAP_SEC_INT_MAP].sz || !hdr->sec[SNAP_SEC_EXT_MAP].sz ||
+		hdr->sec[SNAP_SEC_RNODES].sz % sizeof(struct snapshot_rnode)) {
+		loginfo("The snapshot is incomplete, ignoring it");
+		return -1;
+	}
+
+	if (snapshot_csum((char *) hdr, sz) != hdr->csum) {
+		loginfo("The snapshot checksum is wrong, ignoring it");
+		return -1;
+	}
+
+	if (hdr->stamp > now || now - hdr->stamp > SNAPSHOT_MAX_AGE) {
+		loginfo("The snapshot is %d seconds old, ignoring it",
+				(int) (now - hdr->stamp));
+		return -1;
+	}
+
+	if (hdr->family != my_family || hdr->levels != FAMILY_LVLS ||
+		hdr->restricted != restricted_mode ||
+		hdr->restricted_class != restricted_class) {
+		loginfo("The snapshot was written with a different family or "
+				"restricted mode, ignoring it");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * snapshot_open
+ *
+ * mmaps the snapshot `file' and, if it is valid, keeps it in `snap_warm'
+ * for snapshot_warm_hook(). The mapping is private and writable because
+ * the sections are unpacked in place.
+ * On error -1 is returned.
+ */
+int
+snapshot_open(char *file)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	snap_warm = 0;
+	snap_warm_sz = 0;
+
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		debug(DBG_NORMAL, "No snapshot in %s, we'll hook", file);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct snapshot_hdr)) {
+		loginfo("The snapshot %s is truncated, ignoring it", file);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error("Cannot mmap the snapshot %s: %s", file, strerror(errno));
+		return -1;
+	}
+
+	if (snapshot_verify((struct snapshot_hdr *) map, st.st_size) < 0) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	snap_warm = (struct snapshot_hdr *) map;
+	snap_warm_sz = st.st_size;
+	loginfo("Snapshot %s loaded, it is %d seconds old", file,
+			(int) (time(0) - snap_warm->stamp));
+
+	return 0;
+}
+
+void
+snapshot_close(void)
+{
+	if (!snap_warm)
+		return;
+
+	munmap(snap_warm, snap_warm_sz);
+	snap_warm = 0;
+	snap_warm_sz = 0;
+}
+
+/*
+ * snapshot_warm_qspn_b
+ *
+ * adds `rnode' in qspn_b[`level'], if it isn't already there, as
+ * radar_update_map() does for a new rnode.
+ */
+void
+snapshot_warm_qspn_b(u_char level, map_node * rnode)
+{
+	struct qspn_buffer *qb;
+
+	if (qspn_b_find_rnode(qspn_b[level], rnode))
+		return;
+
+	qb = xzalloc(sizeof(struct qspn_buffer));
+	qb->rnode = rnode;
+	qspn_b[level] = list_add(qspn_b[level], qb);
+}
+
+/*
+ * snapshot_warm_rnodes
+ *
+ * restores the rnodes of the root_node saved in `hdr', with the interfaces
+ * they were reached from. The rnodes reached from none of our current
+ * interfaces are dropped.
+ */
+void
+snapshot_warm_rnodes(struct snapshot_hdr *hdr)
+{
+	struct snapshot_rnode *r;
+	struct rnode_list *rnl;
+	interface *devs[MAX_INTERFACES];
+	quadro_group qg;
+	ext_rnode *e_rnode;
+	map_node *node, *root_node;
+	map_gnode *gnode;
+	map_rnode rnn;
+	inet_prefix ip;
+	size_t sz;
+	int i, n, e, dev_n, idx, level;
+
+	r = (struct snapshot_rnode *) snapshot_sec(hdr, SNAP_SEC_RNODES, &sz);
+	n = sz / sizeof(struct snapshot_rnode);
+
+	for (i = 0; i < n; i++, r++) {
+		for (e = dev_n = 0; e < r->dev_n && e < MAX_INTERFACES; e++) {
+			r->dev[e][IFNAMSIZ - 1] = 0;
+			idx = ifs_find_devname(me.cur_ifs, me.cur_ifs_n, r->dev[e]);
+			if (idx >= 0)
+				devs[dev_n++] = &me.cur_ifs[idx];
+		}
+		if (!dev_n)
+			continue;
+
+		inet_setip_raw(&ip, r->ip, my_family);
+		iptoquadg(ip, me.ext_map, &qg,
+				  QUADG_GID | QUADG_GNODE | QUADG_IPSTART);
+
+		setzero(&rnn, sizeof(map_rnode));
+		rnn.trtt = r->trtt;
+		rnn.bw = r->bw;
+
+		if (quadg_gids_cmp(qg, me.cur_quadg, 1)) {
+			/*
+			 * It belongs to another gnode: in the upper levels its
+			 * gnodes are our rnodes too.
+			 */
+			for (level = qg.levels - 1; level > 0; level--) {
+				if (!quadg_gids_cmp(qg, me.cur_quadg, level))
+					continue;
+				if ((level < qg.levels - 1) &&
+					quadg_gids_cmp(qg, me.cur_quadg, level + 1)) {
+					qg.gnode[_EL(level)] = 0;
+					continue;
+				}
+				if (!(gnode = qg.gnode[_EL(level)]))
+					continue;
+
+				qspn_set_map_vars(level, 0, &root_node, 0, 0);
+				root_node->flags |= MAP_BNODE;
+				me.cur_node->flags |= MAP_BNODE;
+
+				gnode->g.flags |= MAP_BNODE | MAP_GNODE | MAP_RNODE;
+				if (rnode_find(root_node, &gnode->g) < 0) {
+					rnn.r_node = (int *) &gnode->g;
+					rnode_add(root_node, &rnn);
+				}
+				snapshot_warm_qspn_b(level, &gnode->g);
+			}
+
+			e_rnode = xzalloc(sizeof(ext_rnode));
+			memcpy(&e_rnode->quadg, &qg, sizeof(quadro_group));
+			e_rnode->node.flags =
+				MAP_BNODE | MAP_GNODE | MAP_RNODE | MAP_ERNODE;
+			e_rnode_add(&me.cur_erc, e_rnode, me.cur_node->links,
+						&me.cur_erc_counter);
+			node = &e_rnode->node;
+		} else {
+			node = &me.int_map[qg.gid[0]];
+			if (node == me.cur_node || node->flags & MAP_VOID)
+				continue;
+			node->flags |= MAP_RNODE;
+			snapshot_warm_qspn_b(0, node);
+		}
+
+		rnn.r_node = (int *) node;
+		rnode_add(me.cur_node, &rnn);
+
+		rnl = rnl_add(&rlist, &rlist_counter, node, devs[0]);
+		for (e = 1; e < dev_n; e++)
+			rnl->dev[rnl->dev_n++] = devs[e];
+	}
+}
+
+/*
+ * snapshot_warm_apply
+ *
+ * It is called by the map owner: it replaces the maps, the igws, the qspn
+ * ids and the andna caches with the ones of `snap_warm' and restores our
+ * old ip and rnodes. On success `snap_warm_err' is set to 0.
+ */
+void
+snapshot_warm_apply(void)
+{
+	struct snapshot_hdr *hdr = snap_warm;
+	map_node *int_map, *root;
+	map_gnode **ext_map;
+	map_bnode **bnode_map = 0;
+	u_int *bmap_nodes = 0;
+	inet_gw **igws = 0;
+	int *igws_counter = 0, level, counter;
+	quadro_group quadg;
+	inet_prefix ip;
+	char *pack;
+	size_t sz;
+	void *cache;
+
+	snap_warm_err = -1;
+
+	pack = snapshot_sec(hdr, SNAP_SEC_INT_MAP, &sz);
+	if (!(int_map = unpack_map(pack, 0, &root, MAXGROUPNODE,
+							   MAXRNODEBLOCK_PACK_SZ))) {
+		error("Cannot unpack the int_map of the snapshot");
+		return;
+	}
+	pack = snapshot_sec(hdr, SNAP_SEC_EXT_MAP, &sz);
+	if (!(ext_map = unpack_extmap(pack, &quadg))) {
+		error("Cannot unpack the ext_map of the snapshot");
+		free_map(int_map, 0);
+		return;
+	}
+
+	/* Our old ip has to be the root_node of the snapshot */
+	inet_setip_raw(&ip, hdr->ip, my_family);
+	iptoquadg(ip, ext_map, &quadg, QUADG_GID | QUADG_GNODE | QUADG_IPSTART);
+	if (root != &int_map[quadg.gid[0]]) {
+		error("The snapshot doesn't match our old ip");
+		free_extmap(ext_map, FAMILY_LVLS, 0);
+		free_map(int_map, 0);
+		return;
+	}
+
+	if ((pack = snapshot_sec(hdr, SNAP_SEC_BNODE_MAP, &sz)))
+		bnode_map = unpack_all_bmaps(pack, FAMILY_LVLS, ext_map,
+									 &bmap_nodes, MAXGROUPNODE,
+									 MAXBNODE_RNODEBLOCK);
+	if ((pack = snapshot_sec(hdr, SNAP_SEC_IGWS, &sz)) &&
+		unpack_igws(pack, sz, int_map, ext_map, FAMILY_LVLS, &igws,
+					&igws_counter) < 0)
+		igws = 0;
+
+	/*
+	 * Replace the maps
+	 */
+	free_map(me.int_map, 0);
+	me.int_map = int_map;
+	free_extmap(me.ext_map, FAMILY_LVLS, 0);
+	me.ext_map = ext_map;
+	if (bnode_map) {
+		bmap_levels_free(me.bnode_map, me.bmap_nodes);
+		me.bnode_map = bnode_map;
+		me.bmap_nodes = bmap_nodes;
+	}
+	if (igws) {
+		free_igws(me.igws, me.igws_counter, FAMILY_LVLS);
+		me.igws = igws;
+		me.igws_counter = igws_counter;
+	}
+
+	inet_copy(&me.cur_ip, &ip);
+	memcpy(&me.cur_quadg, &quadg, sizeof(quadro_group));
+
+	if (free_the_tmp_cur_node) {
+		xfree(me.cur_node);
+		free_the_tmp_cur_node = 0;
+	}
+	me.cur_node = root;
+	map_node_del(me.cur_node);
+	me.cur_node->flags &= ~MAP_VOID;
+	me.cur_node->flags |= MAP_ME;
+	for (level = 1; level < me.cur_quadg.levels; level++) {
+		me.cur_quadg.gnode[_EL(level)]->g.flags &= ~MAP_VOID;
+		me.cur_quadg.gnode[_EL(level)]->g.flags |= MAP_ME | MAP_GNODE;
+	}
+
+	/*
+	 * The qspn state
+	 */
+	for (level = 0; level < me.cur_quadg.levels && level < MAX_LEVELS;
+		 level++)
+		me.cur_qspn_id[level] = hdr->qspn_id[level];
+	qspn_time_reset(0, me.cur_quadg.levels, me.cur_quadg.levels);
+	memcpy(qspn_gnode_count, hdr->gcount, sizeof(qspn_gnode_count));
+
+	snapshot_warm_rnodes(hdr);
+
+	/*
+	 * The andna caches
+	 */
+	if (!server_opt.disable_andna) {
+		pthread_mutex_lock(&andna_cache_mutex);
+		if ((pack = snapshot_sec(hdr, SNAP_SEC_ANDNA_CACHE, &sz)) &&
+			(cache = unpack_andna_cache(pack, sz, &counter,
+										ACACHE_PACK_FILE))) {
+			andna_cache_destroy();
+			andna_c = cache;
+			andna_c_counter = counter;
+		}
+		if ((pack = snapshot_sec(hdr, SNAP_SEC_COUNTER_C, &sz)) &&
+			(cache = unpack_counter_cache(pack, sz, &counter))) {
+			counter_c_destroy();
+			andna_counter_c = cache;
+			cc_counter = counter;
+		}
+		if ((pack = snapshot_sec(hdr, SNAP_SEC_RH_CACHE, &sz)) &&
+			(cache = unpack_rh_cache(pack, sz, &counter))) {
+			rh_cache_flush();
+			andna_rhc = cache;
+			rhc_counter = counter;
+		}
+		pthread_mutex_unlock(&andna_cache_mutex);
+	}
+
+	map_gen_bump(0);
+	snap_warm_err = 0;
+}
+
+/*
+ * snapshot_warm_undo
+ *
+ * It is called by the map owner when the snapshot hasn't been confirmed:
+ * the routes written from it are deleted, together with the default route,
+ * the tunnels and the rules of the igws in restricted mode.
+ */
+void
+snapshot_warm_undo(void)
+{
+	rt_sync_reset();
+	rt_full_delete();
+
+	if (restricted_mode && (server_opt.use_shared_inet ||
+							server_opt.share_internet)) {
+		rt_delete_def_gw(0);
+		del_all_tunnel_ifs(0, 0, 0, NTK_TUNL_PREFIX);
+		reset_igw_nexthop(multigw_nh);
+		reset_igws(me.igws, me.igws_counter, me.cur_quadg.levels);
+		reset_igw_rules();
+		free_my_igws(&me.my_igws);
+	}
+}
+
+/*
+ * snapshot_warm_known
+ *
+ * returns 1 if `ip' is one of the rnodes saved in the snapshot `hdr'.
+ */
+int
+snapshot_warm_known(struct snapshot_hdr *hdr, inet_prefix * ip)
+{
+	struct snapshot_rnode *r;
+	size_t sz;
+	int i, n;
+
+	r = (struct snapshot_rnode *) snapshot_sec(hdr, SNAP_SEC_RNODES, &sz);
+	n = sz / sizeof(struct snapshot_rnode);
+	for (i = 0; i < n; i++, r++)
+		if (!memcmp(r->ip, ip->data, MAX_IP_SZ))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * snapshot_warm_confirm
+ *
+ * counts the rnodes found by the last radar scan, which aren't hooking, in
+ * `*found'. It returns how many of them are known by the snapshot.
+ */
+int
+snapshot_warm_confirm(int *found)
+{
+	struct radar_queue *rq = radar_q;
+	int known = 0;
+
+	*found = 0;
+	list_for(rq) {
+		if (!rq->node || rq->flags & MAP_HNODE)
+			continue;
+
+		(*found)++;
+		if (snapshot_warm_known(snap_warm, &rq->ip))
+			known++;
+	}
+
+	return known;
+}
+
+/*
+ * snapshot_warm_hook
+ *
+ * It is used in place of the first netsukuku_hook() when a valid snapshot
+ * has been opened: the state of the snapshot is restored and the routes are
+ * written, then the rnodes have to confirm it.
+ * If there's no snapshot, or it cannot be restored or confirmed, -1 is
+ * returned and we have to hook as usual.
+ */
+int
+snapshot_warm_hook(void)
+{
+	struct timeval start, t, diff;
+	inet_prefix ip;
+	size_t sz;
+	int i, found, known, level;
+
+	if (!snap_warm)
+		return -1;
+
+	loginfo("Warm restart from %s", server_opt.snapshot_file);
+	gettimeofday(&start, 0);
+
+	map_owner_call(snapshot_warm_apply);
+	if (snap_warm_err < 0) {
+		snap_warm_state = SNAP_WARM_INVALID;
+		goto cold;
+	}
+
+	/* Set our old ip only where it isn't already set */
+	for (i = 0; i < me.cur_ifs_n; i++)
+		if (get_dev_ip(&ip, my_family, me.cur_ifs[i].dev_name) < 0 ||
+			memcmp(ip.data, me.cur_ip.data, MAX_IP_SZ))
+			break;
+	if (i < me.cur_ifs_n)
+		hook_set_all_ips(me.cur_ip, me.cur_ifs, me.cur_ifs_n);
+
+	if (server_opt.share_internet) {
+		free_my_igws(&me.my_igws);
+		init_my_igws(me.igws, me.igws_counter, &me.my_igws,
+					 me.my_bandwidth, me.cur_node, &me.cur_quadg);
+	}
+
+	/* All the routes, at once */
+	rt_full_update(0);
+	if (restricted_mode && (server_opt.use_shared_inet ||
+							server_opt.share_internet))
+		igw_replace_def_igws(me.igws, me.igws_counter, me.my_igws,
+							 me.cur_quadg.levels, my_family);
+	map_owner_sync();
+
+	gettimeofday(&t, 0);
+	timersub(&t, &start, &diff);
+	snap_warm_ms = MILLISEC(diff);
+	loginfo("Warm restart: the routes were restored in %u ms", snap_warm_ms);
+
+	/*
+	 * Now the rnodes have to confirm that the network is still the one
+	 * of the snapshot
+	 */
+	snapshot_sec(snap_warm, SNAP_SEC_RNODES, &sz);
+	snap_warm_rnodes = sz / sizeof(struct snapshot_rnode);
+	if (radar_scan(0)) {
+		error("Warm restart: the radar scan failed");
+		snap_warm_state = SNAP_WARM_UNCONFIRMED;
+		goto cold;
+	}
+	known = snapshot_warm_confirm(&found);
+	snap_warm_found = found;
+	snap_warm_known = known;
+
+	gettimeofday(&t, 0);
+	timersub(&t, &start, &diff);
+	snap_confirm_ms = MILLISEC(diff);
+
+	if (snap_warm_rnodes ? !known || known * 2 < found : found) {
+		loginfo("Warm restart: only %d of the %d rnodes around us are "
+				"known, hooking", known, found);
+		snap_warm_state = SNAP_WARM_UNCONFIRMED;
+		goto cold;
+	}
+
+	/* We are back */
+	op_filter_reset(OP_FILTER_ALLOW);
+	tracer_pkt_start_mutex = 0;
+	tracer_pkt_start(0);
+	total_hooks++;
+	snap_warm_state = SNAP_WARM_DONE;
+	loginfo("Warm restart confirmed by %d rnodes in %u ms", known,
+			snap_confirm_ms);
+
+	snapshot_close();
+	return 0;
+
+  cold:
+	if (snap_warm_state == SNAP_WARM_UNCONFIRMED)
+		/* The routes of the snapshot have already been written */
+		map_owner_call(snapshot_warm_undo);
+	snapshot_close();
+	reset_radar();
+	rnl_reset(&rlist, &rlist_counter);
+	e_rnode_free(&me.cur_erc, &me.cur_erc_counter);
+	me.cur_erc = e_rnode_init(&me.cur_erc_counter);
+	for (level = 0; level < me.cur_quadg.levels; level++)
+		list_destroy(qspn_b[level]);
+	qspn_reset(me.cur_quadg.levels);
+	hook_reset();
+	return -1;
+}
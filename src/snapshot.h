@@ -0,0 +1,149 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "gmap.h"
+#include "qspn.h"
+
+/*
+ * The state snapshot lets a restarted ntkd take back its place in the
+ * network without hooking again.
+ *
+ * When the warm restart is enabled (-w or `ntk_warm_restart'), the
+ * snapshot_job_save() writes every SNAPSHOT_INTERVAL seconds, and
+ * destroy_netsukuku() at the exit, the `ntk_snapshot_file'. It is a single
+ * file made of a snapshot_hdr followed by SNAP_SECTIONS sections, each
+ * aligned to SNAPSHOT_ALIGN bytes:
+ *  - the int, ext and bnode maps, copied from the map_snapshot published
+ *    by the map owner, which has already packed them;
+ *  - our igws, the rnodes with the interfaces they are reached from, and
+ *    the andna, counter and resolved hostnames caches.
+ * The file is written in a temporary file and renamed, so it is never seen
+ * half written. The header is in host order: the snapshot is read only by
+ * the ntkd of the same host.
+ *
+ * At the start snapshot_open() mmaps the file and checks its checksum, its
+ * age and that it was written with our same family and restricted mode.
+ * snapshot_warm_hook() then replaces the hook: it unpacks the sections in
+ * place, takes back our old ip, restores the rnodes and writes all the
+ * routes at once. Only after that the rnodes are asked to confirm the
+ * snapshot with a radar scan: if less than half of the rnodes which reply
+ * are known by the snapshot, the network has changed too much: the routes
+ * written from the snapshot are deleted and ntkd hooks as usual.
+ */
+
+#define SNAPSHOT_MAGIC		0x4e544b53	/* "NTKS" */
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_INTERVAL	30	/* seconds */
+#define SNAPSHOT_MAX_AGE	600	/* An older snapshot is ignored */
+#define SNAPSHOT_ALIGN		8
+#define SNAPSHOT_ALIGN_SZ(sz)	(((sz) + SNAPSHOT_ALIGN - 1) &		\
+					 ~(size_t)(SNAPSHOT_ALIGN - 1))
+
+/* The sections of the snapshot */
+#define SNAP_SEC_INT_MAP	0
+#define SNAP_SEC_EXT_MAP	1
+#define SNAP_SEC_BNODE_MAP	2
+#define SNAP_SEC_IGWS		3
+#define SNAP_SEC_RNODES		4
+#define SNAP_SEC_ANDNA_CACHE	5
+#define SNAP_SEC_COUNTER_C	6
+#define SNAP_SEC_RH_CACHE	7
+#define SNAP_SECTIONS		8
+
+struct snapshot_sec {
+	u_int off;					/* from the start of the file */
+	u_int sz;					/* 0 if the section is empty */
+};
+
+struct snapshot_hdr {
+	u_int magic;
+	u_int version;
+	u_int size;					/* of the whole file */
+	u_int csum;					/* fnv of the file, with csum=0 */
+	time_t stamp;				/* when it was written */
+
+	int family;
+	int levels;
+	char restricted;
+	int restricted_class;
+
+	u_int ip[MAX_IP_INT];		/* me.cur_ip */
+	int qspn_id[MAX_LEVELS];
+	u_int gcount[GCOUNT_LEVELS];	/* qspn_gnode_count */
+
+	struct snapshot_sec sec[SNAP_SECTIONS];
+};
+
+/* An element of the SNAP_SEC_RNODES section */
+struct snapshot_rnode {
+	u_int ip[MAX_IP_INT];
+	u_int trtt;
+	u_int bw;
+	char dev[MAX_INTERFACES][IFNAMSIZ];
+	int dev_n;
+};
+
+/* snap_warm_state values */
+#define SNAP_WARM_OFF		0	/* no snapshot has been used */
+#define SNAP_WARM_DONE		1
+#define SNAP_WARM_UNCONFIRMED	2	/* the rnodes didn't confirm it */
+#define SNAP_WARM_INVALID	3	/* it couldn't be restored */
+
+struct snapshot_hdr *snap_warm;	/* The mmapped snapshot, until the warm
+								   restart is over */
+size_t snap_warm_sz;
+int snap_warm_err;
+pthread_mutex_t snap_mutex;
+struct timer_job snapshot_job;
+
+u_int snap_written;				/* Stupid statistics */
+u_int snap_last_sz;
+u_int snap_last_us;
+int snap_warm_state;
+u_int snap_warm_ms;				/* time-to-routes of the warm restart */
+u_int snap_confirm_ms;
+int snap_warm_rnodes;
+int snap_warm_found;
+int snap_warm_known;
+
+
+/* * * Functions declaration * * */
+void snapshot_init(void);
+void snapshot_collect(void);
+u_int snapshot_csum(char *buf, size_t sz);
+int snapshot_write(char *file, char *buf, size_t sz);
+int snapshot_save(void);
+u_int snapshot_job_save(void *null);
+
+char *snapshot_sec(struct snapshot_hdr *hdr, int sec, size_t * sz);
+int snapshot_verify(struct snapshot_hdr *hdr, size_t sz);
+int snapshot_open(char *file);
+void snapshot_close(void);
+
+void snapshot_warm_qspn_b(u_char level, map_node * rnode);
+void snapshot_warm_rnodes(struct snapshot_hdr *hdr);
+void snapshot_warm_apply(void);
+void snapshot_warm_undo(void);
+int snapshot_warm_known(struct snapshot_hdr *hdr, inet_prefix * ip);
+int snapshot_warm_confirm(int *found);
+int snapshot_warm_hook(void);
+
+#endif							/*SNAPSHOT_H */
@@ -36,6 +36,7 @@ void
 snsd_cache_init(int family)
 {
 	net_family = family;
+	pthread_mutex_init(&snsd_flat_mutex, 0);
 }
 
 /*
@@ -1159,6 +1160,698 @@ snsd_service_llist_merge(snsd_service ** dst, u_short * snsd_counter,
 
 
 
+/*\
+ *
+ *  *  *  *   Flat arena functions   *  *  *
+ *
+ * For an explanation of the snsd_flat arena, read snsd_cache.h
+\*/
+
+/*
+ * snsd_flat_alloc
+ *
+ * It allocates a zeroed arena which can keep `services' services, `prios'
+ * prios and `nodes' nodes.
+ */
+snsd_flat *
+snsd_flat_alloc(int services, int prios, int nodes)
+{
+	snsd_flat *f;
+	u_int prio_off, node_off, size;
+
+	prio_off = SNSD_FLAT_ALIGN(sizeof(snsd_flat) +
+							   sizeof(struct snsd_flat_service) * services);
+	node_off = SNSD_FLAT_ALIGN(prio_off +
+							   sizeof(struct snsd_flat_prio) * prios);
+	size = node_off + sizeof(struct snsd_flat_node) * nodes;
+
+	f = xzalloc(size);
+	f->size = size;
+	f->services = services;
+	f->prios = prios;
+	f->nodes = f->snsd_counter = nodes;
+	f->prio_off = prio_off;
+	f->node_off = node_off;
+
+	return f;
+}
+
+void
+snsd_flat_del(snsd_flat ** flat)
+{
+	if (*flat)
+		xfree(*flat);
+	*flat = 0;
+}
+
+snsd_flat *
+snsd_flat_dup(snsd_flat * f)
+{
+	snsd_flat *new;
+
+	if (!f)
+		return 0;
+
+	new = xmalloc(f->size);
+	memcpy(new, f, f->size);
+	return new;
+}
+
+/*
+ * snsd_flat_alias
+ *
+ * It builds the alias table of the `p' prio, whose nodes are `n'.
+ * A node is chosen by picking a random slot `i' and a random number `r' in
+ * [0, p->wsum): if `r' < n[i].accept the node is `i', otherwise it is
+ * n[i].alias. The probability of each node is proportional to its weight.
+ * (Vose's alias method, with integer thresholds).
+ *
+ * The nodes with a zero weight are never chosen, unless all the weights of
+ * the prio are zero: in that case the choice is uniform.
+ */
+void
+snsd_flat_alias(struct snsd_flat_prio *p, struct snsd_flat_node *n)
+{
+	int q[SNSD_MAX_RECORDS], small[SNSD_MAX_RECORDS],
+		large[SNSD_MAX_RECORDS];
+	int i, s, l, ns = 0, nl = 0, wsum = 0;
+
+	for (i = 0; i < p->nodes; i++)
+		wsum += n[i].weight;
+	p->wsum = wsum ? wsum : p->nodes;
+
+	/* q[i]/p->wsum is the probability of `i' multiplied by p->nodes */
+	for (i = 0; i < p->nodes; i++) {
+		q[i] = (wsum ? n[i].weight : 1) * p->nodes;
+		n[i].alias = i;
+		if (q[i] < p->wsum)
+			small[ns++] = i;
+		else
+			large[nl++] = i;
+	}
+
+	while (ns && nl) {
+		s = small[--ns];
+		l = large[--nl];
+
+		n[s].accept = q[s];
+		n[s].alias = l;
+
+		q[l] -= p->wsum - q[s];
+		if (q[l] < p->wsum)
+			small[ns++] = l;
+		else
+			large[nl++] = l;
+	}
+
+	/* The remaining slots are full */
+	while (nl)
+		n[large[--nl]].accept = p->wsum;
+	while (ns)
+		n[small[--ns]].accept = p->wsum;
+}
+
+/*
+ * snsd_flat_index
+ *
+ * It calculates the highest prio of each service and the alias tables of
+ * all the prios of `f'.
+ */
+void
+snsd_flat_index(snsd_flat * f)
+{
+	struct snsd_flat_service *s = SNSD_FLAT_SERVICES(f);
+	struct snsd_flat_prio *p = SNSD_FLAT_PRIOS(f);
+	struct snsd_flat_node *n = SNSD_FLAT_NODES(f);
+	int i, j;
+
+	for (i = 0; i < f->services; i++) {
+		s[i].best = s[i].prio;
+		for (j = s[i].prio; j < s[i].prio + s[i].prios; j++)
+			if (p[j].prio > p[s[i].best].prio)
+				s[i].best = j;
+	}
+
+	for (i = 0; i < f->prios; i++)
+		snsd_flat_alias(&p[i], n + p[i].node);
+}
+
+/*
+ * snsd_flat_build
+ *
+ * It builds the arena of the `sns' llist. If `service' isn't
+ * SNSD_ALL_SERVICE, only the services which have the same service and proto
+ * values of `service' and `proto' are included (see
+ * snsd_service_llist_copy()).
+ *
+ * If nothing has been included, 0 is returned.
+ */
+snsd_flat *
+snsd_flat_build(snsd_service * sns, int service, u_char proto)
+{
+	struct snsd_flat_service *fs;
+	struct snsd_flat_prio *fp;
+	struct snsd_flat_node *fn;
+	snsd_service *s;
+	snsd_prio *snp;
+	snsd_node *snd;
+	snsd_flat *f;
+	int services = 0, prios = 0, nodes = 0;
+
+	s = sns;
+	list_for(s) {
+		if (service != SNSD_ALL_SERVICE &&
+			!is_equal_to_serv_proto(s, (u_short) service, proto))
+			continue;
+		services++;
+		snp = s->prio;
+		list_for(snp) {
+			prios++;
+			nodes += snsd_count_nodes(snp->node);
+		}
+	}
+	if (!services)
+		return 0;
+
+	f = snsd_flat_alloc(services, prios, nodes);
+	fs = SNSD_FLAT_SERVICES(f);
+	fp = SNSD_FLAT_PRIOS(f);
+	fn = SNSD_FLAT_NODES(f);
+
+	list_for(sns) {
+		if (service != SNSD_ALL_SERVICE &&
+			!is_equal_to_serv_proto(sns, (u_short) service, proto))
+			continue;
+
+		fs->service = sns->service;
+		fs->proto = sns->proto;
+		fs->prio = fp - SNSD_FLAT_PRIOS(f);
+
+		snp = sns->prio;
+		list_for(snp) {
+			fp->prio = snp->prio;
+			fp->node = fn - SNSD_FLAT_NODES(f);
+
+			snd = snp->node;
+			list_for(snd) {
+				memcpy(fn->record, snd->record, MAX_IP_SZ);
+				fn->flags = snd->flags;
+				fn->weight = snd->weight;
+				fn++;
+			}
+
+			fp->nodes = (fn - SNSD_FLAT_NODES(f)) - fp->node;
+			fp++;
+			fs->prios++;
+		}
+		fs++;
+	}
+
+	snsd_flat_index(f);
+	return f;
+}
+
+/*
+ * snsd_flat_service_nodes
+ *
+ * It returns the number of nodes of the `s' service of `f'. The index of its
+ * first node is written in `*first'.
+ */
+int
+snsd_flat_service_nodes(snsd_flat * f, struct snsd_flat_service *s,
+						int *first)
+{
+	struct snsd_flat_prio *p = SNSD_FLAT_PRIOS(f);
+
+	*first = 0;
+	if (!s->prios)
+		return 0;
+
+	*first = p[s->prio].node;
+	return p[s->prio + s->prios - 1].node +
+		p[s->prio + s->prios - 1].nodes - *first;
+}
+
+/*
+ * snsd_flat_select
+ *
+ * It returns a new arena which contains only the services of `f' which have
+ * the same service and proto values of `service' and `proto'. If `service'
+ * is SNSD_ALL_SERVICE, the copy of the whole `f' is returned.
+ * The records are copied in blocks and the alias tables are reused as they
+ * are, since they are relative to their prio.
+ *
+ * If nothing has been selected, 0 is returned.
+ */
+snsd_flat *
+snsd_flat_select(snsd_flat * f, int service, u_char proto)
+{
+	struct snsd_flat_service *s, *ns;
+	struct snsd_flat_prio *np;
+	snsd_flat *new;
+	int i, j, n, first, services = 0, prios = 0, nodes = 0;
+
+	if (!f)
+		return 0;
+	if (service == SNSD_ALL_SERVICE)
+		return snsd_flat_dup(f);
+
+	s = SNSD_FLAT_SERVICES(f);
+	for (i = 0; i < f->services; i++)
+		if (s[i].service == (u_short) service &&
+			(s[i].proto == proto || s[i].service == SNSD_DEFAULT_SERVICE)) {
+			services++;
+			prios += s[i].prios;
+			nodes += snsd_flat_service_nodes(f, &s[i], &first);
+		}
+	if (!services)
+		return 0;
+
+	new = snsd_flat_alloc(services, prios, nodes);
+	ns = SNSD_FLAT_SERVICES(new);
+	np = SNSD_FLAT_PRIOS(new);
+
+	services = prios = nodes = 0;
+	for (i = 0; i < f->services; i++) {
+		if (s[i].service != (u_short) service ||
+			(s[i].proto != proto && s[i].service != SNSD_DEFAULT_SERVICE))
+			continue;
+
+		n = snsd_flat_service_nodes(f, &s[i], &first);
+
+		ns[services] = s[i];
+		ns[services].prio = prios;
+		ns[services].best = s[i].best - s[i].prio + prios;
+
+		memcpy(&np[prios], &SNSD_FLAT_PRIOS(f)[s[i].prio],
+			   sizeof(struct snsd_flat_prio) * s[i].prios);
+		for (j = prios; j < prios + s[i].prios; j++)
+			np[j].node = np[j].node - first + nodes;
+
+		memcpy(&SNSD_FLAT_NODES(new)[nodes], &SNSD_FLAT_NODES(f)[first],
+			   sizeof(struct snsd_flat_node) * n);
+
+		services++;
+		prios += s[i].prios;
+		nodes += n;
+	}
+
+	return new;
+}
+
+/*
+ * snsd_flat_cache
+ *
+ * It returns the arena of the `sns' llist, which is kept in `*cached'. If
+ * it hasn't been built yet, it is built now.
+ * snsd_flat_mutex must be locked.
+ */
+snsd_flat *
+snsd_flat_cache(snsd_flat ** cached, snsd_service * sns)
+{
+	if (!*cached)
+		*cached = snsd_flat_build(sns, SNSD_ALL_SERVICE, 0);
+	return *cached;
+}
+
+/*
+ * snsd_flat_cache_select
+ *
+ * It returns the snsd_flat_select() of the arena of `sns' cached in
+ * `*cached'. If the `service' hasn't been found, it falls back to
+ * SNSD_DEFAULT_SERVICE.
+ * The returned arena is a new copy, free it with snsd_flat_del().
+ *
+ * If nothing has been found 0 is returned.
+ */
+snsd_flat *
+snsd_flat_cache_select(snsd_flat ** cached, snsd_service * sns,
+					   int service, u_char proto)
+{
+	snsd_flat *f, *ret;
+
+	pthread_mutex_lock(&snsd_flat_mutex);
+
+	f = snsd_flat_cache(cached, sns);
+	ret = snsd_flat_select(f, service, proto);
+	if (!ret && service != SNSD_ALL_SERVICE &&
+		service != SNSD_DEFAULT_SERVICE)
+		ret = snsd_flat_select(f, SNSD_DEFAULT_SERVICE, 0);
+
+	pthread_mutex_unlock(&snsd_flat_mutex);
+
+	return ret;
+}
+
+/*
+ * snsd_flat_cache_del
+ *
+ * It invalidates the arena cached in `*cached'. It has to be called each
+ * time the llist of the arena is modified.
+ */
+void
+snsd_flat_cache_del(snsd_flat ** cached)
+{
+	pthread_mutex_lock(&snsd_flat_mutex);
+	snsd_flat_del(cached);
+	pthread_mutex_unlock(&snsd_flat_mutex);
+}
+
+/*
+ * snsd_flat_find_service
+ *
+ * It returns the index of the first service of `f' which matches `service'
+ * and `proto' (see snsd_find_service()), or -1 if there isn't any.
+ */
+int
+snsd_flat_find_service(snsd_flat * f, u_short service, u_char proto)
+{
+	struct snsd_flat_service *s;
+	int i;
+
+	if (!f)
+		return -1;
+
+	s = SNSD_FLAT_SERVICES(f);
+	for (i = 0; i < f->services; i++)
+		if (s[i].service == service &&
+			(s[i].proto == proto || service == SNSD_DEFAULT_SERVICE))
+			return i;
+	return -1;
+}
+
+/*
+ * snsd_flat_highest_prio
+ *
+ * It returns the prio of the `s' service which has the highest `prio'
+ * value, or 0 if `s' has no prios.
+ */
+struct snsd_flat_prio *
+snsd_flat_highest_prio(snsd_flat * f, struct snsd_flat_service *s)
+{
+	if (!s->prios)
+		return 0;
+	return &SNSD_FLAT_PRIOS(f)[s->best];
+}
+
+/*
+ * snsd_flat_choose_wrand
+ *
+ * The same of snsd_choose_wrand(), but in O(1): it returns one of the nodes
+ * of the `p' prio, chosen randomly using its alias table.
+ * If `p' has no nodes, 0 is returned.
+ */
+struct snsd_flat_node *
+snsd_flat_choose_wrand(snsd_flat * f, struct snsd_flat_prio *p)
+{
+	struct snsd_flat_node *n;
+	int i;
+
+	if (!p || !p->nodes)
+		return 0;
+
+	n = SNSD_FLAT_NODES(f) + p->node;
+	i = rand_range(0, p->nodes - 1);
+	if (rand_range(0, p->wsum - 1) >= n[i].accept)
+		i = n[i].alias;
+
+	return &n[i];
+}
+
+/*
+ * snsd_flat_find_mainip
+ *
+ * It returns the first node of `f' which has the SNSD_NODE_MAIN_IP flag set,
+ * or 0.
+ */
+struct snsd_flat_node *
+snsd_flat_find_mainip(snsd_flat * f)
+{
+	struct snsd_flat_node *n;
+	int i;
+
+	if (!f)
+		return 0;
+
+	n = SNSD_FLAT_NODES(f);
+	for (i = 0; i < f->nodes; i++)
+		if (n[i].flags & SNSD_NODE_MAIN_IP)
+			return &n[i];
+	return 0;
+}
+
+/*
+ * snsd_flat_pack_sz
+ *
+ * It returns the size of the pack of the `s' service of `f', which is the
+ * same of SNSD_SERVICE_SINGLE_PACK_SZ(). If `s' is -1, the size of the pack
+ * of all the services is returned, as SNSD_SERVICE_LLIST_PACK_SZ() does.
+ */
+int
+snsd_flat_pack_sz(snsd_flat * f, int s)
+{
+	struct snsd_flat_service *fs;
+	int first, sz;
+
+	if (!f)
+		return 0;
+
+	if (s < 0)
+		return sizeof(struct snsd_service_llist_hdr) +
+			f->services * (SNSD_SERVICE_PACK_SZ +
+						   sizeof(struct snsd_prio_llist_hdr)) +
+			f->prios * (SNSD_PRIO_PACK_SZ +
+						sizeof(struct snsd_node_llist_hdr)) +
+			f->nodes * SNSD_NODE_PACK_SZ;
+
+	fs = &SNSD_FLAT_SERVICES(f)[s];
+	sz = SNSD_SERVICE_PACK_SZ + sizeof(struct snsd_prio_llist_hdr);
+	sz += fs->prios * (SNSD_PRIO_PACK_SZ +
+					   sizeof(struct snsd_node_llist_hdr));
+	sz += snsd_flat_service_nodes(f, fs, &first) * SNSD_NODE_PACK_SZ;
+
+	return sz;
+}
+
+/*
+ * snsd_flat_pack_service
+ *
+ * It packs the `s' service of `f' in `pack', which has `free_sz' free
+ * bytes. The pack is the same of snsd_pack_service().
+ *
+ * On error -1 is returned, otherwise the size of the package is returned.
+ */
+int
+snsd_flat_pack_service(char *pack, size_t free_sz, snsd_flat * f, int s)
+{
+	struct snsd_flat_service *fs;
+	struct snsd_flat_prio *fp;
+	struct snsd_flat_node *fn;
+	char *buf = pack;
+	int i, j;
+
+	if (!f || s < 0 || s >= f->services ||
+		free_sz < snsd_flat_pack_sz(f, s))
+		return -1;
+
+	fs = &SNSD_FLAT_SERVICES(f)[s];
+	(*(u_short *) (buf)) = htons(fs->service);
+	buf += sizeof(short);
+	(*(u_char *) (buf)) = fs->proto;
+	buf += sizeof(u_char);
+
+	(*(u_short *) (buf)) = htons(fs->prios);
+	buf += sizeof(struct snsd_prio_llist_hdr);
+
+	fp = SNSD_FLAT_PRIOS(f) + fs->prio;
+	for (i = 0; i < fs->prios; i++, fp++) {
+		*buf = fp->prio;
+		buf += SNSD_PRIO_PACK_SZ;
+
+		(*(u_short *) (buf)) = htons(fp->nodes);
+		buf += sizeof(struct snsd_node_llist_hdr);
+
+		fn = SNSD_FLAT_NODES(f) + fp->node;
+		for (j = 0; j < fp->nodes; j++, fn++) {
+			memcpy(buf, fn->record, MAX_IP_SZ);
+			if (fn->flags & SNSD_NODE_IP)
+				inet_htonl((u_int *) buf, net_family);
+			buf += MAX_IP_SZ;
+
+			*buf++ = fn->flags;
+			*buf++ = fn->weight;
+		}
+	}
+
+	return buf - pack;
+}
+
+/*
+ * snsd_flat_pack_all_services
+ *
+ * It packs all the services of `f' in `pack', which is `pack_sz' big. The
+ * pack is the same of snsd_pack_all_services().
+ * Use snsd_flat_pack_sz(f, -1) to calculate the pack size.
+ *
+ * On error -1 is returned, otherwise the size of the package is returned.
+ */
+int
+snsd_flat_pack_all_services(char *pack, size_t pack_sz, snsd_flat * f)
+{
+	int i, sz, wsz;
+
+	if (!f || pack_sz < snsd_flat_pack_sz(f, -1))
+		return -1;
+
+	(*(u_short *) (pack)) = htons(f->services);
+	wsz = sizeof(struct snsd_service_llist_hdr);
+
+	for (i = 0; i < f->services; i++) {
+		if ((sz = snsd_flat_pack_service(pack + wsz, pack_sz - wsz,
+										 f, i)) < 0)
+			return -1;
+		wsz += sz;
+	}
+
+	return wsz;
+}
+
+/*
+ * snsd_flat_unpack_walk
+ *
+ * It walks through the snsd pack `pack', which is `pack_sz' big. If `all' is
+ * non zero the pack is a llist of services, as written by
+ * snsd_pack_all_services(), otherwise it is a single service.
+ * The number of services, prios and nodes found in the pack are written in
+ * `*services', `*prios' and `*nodes'.
+ *
+ * If `f' isn't null, the records are stored in it, which must have been
+ * allocated with the sizes found by a previous walk.
+ *
+ * The same limits of the snsd_unpack_* functions are checked.
+ * On error -1 is returned, otherwise the number of read bytes.
+ */
+int
+snsd_flat_unpack_walk(char *pack, size_t pack_sz, int all, snsd_flat * f,
+					  int *services, int *prios, int *nodes)
+{
+	struct snsd_flat_service *fs = 0;
+	struct snsd_flat_prio *fp = 0;
+	struct snsd_flat_node *fn;
+	char *buf = pack;
+	int s, p, n, scount, pcount, ncount, snodes;
+
+#define LEFT(_sz)	((size_t) (buf - pack) + (_sz) > pack_sz)
+
+	*services = *prios = *nodes = 0;
+
+	if (all) {
+		if (LEFT(sizeof(struct snsd_service_llist_hdr)))
+			return -1;
+		scount = ntohs((*(u_short *) buf));
+		buf += sizeof(struct snsd_service_llist_hdr);
+
+		if (scount <= 0 || scount > SNSD_MAX_RECORDS)
+			return -1;
+	} else
+		scount = 1;
+
+	for (s = 0; s < scount; s++) {
+		if (LEFT(SNSD_SERVICE_PACK_SZ + sizeof(struct snsd_prio_llist_hdr)))
+			return -1;
+
+		if (f) {
+			fs = &SNSD_FLAT_SERVICES(f)[*services];
+			fs->service = ntohs((*(u_short *) buf));
+			fs->proto = (*(u_char *) (buf + sizeof(u_short)));
+			fs->prio = *prios;
+		}
+		buf += SNSD_SERVICE_PACK_SZ;
+
+		pcount = ntohs((*(u_short *) buf));
+		buf += sizeof(struct snsd_prio_llist_hdr);
+		if (pcount <= 0 || pcount > SNSD_MAX_REC_SERV)
+			return -1;
+
+		for (p = 0, snodes = 0; p < pcount; p++) {
+			if (LEFT(SNSD_PRIO_PACK_SZ + sizeof(struct snsd_node_llist_hdr)))
+				return -1;
+
+			if (f) {
+				fp = &SNSD_FLAT_PRIOS(f)[*prios];
+				fp->prio = *buf;
+				fp->node = *nodes;
+			}
+			buf += SNSD_PRIO_PACK_SZ;
+
+			ncount = ntohs((*(u_short *) buf));
+			buf += sizeof(struct snsd_node_llist_hdr);
+
+			snodes += ncount;
+			if (ncount <= 0 || snodes > SNSD_MAX_REC_SERV ||
+				*nodes + ncount > SNSD_MAX_RECORDS ||
+				LEFT(ncount * SNSD_NODE_PACK_SZ))
+				return -1;
+
+			for (n = 0; n < ncount; n++, buf += SNSD_NODE_PACK_SZ) {
+				if (!f)
+					continue;
+
+				fn = &SNSD_FLAT_NODES(f)[*nodes + n];
+				memcpy(fn->record, buf, MAX_IP_SZ);
+				fn->flags = buf[MAX_IP_SZ];
+				fn->weight = SNSD_WEIGHT(buf[MAX_IP_SZ + 1]);
+				if (fn->flags & SNSD_NODE_IP)
+					inet_ntohl(fn->record, net_family);
+			}
+
+			if (f)
+				fp->nodes = ncount;
+			(*nodes) += ncount;
+			(*prios)++;
+		}
+
+		if (f)
+			fs->prios = pcount;
+		(*services)++;
+	}
+
+#undef LEFT
+
+	return buf - pack;
+}
+
+/*
+ * snsd_flat_unpack
+ *
+ * It unpacks the snsd pack `pack' directly in a new arena, without building
+ * the llists. `all' is the same of snsd_flat_unpack_walk().
+ * The number of unpacked nodes is written in `*nodes_counter'.
+ *
+ * On error 0 is returned.
+ */
+snsd_flat *
+snsd_flat_unpack(char *pack, size_t pack_sz, int all,
+				 u_short * nodes_counter)
+{
+	snsd_flat *f;
+	int services, prios, nodes;
+
+	if (snsd_flat_unpack_walk(pack, pack_sz, all, 0, &services, &prios,
+							  &nodes) < 0)
+		return 0;
+
+	f = snsd_flat_alloc(services, prios, nodes);
+	snsd_flat_unpack_walk(pack, pack_sz, all, f, &services, &prios,
+						  &nodes);
+	snsd_flat_index(f);
+
+	if (nodes_counter)
+		*nodes_counter = f->snsd_counter;
+	return f;
+}
+
+
 /*\
  *
  *  *  *  *   Dump functions   *  *  *
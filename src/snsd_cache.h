@@ -230,6 +230,85 @@ INT_INFO snsd_service_llist_hdr_iinfo = { 1, {INT_TYPE_16BIT}, {0}, {1} };
 )
 
 
+/*
+ * snsd_flat
+ *
+ * The flattened form of a snsd_service llist: the services, the prios and
+ * the nodes are stored in three arrays of a single contiguous arena, which
+ * begins with the snsd_flat header:
+ *
+ * 	| snsd_flat | services[] | prios[] | nodes[] |
+ *
+ * The services of the llist, their prios and their nodes keep the llist
+ * order. The prios of a service are contiguous in prios[] and the nodes of a
+ * prio in nodes[], so each of them refers to its children with the index of
+ * the first one and their number.
+ * All the references are indexes, thus an arena can be duplicated with a
+ * single memcpy().
+ *
+ * Each service keeps the index of its prio with the highest `prio' value and
+ * each prio keeps the alias table of the weights of its nodes, in this way
+ * snsd_flat_highest_prio() and snsd_flat_choose_wrand() are O(1).
+ *
+ * The llists remain the place where the records are registered, merged and
+ * deleted. The andna_cache_queue and the rh_cache keep the arena of their
+ * llist in `flat', which is built the first time it is needed and it is
+ * invalidated with snsd_flat_del() each time their `service' llist changes.
+ * The resolution functions return a copy of it, which costs one allocation
+ * instead of one for each service, prio and node.
+ *
+ * `snsd_node->pubkey' isn't kept in the arena.
+ */
+struct snsd_flat_node {
+	u_int record[MAX_IP_INT];
+	char flags;
+	u_char weight;
+
+	u_char alias;				/* alias table: if the node isn't
+								   accepted, its alias is chosen */
+	u_short accept;				/* acceptance threshold, in
+								   [0, snsd_flat_prio.wsum] */
+};
+
+struct snsd_flat_prio {
+	u_char prio;
+	u_short wsum;				/* sum of the weights of the nodes */
+
+	u_short node;				/* index of the first node in nodes[] */
+	u_short nodes;				/* # of nodes */
+};
+
+struct snsd_flat_service {
+	u_short service;
+	u_char proto;
+
+	u_short prio;				/* index of the first prio in prios[] */
+	u_short prios;				/* # of prios */
+	u_short best;				/* index of the highest prio */
+};
+
+typedef struct snsd_flat {
+	u_int size;					/* size of the whole arena */
+
+	u_short services;
+	u_short prios;
+	u_short nodes;
+	u_short snsd_counter;		/* # of nodes, as in the caches */
+
+	u_int prio_off;				/* offsets of prios[] and nodes[] */
+	u_int node_off;
+} snsd_flat;
+
+#define SNSD_FLAT_ALIGN(x)		(((x) + 3) & ~3)
+#define SNSD_FLAT_SERVICES(f)	((struct snsd_flat_service *)((f) + 1))
+#define SNSD_FLAT_PRIOS(f)						\
+	((struct snsd_flat_prio *)((char *)(f) + (f)->prio_off))
+#define SNSD_FLAT_NODES(f)						\
+	((struct snsd_flat_node *)((char *)(f) + (f)->node_off))
+
+pthread_mutex_t snsd_flat_mutex;	/* protects the `flat' of the caches */
+
+
 /*
  * This array is used to associate a 8bit number to a protocol name.
  * The number is the position of the protocol name in this array.
@@ -309,4 +388,33 @@ void snsd_service_llist_merge(snsd_service ** dst, u_short * snsd_counter,
 int snsd_count_nodes(snsd_node * head);
 int snsd_count_prio_nodes(snsd_prio * head);
 int snsd_count_service_nodes(snsd_service * head);
+
+snsd_flat *snsd_flat_alloc(int services, int prios, int nodes);
+void snsd_flat_del(snsd_flat ** flat);
+snsd_flat *snsd_flat_dup(snsd_flat * f);
+void snsd_flat_alias(struct snsd_flat_prio *p, struct snsd_flat_node *n);
+void snsd_flat_index(snsd_flat * f);
+snsd_flat *snsd_flat_build(snsd_service * sns, int service, u_char proto);
+snsd_flat *snsd_flat_select(snsd_flat * f, int service, u_char proto);
+snsd_flat *snsd_flat_cache(snsd_flat ** cached, snsd_service * sns);
+snsd_flat *snsd_flat_cache_select(snsd_flat ** cached, snsd_service * sns,
+								  int service, u_char proto);
+void snsd_flat_cache_del(snsd_flat ** cached);
+int snsd_flat_service_nodes(snsd_flat * f, struct snsd_flat_service *s,
+							int *first);
+int snsd_flat_find_service(snsd_flat * f, u_short service, u_char proto);
+struct snsd_flat_prio *snsd_flat_highest_prio(snsd_flat * f,
+											  struct snsd_flat_service
+											  *s);
+struct snsd_flat_node *snsd_flat_choose_wrand(snsd_flat * f,
+											  struct snsd_flat_prio *p);
+struct snsd_flat_node *snsd_flat_find_mainip(snsd_flat * f);
+int snsd_flat_pack_sz(snsd_flat * f, int s);
+int snsd_flat_pack_service(char *pack, size_t free_sz, snsd_flat * f, int s);
+int snsd_flat_pack_all_services(char *pack, size_t pack_sz, snsd_flat * f);
+int snsd_flat_unpack_walk(char *pack, size_t pack_sz, int all,
+						  snsd_flat * f, int *services, int *prios,
+						  int *nodes);
+snsd_flat *snsd_flat_unpack(char *pack, size_t pack_sz, int all,
+							u_short * nodes_counter);
 #endif							/*SNSD_H */
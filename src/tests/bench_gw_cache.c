@@ -0,0 +1,101 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * bench_gw_cache
+ *
+ * Measures how long it takes to rebuild the gateways of all the gnodes of
+ * the level 1 with get_gw_gnode(): the synthetic ext_map has MAXGROUPNODE-1
+ * gnodes, SYNTH_GRNODES of them are rnodes and SYNTH_BNODES bnodes lead to
+ * them. In the "invalidated" rounds the maps change before each rebuild, so
+ * every gateway is searched again as it was before the gateway cache; in
+ * the "warm" rounds nothing changes and they are all taken from the cache.
+ *
+ * Usage: bench_gw_cache [rounds]
+ */
+
+#include "includes.h"
+
+#include "inet.h"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "route.h"
+#include "netsukuku.h"
+#include "tests/synth.h"
+#include "common.h"
+
+/*
+ * rebuild
+ *
+ * searches the gateways of all the gnodes of the level 1 and returns the
+ * number of the gnodes which have one.
+ */
+int
+rebuild(void)
+{
+	void **gw;
+	int i, found = 0;
+
+	for (i = 1; i < MAXGROUPNODE; i++) {
+		gw = get_gw_gnode(me.int_map, me.ext_map, me.bnode_map,
+						  me.bmap_nodes, me.cur_erc, &me.ext_map[_EL(1)][i],
+						  1, 0, 0);
+		if (gw) {
+			found++;
+			xfree(gw);
+		}
+	}
+
+	return found;
+}
+
+int
+main(int argc, char **argv)
+{
+	double t0, t_inval, t_warm;
+	int rounds, r, found, warm_found;
+
+	rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+	synth_init("bench_gw_cache");
+	synth_maps(1);
+
+	t0 = synth_now();
+	for (r = 0, found = 0; r < rounds; r++) {
+		map_gen_bump(0);
+		found += rebuild();
+	}
+	t_inval = (synth_now() - t0) * 1e6 / rounds;
+
+	gw_cache_hits = gw_cache_misses = 0;
+	t0 = synth_now();
+	for (r = 0, warm_found = 0; r < rounds; r++)
+		warm_found += rebuild();
+	t_warm = (synth_now() - t0) * 1e6 / rounds;
+
+	if (warm_found != found)
+		fatal("The cache found %d gateways, %d expected", warm_found, found);
+
+	printf("%d rebuilds of %d gnodes, %d with a gateway\n", rounds,
+		   MAXGROUPNODE - 1, found / rounds);
+	printf("invalidated %.1f us/rebuild, warm %.1f us/rebuild "
+		   "(hits %u, misses %u)\n", t_inval, t_warm, gw_cache_hits,
+		   gw_cache_misses);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * bench_hash_gnode
+ *
+ * Measures how long find_hash_gnode() takes to resolve a hash to its
+ * hash_gnode, on the dense synthetic maps, where all the gnodes are alive,
+ * and on the sparse ones, where only one gnode every SPARSE_EVERY is.
+ * The hashes are resolved twice: a few of them, always found in the
+ * hgnode_memo, and then always new ones, which are all searched in the maps.
+ *
+ * Usage: bench_hash_gnode [resolves]
+ */
+
+#include "includes.h"
+
+#include "inet.h"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "route.h"
+#include "request.h"
+#include "pkts.h"
+#include "andna.h"
+#include "netsukuku.h"
+#include "tests/synth.h"
+#include "common.h"
+
+#define SPARSE_EVERY	8
+#define MEMO_HASHES	16		/* They all fit in the hgnode_memo */
+
+static int density[] = { 1, SPARSE_EVERY };
+
+/*
+ * resolve
+ *
+ * resolves `n' hashes, taken among `hashes' different ones, and returns the
+ * us taken by each one.
+ */
+double
+resolve(int n, int hashes)
+{
+	u_int hash[MAX_IP_INT];
+	inet_prefix to;
+	double t0;
+	int i;
+
+	t0 = synth_now();
+	for (i = 0; i < n; i++) {
+		setzero(hash, sizeof(hash));
+		hash[0] = (u_int) (i % hashes) * 2654435761U;
+		if (find_hash_gnode(hash, &to, 0, 0, 1) < 0)
+			fatal("The hash_gnode of %x hasn't been found", hash[0]);
+	}
+
+	return (synth_now() - t0) * 1e6 / n;
+}
+
+int
+main(int argc, char **argv)
+{
+	int n, i;
+	double t_hit, t_miss;
+
+	n = argc > 1 ? atoi(argv[1]) : 200000;
+
+	synth_init("bench_hash_gnode");
+	for (i = 0; i < sizeof(density) / sizeof(int); i++) {
+		synth_maps(density[i]);
+		setzero(hgnode_memo, sizeof(hgnode_memo));
+
+		t_hit = resolve(n, MEMO_HASHES);
+		t_miss = resolve(n, n);
+		printf("%s maps: %.3f us/resolve with a memo hit, %.3f us with a "
+			   "miss\n", i ? "sparse" : "dense ", t_hit, t_miss);
+	}
+
+	return 0;
+}
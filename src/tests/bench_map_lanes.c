@@ -0,0 +1,158 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * bench_map_lanes
+ *
+ * Measures the throughput of the map owner executing the tracer pkts, one
+ * after the other and in the lanes of their levels. BENCH_PKTS synthetic
+ * pkts are posted with map_owner_post(), spread over one, two and four
+ * levels. Each one does about `work' iterations (2 us by default) on the
+ * state of its level and posts a map_msg, as the tracer does for the
+ * qspn_gnode_count.
+ * The lanes are used only with more than one cpu: here they are forced on,
+ * so on a single cpu only their overhead is measured.
+ *
+ * Usage: bench_map_lanes [work]
+ */
+
+#include "includes.h"
+
+#include "llist.c"
+#include "inet.h"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "request.h"
+#include "pkts.h"
+#include "mapowner.h"
+#include "netsukuku.h"
+#include "tests/synth.h"
+#include "common.h"
+
+#define BENCH_PKTS	40000
+
+static int levels[] = { 1, 2, 4 };
+
+int work = 2000;
+volatile u_int level_state[MAX_LEVELS][256];
+u_int applied;
+
+void
+bench_apply(struct map_msg *msg)
+{
+	applied++;
+}
+
+int
+bench_exec(PACKET pkt)
+{
+	brdcast_hdr *bcast_hdr;
+	int level, i;
+
+	bcast_hdr = BRDCAST_HDR_PTR(pkt.msg);
+	level = bcast_hdr->level ? bcast_hdr->level - 1 : 0;
+	for (i = 0; i < work; i++)
+		level_state[level][i & 255] += i ^ pkt.hdr.id;
+
+	map_msg_post(bench_apply, level, 0, 1, 0, 0, 0);
+	return 0;
+}
+
+void
+bench_nop(void)
+{
+}
+
+/*
+ * bench_run
+ *
+ * posts the BENCH_PKTS pkts over `nlevels' levels, waits until they and
+ * their messages have been executed and prints the pkts/s and the
+ * statistics of the lanes.
+ */
+void
+bench_run(int nlevels)
+{
+	PACKET pkt;
+	brdcast_hdr bcast_hdr;
+	double t0, t;
+	int i;
+
+	for (i = 0; i < MAP_LANES; i++) {
+		map_lanes[i].pkts = map_lanes[i].phases = 0;
+		map_lanes[i].msgs_posted = 0;
+		map_lanes[i].usecs = 0;
+	}
+	applied = map_phases = 0;
+
+	t0 = synth_now();
+	for (i = 0; i < BENCH_PKTS; i++) {
+		setzero(&pkt, sizeof(PACKET));
+		setzero(&bcast_hdr, sizeof(brdcast_hdr));
+		bcast_hdr.level = i % nlevels + 1;
+		pkt.hdr.op = TRACER_PKT;
+		pkt.hdr.id = i;
+		pkt.hdr.sz = sizeof(brdcast_hdr);
+		pkt.msg = (char *) &bcast_hdr;
+		map_owner_post(bench_exec, pkt);
+	}
+	/* The call is executed after all the pkts and their messages */
+	map_owner_call(bench_nop);
+	t = synth_now() - t0;
+
+	if (applied != BENCH_PKTS)
+		fatal("%u messages applied, %d expected", applied, BENCH_PKTS);
+
+	printf("%d levels, lanes %s: %.0f pkts/s, %u phases\n", nlevels,
+		   map_lanes_cpus > 1 ? "on " : "off", BENCH_PKTS / t, map_phases);
+	for (i = 0; map_lanes_cpus > 1 && i < nlevels; i++)
+		printf("  level %d: %u pkts, %u phases, %u msgs, %.2f us/pkt\n", i,
+			   map_lanes[i].pkts, map_lanes[i].phases,
+			   map_lanes[i].msgs_posted, map_lanes[i].pkts ?
+			   (double) map_lanes[i].usecs / map_lanes[i].pkts : 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t thread;
+	int i, cpus;
+
+	if (argc > 1)
+		work = atoi(argv[1]);
+
+	synth_init("bench_map_lanes");
+	synth_maps(1);
+
+	map_owner_init();
+	cpus = map_lanes_cpus;
+	pthread_create(&thread, 0, map_owner_daemon, 0);
+	while (!map_owner_running)
+		usleep(1000);
+
+	printf("%d pkts, work %d, %d cpus\n", BENCH_PKTS, work, cpus);
+	for (i = 0; i < sizeof(levels) / sizeof(int); i++) {
+		map_lanes_cpus = 1;
+		bench_run(levels[i]);
+		map_lanes_cpus = cpus > 1 ? cpus : 2;
+		bench_run(levels[i]);
+	}
+
+	return 0;
+}
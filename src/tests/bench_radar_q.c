@@ -0,0 +1,195 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * bench_radar_q
+ *
+ * Simulates the bursts of ECHO_REPLY received during a radar scan from many
+ * neighbours, and measures how long radar_exec_reply() takes to find the
+ * radar_queue entry of each reply, together with the cost of the lookups by
+ * node in the radar_queue and in the rnode_list. The same lookups done by
+ * walking the lists, as it was before their hash indexes, are measured for
+ * comparison.
+ *
+ * Usage: bench_radar_q [bursts]
+ */
+
+#include "includes.h"
+
+#include "llist.c"
+#include "inet.h"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "request.h"
+#include "pkts.h"
+#include "radar.h"
+#include "netsukuku.h"
+#include "tests/synth.h"
+#include "common.h"
+
+static int neighbours[] = { 16, 64, 250 };
+
+struct radar_queue *
+linear_ip_radar_q(inet_prefix * ip)
+{
+	struct radar_queue *rq = radar_q;
+
+	list_for(rq)
+		if (!memcmp(rq->ip.data, ip->data, MAX_IP_SZ))
+		return rq;
+	return 0;
+}
+
+struct radar_queue *
+linear_node_radar_q(map_node * node)
+{
+	struct radar_queue *rq = radar_q;
+
+	list_for(rq)
+		if (rq->node == node)
+		return rq;
+	return 0;
+}
+
+struct rnode_list *
+linear_rnl_find_node(map_node * node)
+{
+	struct rnode_list *rnl = rlist;
+
+	list_for(rnl)
+		if (rnl->node == node)
+		return rnl;
+	return 0;
+}
+
+/*
+ * burst
+ *
+ * receives `bursts' times a full scan of replies from `n' neighbours and
+ * returns the average usecs spent for each reply.
+ */
+double
+burst(int n, int bursts)
+{
+	PACKET pkt;
+	double t0, t = 0;
+	int b, s, k;
+
+	for (b = 0; b < bursts; b++) {
+		reset_radar();
+		radar_scans[0] = MAX_RADAR_SCANS;
+
+		t0 = synth_now();
+		for (s = 0; s < MAX_RADAR_SCANS; s++)
+			for (k = 0; k < n; k++) {
+				setzero(&pkt, sizeof(PACKET));
+				postoip(k + 1, me.cur_quadg.ipstart[1], &pkt.from);
+				pkt.dev = &me.cur_ifs[0];
+				gettimeofday(&pkt.stamp, 0);
+				radar_exec_reply(pkt);
+			}
+		t += synth_now() - t0;
+	}
+
+	return t * 1e6 / ((double) bursts * MAX_RADAR_SCANS * n);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct radar_queue *rq, **rqs;
+	inet_prefix ip;
+	double t0, t_idx, t_lin;
+	int bursts, i, k, n, found;
+
+	bursts = argc > 1 ? atoi(argv[1]) : 200;
+
+	synth_init("bench_radar_q");
+	synth_maps(1);
+	me.cur_ifs_n = 1;
+	strcpy(me.cur_ifs[0].dev_name, "eth0");
+	me.cur_ifs[0].dev_idx = 1;
+	first_init_radar();
+
+	/* During the scans of the hook the replies are found by ip */
+	me.cur_node->flags |= MAP_HNODE;
+
+	printf("%d bursts of %d replies from each neighbour\n", bursts,
+		   MAX_RADAR_SCANS);
+	for (i = 0; i < sizeof(neighbours) / sizeof(int); i++) {
+		n = neighbours[i];
+
+		t_idx = burst(n, bursts);
+		if (radar_q_counter != n)
+			fatal("%d neighbours in the radar_queue, %d expected",
+				  radar_q_counter, n);
+
+		/* The same lookups, walking the radar_queue */
+		t0 = synth_now();
+		for (k = 0, found = 0; k < bursts * MAX_RADAR_SCANS * n; k++) {
+			postoip(k % n + 1, me.cur_quadg.ipstart[1], &ip);
+			found += !!linear_ip_radar_q(&ip);
+		}
+		t_lin = (synth_now() - t0) * 1e6 / (bursts * MAX_RADAR_SCANS * n);
+		printf("%3d neighbours: radar_exec_reply %.3f us/reply, "
+			   "linear ip lookup alone %.3f us\n", n, t_idx, t_lin);
+
+		/* The lookups by node, used by radar_update_map() */
+		rqs = xmalloc(sizeof(struct radar_queue *) * n);
+		rq = radar_q;
+		k = 0;
+		list_for(rq)
+			rqs[k++] = rq;
+
+		t0 = synth_now();
+		for (k = 0, found = 0; k < bursts * n; k++)
+			found += find_node_radar_q(rqs[k % n]->node) == rqs[k % n];
+		t_idx = (synth_now() - t0) * 1e6 / (bursts * n);
+		t0 = synth_now();
+		for (k = 0; k < bursts * n; k++)
+			found += linear_node_radar_q(rqs[k % n]->node) == rqs[k % n];
+		t_lin = (synth_now() - t0) * 1e6 / (bursts * n);
+		if (found != 2 * bursts * n)
+			fatal("find_node_radar_q() lost some nodes");
+		printf("%3d neighbours: find_node_radar_q %.3f us, linear %.3f "
+			   "us\n", n, t_idx, t_lin);
+		xfree(rqs);
+
+		/* The rnode_list */
+		rnl_reset(&rlist, &rlist_counter);
+		for (k = 0; k < n; k++)
+			rnl_add(&rlist, &rlist_counter, &me.int_map[k + 1],
+					&me.cur_ifs[0]);
+
+		t0 = synth_now();
+		for (k = 0, found = 0; k < bursts * n; k++)
+			found += !!rnl_find_node(rlist, &me.int_map[k % n + 1]);
+		t_idx = (synth_now() - t0) * 1e6 / (bursts * n);
+		t0 = synth_now();
+		for (k = 0; k < bursts * n; k++)
+			found += !!linear_rnl_find_node(&me.int_map[k % n + 1]);
+		t_lin = (synth_now() - t0) * 1e6 / (bursts * n);
+		if (found != 2 * bursts * n)
+			fatal("rnl_find_node() lost some rnodes");
+		printf("%3d neighbours: rnl_find_node %.3f us, linear %.3f us\n",
+			   n, t_idx, t_lin);
+	}
+
+	return 0;
+}
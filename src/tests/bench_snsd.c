@@ -0,0 +1,227 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * bench_snsd
+ *
+ * Measures the cost of resolving the SNSD records of a hostname, which has
+ * SNSD_SERVICES services with SNSD_PRIOS prios of SNSD_NODES nodes each:
+ *  - the resolve of the local cache: the records are copied, then the
+ *    highest prio and a node of it are chosen with a weighted random and the
+ *    copy is freed. It is done with the snsd_service llists, as it was
+ *    before the snsd_flat arenas, and with the arenas;
+ *  - the reply of a remote resolve, which is unpacked and copied in the
+ *    rh_cache.
+ * For each one, the time and the number of malloc() and calloc() are
+ * printed. They are counted by wrapping them, so bench_snsd is linked with
+ * -Wl,--wrap=malloc,--wrap=calloc.
+ *
+ * Usage: bench_snsd [resolves]
+ */
+
+#include "includes.h"
+
+#include "inet.h"
+#include "map.h"
+#include "snsd_cache.h"
+#include "tests/synth.h"
+#include "common.h"
+
+#define SNSD_SERVICES	3
+#define SNSD_PRIOS	3
+#define SNSD_NODES	4
+
+long allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+/*
+ * snsd_records
+ *
+ * returns the llist of the records of the benchmarked hostname. The first
+ * node is its main ip.
+ */
+snsd_service *
+snsd_records(void)
+{
+	snsd_service *head = 0, *sns;
+	snsd_prio *snp;
+	snsd_node *snd;
+	u_int record[MAX_IP_INT];
+	u_short counter = 0;
+	int s, p, n;
+
+	for (s = 0; s < SNSD_SERVICES; s++) {
+		sns = snsd_add_service(&head, s ? 80 + s : 0, 1);
+		for (p = 0; p < SNSD_PRIOS; p++) {
+			snp = snsd_add_prio(&sns->prio, 10 + p);
+			for (n = 0; n < SNSD_NODES; n++) {
+				setzero(record, sizeof(record));
+				record[0] = s << 16 | p << 8 | n;
+				snd = snsd_add_node(&snp->node, &counter, SNSD_MAX_RECORDS,
+									record);
+				snd->flags = SNSD_NODE_IP;
+				if (!s && !p && !n)
+					snd->flags |= SNSD_NODE_MAIN_IP;
+				snd->weight = n;
+			}
+		}
+	}
+
+	return head;
+}
+
+void
+bench_print(char *what, double t0, long allocs0, int n)
+{
+	printf("%-40s %.3f us, %.1f allocs\n", what,
+		   (synth_now() - t0) * 1e6 / n, (double) (allocs - allocs0) / n);
+}
+
+/*
+ * bench_resolve
+ *
+ * resolves `n' times the records of `service', or of all the services if it
+ * is -1.
+ */
+void
+bench_resolve(snsd_service * head, int service, int n)
+{
+	snsd_service *copy;
+	snsd_prio *snp;
+	snsd_flat *cache = 0, *flat;
+	struct snsd_flat_prio *prio;
+	volatile u_int sink = 0;
+	long allocs0;
+	double t0;
+	int i;
+
+	allocs0 = allocs;
+	t0 = synth_now();
+	for (i = 0; i < n; i++) {
+		copy = snsd_service_llist_copy(head, service, 1);
+		snp = snsd_highest_prio(copy->prio);
+		sink += snsd_choose_wrand(snp->node)->record[0];
+		snsd_service_llist_del(&copy);
+	}
+	bench_print(service < 0 ? "all services, llist:" : "service 0, llist:",
+				t0, allocs0, n);
+
+	allocs0 = allocs;
+	t0 = synth_now();
+	for (i = 0; i < n; i++) {
+		flat = snsd_flat_cache_select(&cache, head, service, 1);
+		prio = snsd_flat_highest_prio(flat, SNSD_FLAT_SERVICES(flat));
+		sink += snsd_flat_choose_wrand(flat, prio)->record[0];
+		snsd_flat_del(&flat);
+	}
+	bench_print(service < 0 ? "all services, snsd_flat:" :
+				"service 0, snsd_flat:", t0, allocs0, n);
+	snsd_flat_cache_del(&cache);
+}
+
+/*
+ * bench_reply
+ *
+ * unpacks `n' times the reply of a remote resolve and copies it as the
+ * rh_cache does.
+ */
+void
+bench_reply(char *pack, int pack_sz, int n)
+{
+	snsd_service *sns, *copy;
+	snsd_flat *flat;
+	size_t unpacked_sz;
+	u_short counter;
+	long allocs0;
+	double t0;
+	int i;
+
+	allocs0 = allocs;
+	t0 = synth_now();
+	for (i = 0; i < n; i++) {
+		unpacked_sz = 0;
+		sns = snsd_unpack_all_service(pack, pack_sz, &unpacked_sz,
+									  &counter);
+		copy = snsd_service_llist_copy(sns, -1, 0);
+		snsd_service_llist_del(&copy);
+		snsd_service_llist_del(&sns);
+	}
+	bench_print("remote reply, llist:", t0, allocs0, n);
+
+	/* The rh_cache keeps the llist, the resolver uses the arena */
+	allocs0 = allocs;
+	t0 = synth_now();
+	for (i = 0; i < n; i++) {
+		unpacked_sz = 0;
+		flat = snsd_flat_unpack(pack, pack_sz, 1, &counter);
+		sns = snsd_unpack_all_service(pack, pack_sz, &unpacked_sz,
+									  &counter);
+		snsd_service_llist_del(&sns);
+		snsd_flat_del(&flat);
+	}
+	bench_print("remote reply, snsd_flat:", t0, allocs0, n);
+}
+
+int
+main(int argc, char **argv)
+{
+	char pack[8192], flat_pack[8192];
+	snsd_service *head;
+	snsd_flat *flat;
+	int n, pack_sz;
+
+	n = argc > 1 ? atoi(argv[1]) : 200000;
+
+	synth_init("bench_snsd");
+	snsd_cache_init(AF_INET);
+	srand(1);
+
+	head = snsd_records();
+	flat = snsd_flat_build(head, -1, 0);
+	pack_sz = snsd_pack_all_services(pack, sizeof(pack), head);
+	if (pack_sz <= 0 ||
+		snsd_flat_pack_all_services(flat_pack, sizeof(flat_pack), flat) !=
+		pack_sz || memcmp(pack, flat_pack, pack_sz))
+		fatal("The snsd_flat pack differs from the llist one");
+	snsd_flat_del(&flat);
+
+	printf("%d resolves of %d services x %d prios x %d nodes\n", n,
+		   SNSD_SERVICES, SNSD_PRIOS, SNSD_NODES);
+	bench_resolve(head, -1, n);
+	bench_resolve(head, 0, n);
+	bench_reply(pack, pack_sz, n);
+
+	snsd_service_llist_del(&head);
+	return 0;
+}
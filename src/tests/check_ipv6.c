@@ -0,0 +1,347 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * check_ipv6
+ *
+ * Checks the 128bit operations of ipv6-gmp.c against the same operations
+ * done directly with GMP, for the three implementations of the file: the
+ * one of the ntk objects (GMP, since check_ipv6 is built only with
+ * `gmp=yes'), the native unsigned __int128 one and the carrying one. The
+ * last two are compiled here, renamed, by including ipv6-gmp.c.
+ *
+ * Each implementation is checked on:
+ *  - every pair of the numbers whose u_ints are all in `edges', that is
+ *    the carries, the borrows and the divisors of one, two, three and four
+ *    u_ints;
+ *  - the pairs of random numbers, with random lengths.
+ * The division by zero must return -1 and htonl_128() must give the
+ * network order of the number. At the end the time taken by the
+ * operations of each implementation is printed.
+ * It exits with 1 if a check failed.
+ *
+ * Usage: check_ipv6 [random pairs]
+ */
+
+#include "includes.h"
+#include <gmp.h>
+
+#include "ipv6-gmp.h"
+
+#ifdef USE_GMP
+#define LIB_IMPL	"gmp"
+#else
+#define LIB_IMPL	"ntk"
+#endif
+
+/*
+ * The native implementations of ipv6-gmp.c, with their functions renamed
+ * by IMPL()
+ */
+#undef USE_GMP
+#define sum_int		IMPL(sum_int)
+#define sum_128		IMPL(sum_128)
+#define sub_int		IMPL(sub_int)
+#define sub_128		IMPL(sub_128)
+#define div_128		IMPL(div_128)
+#define div_int		IMPL(div_int)
+#define cmp_128		IMPL(cmp_128)
+#define u128_get	IMPL(u128_get)
+#define u128_put	IMPL(u128_put)
+#define htonl_128	IMPL(htonl_128)
+#define ntohl_128	IMPL(ntohl_128)
+
+#define IMPL(f)		native_##f
+#undef IPV6_GMP_H
+#include "ipv6-gmp.c"
+#undef IMPL
+
+#define IMPL(f)		carry_##f
+#undef IPV6_GMP_H
+#undef __SIZEOF_INT128__
+#include "ipv6-gmp.c"
+#undef IMPL
+
+#undef sum_int
+#undef sum_128
+#undef sub_int
+#undef sub_128
+#undef div_128
+#undef div_int
+#undef cmp_128
+#undef u128_get
+#undef u128_put
+#undef htonl_128
+#undef ntohl_128
+
+#include "inet.h"
+#include "map.h"
+#include "tests/synth.h"
+#include "common.h"
+
+#define RANDOM_PAIRS	1000000
+#define BENCH_OPS	2000000
+
+struct ipv6_impl {
+	char *name;
+	int (*sum_128) (u_int *, u_int *);
+	int (*sub_128) (u_int *, u_int *);
+	int (*div_128) (u_int *, u_int *);
+	int (*sum_int) (u_int, u_int *);
+	int (*sub_int) (u_int *, u_int);
+	int (*div_int) (u_int *, u_int);
+	int (*cmp_128) (u_int *, u_int *);
+	int (*htonl_128) (u_int *, u_int *);
+	int (*ntohl_128) (u_int *, u_int *);
+} impls[] = {
+	{ LIB_IMPL, sum_128, sub_128, div_128, sum_int, sub_int, div_int,
+	  cmp_128, htonl_128, ntohl_128 },
+	{ "int128", native_sum_128, native_sub_128, native_div_128,
+	  native_sum_int, native_sub_int, native_div_int, native_cmp_128,
+	  native_htonl_128, native_ntohl_128 },
+	{ "carry", carry_sum_128, carry_sub_128, carry_div_128,
+	  carry_sum_int, carry_sub_int, carry_div_int, carry_cmp_128,
+	  carry_htonl_128, carry_ntohl_128 },
+};
+#define IMPLS		(sizeof(impls) / sizeof(struct ipv6_impl))
+
+static u_int edges[] = { 0, 1, 0x7fffffff, 0x80000000, 0xffffffff };
+#define EDGES		(sizeof(edges) / sizeof(u_int))
+
+int checks, failed;
+mpz_t za, zb, zr;
+
+void
+check(int ok, struct ipv6_impl *impl, char *what, u_int *x, u_int *y)
+{
+	checks++;
+	if (ok)
+		return;
+	if (failed++ < 20)
+		printf("FAILED: %s %s x=%08x%08x%08x%08x y=%08x%08x%08x%08x\n",
+			   impl->name, what, x[3], x[2], x[1], x[0],
+			   y[3], y[2], y[1], y[0]);
+}
+
+void
+mpz_get_128(mpz_t z, u_int *x)
+{
+	mpz_import(z, 4, HOST_ORDER, sizeof(x[0]), NATIVE_ENDIAN, 0, x);
+}
+
+/*
+ * mpz_put_128
+ *
+ * stores `z' modulo 2^128 in `y'.
+ */
+void
+mpz_put_128(mpz_t z, u_int *y)
+{
+	mpz_t t;
+	size_t count;
+
+	mpz_init(t);
+	mpz_fdiv_r_2exp(t, z, 128);
+	memset(y, 0, sizeof(u_int) * 4);
+	mpz_export(y, &count, HOST_ORDER, sizeof(y[0]), NATIVE_ENDIAN, 0, t);
+	mpz_clear(t);
+}
+
+/*
+ * check_pair
+ *
+ * checks all the operations of `impl' on `x' and `y', and on `x' and the
+ * u_int `s'.
+ */
+void
+check_pair(struct ipv6_impl *impl, u_int *x, u_int *y, u_int s)
+{
+	u_int z[4], e[4], n[4];
+	int ret, cmp;
+
+	mpz_get_128(za, x);
+	mpz_get_128(zb, y);
+
+	memcpy(z, y, sizeof(z));
+	impl->sum_128(x, z);
+	mpz_add(zr, za, zb);
+	mpz_put_128(zr, e);
+	check(!memcmp(z, e, sizeof(z)), impl, "sum_128", x, y);
+
+	memcpy(z, y, sizeof(z));
+	impl->sub_128(x, z);
+	mpz_sub(zr, za, zb);
+	mpz_put_128(zr, e);
+	check(!memcmp(z, e, sizeof(z)), impl, "sub_128", x, y);
+
+	memcpy(z, y, sizeof(z));
+	ret = impl->div_128(x, z);
+	if (mpz_sgn(zb)) {
+		mpz_tdiv_q(zr, za, zb);
+		mpz_put_128(zr, e);
+		check(!ret && !memcmp(z, e, sizeof(z)), impl, "div_128", x, y);
+	} else
+		check(ret == -1, impl, "div_128 by zero", x, y);
+
+	cmp = mpz_cmp(za, zb);
+	cmp = cmp > 0 ? 1 : cmp < 0 ? -1 : 0;
+	check(impl->cmp_128(x, y) == cmp, impl, "cmp_128", x, y);
+
+	memcpy(z, x, sizeof(z));
+	impl->sum_int(s, z);
+	mpz_add_ui(zr, za, s);
+	mpz_put_128(zr, e);
+	check(!memcmp(z, e, sizeof(z)), impl, "sum_int", x, y);
+
+	memcpy(z, x, sizeof(z));
+	impl->sub_int(z, s);
+	mpz_sub_ui(zr, za, s);
+	mpz_put_128(zr, e);
+	check(!memcmp(z, e, sizeof(z)), impl, "sub_int", x, y);
+
+	memcpy(z, x, sizeof(z));
+	ret = impl->div_int(z, s);
+	if (s) {
+		mpz_tdiv_q_ui(zr, za, s);
+		mpz_put_128(zr, e);
+		check(!ret && !memcmp(z, e, sizeof(z)), impl, "div_int", x, y);
+	} else
+		check(ret == -1 && !memcmp(z, x, sizeof(z)), impl,
+			  "div_int by zero", x, y);
+
+	/* The network order is the most significant byte first */
+	impl->htonl_128(x, z);
+	for (ret = 0; ret < 4; ret++)
+		n[ret] = htonl(x[3 - ret]);
+	check(!memcmp(z, n, sizeof(z)), impl, "htonl_128", x, y);
+	impl->ntohl_128(z, e);
+	check(!memcmp(e, x, sizeof(e)), impl, "ntohl_128", x, y);
+}
+
+/*
+ * check_edges
+ *
+ * checks every pair of the numbers made of `edges'.
+ */
+void
+check_edges(struct ipv6_impl *impl)
+{
+	u_int x[4], y[4];
+	int i, j, w, d;
+
+	for (i = 0; i < EDGES * EDGES * EDGES * EDGES; i++)
+		for (j = 0; j < EDGES * EDGES * EDGES * EDGES; j++) {
+			for (w = 0, d = 1; w < 4; w++, d *= EDGES) {
+				x[w] = edges[(i / d) % EDGES];
+				y[w] = edges[(j / d) % EDGES];
+			}
+			check_pair(impl, x, y, edges[(i + j) % EDGES]);
+		}
+}
+
+u_int
+rand_u32(void)
+{
+	u_int v = ((u_int) rand() << 16) ^ rand();
+
+	switch (rand() % 5) {
+	case 0:
+		return 0;
+	case 1:
+		return 0xffffffff;
+	case 2:
+		return v & 0xff;
+	default:
+		return v;
+	}
+}
+
+/* A random number of random length */
+void
+rand_128(u_int *x)
+{
+	int i, len;
+
+	len = 1 + rand() % 4;
+	for (i = 0; i < 4; i++)
+		x[i] = i < len ? rand_u32() : 0;
+}
+
+void
+check_random(struct ipv6_impl *impl, int pairs)
+{
+	u_int x[4], y[4];
+	int i;
+
+	srand(1);
+	for (i = 0; i < pairs; i++) {
+		rand_128(x);
+		rand_128(y);
+		check_pair(impl, x, y, rand_u32());
+	}
+}
+
+/*
+ * bench_impl
+ *
+ * returns the us taken by a sum_128, a sub_128 and a div_128 of `impl'.
+ */
+double
+bench_impl(struct ipv6_impl *impl)
+{
+	u_int x[4] = { 1, 2, 3, 4 }, y[4];
+	double t0;
+	int i;
+
+	t0 = synth_now();
+	for (i = 0; i < BENCH_OPS; i++) {
+		y[0] = 7 + i;
+		y[1] = i & 1;
+		y[2] = y[3] = 0;
+		impl->div_128(x, y);
+		impl->sum_128(x, y);
+		impl->sub_128(x, y);
+	}
+	return (synth_now() - t0) * 1e6 / BENCH_OPS;
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, pairs;
+
+	pairs = argc > 1 ? atoi(argv[1]) : RANDOM_PAIRS;
+
+	mpz_init(za);
+	mpz_init(zb);
+	mpz_init(zr);
+	for (i = 0; i < IMPLS; i++) {
+		check_edges(&impls[i]);
+		check_random(&impls[i], pairs);
+	}
+	printf("check_ipv6: %d checks, %d failed\n", checks, failed);
+
+	for (i = 0; i < IMPLS; i++)
+		printf("%-6s: div_128+sum_128+sub_128 %.3f us\n", impls[i].name,
+			   bench_impl(&impls[i]));
+
+	mpz_clear(za);
+	mpz_clear(zb);
+	mpz_clear(zr);
+	return failed ? 1 : 0;
+}
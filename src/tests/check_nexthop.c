@@ -0,0 +1,237 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * check_nexthop
+ *
+ * Builds the multipath routes of the synthetic maps with
+ * rt_build_nexthop_gw() and checks their nexthops and weights:
+ *  - the route to each node of level 0 uses exactly the rnodes of that node,
+ *    weighted by their trtt;
+ *  - the weights don't change while the trtts move less than
+ *    RT_NH_HYSTERESIS%, and they do when the trtts move more;
+ *  - the routes to the gnodes of level 1 use only our rnodes, without
+ *    duplicates, and the best one has RT_NH_WEIGHT_MAX;
+ *  - the rt_nh_states of a level are allocated only once when many threads
+ *    ask for them at the same time.
+ * It exits with 1 if a check failed.
+ */
+
+#include "includes.h"
+
+#include "llist.c"
+#include "libnetlink.h"
+#include "inet.h"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "request.h"
+#include "pkts.h"
+#include "radar.h"
+#include "krnl_route.h"
+#include "route.h"
+#include "netsukuku.h"
+#include "tests/synth.h"
+#include "common.h"
+
+#define NH_THREADS	8
+
+int checks, failed;
+
+void
+check(int ok, char *what, int pos)
+{
+	checks++;
+	if (ok)
+		return;
+	failed++;
+	printf("FAILED: %s (%d)\n", what, pos);
+}
+
+/*
+ * nh_count
+ *
+ * returns the number of nexthops of `nh' and checks that they are all our
+ * rnodes, without duplicates. The rnode positions are stored in `rpos'.
+ */
+int
+nh_count(struct nexthop *nh, int *rpos, int pos)
+{
+	inet_prefix ip;
+	int n, i, r;
+
+	for (n = 0; nh && nh[n].dev; n++) {
+		memcpy(&ip, &nh[n].gw, sizeof(inet_prefix));
+		inet_ntohl(ip.data, ip.family);
+		r = ip.data[0] - me.cur_quadg.ipstart[1].data[0];
+		check(r >= 1 && r <= SYNTH_RNODES, "the gw is one of our rnodes",
+			  pos);
+		check(!strcmp(nh[n].dev, me.cur_ifs[0].dev_name), "the dev of "
+			  "the gw", pos);
+		check(nh[n].hops >= 1 && nh[n].hops <= RT_NH_WEIGHT_MAX,
+			  "the weight is in range", pos);
+		for (i = 0; i < n; i++)
+			check(rpos[i] != r, "duplicated gw", pos);
+		rpos[n] = r;
+	}
+
+	return n;
+}
+
+/*
+ * check_level0
+ *
+ * checks the routes to the nodes which aren't our rnodes.
+ */
+void
+check_level0(void)
+{
+	struct nexthop *nh, *nh2;
+	map_node *node;
+	int i, e, k, n, rpos[MAX_MULTIPATH_ROUTES + 1], w, trtt;
+
+	for (i = SYNTH_RNODES + 1; i <= SYNTH_RNODES + SYNTH_BNODES; i++) {
+		node = &me.int_map[i];
+		nh = rt_build_nexthop_gw(node, 0, 0, 0);
+		n = nh_count(nh, rpos, i);
+		check(n == node->links, "a nexthop for each rnode of the node", i);
+
+		for (k = 0; k < n; k++)
+			for (e = 0; e < node->links; e++) {
+				if ((map_node *) node->r_node[e].r_node !=
+					&me.int_map[rpos[k]])
+					continue;
+				trtt = node->r_node[e].trtt;
+				w = (int) (RT_NH_WEIGHT_MAX * (double) i / trtt + 0.5);
+				check(nh[k].hops == w, "weight proportional to 1/trtt", i);
+			}
+
+		/* A small change is absorbed by the hysteresis */
+		for (e = 0; e < node->links; e++)
+			node->r_node[e].trtt += node->r_node[e].trtt *
+				(RT_NH_HYSTERESIS / 2) / 100;
+		nh2 = rt_build_nexthop_gw(node, 0, 0, 0);
+		for (k = 0; k < n; k++)
+			check(nh2[k].hops == nh[k].hops, "the weights are stable", i);
+		xfree(nh2);
+
+		/* A big one isn't: the first rnode becomes four times slower */
+		node->r_node[0].trtt *= 4;
+		nh2 = rt_build_nexthop_gw(node, 0, 0, 0);
+		for (k = 0, e = 0; k < n; k++)
+			e += nh2[k].hops != nh[k].hops;
+		check(e > 0, "the weights follow a big change", i);
+		xfree(nh2);
+
+		/* Restore the map */
+		for (e = 0; e < node->links; e++)
+			node->r_node[e].trtt = i + e;
+		rt_nh_state_del(0, i);
+		xfree(nh);
+	}
+}
+
+/*
+ * check_level1
+ *
+ * checks the routes to the gnodes of the first level.
+ */
+void
+check_level1(void)
+{
+	struct nexthop *nh;
+	int i, k, n, best, rpos[MAX_MULTIPATH_ROUTES + 1];
+
+	for (i = 1; i < MAXGROUPNODE; i++) {
+		if (me.ext_map[_EL(1)][i].flags & GMAP_VOID)
+			continue;
+
+		nh = rt_build_nexthop_gw(0, &me.ext_map[_EL(1)][i], 1, 0);
+		n = nh_count(nh, rpos, i);
+		check(n >= 1, "the gnode is reachable", i);
+
+		for (k = 0, best = 0; k < n; k++)
+			best = nh[k].hops > best ? nh[k].hops : best;
+		check(!n || best == RT_NH_WEIGHT_MAX, "the best gw has the max "
+			  "weight", i);
+		if (nh)
+			xfree(nh);
+	}
+}
+
+struct rt_nh_state *nh_states_seen[NH_THREADS];
+
+void *
+nh_state_t(void *arg)
+{
+	int t = (int) (long) arg;
+
+	pthread_mutex_lock(&rt_nh_mutex);
+	nh_states_seen[t] = rt_nh_state_get(2, t);
+	pthread_mutex_unlock(&rt_nh_mutex);
+
+	return 0;
+}
+
+/*
+ * check_nh_state_alloc
+ *
+ * many threads ask the states of the same level, which isn't allocated yet.
+ */
+void
+check_nh_state_alloc(void)
+{
+	pthread_t thread[NH_THREADS];
+	int t, r;
+
+	for (r = 0; r < 100; r++) {
+		rt_nh_states_reset();
+		for (t = 0; t < NH_THREADS; t++)
+			pthread_create(&thread[t], 0, nh_state_t, (void *) (long) t);
+		for (t = 0; t < NH_THREADS; t++)
+			pthread_join(thread[t], 0);
+
+		for (t = 0; t < NH_THREADS; t++)
+			check(nh_states_seen[t] == &rt_nh_states[2][t],
+				  "a single rt_nh_states allocation", t);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int i;
+
+	synth_init("check_nexthop");
+	synth_maps(1);
+	rt_sync_init();
+
+	me.cur_ifs_n = 1;
+	strcpy(me.cur_ifs[0].dev_name, "eth0");
+	me.cur_ifs[0].dev_idx = 1;
+	first_init_radar();
+	for (i = 1; i <= SYNTH_RNODES; i++)
+		rnl_add(&rlist, &rlist_counter, &me.int_map[i], &me.cur_ifs[0]);
+
+	check_level0();
+	check_level1();
+	check_nh_state_alloc();
+
+	printf("check_nexthop: %d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "includes.h"
+
+#include "inet.h"
+#include "map.h"
+#include "gmap.h"
+#include "bmap.h"
+#include "route.h"
+#include "request.h"
+#include "pkts.h"
+#include "qspn.h"
+#include "andna.h"
+#include "hook.h"
+#include "netsukuku.h"
+#include "tests/synth.h"
+#include "common.h"
+
+/*
+ * synth_now
+ *
+ * returns the monotonic time in seconds.
+ */
+double
+synth_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * synth_init
+ *
+ * initializes the parts of ntkd used by the benchmarks. The logs go to
+ * stderr.
+ */
+void
+synth_init(char *prog)
+{
+	my_family = AF_INET;
+	log_init(prog, 0, 1);
+
+	gw_cache_init();
+	gnode_live_init();
+	setzero(hgnode_memo, sizeof(hgnode_memo));
+	pthread_mutex_init(&hgnode_memo_mutex, 0);
+	qspn_init(FAMILY_LVLS);
+}
+
+/*
+ * synth_link
+ *
+ * adds to `node' an rnode which points to `rnode', reached with `trtt' ms.
+ */
+void
+synth_link(map_node * node, void *rnode, u_int trtt)
+{
+	map_rnode rn;
+
+	setzero(&rn, sizeof(map_rnode));
+	rn.r_node = (int *) rnode;
+	rn.trtt = trtt;
+	rnode_add(node, &rn);
+}
+
+/*
+ * synth_maps
+ *
+ * builds the maps described in synth.h. Our node is 10.0.0.0, the first of
+ * the int_map.
+ */
+void
+synth_maps(int every)
+{
+	map_gnode *gmap;
+	inet_prefix ip;
+	u_int idata[MAX_IP_INT];
+	int i, e, bm;
+
+	me.int_map = init_map(0);
+	me.ext_map = init_extmap(FAMILY_LVLS, 0);
+	bmap_levels_init(BMAP_LEVELS(FAMILY_LVLS), &me.bnode_map,
+					 &me.bmap_nodes);
+
+	hook_reset_state();
+	setzero(idata, MAX_IP_SZ);
+	idata[0] = 10 << 24;
+	inet_setip_raw(&ip, idata, my_family);
+	create_gnodes(&ip, FAMILY_LVLS);
+	me.cur_node->flags &= ~MAP_HNODE;
+
+	/* Level 0 */
+	for (i = 1; i < MAXGROUPNODE; i++)
+		if (i > SYNTH_RNODES + SYNTH_BNODES && i % every)
+			me.int_map[i].flags |= MAP_VOID;
+		else
+			me.int_map[i].flags &= ~MAP_VOID;
+
+	for (i = 1; i <= SYNTH_RNODES; i++) {
+		me.int_map[i].flags |= MAP_RNODE;
+		synth_link(me.cur_node, &me.int_map[i], i);
+	}
+	for (i = SYNTH_RNODES + 1; i <= SYNTH_RNODES + SYNTH_BNODES; i++) {
+		for (e = 0; e < 3; e++)
+			synth_link(&me.int_map[i],
+					   &me.int_map[1 + (i + e) % SYNTH_RNODES], i + e);
+
+		bm = map_add_bnode(&me.bnode_map[0], &me.bmap_nodes[0], i, 0);
+		synth_link(&me.bnode_map[0][bm],
+				   &me.ext_map[_EL(1)][1 + i % SYNTH_GRNODES], i);
+	}
+
+	/* Level 1 */
+	gmap = me.ext_map[_EL(1)];
+	for (i = 1; i < MAXGROUPNODE; i++) {
+		if (i > SYNTH_GRNODES && i % every) {
+			gmap[i].flags |= GMAP_VOID;
+			gmap[i].g.flags |= MAP_VOID;
+			continue;
+		}
+		gmap[i].flags &= ~GMAP_VOID;
+		gmap[i].g.flags &= ~MAP_VOID;
+
+		if (i <= SYNTH_GRNODES) {
+			gmap[i].g.flags |= MAP_RNODE;
+			continue;
+		}
+		for (e = 0; e < 4; e++)
+			synth_link(&gmap[i].g, &gmap[1 + (i + e * 5) % SYNTH_GRNODES],
+					   i + e);
+	}
+
+	map_gen_bump(0);
+}
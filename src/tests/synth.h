@@ -0,0 +1,47 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+/*
+ * The benchmarks and the checks of the tests/ directory run the ntkd code on
+ * synthetic maps, without any network.
+ *
+ * synth_maps() builds the maps of a node of the 10.0.0.0 gnode:
+ *  - level 0: SYNTH_RNODES rnodes and SYNTH_BNODES nodes reached through
+ *    them, each of which is also a bnode linked to one of the rnode gnodes
+ *    of level 1;
+ *  - level 1: SYNTH_GRNODES rnode gnodes, the others are reached through
+ *    four of them;
+ *  - the upper levels contain only our gnodes.
+ * With `every' > 1, only one node (gnode) every `every' is alive in the
+ * level 0 (1), beyond the rnodes and the bnodes: the maps are sparse.
+ */
+
+#define SYNTH_RNODES		8
+#define SYNTH_BNODES		32
+#define SYNTH_GRNODES		16
+
+/* * * Functions declaration * * */
+double synth_now(void);
+void synth_init(char *prog);
+void synth_link(map_node * node, void *rnode, u_int trtt);
+void synth_maps(int every);
+
+#endif							/*SYNTH_H */
@@ -0,0 +1,360 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * --
+ * timer.c
+ *
+ * The timing wheel which keeps all the timers of ntkd, and the thread which
+ * fires them.
+ */
+
+#include "includes.h"
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "timer.h"
+#include "common.h"
+
+void
+timer_init(void)
+{
+	struct epoll_event ev;
+
+	setzero(timer_wheel, sizeof(timer_wheel));
+	timer_ticks = timer_pending = timer_armed = 0;
+	timer_running = 0;
+	pthread_mutex_init(&timer_mutex, 0);
+	pthread_cond_init(&timer_done_cond, 0);
+	clock_gettime(CLOCK_MONOTONIC, &timer_start);
+
+	if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+		fatal("timer_init(): timerfd_create: %s", strerror(errno));
+	if ((timer_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		fatal("timer_init(): eventfd: %s", strerror(errno));
+	if ((timer_epfd = epoll_create(2)) < 0)
+		fatal("timer_init(): epoll_create: %s", strerror(errno));
+
+	setzero(&ev, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	epoll_ctl(timer_epfd, EPOLL_CTL_ADD, timer_fd, &ev);
+	ev.data.fd = timer_wake_fd;
+	epoll_ctl(timer_epfd, EPOLL_CTL_ADD, timer_wake_fd, &ev);
+}
+
+/*
+ * timer_now
+ *
+ * returns the current tick, counted from timer_init().
+ */
+u_int
+timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((ts.tv_sec - timer_start.tv_sec) * 1000 +
+			(ts.tv_nsec - timer_start.tv_nsec) / 1000000) / TIMER_TICK_MS;
+}
+
+/*
+ * timer_queue
+ *
+ * puts `t' in the slot of the wheel which covers its expiration.
+ * timer_mutex must be locked.
+ */
+void
+timer_queue(struct ntk_timer *t)
+{
+	u_int delta, idx;
+	int level;
+
+	/* An expired timer is run at the next tick */
+	if ((int) (t->expire - timer_ticks) < 0)
+		t->expire = timer_ticks;
+	delta = t->expire - timer_ticks;
+	if (delta > TIMER_MAX_TICKS) {
+		delta = TIMER_MAX_TICKS;
+		t->expire = timer_ticks + delta;
+	}
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (delta < 1U << (TIMER_SLOT_BITS * (level + 1)))
+			break;
+	idx = (t->expire >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+
+	t->slot = &timer_wheel[level][idx];
+	*t->slot = list_add(*t->slot, t);
+	t->flags |= TIMER_PENDING;
+}
+
+/*
+ * timer_add
+ *
+ * schedules `func'(`arg') to be called after `msecs' milliseconds.
+ * If `t' was already pending, it is rescheduled.
+ * `t' must remain valid until it is fired or timer_del()ed.
+ */
+void
+timer_add(struct ntk_timer *t, u_int msecs, void (*func) (void *),
+		  void *arg)
+{
+	uint64_t one = 1;
+	int wake;
+
+	pthread_mutex_lock(&timer_mutex);
+	if (t->flags & TIMER_PENDING) {
+		*t->slot = list_join(*t->slot, t);
+		timer_pending--;
+	}
+
+	t->func = func;
+	t->arg = arg;
+	t->flags = 0;
+	t->expire = timer_now() + (msecs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	timer_queue(t);
+	timer_pending++;
+	timers_added++;
+
+	/* The timer_daemon has to rearm the timerfd */
+	wake = !timer_armed || (int) (t->expire - timer_armed) < 0;
+	pthread_mutex_unlock(&timer_mutex);
+
+	if (wake && write(timer_wake_fd, &one, sizeof(one)) < 0)
+		error("timer_add(): cannot wake the timer_daemon: %s",
+			  strerror(errno));
+}
+
+/*
+ * timer_del
+ *
+ * removes `t' from the wheel. If its callback is running, it waits until it
+ * finishes, so after the return `t' can be freed.
+ * It returns 1 if `t' was still pending.
+ */
+int
+timer_del(struct ntk_timer *t)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&timer_mutex);
+	if (t->flags & TIMER_PENDING) {
+		*t->slot = list_join(*t->slot, t);
+		t->flags &= ~TIMER_PENDING;
+		timer_pending--;
+		ret = 1;
+	}
+	while (timer_running == t && !pthread_equal(pthread_self(),
+												 timer_daemon_thread))
+		pthread_cond_wait(&timer_done_cond, &timer_mutex);
+	pthread_mutex_unlock(&timer_mutex);
+
+	return ret;
+}
+
+/*
+ * timer_cascade
+ *
+ * moves the timers of the current slots of the upper levels in the lower
+ * ones. It is called when the level 0 wraps. timer_mutex must be locked.
+ */
+void
+timer_cascade(void)
+{
+	struct ntk_timer *t, **slot;
+	u_int idx;
+	int level;
+
+	for (level = 1; level < TIMER_LEVELS; level++) {
+		idx = (timer_ticks >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+		slot = &timer_wheel[level][idx];
+		while ((t = *slot)) {
+			*slot = list_join(*slot, t);
+			timer_queue(t);
+		}
+
+		/* The upper level wraps too only if this one did */
+		if (idx)
+			break;
+	}
+}
+
+/*
+ * timer_run
+ *
+ * fires all the timers expired until now.
+ */
+void
+timer_run(void)
+{
+	struct ntk_timer *t, **slot;
+	u_int now;
+
+	pthread_mutex_lock(&timer_mutex);
+	now = timer_now();
+	while ((int) (now - timer_ticks) >= 0) {
+		if (!(timer_ticks & TIMER_SLOT_MASK))
+			timer_cascade();
+
+		slot = &timer_wheel[0][timer_ticks & TIMER_SLOT_MASK];
+		while ((t = *slot)) {
+			*slot = list_join(*slot, t);
+			t->flags &= ~TIMER_PENDING;
+			timer_pending--;
+			timers_fired++;
+
+			/* The callback can add or delete other timers */
+			timer_running = t;
+			pthread_mutex_unlock(&timer_mutex);
+			t->func(t->arg);
+			pthread_mutex_lock(&timer_mutex);
+			timer_running = 0;
+			pthread_cond_broadcast(&timer_done_cond);
+		}
+		timer_ticks++;
+	}
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+/*
+ * timer_arm
+ *
+ * arms the timerfd for the next tick which has something to do: the first
+ * non empty slot of the level 0 or, if there's none, its next wrap.
+ * If no timer is pending, the timerfd is disarmed.
+ */
+void
+timer_arm(void)
+{
+	struct itimerspec its;
+	u_int next;
+
+	setzero(&its, sizeof(its));
+
+	pthread_mutex_lock(&timer_mutex);
+	if (!timer_pending) {
+		timer_armed = 0;
+		goto finish;
+	}
+
+	/* At the wrap, the upper levels have to be cascaded anyway */
+	for (next = timer_ticks; next & TIMER_SLOT_MASK; next++)
+		if (timer_wheel[0][next & TIMER_SLOT_MASK])
+			break;
+	timer_armed = next ? next : 1;
+
+	its.it_value.tv_sec = timer_start.tv_sec +
+		timer_armed / (1000 / TIMER_TICK_MS);
+	its.it_value.tv_nsec = timer_start.tv_nsec +
+		(timer_armed % (1000 / TIMER_TICK_MS)) * TIMER_TICK_MS * 1000000;
+	if (its.it_value.tv_nsec >= 1000000000) {
+		its.it_value.tv_sec++;
+		its.it_value.tv_nsec -= 1000000000;
+	}
+
+  finish:
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, 0) < 0)
+		error("timer_arm(): timerfd_settime: %s", strerror(errno));
+	pthread_mutex_unlock(&timer_mutex);
+}
+
+/*
+ * timer_daemon
+ *
+ * It waits for the timerfd to expire or for a timer_add() to wake it up,
+ * then it fires the expired timers and rearms the timerfd.
+ */
+void *
+timer_daemon(void *null)
+{
+	struct epoll_event ev[2];
+	uint64_t val;
+	int i, n;
+
+	timer_daemon_thread = pthread_self();
+	timer_daemon_running = 1;
+
+	debug(DBG_NORMAL, "Timer daemon up & running");
+	for (;;) {
+		timer_run();
+		timer_arm();
+
+		n = epoll_wait(timer_epfd, ev, 2, -1);
+		if (n < 0 && errno != EINTR)
+			error("timer_daemon(): epoll_wait: %s", strerror(errno));
+		for (i = 0; i < n; i++)
+			if (read(ev[i].data.fd, &val, sizeof(val)) < 0 &&
+				errno != EAGAIN)
+				error("timer_daemon(): read: %s", strerror(errno));
+	}
+
+	return 0;
+}
+
+/*
+ * timer_job_start
+ *
+ * runs for the first time the timer_job `j' after `msecs' milliseconds:
+ * `func'(`arg') is called, then again after the milliseconds it returns.
+ */
+void
+timer_job_start(struct timer_job *j, u_int msecs, u_int (*func) (void *),
+				void *arg)
+{
+	j->func = func;
+	j->arg = arg;
+	timer_add(&j->timer, msecs, timer_job_fire, j);
+}
+
+/*
+ * timer_job_fire
+ *
+ * The timer callback of a timer_job: it posts the job to a detached
+ * timer_job_t() thread.
+ */
+void
+timer_job_fire(void *arg)
+{
+	struct timer_job *j = (struct timer_job *) arg;
+	pthread_attr_t t_attr;
+	pthread_t thread;
+	int err;
+
+	pthread_attr_init(&t_attr);
+	pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
+	if ((err = pthread_create(&thread, &t_attr, timer_job_t, j))) {
+		error("timer_job_fire(): cannot start the job: %s", strerror(err));
+		timer_add(&j->timer, TIMER_JOB_RETRY_MS, timer_job_fire, j);
+	}
+	pthread_attr_destroy(&t_attr);
+}
+
+/*
+ * timer_job_t
+ *
+ * runs the timer_job `arg' and rearms its timer.
+ */
+void *
+timer_job_t(void *arg)
+{
+	struct timer_job *j = (struct timer_job *) arg;
+
+	timer_add(&j->timer, j->func(j->arg), timer_job_fire, j);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* This file is part of Netsukuku
+ * (c) Copyright 2005 Andrea Lo Pumo aka AlpT <alpt@freaknet.org>
+ *
+ * This source code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This source code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Please refer to the GNU Public License for more details.
+ *
+ * You should have received a copy of the GNU Public License along with
+ * this source code; if not, write to:
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "llist.c"
+
+/*
+ * The timers of ntkd are kept in a hierarchical timing wheel, driven by the
+ * timer_daemon() thread, which sleeps in epoll on a timerfd armed for the
+ * next expiration. When a timer expires its callback is called by the
+ * timer_daemon(), so it must be short and it must not block: a periodic job
+ * which may block is a timer_job.
+ *
+ * The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots. A slot of the
+ * level `l' covers TIMER_SLOTS^l ticks; when the level 0 wraps, the timers of
+ * the next slot of the upper level are moved (cascaded) in the lower one.
+ * A timer can't be set more than TIMER_MAX_TICKS ticks (~46 hours) ahead.
+ */
+#define TIMER_TICK_MS		10
+#define TIMER_SLOT_BITS		6
+#define TIMER_SLOTS		(1<<TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK		(TIMER_SLOTS-1)
+#define TIMER_LEVELS		4
+#define TIMER_MAX_TICKS		((1<<(TIMER_SLOT_BITS*TIMER_LEVELS))-1)
+
+/* ntk_timer flags */
+#define TIMER_PENDING		1	/* It is queued in the wheel */
+
+struct ntk_timer {
+	LLIST_HDR(struct ntk_timer);
+
+	struct ntk_timer **slot;	/* The wheel slot where it is queued */
+	u_int expire;				/* The tick of its expiration */
+
+	void (*func) (void *);
+	void *arg;
+
+	u_char flags;
+};
+
+struct ntk_timer *timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+u_int timer_ticks;				/* The next tick to be run */
+u_int timer_pending;			/* Number of queued timers */
+u_int timer_armed;				/* The tick the timerfd is armed for */
+struct timespec timer_start;	/* The CLOCK_MONOTONIC time of the tick 0 */
+
+pthread_mutex_t timer_mutex;
+pthread_cond_t timer_done_cond;	/* timer_running has returned */
+struct ntk_timer *timer_running;	/* The timer whose callback is running */
+
+int timer_epfd, timer_fd, timer_wake_fd;
+pthread_t timer_daemon_thread;
+int timer_daemon_running;
+
+u_int timers_added;				/* Stupid statistics */
+u_int timers_fired;
+
+/*
+ * A timer_job is a periodic job which may block, thus its timer callback,
+ * timer_job_fire(), just posts `func' to a detached thread. When `func'
+ * returns, the timer is rearmed for the milliseconds it returned: two runs of
+ * the same job never overlap and no thread waits between them.
+ */
+#define TIMER_JOB_RETRY_MS	1000	/* when the thread can't be created */
+
+struct timer_job {
+	struct ntk_timer timer;
+
+	u_int (*func) (void *);		/* returns the ms to wait before the
+								   next run */
+	void *arg;
+};
+
+
+/* * * Functions declaration * * */
+void timer_init(void);
+u_int timer_now(void);
+void timer_queue(struct ntk_timer *t);
+void timer_add(struct ntk_timer *t, u_int msecs, void (*func) (void *),
+			   void *arg);
+int timer_del(struct ntk_timer *t);
+void timer_cascade(void);
+void timer_run(void);
+void timer_arm(void);
+void *timer_daemon(void *null);
+void timer_job_start(struct timer_job *j, u_int msecs,
+					 u_int (*func) (void *), void *arg);
+void timer_job_fire(void *arg);
+void *timer_job_t(void *arg);
+
+#endif							/*TIMER_H */
@@ -29,7 +29,11 @@
 #include "tracer.h"
 #include "qspn.h"
 #include "igs.h"
+#include "flood.h"
+#include "bw.h"
 #include "netsukuku.h"
+#include "mapowner.h"
+#include "codec.h"
 
 char *tracer_pack_pkt(brdcast_hdr * bcast_hdr, tracer_hdr * trcr_hdr,
 					  tracer_chunk * tracer, char *bblocks,
@@ -226,6 +230,7 @@ tracer_add_entry(void *void_map, void *void_node, tracer_chunk * tracer,
 			rfrom = &me.cur_quadg.gnode[_EL(level)]->g.r_node[pos];
 		}
 		t[new_entry_pos].rtt = rfrom->trtt;
+		t[new_entry_pos].bw = rfrom->bw;
 	}
 
 	/* Fill the new entry in the tracer_pkt */
@@ -243,12 +248,14 @@ tracer_add_entry(void *void_map, void *void_node, tracer_chunk * tracer,
 /* 
  * tracer_add_rtt: Increments the rtt of the `hop'th `tracer' chunk by adding
  * the rtt of the rnode who is in the `rpos' postion in me.cur_node->r_node.
+ * The bandwidth of the chunk becomes the bottleneck of the two.
  * It returns the new rtt value on success.
  */
 int
 tracer_add_rtt(int rpos, tracer_chunk * tracer, u_short hop)
 {
 	tracer[hop].rtt += me.cur_node->r_node[rpos].trtt;
+	tracer[hop].bw = BW_MIN(tracer[hop].bw, me.cur_node->r_node[rpos].bw);
 	return tracer[hop].rtt;
 }
 
@@ -282,12 +289,45 @@ tracer_get_trtt(int from_rnode_pos, tracer_hdr * trcr_hdr,
 	return 0;
 }
 
+/*
+ * tracer_msg_gcount: the map_msg which adds msg.arg[0] to the `msg.ptr'
+ * gcount counter, from the msg.level level upwards.
+ */
+void
+tracer_msg_gcount(struct map_msg *msg)
+{
+	qspn_inc_gcount((u_int *) msg->ptr, msg->level, msg->arg[0]);
+}
+
+/*
+ * tracer_msg_rehook: the map_msg which calls new_rehook(). It reads the
+ * gcount of the upper levels, which aren't ours.
+ */
+void
+tracer_msg_rehook(struct map_msg *msg)
+{
+	new_rehook((map_gnode *) msg->ptr, msg->arg[0], msg->level,
+			   msg->arg[1]);
+}
+
+/*
+ * tracer_msg_seeds: the map_msg which calls gnode_inc_seeds(). The seeds
+ * are kept in the gnode of the upper level.
+ */
+void
+tracer_msg_seeds(struct map_msg *msg)
+{
+	gnode_inc_seeds(&me.cur_quadg, msg->level);
+}
+
 /*
  * tracer_update_gcount: it updates `gcount_counter' by adding the sum of 
  * gcounts present in `tracer'.
  * It then updates the map_gnode.gcount counter of the gnodes present in the 
  * `ext_map' of the `level'th level.
  * It ignores all the tracer chunks < `first_hop'.
+ * `gcount_counter' counts the nodes of the upper levels too, thus it is
+ * updated with a map_msg.
  */
 void
 tracer_update_gcount(tracer_hdr * trcr_hdr, tracer_chunk * tracer,
@@ -297,7 +337,7 @@ tracer_update_gcount(tracer_hdr * trcr_hdr, tracer_chunk * tracer,
 	map_node *node = 0;
 	map_gnode *gnode;
 	u_int hops;
-	int i;
+	int i, inc = 0;
 
 	hops = trcr_hdr->hops;
 	if (!hops || first_hop >= hops || first_hop < 0)
@@ -306,14 +346,18 @@ tracer_update_gcount(tracer_hdr * trcr_hdr, tracer_chunk * tracer,
 	for (i = first_hop; i >= 0; i--) {
 		if (level) {
 			gnode = gnode_from_pos(tracer[i].node, ext_map[_EL(level)]);
-			qspn_dec_gcount(gcount_counter, level + 1, gnode->gcount);
+			inc -= gnode->gcount;
 			gnode->gcount = tracer[i].gcount;
 		} else
 			node = node_from_pos(tracer[i].node, int_map);
 
 		if (level || (!level && node->flags & MAP_VOID))
-			qspn_inc_gcount(gcount_counter, level + 1, tracer[i].gcount);
+			inc += tracer[i].gcount;
 	}
+
+	if (inc)
+		map_msg_post(tracer_msg_gcount, level + 1, gcount_counter, inc, 0,
+					 0, 0);
 }
 
 /* 
@@ -619,6 +663,7 @@ tracer_pack_pkt(brdcast_hdr * bcast_hdr, tracer_hdr * trcr_hdr,
 	buf += sizeof(brdcast_hdr);
 
 	/* add the tracer header */
+	trcr_hdr->flags |= TRCR_BW;
 	memcpy(buf, trcr_hdr, sizeof(tracer_hdr));
 	ints_host_to_network(buf, tracer_hdr_iinfo);
 	buf += sizeof(tracer_hdr);
@@ -653,6 +698,117 @@ tracer_pack_pkt(brdcast_hdr * bcast_hdr, tracer_hdr * trcr_hdr,
 	return msg;
 }
 
+/*
+ * tracer_chunks_conv
+ *
+ * It returns a copy of the tracer pkt `msg', which is `sz' bytes long, is in
+ * network order and has `hops' chunks of `from_sz' bytes. In the copy the
+ * chunks are `to_sz' bytes long: they are truncated or padded with zeros.
+ * The size of the copy is stored in `new_sz'.
+ */
+char *
+tracer_chunks_conv(char *msg, size_t sz, u_short hops, size_t from_sz,
+				   size_t to_sz, size_t * new_sz)
+{
+	brdcast_hdr bcast_hdr;
+	size_t hdrs_sz, chunks_sz;
+	char *new_msg, *buf;
+	int i;
+
+	hdrs_sz = BRDCAST_SZ(sizeof(tracer_hdr));
+	chunks_sz = from_sz * hops;
+	*new_sz = sz - chunks_sz + to_sz * hops;
+
+	buf = new_msg = xzalloc(*new_sz);
+	memcpy(buf, msg, hdrs_sz);
+	buf += hdrs_sz;
+	msg += hdrs_sz;
+
+	for (i = 0; i < hops; i++) {
+		memcpy(buf, msg, from_sz < to_sz ? from_sz : to_sz);
+		buf += to_sz;
+		msg += from_sz;
+	}
+
+	/* the bnode blocks */
+	memcpy(buf, msg, sz - hdrs_sz - chunks_sz);
+
+	/* update the size written in the broadcast header */
+	memcpy(&bcast_hdr, new_msg, sizeof(brdcast_hdr));
+	ints_network_to_host(&bcast_hdr, brdcast_hdr_iinfo);
+	if (bcast_hdr.sz >= chunks_sz)
+		bcast_hdr.sz = bcast_hdr.sz - chunks_sz + to_sz * hops;
+	ints_host_to_network(&bcast_hdr, brdcast_hdr_iinfo);
+	memcpy(new_msg, &bcast_hdr, sizeof(brdcast_hdr));
+
+	return new_msg;
+}
+
+/*
+ * tracer_pkt_compat
+ *
+ * It is the compat_func of the tracer and qspn ops (see pkt_exec()).
+ * If the received tracer pkt `pkt' hasn't the TRCR_BW flag, it has been sent
+ * by an older ntkd: its chunks are converted to tracer_chunks with an unknown
+ * `bw' and `pkt'->msg is replaced with the converted copy.
+ * It returns 1 if `pkt'->msg has been replaced, 0 if it was already in the
+ * current format and -1 if the pkt is messed.
+ */
+int
+tracer_pkt_compat(PACKET * pkt)
+{
+	tracer_hdr trcr_hdr;
+	size_t sz;
+	char *msg;
+
+	if (pkt->hdr.sz < BRDCAST_SZ(sizeof(tracer_hdr)))
+		return -1;
+
+	memcpy(&trcr_hdr, TRACER_HDR_PTR(pkt->msg), sizeof(tracer_hdr));
+	if (trcr_hdr.flags & TRCR_BW)
+		return 0;
+
+	ints_network_to_host(&trcr_hdr, tracer_hdr_iinfo);
+	if (!trcr_hdr.hops || trcr_hdr.hops > MAXGROUPNODE ||
+		BRDCAST_SZ(sizeof(tracer_hdr) +
+				   TRACER_CHUNK_V0_SZ * trcr_hdr.hops) > pkt->hdr.sz) {
+		debug(DBG_INSANE, "%s:%d messed tracer pkt: %d, %d", ERROR_POS,
+			  (int) pkt->hdr.sz, trcr_hdr.hops);
+		return -1;
+	}
+
+	msg = tracer_chunks_conv(pkt->msg, pkt->hdr.sz, trcr_hdr.hops,
+							 TRACER_CHUNK_V0_SZ, sizeof(tracer_chunk), &sz);
+	TRACER_HDR_PTR(msg)->flags |= TRCR_BW;
+
+	pkt->msg = msg;
+	pkt->hdr.sz = sz;
+	return 1;
+}
+
+/*
+ * tracer_pkt_v0
+ *
+ * It returns a copy of the packed tracer pkt `msg', `sz' bytes long, whose
+ * chunks are in the format of an older ntkd, which can't parse the `bw'.
+ * The size of the copy is stored in `new_sz'.
+ */
+char *
+tracer_pkt_v0(char *msg, size_t sz, size_t * new_sz)
+{
+	tracer_hdr trcr_hdr;
+	char *v0_msg;
+
+	memcpy(&trcr_hdr, TRACER_HDR_PTR(msg), sizeof(tracer_hdr));
+	ints_network_to_host(&trcr_hdr, tracer_hdr_iinfo);
+
+	v0_msg = tracer_chunks_conv(msg, sz, trcr_hdr.hops, sizeof(tracer_chunk),
+								TRACER_CHUNK_V0_SZ, new_sz);
+	TRACER_HDR_PTR(v0_msg)->flags &= ~TRCR_BW;
+
+	return v0_msg;
+}
+
 /* 
  * tracer_unpack_pkt: Given a packet `rpkt' it scomposes the rpkt.msg in 
  * `new_bcast_hdr', `new_tracer_hdr', `new_tracer', 'new_bhdr', and 
@@ -852,6 +1008,104 @@ tracer_split_bblock(void *bnode_block_start, size_t bblock_sz,
 	return x;
 }
 
+/*
+ * tracer_store_bentry: stores in the bnode maps the bnode block `bhdr',
+ * whose bnode chunks follow it in memory. The bnode is stored in the bmaps
+ * of the levels which go from `o' to the last level of the block, where `o'
+ * is the highest level, not above `level', in which its gids differ from
+ * ours.
+ * If `igw' is non zero, the block describes an Internet gateway and it is
+ * stored in me.igws instead.
+ * `level' is the level of the tracer pkt which carried the block.
+ */
+void
+tracer_store_bentry(u_char level, int o, int igw, bnode_hdr * bhdr)
+{
+	map_node *node;
+	map_gnode *gnode;
+	bnode_chunk *bchunk;
+	map_rnode rn;
+	int e, p, bm;
+	u_char *bnode_gid, bnode, blevel;
+
+	bnode_gid = (u_char *) bhdr + sizeof(bnode_hdr);
+	bchunk = (bnode_chunk *) ((char *) bhdr +
+							  BNODE_HDR_SZ(bhdr->bnode_levels));
+
+	if (igw) {
+		if (server_opt.use_shared_inet)
+			igw_store_bblock(bhdr, bchunk, level);
+		return;
+	}
+
+	for (blevel = o; blevel < bhdr->bnode_levels; blevel++) {
+		bnode = bnode_gid[blevel];
+
+		if (!blevel) {
+			node = node_from_pos(bnode, me.int_map);
+			node->flags |= MAP_BNODE;
+			node->flags &= ~QSPN_OLD;
+		} else {
+			gnode = gnode_from_pos(bnode, me.ext_map[_EL(blevel)]);
+			gnode->g.flags |= MAP_BNODE;
+			gnode->g.flags &= ~QSPN_OLD;
+		}
+
+		/* Let's check if we have this bnode in the bmap, if not let's 
+		 * add it */
+		bm = map_find_bnode(me.bnode_map[blevel],
+							me.bmap_nodes[blevel], bnode);
+		if (bm == -1)
+			bm = map_add_bnode(&me.bnode_map[blevel],
+							   &me.bmap_nodes[blevel], bnode, 0);
+
+		/* This bnode has the BMAP_UPDATE
+		 * flag set, thus this is the first
+		 * time we update him during this new
+		 * qspn_round and for this reason
+		 * delete all its rnodes */
+		if (me.bnode_map[blevel][bm].flags & BMAP_UPDATE) {
+			rnode_destroy(&me.bnode_map[blevel][bm]);
+			me.bnode_map[blevel][bm].flags &= ~BMAP_UPDATE;
+		}
+
+		/* Store the rnodes of the bnode */
+		for (e = 0; e < bhdr->links; e++) {
+			setzero(&rn, sizeof(map_rnode));
+			debug(DBG_INSANE, "Bnode %d new link %d: gid %d lvl %d",
+				  bnode, e, bchunk[e].gnode, bchunk[e].level);
+
+			gnode = gnode_from_pos(bchunk[e].gnode,
+								   me.ext_map[_EL(bchunk[e].level)]);
+			gnode->g.flags &= ~QSPN_OLD;
+
+			rn.r_node = (int *) gnode;
+			rn.trtt = bchunk[e].rtt;
+
+			if ((p = rnode_find(&me.bnode_map[blevel][bm], gnode)) > 0) {
+				/* Overwrite the current rnode */
+				map_rnode_insert(&me.bnode_map[blevel][bm], p, &rn);
+			} else
+				/* Add a new rnode */
+				rnode_add(&me.bnode_map[blevel][bm], &rn);
+		}
+	}
+
+	map_gen_bump(o);
+}
+
+/*
+ * tracer_msg_bblock: the map_msg which makes the owner call
+ * tracer_store_bentry(). The bnode maps are shared by all the levels, so a
+ * lane can't touch them.
+ */
+void
+tracer_msg_bblock(struct map_msg *msg)
+{
+	tracer_store_bentry(msg->level, msg->arg[0], msg->arg[1],
+						(bnode_hdr *) msg->buf);
+}
+
 /*
  * tracer_store_bblock: stores in the bnode map the chunks of the bblock
  * starting at `bnode_block_start'.
@@ -867,18 +1121,13 @@ tracer_store_bblock(u_char level, tracer_hdr * trcr_hdr,
 					size_t bblock_sz, u_short * bblocks_found,
 					char **bblocks_found_block, size_t * bblock_found_sz)
 {
-	map_node *node;
-	map_gnode *gnode;
-	void *void_node;
-
 	bnode_hdr **bblist_hdr = 0;
 	bnode_chunk ***bblist = 0;
-	map_rnode rn;
-	int i, e, o, f, p, bm, igws_found = 0;
+	int i, o, f, igw, igws_found = 0;
 	u_short bb;
 	size_t found_block_sz, bsz, x;
 	char *found_block;
-	u_char *bnode_gid, bnode, blevel;
+	u_char *bnode_gid;
 
 	/*
 	 * Split the block
@@ -928,90 +1177,32 @@ tracer_store_bblock(u_char level, tracer_hdr * trcr_hdr,
 		 * Check if this bblock is an IGW. If it is, store it in
 		 * me.igws
 		 */
+		igw = 0;
 		if (bblist[i][0]->level >= FAMILY_LVLS + 1) {
 			if (restricted_mode &&
 				(igws_found < MAX_IGW_PER_QSPN_CHUNK &&
 				 trcr_hdr->flags & TRCR_IGW)) {
-
-				if (server_opt.use_shared_inet)
-					igw_store_bblock(bblist_hdr[i], bblist[i][0], level);
+				igw = 1;
 				igws_found++;
-
-				goto skip_bmap;
 			} else {
 				debug(DBG_NOISE, ERROR_MSG "Malforded bblock entry",
 					  ERROR_POS);
 				goto discard_bblock;
 			}
-		}
-
-		if (!(trcr_hdr->flags & TRCR_BBLOCK)) {
+		} else if (!(trcr_hdr->flags & TRCR_BBLOCK)) {
 			debug(DBG_NOISE, ERROR_MSG "Malforded bblock entry",
 				  ERROR_POS);
 			goto discard_bblock;
 		}
 
-		for (blevel = o; blevel < bblist_hdr[i]->bnode_levels; blevel++) {
-			bnode = bnode_gid[blevel];
-
-			if (!blevel) {
-				node = node_from_pos(bnode, me.int_map);
-				node->flags |= MAP_BNODE;
-				node->flags &= ~QSPN_OLD;
-				void_node = (void *) node;
-			} else {
-				gnode = gnode_from_pos(bnode, me.ext_map[_EL(blevel)]);
-				gnode->g.flags |= MAP_BNODE;
-				gnode->g.flags &= ~QSPN_OLD;
-				void_node = (void *) &gnode->g;
-			}
-
-			/* Let's check if we have this bnode in the bmap, if not let's 
-			 * add it */
-			bm = map_find_bnode(me.bnode_map[blevel],
-								me.bmap_nodes[blevel], bnode);
-			if (bm == -1)
-				bm = map_add_bnode(&me.bnode_map[blevel],
-								   &me.bmap_nodes[blevel], bnode, 0);
-
-			/* This bnode has the BMAP_UPDATE
-			 * flag set, thus this is the first
-			 * time we update him during this new
-			 * qspn_round and for this reason
-			 * delete all its rnodes */
-			if (me.bnode_map[blevel][bm].flags & BMAP_UPDATE) {
-				rnode_destroy(&me.bnode_map[blevel][bm]);
-				me.bnode_map[blevel][bm].flags &= ~BMAP_UPDATE;
-			}
-
-			/* Store the rnodes of the bnode */
-			for (e = 0; e < bblist_hdr[i]->links; e++) {
-				setzero(&rn, sizeof(map_rnode));
-				debug(DBG_INSANE, "Bnode %d new link %d: gid %d lvl %d",
-					  bnode, e, bblist[i][e]->gnode, bblist[i][e]->level);
-
-				gnode = gnode_from_pos(bblist[i][e]->gnode,
-									   me.
-									   ext_map[_EL(bblist[i][e]->level)]);
-				gnode->g.flags &= ~QSPN_OLD;
-
-				rn.r_node = (int *) gnode;
-				rn.trtt = bblist[i][e]->rtt;
-
-				if ((p = rnode_find(&me.bnode_map[blevel][bm], gnode)) > 0) {
-					/* Overwrite the current rnode */
-					map_rnode_insert(&me.bnode_map[blevel][bm], p, &rn);
-				} else
-					/* Add a new rnode */
-					rnode_add(&me.bnode_map[blevel][bm], &rn);
-			}
-		}
-	  skip_bmap:
-		/* Copy the found bblock in `bblocks_found_block' and converts
-		 * it in network order */
 		bsz =
 			BNODEBLOCK_SZ(bblist_hdr[i]->bnode_levels,
 						  bblist_hdr[i]->links);
+		map_msg_post(tracer_msg_bblock, level, 0, o, igw,
+					 (char *) bblist_hdr[i], bsz);
+
+		/* Copy the found bblock in `bblocks_found_block' and converts
+		 * it in network order */
 		memcpy(found_block + x, bblist_hdr[i], bsz);
 		x += bsz;
 	  discard_bblock:
@@ -1069,7 +1260,8 @@ tracer_check_node_collision(tracer_hdr * trcr, int hop, map_node * node,
 		debug(DBG_NORMAL, "collision info: i: %d, starter %d opener %d",
 			  hop, me.cur_node->flags & QSPN_STARTER,
 			  me.cur_node->flags & QSPN_OPENER);
-		new_rehook(gnode, tr_node, level, gcount);
+		map_msg_post(tracer_msg_rehook, level, gnode, tr_node, gcount, 0,
+					 0);
 
 		return 1;
 	}
@@ -1105,7 +1297,7 @@ tracer_store_pkt(inet_prefix rip, quadro_group * rip_quadg, u_char level,
 
 	int i, e, x, f, diff, from_rnode_pos, skip_rfrom;
 	int gfrom_rnode_pos, from_tpos;
-	u_int hops, trtt_ms = 0;
+	u_int hops, trtt_ms = 0, bw;
 
 
 	hops = trcr_hdr->hops;
@@ -1178,6 +1370,7 @@ tracer_store_pkt(inet_prefix rip, quadro_group * rip_quadg, u_char level,
 				rnode_add(root_node, &rnn);
 			}
 			root_node->r_node[gfrom_rnode_pos].trtt = tracer[hops - 2].rtt;
+			root_node->r_node[gfrom_rnode_pos].bw = tracer[hops - 2].bw;
 		}
 
 		/* we are using the real from, so the root node is the one
@@ -1200,20 +1393,26 @@ tracer_store_pkt(inet_prefix rip, quadro_group * rip_quadg, u_char level,
 							 level);
 
 		/* Let's see if we have to rehook */
-		new_rehook((map_gnode *) from, tracer[from_tpos].node, level,
-				   tracer[from_tpos].gcount);
+		map_msg_post(tracer_msg_rehook, level, from,
+					 tracer[from_tpos].node, tracer[from_tpos].gcount, 0, 0);
 	}
 
-	/* We add in the total rtt the first rtt which is me -> from */
+	/* We add in the total rtt the first rtt which is me -> from, and the
+	 * route has at most the bandwidth of its first link */
 	trtt_ms = node->r_node[from_rnode_pos].trtt;
+	bw = node->r_node[from_rnode_pos].bw;
 
 	/* If we are skipping the rfrom, remember to sum its rtt */
-	if (skip_rfrom)
+	if (skip_rfrom) {
 		trtt_ms += tracer[hops - 1].rtt;
+		bw = BW_MIN(bw, tracer[hops - 1].bw);
+	}
 
 	for (i = (hops - skip_rfrom) - 1; i >= 0; i--) {
-		if (i)
+		if (i) {
 			trtt_ms += tracer[i].rtt;
+			bw = BW_MIN(bw, tracer[i].bw);
+		}
 
 		if (!level)
 			node = node_from_pos(tracer[i].node, me.int_map);
@@ -1239,16 +1438,18 @@ tracer_store_pkt(inet_prefix rip, quadro_group * rip_quadg, u_char level,
 			if (level)
 				gnode->flags &= ~GMAP_VOID;
 
-			gnode_inc_seeds(&me.cur_quadg, level);
+			map_msg_post(tracer_msg_seeds, level, 0, 0, 0, 0, 0);
 			debug(DBG_INSANE, "TRCR_STORE: node %d added", tracer[i].node);
 		}
 
-		/* update the rtt of the node */
+		/* update the rtt and the bandwidth of the node */
 		for (e = 0, f = 0; e < node->links; e++) {
 			if (node->r_node[e].r_node == (int *) from) {
 				diff = abs(node->r_node[e].trtt - trtt_ms);
-				if (diff >= RTT_DELTA) {
+				if (diff >= RTT_DELTA ||
+					!BW_SIMILAR(node->r_node[e].bw, bw)) {
 					node->r_node[e].trtt = trtt_ms;
+					node->r_node[e].bw = bw;
 					node->flags |= MAP_UPDATE;
 				}
 				f = 1;
@@ -1261,6 +1462,7 @@ tracer_store_pkt(inet_prefix rip, quadro_group * rip_quadg, u_char level,
 
 			rnn.r_node = (int *) from;
 			rnn.trtt = trtt_ms;
+			rnn.bw = bw;
 
 			rnode_add(node, &rnn);
 			node->flags |= MAP_UPDATE;
@@ -1281,10 +1483,12 @@ tracer_store_pkt(inet_prefix rip, quadro_group * rip_quadg, u_char level,
 
 			debug(DBG_INSANE, "TRCR_STORE: krnl_update node %d",
 				  tracer[i].node);
-			rt_update_node(0, node, 0, 0, 0, level);
+			rt_sync_node(node, level);
 			node->flags &= ~MAP_UPDATE;
 		}
 	}
+
+	map_gen_bump(level);
 	return 0;
 }
 
@@ -1314,7 +1518,9 @@ flood_pkt_send(int (*is_node_excluded) (TRACER_PKT_EXCLUDE_VARS),
 
 	ssize_t err;
 	const char *ntop;
-	int i, e = 0;
+	char *msg = 0, *v0_msg = 0;
+	size_t sz = 0, v0_sz = 0;
+	int i, e = 0, v0;
 
 	/*
 	 * Forward the pkt to all our r_nodes (excluding the excluded;)
@@ -1343,8 +1549,27 @@ flood_pkt_send(int (*is_node_excluded) (TRACER_PKT_EXCLUDE_VARS),
 				  " lvl %d", pkt.hdr.id,
 				  rq_to_str(pkt.hdr.op), inet_to_str(pkt.to), level - 1);
 
+		/*
+		 * A rnode which didn't advertise its codecs is an older ntkd,
+		 * which can't parse the tracer chunks with the `bw'
+		 */
+		v0 = (BRDCAST_HDR_PTR(pkt.msg)->flags & BCAST_TRACER_PKT) &&
+			!codec_peer_get(&pkt.to);
+		if (v0) {
+			if (!v0_msg)
+				v0_msg = tracer_pkt_v0(pkt.msg, pkt.hdr.sz, &v0_sz);
+			msg = pkt.msg;
+			sz = pkt.hdr.sz;
+			pkt.msg = v0_msg;
+			pkt.hdr.sz = v0_sz;
+		}
+
 		/* Let's send the pkt */
 		err = rnl_send_rq(node, &pkt, 0, pkt.hdr.op, pkt.hdr.id, 0, 0, 0);
+		if (v0) {
+			pkt.msg = msg;
+			pkt.hdr.sz = sz;
+		}
 		if (err == -1) {
 			ntop = inet_to_str(pkt.to);
 			error(ERROR_MSG "Cannot send the %s request"
@@ -1354,6 +1579,8 @@ flood_pkt_send(int (*is_node_excluded) (TRACER_PKT_EXCLUDE_VARS),
 			e++;
 	}
 
+	if (v0_msg)
+		xfree(v0_msg);
 	pkt_free(&pkt, 0);
 	return e;
 }
@@ -1436,7 +1663,7 @@ tracer_pkt_recv(PACKET rpkt)
 	u_int hops;
 	size_t bblock_sz = 0, old_bblock_sz;
 	u_short old_bblocks_found = 0;
-	u_char level, orig_lvl;
+	u_char level, orig_lvl, origin[3];
 	const char *ntop = 0;
 	char *old_bblock = 0;
 	void *void_map;
@@ -1451,6 +1678,16 @@ tracer_pkt_recv(PACKET rpkt)
 		return -1;
 	}
 
+	/* The flood is identified by its starter and its brdcast id */
+	origin[0] = bcast_hdr->g_node;
+	origin[1] = bcast_hdr->level;
+	origin[2] = tracer[0].node;
+	if (flood_seen(rpkt.hdr.op, rpkt.hdr.id, origin, sizeof(origin))) {
+		debug(DBG_INSANE, "tracer_pkt_recv(): Dropped 0x%x, we already "
+			  "received it", rpkt.hdr.id);
+		return 0;
+	}
+
 	hops = trcr_hdr->hops;
 	gid = bcast_hdr->g_node;
 	level = orig_lvl = bcast_hdr->level;
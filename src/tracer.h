@@ -33,6 +33,12 @@
 								   encapsulated bblocks */
 #define TRCR_IGW		(1<<1)	/* Internet Gateways are encapsulated
 								   in the pkt */
+#define TRCR_BW			(1<<2)	/* The tracer chunks carry the `bw'.
+								   The pkts of an older ntkd, whose
+								   chunks are TRACER_CHUNK_V0_SZ
+								   bytes, haven't it: see
+								   tracer_pkt_compat() and
+								   tracer_pkt_v0() */
 
 /*
  * *  Tracer packet. It is encapsulated in a broadcast pkt  *
@@ -56,14 +62,21 @@ typedef struct {
 								   (in milliseconds) */
 	u_int gcount;				/* how many nodes there are in the `node' 
 								   gnode */
+	u_int bw;					/* The bandwidth available from the current
+								   node to the `node' of the previous chunk 
+								   (in Kb/s, 0 if unknown) */
 } _PACKED_ tracer_chunk;
-INT_INFO tracer_chunk_iinfo = { 2,
-	{INT_TYPE_32BIT, INT_TYPE_32BIT},
-	{sizeof(char), sizeof(char) + sizeof(u_int)}
+INT_INFO tracer_chunk_iinfo = { 3,
+	{INT_TYPE_32BIT, INT_TYPE_32BIT, INT_TYPE_32BIT},
+	{sizeof(char), sizeof(char) + sizeof(u_int),
+	 sizeof(char) + sizeof(u_int) * 2}
 	,
-	{1, 1}
+	{1, 1, 1}
 };
 
+/* The tracer_chunk of an older ntkd, without the `bw' */
+#define TRACER_CHUNK_V0_SZ	(sizeof(tracer_chunk) - sizeof(u_int))
+
 #define TRACERPKT_SZ(hops) 	(sizeof(tracer_hdr)+(sizeof(tracer_chunk)*(hops)))
 #define TRACER_HDR_PTR(msg) 	((tracer_hdr *)(((char *)BRDCAST_HDR_PTR((msg)))+sizeof(brdcast_hdr)))
 #define TRACER_CHUNK_PTR(msg)	((tracer_chunk *)(((char *)TRACER_HDR_PTR(msg))+sizeof(tracer_hdr)))
@@ -84,6 +97,10 @@ int tracer_get_trtt(int from_rnode_pos, tracer_hdr * trcr_hdr,
 int tracer_store_pkt(inet_prefix, quadro_group *, u_char, tracer_hdr *,
 					 tracer_chunk *, void *, size_t, u_short *, char **,
 					 size_t *);
+char *tracer_chunks_conv(char *, size_t, u_short, size_t, size_t,
+						 size_t *);
+int tracer_pkt_compat(PACKET *);
+char *tracer_pkt_v0(char *, size_t, size_t *);
 int tracer_unpack_pkt(PACKET, brdcast_hdr **, tracer_hdr **,
 					  tracer_chunk **, bnode_hdr **, size_t *,
 					  quadro_group *, int *);